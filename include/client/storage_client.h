@@ -14,9 +14,41 @@ void client_disconnect(int fd);
 
 // Storage operations
 int client_put(int fd, const char* key, const char* value, size_t value_size);
+int client_put_ttl(int fd, const char* key, const char* value, size_t value_size,
+                   uint32_t ttl_seconds);
 int client_get(int fd, const char* key, char* value, size_t* value_size);
+int client_get_version(int fd, const char* key, char* value, size_t* value_size,
+                       uint64_t* version);
 int client_delete(int fd, const char* key);
 
+// Atomic updates, run under the daemon's storage lock. CAS returns
+// RESULT_VERSION_MISMATCH (with the current version) if another write got
+// there first; INCR returns RESULT_NOT_INTEGER for a non-numeric value.
+int client_cas(int fd, const char* key, const char* value, size_t value_size,
+               uint32_t ttl_seconds, uint64_t expected_version, uint64_t* version);
+int client_incr(int fd, const char* key, int64_t delta, int64_t* value, uint64_t* version);
+
+// Add `size` bytes to the end of a value (creating the key), keeping its
+// TTL. RESULT_TOO_LARGE if the value would pass MAX_VALUE_SIZE.
+int client_append(int fd, const char* key, const char* data, size_t size,
+                  uint32_t* value_size, uint64_t* version);
+
+// Ordered listing. Calls `fn` for each entry of one page; `key` is NUL
+// terminated, `value` is not. On return `next_key` (MAX_KEY_SIZE bytes) holds
+// the start key of the next page, or "" when the scan is complete.
+typedef void (*client_scan_fn)(const char* key, const char* value, size_t value_size, void* arg);
+int client_scan(int fd, const struct scan_request* req, client_scan_fn fn, void* arg,
+                char* next_key);
+
+// Online backup. BEGIN and END carry no entries (`fn` may be NULL); READ
+// pages through the snapshot like client_scan.
+int client_snapshot(int fd, const struct snapshot_request* req, client_scan_fn fn, void* arg,
+                    char* next_key);
+
+// Diagnostics
+int client_dump_flight_recorder(int fd, struct dump_response* resp);
+int client_stats(int fd, struct stats_response* resp);
+
 // Helper for string values
 int client_put_string(int fd, const char* key, const char* value);
 int client_get_string(int fd, const char* key, char* value, size_t value_buffer_size);
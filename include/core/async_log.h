@@ -0,0 +1,79 @@
+#ifndef CORE_ASYNC_LOG_H
+#define CORE_ASYNC_LOG_H
+
+#include <syslog.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compile-time trace levels. Anything above TRACE_LEVEL compiles to nothing,
+// so per-block and per-request tracing costs zero in normal builds.
+// Build with e.g. `make TRACE_LEVEL=4` to get debug traces back.
+#define TRACE_LEVEL_NONE  0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_WARN  2
+#define TRACE_LEVEL_INFO  3
+#define TRACE_LEVEL_DEBUG 4
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+// Async logger tuning
+#define ASYNC_LOG_RING_SIZE 1024    // Slots in the ring (power of two)
+#define ASYNC_LOG_MSG_SIZE 240      // Max formatted message length
+#define ASYNC_LOG_RATE_LIMIT 2000   // Max messages accepted per second
+#define ASYNC_LOG_DRAIN_MS 10       // Drain thread poll interval
+
+// Start/stop the background drain thread. Must be called after fork() since
+// threads do not survive daemonization. Until started, messages go straight
+// to syslog.
+int async_log_start(void);
+void async_log_stop(void);
+
+// Queue a message without blocking: the caller formats into a ring slot and
+// returns, the drain thread does the syslog() send. Messages are dropped
+// (and counted) when the ring is full or the per-second rate limit is hit.
+void async_log(int priority, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(...) async_log(LOG_ERR, __VA_ARGS__)
+#else
+#define TRACE_ERROR(...) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_WARN
+#define TRACE_WARN(...) async_log(LOG_WARNING, __VA_ARGS__)
+#else
+#define TRACE_WARN(...) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(...) async_log(LOG_INFO, __VA_ARGS__)
+#else
+#define TRACE_INFO(...) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(...) async_log(LOG_DEBUG, __VA_ARGS__)
+#else
+#define TRACE_DEBUG(...) ((void)0)
+#endif
+
+// Log only one in every `rate` hits of this call site. Used for per-request
+// lines so steady-state traffic leaves a sample in syslog without paying
+// for every op.
+#define TRACE_SAMPLED(trace_macro, rate, ...) do {                        \
+        static unsigned long trace_sample_hits_;                          \
+        if (__atomic_fetch_add(&trace_sample_hits_, 1,                    \
+                               __ATOMIC_RELAXED) % (rate) == 0) {         \
+            trace_macro(__VA_ARGS__);                                     \
+        }                                                                 \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_ASYNC_LOG_H
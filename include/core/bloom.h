@@ -0,0 +1,48 @@
+#ifndef CORE_BLOOM_H
+#define CORE_BLOOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Split-block Bloom filter over key strings. A key hashes to one 32-byte
+// block (half a cache line) and sets one bit in each of its eight 32-bit
+// lanes, so a probe is a single memory access and an eight-lane compare.
+// Around 1-2% false positives at BLOOM_BITS_PER_KEY.
+#define BLOOM_LANES 8
+#define BLOOM_BITS_PER_KEY 10
+
+struct bloom_block {
+    uint32_t lane[BLOOM_LANES];
+} __attribute__((aligned(32)));
+
+struct bloom {
+    struct bloom_block* blocks;
+    size_t block_count;      // Power of two
+    size_t capacity;         // Keys it was sized for
+    int borrowed;            // Blocks belong to the caller (bloom_attach)
+};
+
+// Size for `capacity` keys. Returns 0 or -1; a filter that failed to
+// allocate answers "maybe" for everything.
+int bloom_init(struct bloom* b, size_t capacity);
+void bloom_free(struct bloom* b);
+
+// Use `count` blocks filled by an earlier filter (e.g. mapped from a file)
+// in place; bloom_free then leaves them to the caller. Returns 0, or -1 if
+// `count` is not a power of two.
+int bloom_attach(struct bloom* b, struct bloom_block* blocks, size_t count, size_t capacity);
+
+void bloom_add(struct bloom* b, const char* key);
+
+// 0 if `key` was never added, 1 if it may have been
+int bloom_may_contain(const struct bloom* b, const char* key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_BLOOM_H
@@ -0,0 +1,82 @@
+#ifndef CORE_BTREE_H
+#define CORE_BTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ordered key index: a B+tree in its own page file. Keys are byte strings up
+// to BTREE_MAX_KEY bytes, values are fixed-size records chosen at creation.
+// Each node stores the prefix shared by all its keys once and only the
+// suffixes per entry; separators in internal nodes are truncated to the
+// shortest string that still splits the two children. Leaves also keep a
+// one-byte hash tag per entry so exact lookups skip non-matching keys.
+#define BTREE_PAGE_SIZE 4096
+#define BTREE_MAX_KEY 255
+#define BTREE_MAX_VALUE 64
+#define BTREE_MAGIC 0x42545245  // "BTRE"
+#define BTREE_VERSION 2
+
+struct btree_item;
+
+struct btree {
+    int fd;                  // -1 for a tree that lives only in memory
+    int in_memory;           // No page file: the cache is the whole tree
+    uint32_t value_size;     // Bytes per leaf record
+    uint32_t root;
+    uint32_t height;         // 1 = root is a leaf
+    uint32_t page_count;     // Including the header page
+    uint64_t entry_count;
+    uint8_t** pages;         // Page cache, filled on first access
+    uint32_t cache_cap;
+    uint32_t* dirty;         // Pages to write on flush
+    uint32_t dirty_count;
+    uint32_t dirty_cap;
+    uint8_t* is_dirty;
+    int header_dirty;
+    struct btree_item* scratch;  // Decoded node plus one for rebuilds
+};
+
+// Position in the leaf level, for ordered iteration
+struct btree_cursor {
+    struct btree* tree;
+    uint32_t page;
+    uint32_t slot;
+};
+
+// Create (create != 0) or open the index at `path`. A NULL path creates a
+// tree that is never written anywhere. Returns 0 or -1.
+int btree_open(struct btree* t, const char* path, uint32_t value_size, int create);
+void btree_close(struct btree* t);
+
+// Copy every page of `src` into a new in-memory tree `dst`. Returns 0 or -1.
+int btree_clone(struct btree* dst, struct btree* src);
+
+// Lookup. Returns 0 and fills `value` if found, -1 otherwise.
+int btree_get(struct btree* t, const char* key, void* value);
+
+// Insert or replace. Returns 0 or -1.
+int btree_put(struct btree* t, const char* key, const void* value);
+
+// Remove. Returns 0, or -1 if the key is not present. Leaves are not
+// merged; an emptied leaf stays in the sibling chain until reused.
+int btree_delete(struct btree* t, const char* key);
+
+// Write dirty pages and the header. Returns 0 or -1.
+int btree_flush(struct btree* t);
+
+// Position `c` at the first key >= `key` (NULL or "" = first key)
+int btree_seek(struct btree* t, const char* key, struct btree_cursor* c);
+
+// Copy out the entry at the cursor and advance. `key` must hold
+// BTREE_MAX_KEY + 1 bytes. Returns 0, 1 at the end, or -1 on error.
+int btree_next(struct btree_cursor* c, char* key, void* value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_BTREE_H
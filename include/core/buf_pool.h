@@ -0,0 +1,51 @@
+#ifndef CORE_BUF_POOL_H
+#define CORE_BUF_POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recycled buffers in power-of-two size classes, for the per-request
+// allocations of the daemon and the storage layer. Each thread keeps a few
+// free buffers per class and trades batches with a shared depot when it
+// runs out or has too many, so the steady state neither calls malloc nor
+// takes a lock on most calls. Buffers may be freed by any thread.
+// Requests above the largest class go straight to malloc.
+#define POOL_MIN_SHIFT 6         // 64 B
+#define POOL_MAX_SHIFT 20        // 1 MB
+#define POOL_LOCAL_MAX 32        // Free buffers a thread keeps per class
+#define POOL_BATCH 16            // Moved to or from the depot at once
+#define POOL_DEPOT_MAX 1024      // Free buffers the depot keeps per class
+
+// At least `size` bytes, 16-byte aligned, or NULL
+void* pool_alloc(size_t size);
+
+// Return a buffer from pool_alloc or pool_realloc (NULL is ignored)
+void pool_free(void* p);
+
+// Resize, keeping the contents; stays in place while the class fits
+void* pool_realloc(void* p, size_t size);
+
+// Bump allocator for the temporaries of one request, freed together by
+// arena_release. Chunks come from the pool.
+#define ARENA_CHUNK 8192
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk* chunks;  // Newest first
+};
+
+void arena_init(struct arena* a);
+
+// `size` bytes, 16-byte aligned, valid until arena_release, or NULL
+void* arena_alloc(struct arena* a, size_t size);
+void arena_release(struct arena* a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_BUF_POOL_H
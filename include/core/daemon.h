@@ -10,9 +10,14 @@ extern "C" {
 
 // Protocol definitions (shared between C and C++)
 #define SOCKET_PATH "/tmp/storage_daemon.sock"
+#define SOCKET_ENV "STORAGE_DAEMON_SOCKET"  // Overrides SOCKET_PATH for clients
 #define MAX_CLIENTS 10
 #define MAX_MESSAGE_SIZE 4096
 #define MAX_VALUE_SIZE 4000  // Leave room for protocol headers
+#define SCAN_MAX_PAYLOAD 16384  // Soft cap on one SCAN response page
+#define DEFAULT_COMPACT_MBPS 8  // Background compaction I/O budget
+#define MAX_SHARDS 64           // Storage files one daemon splits keys over
+#define SHARD_SUFFIX ".shard"   // Shard i lives in <file>.shard<i>
 
 typedef enum {
     MSG_PUT_REQUEST = 1,
@@ -21,7 +26,24 @@ typedef enum {
     MSG_GET_RESPONSE = 4,
     MSG_DELETE_REQUEST = 5,
     MSG_DELETE_RESPONSE = 6,
-    MSG_ERROR = 7
+    MSG_ERROR = 7,
+    MSG_DUMP_REQUEST = 8,       // Dump the flight recorder (no payload)
+    MSG_DUMP_RESPONSE = 9,
+    MSG_SCAN_REQUEST = 10,      // Ordered range/prefix listing, paged
+    MSG_SCAN_RESPONSE = 11,
+    MSG_STATS_REQUEST = 12,     // Daemon counters (no payload)
+    MSG_STATS_RESPONSE = 13,
+    MSG_SNAPSHOT_REQUEST = 14,  // Online backup: begin, read pages, end
+    MSG_SNAPSHOT_RESPONSE = 15, // Same payload as MSG_SCAN_RESPONSE
+    MSG_REPLICATE_REQUEST = 16, // Follower subscribes; the connection then
+    MSG_REPL_RECORD = 17,       //   carries records and heartbeats from
+    MSG_REPL_HEARTBEAT = 18,    //   the primary until either side closes
+    MSG_CAS_REQUEST = 19,       // PUT if the key is at a given version
+    MSG_CAS_RESPONSE = 20,
+    MSG_INCR_REQUEST = 21,      // Add to an integer value
+    MSG_INCR_RESPONSE = 22,
+    MSG_APPEND_REQUEST = 23,    // Add bytes to the end of a value
+    MSG_APPEND_RESPONSE = 24
 } message_type_t;
 
 struct message_header {
@@ -35,6 +57,7 @@ struct message_header {
 struct put_request {
     char key[MAX_KEY_SIZE];
     uint32_t value_size;
+    uint32_t ttl_seconds;    // 0 = never expires
     // Value data follows this struct
 } __attribute__((packed));
 
@@ -52,6 +75,7 @@ struct get_request {
 struct get_response {
     int32_t result;      // 0 = success, negative = error code
     uint32_t value_size; // Size of value data that follows
+    uint64_t version;    // Key version, for MSG_CAS_REQUEST
     // Value data follows this struct (if result == 0)
 } __attribute__((packed));
 
@@ -65,14 +89,182 @@ struct delete_response {
     int32_t result;  // 0 = success, negative = error code
 } __attribute__((packed));
 
+// Result of a CAS or INCR that found the key in another state than asked
+#define RESULT_VERSION_MISMATCH (-2)  // CAS: `version` holds the current one
+#define RESULT_NOT_INTEGER (-3)       // INCR: value isn't an integer, or overflow
+#define RESULT_TOO_LARGE (-4)         // APPEND: value would pass MAX_VALUE_SIZE
+
+// CAS request payload. expected_version 0 (KEY_VERSION_NONE) only creates.
+struct cas_request {
+    char key[MAX_KEY_SIZE];
+    uint64_t expected_version;
+    uint32_t value_size;
+    uint32_t ttl_seconds;    // 0 = never expires
+    // Value data follows this struct
+} __attribute__((packed));
+
+// CAS response payload
+struct cas_response {
+    int32_t result;          // 0 = written, RESULT_VERSION_MISMATCH, or error
+    uint64_t version;        // New version, or the current one on a mismatch
+} __attribute__((packed));
+
+// INCR request payload
+struct incr_request {
+    char key[MAX_KEY_SIZE];
+    int64_t delta;
+} __attribute__((packed));
+
+// INCR response payload
+struct incr_response {
+    int32_t result;          // 0 = success, RESULT_NOT_INTEGER, or error
+    int64_t value;           // After the increment
+    uint64_t version;
+} __attribute__((packed));
+
+// APPEND request payload. A missing key is created; the TTL is kept.
+struct append_request {
+    char key[MAX_KEY_SIZE];
+    uint32_t value_size;
+    // Data follows this struct
+} __attribute__((packed));
+
+// APPEND response payload
+struct append_response {
+    int32_t result;          // 0 = success, RESULT_TOO_LARGE, or error
+    uint32_t value_size;     // Of the whole value after the append
+    uint64_t version;
+} __attribute__((packed));
+
 // Error response payload
 struct error_response {
     int32_t error_code;
     char error_message[256];
 } __attribute__((packed));
 
+// DUMP response payload
+struct dump_response {
+    int32_t result;          // 0 = success, negative = error code
+    uint32_t record_count;   // Records written to the dump file
+    char path[256];          // Where the dump was written
+} __attribute__((packed));
+
+// STATS response payload. A break is a link from one block of a value's
+// chain to anything but the next block on disk.
+struct stats_response {
+    int32_t result;                // 0 = success, negative = error code
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t compact_passes;       // Full sweeps of the index by the compactor
+    uint64_t compact_chains_moved;
+    uint64_t compact_blocks_moved;
+    uint64_t compact_breaks_removed;
+    uint64_t fragmentation;        // Breaks left after the last full pass
+    uint32_t repl_role;            // REPL_ROLE_*
+    uint32_t repl_followers;       // Primary: followers streaming now
+    uint64_t repl_seq;             // Primary: last logged, follower: last applied
+    uint64_t repl_lag_records;     // Follower: records the primary has that we don't
+    uint64_t repl_lag_ms;          // Follower: primary commit to local apply
+    char storage_engine[16];       // Engine name, NUL terminated
+    uint64_t storage_keys;         // Summed over shards
+    uint64_t storage_bytes_total;  // Bytes the engine holds on disk (or in memory)
+    uint64_t storage_bytes_used;   // Of which live data
+} __attribute__((packed));
+
+enum {
+    REPL_ROLE_PRIMARY = 0,
+    REPL_ROLE_FOLLOWER = 1
+};
+
+// SCAN request payload. Empty strings leave a bound open.
+struct scan_request {
+    char start_key[MAX_KEY_SIZE];  // Inclusive; resume here with next_key
+    char end_key[MAX_KEY_SIZE];    // Exclusive
+    char prefix[MAX_KEY_SIZE];     // Only keys starting with this
+    uint32_t limit;                // Max entries in this page, 0 = no limit
+} __attribute__((packed));
+
+// SCAN response payload
+struct scan_response {
+    int32_t result;                // 0 = success, negative = error code
+    uint32_t count;                // Entries that follow
+    uint8_t more;                  // 1 = more keys, request again from next_key
+    char next_key[MAX_KEY_SIZE];
+    // count x (struct scan_entry, key bytes, value bytes) follow
+} __attribute__((packed));
+
+struct scan_entry {
+    uint16_t key_len;              // Key bytes that follow, no terminator
+    uint32_t value_size;           // Value bytes after the key
+} __attribute__((packed));
+
+// SNAPSHOT request payload. BEGIN pins a point-in-time view of the storage
+// (one at a time), READ returns pages of it like SCAN while writers carry
+// on, END releases it and frees the blocks only it was holding.
+enum {
+    SNAPSHOT_BEGIN = 1,
+    SNAPSHOT_READ = 2,
+    SNAPSHOT_END = 3
+};
+
+struct snapshot_request {
+    uint32_t op;                   // SNAPSHOT_*
+    char start_key[MAX_KEY_SIZE];  // READ: resume here with next_key
+    uint32_t limit;                // READ: max entries in this page, 0 = no limit
+} __attribute__((packed));
+
+// REPLICATE request payload. A follower that can't be served from the
+// primary's log (new, too far behind, or from an earlier primary run) gets
+// REPL_OP_RESET, a full copy as REPL_OP_PUT records, then REPL_OP_SYNCED.
+// A primary refuses a follower speaking another REPL_PROTOCOL_VERSION.
+#define REPL_PROTOCOL_VERSION 2    // 2: records carry the key's version
+struct replicate_request {
+    uint32_t protocol;             // REPL_PROTOCOL_VERSION
+    uint64_t epoch;                // From the primary's heartbeats, 0 = none
+    uint64_t last_seq;             // Last record applied, 0 = none
+} __attribute__((packed));
+
+enum {
+    REPL_OP_PUT = 1,
+    REPL_OP_DELETE = 2,
+    REPL_OP_RESET = 3,             // Drop every key, a full copy follows
+    REPL_OP_SYNCED = 4             // Full copy complete as of `seq`
+};
+
+// REPL_RECORD payload; key_len key bytes (no terminator) and value_size
+// value bytes follow. Records of a full copy carry the sequence it is
+// consistent with.
+struct repl_record {
+    uint64_t seq;
+    uint64_t time_ms;              // Primary wall clock when logged
+    uint64_t version;              // PUT: the key's version on the primary
+    uint32_t expires_at;           // PUT: Unix time, 0 = never
+    uint32_t value_size;
+    uint16_t key_len;
+    uint8_t op;                    // REPL_OP_*
+} __attribute__((packed));
+
+// REPL_HEARTBEAT payload, sent when the stream is idle
+struct repl_heartbeat {
+    uint64_t epoch;
+    uint64_t last_seq;             // Last record logged by the primary
+    uint64_t time_ms;
+} __attribute__((packed));
+
+// Startup options from the command line
+struct daemon_options {
+    struct storage_format format;  // Only applied when creating the storage file
+                                   // (format.in_memory: never create one)
+    size_t compress_threshold;     // Compress values this large, 0 = off
+    size_t cache_bytes;            // Hot value cache budget, 0 = off
+    size_t compact_rate;           // Compaction I/O, bytes per second, 0 = off
+    const char* socket_path;       // NULL = SOCKET_PATH
+    const char* follow;            // Primary's socket: run as a read-only follower
+    uint32_t shards;               // Storage files keys are split over, 0 = 1
+};
+
 // Core daemon functions (C implementation)
-int daemon_start(const char* storage_file);
+int daemon_start(const char* storage_file, const struct daemon_options* options);
 int daemon_is_running(void);
 void daemon_stop(void);
 
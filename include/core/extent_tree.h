@@ -0,0 +1,55 @@
+#ifndef CORE_EXTENT_TREE_H
+#define CORE_EXTENT_TREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Free space of one segment as maximal runs of free blocks. Each run sits in
+// two treaps over the same nodes: one ordered by start (to merge with its
+// neighbours on free) and one by (length, start) (for best-fit allocation).
+// Allocation and free are O(log n) in the number of runs.
+enum { EXTENT_BY_START = 0, EXTENT_BY_SIZE = 1 };
+
+struct extent {
+    uint32_t start;
+    uint32_t len;
+    uint32_t priority;               // Heap order (random) in both treaps
+    struct extent* child[2][2];      // [treap][left, right]
+};
+
+struct extent_tree {
+    struct extent* root[2];
+    size_t count;                    // Runs
+    uint64_t free_blocks;
+    uint32_t seed;
+};
+
+void extent_tree_init(struct extent_tree* t);
+void extent_tree_clear(struct extent_tree* t);
+
+// Return [start, start + len) to free space, merging with adjacent runs.
+// The range must not overlap free space. Returns 0, or -1 if a node could
+// not be allocated (the range is then not tracked).
+int extent_tree_free(struct extent_tree* t, uint32_t start, uint32_t len);
+
+// Take up to `want` contiguous blocks: the smallest run that holds all of
+// them, or failing that the largest run there is. Stores the first block in
+// `start` and returns the number taken, 0 when there is no free space.
+uint32_t extent_tree_alloc(struct extent_tree* t, uint32_t want, uint32_t* start);
+
+// Length of the largest run, 0 when empty
+uint32_t extent_tree_largest(const struct extent_tree* t);
+
+// Visit every run in order of start
+typedef void (*extent_fn)(uint32_t start, uint32_t len, void* arg);
+void extent_tree_foreach(const struct extent_tree* t, extent_fn fn, void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_EXTENT_TREE_H
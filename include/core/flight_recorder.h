@@ -0,0 +1,69 @@
+#ifndef CORE_FLIGHT_RECORDER_H
+#define CORE_FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include <time.h>
+#include "hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-thread ring of recent operations, dumped on SIGUSR1 or MSG_DUMP_REQUEST
+// so latency spikes can be inspected after the fact.
+#define FLIGHT_RECORDER_ENTRIES 4096      // Per thread, power of two
+#define FLIGHT_RECORDER_MAX_THREADS 65   // Each shard owner and the main loop
+#define FLIGHT_RECORDER_DUMP_PATH "/tmp/storage_daemon.flight"
+
+typedef enum {
+    FLIGHT_OP_PUT = 1,
+    FLIGHT_OP_GET = 2,
+    FLIGHT_OP_DELETE = 3,
+    FLIGHT_OP_OTHER = 4,
+    FLIGHT_OP_SCAN = 5,
+    FLIGHT_OP_CAS = 6,
+    FLIGHT_OP_INCR = 7,
+    FLIGHT_OP_APPEND = 8
+} flight_op_t;
+
+// Phase timestamps are CLOCK_MONOTONIC nanoseconds:
+// queued -> started (request read) -> locked (storage lock held) -> done
+struct flight_record {
+    uint64_t t_queued;
+    uint64_t t_started;
+    uint64_t t_locked;
+    uint64_t t_done;
+    uint32_t key_hash;
+    uint32_t value_size;
+    uint16_t op;            // flight_op_t
+    int16_t result;
+    uint32_t sequence_id;
+};
+
+static inline uint64_t flight_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// FNV-1a, cheap enough for the request path and stable across dumps
+static inline uint32_t flight_key_hash(const char* key) {
+    return fnv1a_32_str(key);
+}
+
+// Append a record to the calling thread's ring. The ring is registered on
+// first use; recording is a struct copy plus a release store.
+void flight_record(const struct flight_record* rec);
+
+// Write every registered ring to `path` as text, oldest first per thread.
+// The path may sit in a shared directory such as /tmp, so a symlink there is
+// refused rather than followed, and so is a file another user owns; a new
+// file is readable by the daemon's user only. Returns the number of records
+// written, or -1 on error.
+int flight_recorder_dump(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_FLIGHT_RECORDER_H
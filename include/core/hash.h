@@ -0,0 +1,55 @@
+#ifndef CORE_HASH_H
+#define CORE_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// FNV-1a, the one key hash everything shares. Shard routing and B+tree leaf
+// tags depend on the 32-bit values staying exactly as they are.
+#define FNV1A_32_BASIS 2166136261u
+#define FNV1A_32_PRIME 16777619u
+#define FNV1A_64_BASIS 14695981039346656037ULL
+#define FNV1A_64_PRIME 1099511628211ULL
+
+static inline uint32_t fnv1a_32(const char* data, size_t len) {
+    uint32_t h = FNV1A_32_BASIS;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)data[i]) * FNV1A_32_PRIME;
+    }
+    return h;
+}
+
+static inline uint64_t fnv1a_64(const char* data, size_t len) {
+    uint64_t h = FNV1A_64_BASIS;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)data[i]) * FNV1A_64_PRIME;
+    }
+    return h;
+}
+
+// The same over a C string, without measuring it first
+static inline uint32_t fnv1a_32_str(const char* s) {
+    uint32_t h = FNV1A_32_BASIS;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * FNV1A_32_PRIME;
+    }
+    return h;
+}
+
+static inline uint64_t fnv1a_64_str(const char* s) {
+    uint64_t h = FNV1A_64_BASIS;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * FNV1A_64_PRIME;
+    }
+    return h;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_HASH_H
@@ -0,0 +1,27 @@
+#ifndef CORE_LZ_H
+#define CORE_LZ_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Small LZ77 block codec in the LZ4 block format: greedy single-probe hash
+// matching, 64KB window, byte-aligned tokens. Fast enough to run on the
+// request path; no external dependency.
+
+// Compress `src_len` bytes into `dst`. Returns the compressed size, or 0 if
+// the output would not fit in `dst_cap` bytes (the caller stores raw then).
+size_t lz_compress(const void* src, size_t src_len, void* dst, size_t dst_cap);
+
+// Decompress into `dst`. `dst_len` holds the capacity on entry and the
+// decompressed size on return. Returns 0 on success, -1 on malformed input
+// or if the output does not fit.
+int lz_decompress(const void* src, size_t src_len, void* dst, size_t* dst_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_LZ_H
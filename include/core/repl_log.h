@@ -0,0 +1,75 @@
+#ifndef CORE_REPL_LOG_H
+#define CORE_REPL_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recent mutations of a primary, numbered from 1 in the order they were
+// applied, each kept as the MSG_REPL_RECORD frame that ships it. Followers
+// stream from the sequence they last applied. The oldest records are dropped
+// beyond REPL_LOG_RECORDS or the byte budget; a follower that falls further
+// behind than that starts over with a full copy.
+#define REPL_LOG_RECORDS 65536          // Power of two
+#define DEFAULT_REPL_LOG_BYTES (16ULL << 20)
+
+struct repl_log {
+    pthread_mutex_t lock;
+    pthread_cond_t grown;        // Signalled on append and close
+    char** frames;               // REPL_LOG_RECORDS slots, indexed by seq
+    uint64_t first_seq;          // Oldest record kept (== next_seq when empty)
+    uint64_t next_seq;
+    size_t bytes;
+    size_t budget;
+    uint64_t epoch;              // Identifies this primary run
+    int enabled;                 // Nothing is kept until a follower subscribes
+    int closed;
+};
+
+// Returns 0 or -1
+int repl_log_init(struct repl_log* log, size_t budget);
+void repl_log_destroy(struct repl_log* log);
+
+// Wake every reader and make further reads fail
+void repl_log_close(struct repl_log* log);
+
+// Start keeping records (first subscriber). Returns the last sequence number
+// assigned, from which a full copy taken now is consistent.
+uint64_t repl_log_enable(struct repl_log* log);
+
+// Record a mutation that was just applied: `op` is REPL_OP_PUT (with the
+// version it gave the key) or REPL_OP_DELETE. Numbers it even while
+// disabled. Returns its sequence.
+uint64_t repl_log_append(struct repl_log* log, uint8_t op, const char* key,
+                         const char* value, uint32_t value_size, uint32_t expires_at,
+                         uint64_t version);
+
+// Copy the frames after `after` into `buf` (at least one frame, as many as
+// fit in `cap`), waiting up to `timeout_ms` for one to arrive. Returns the
+// bytes copied and stores the last sequence copied in `last`; 0 on timeout,
+// -1 if `after` has already been dropped or the log was closed.
+long repl_log_read(struct repl_log* log, uint64_t after, char* buf, size_t cap,
+                   uint64_t* last, int timeout_ms);
+
+// Last sequence assigned
+uint64_t repl_log_last(struct repl_log* log);
+
+// Whether records are being kept. Stable while any shard lock is held, as
+// the log is only enabled under all of them.
+int repl_log_enabled(struct repl_log* log);
+
+// Encode one MSG_REPL_RECORD frame into `buf` (repl_frame_size bytes)
+size_t repl_frame_size(size_t key_len, uint32_t value_size);
+void repl_frame_encode(char* buf, uint64_t seq, uint8_t op, const char* key,
+                       const char* value, uint32_t value_size, uint32_t expires_at,
+                       uint64_t version);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_REPL_LOG_H
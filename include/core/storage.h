@@ -9,40 +9,340 @@ extern "C" {
 #endif
 
 // Core storage data structures (remain in C)
-#define BLOCK_SIZE 4096
-#define TOTAL_BLOCKS 16384  // 64MB / 4KB
+#define DEFAULT_BLOCK_SIZE 4096
+#define MIN_BLOCK_SIZE 512
+#define MAX_BLOCK_SIZE 65536
+#define SUPERBLOCK_SIZE 4096  // Superblock region at offset 0, any block size
 #define MAX_KEY_SIZE 256
-#define MAX_KEYS 7          // Limited by Block 0 space
+#define INDEX_SUFFIX ".idx" // Key index file next to segment 0
+#define CHECKPOINT_SUFFIX ".ckpt" // Startup checkpoint next to segment 0
 
-struct key_entry {
-    char key[MAX_KEY_SIZE];
+#define STORAGE_MAGIC 0xDEADBEEF
+#define SEGMENT_MAGIC 0x5345474D  // "SEGM"
+#define STORAGE_VERSION 8
+#define CHECKPOINT_MAGIC 0x434B5054  // "CKPT"
+#define CHECKPOINT_VERSION 1
+
+// Engines, chosen when the storage is created (see storage_engine.h)
+#define STORAGE_ENGINE_BLOCK 0       // Block chains and a B+tree index
+#define STORAGE_ENGINE_LOG 1         // Append-only log files and a hash keydir
+
+// Storage is split into segment files (<file>, <file>.1, <file>.2, ...).
+// A block address packs the segment id above SEGMENT_SHIFT and the block
+// index within that segment below it. Address 0 is segment 0's superblock,
+// so 0 still works as the end-of-chain marker.
+#define SEGMENT_SHIFT 24
+#define MAX_SEGMENTS 256
+#define BLOCK_ADDR(seg, index) (((uint32_t)(seg) << SEGMENT_SHIFT) | (uint32_t)(index))
+#define BLOCK_SEGMENT(addr) ((uint32_t)(addr) >> SEGMENT_SHIFT)
+#define BLOCK_INDEX(addr) ((uint32_t)(addr) & ((1u << SEGMENT_SHIFT) - 1))
+
+// Default geometry for newly formatted storage, in bytes so it holds for
+// any block size (block counts are capped at 1 << SEGMENT_SHIFT)
+#define DEFAULT_SEGMENT_MAX_BYTES (4ULL << 30)  // 4GB segments
+#define DEFAULT_INITIAL_BYTES (64ULL << 20)     // 64MB, grown with fallocate
+#define SEGMENT_GROW_MAX_BYTES (1ULL << 30)     // Grow by at most 1GB at a time
+
+// Values at least this large are compressed on PUT when it saves space
+#define DEFAULT_COMPRESS_THRESHOLD 256
+
+#define ENTRY_FLAG_COMPRESSED 0x01  // Chain holds lz-compressed bytes
+
+// Index record for one key. Records live in the leaves of the B+tree in
+// <file>.idx, ordered by key.
+struct index_entry {
     uint32_t first_block_id;
-    uint32_t value_size;
-    uint8_t is_valid;
+    uint32_t last_block_id;      // Tail of the chain, where APPEND writes
+    uint32_t value_size;         // Size returned to readers
+    uint32_t stored_size;        // Bytes in the block chain
+    uint8_t flags;               // ENTRY_FLAG_*
+    uint32_t expires_at;         // Unix time the key expires, 0 = never
+    uint64_t version;            // Bumped by every write of the key, from 1
 } __attribute__((packed));
 
+// Superblock: the first SUPERBLOCK_SIZE bytes of segment 0. Segments reserve
+// max(1, SUPERBLOCK_SIZE / block_size) header blocks for it (or for their
+// segment_header), followed by their allocation bitmap region.
 struct metadata_block {
-    uint32_t magic;         // 0xDEADBEEF
-    uint32_t version;       // 1
-    uint32_t total_blocks;  // 16384
-    uint32_t free_blocks;   // Current free blocks
-    uint8_t bitmap[2048];   // 16384 bits for free blocks
-    struct key_entry entries[MAX_KEYS];
-    uint8_t padding[177];   // Fill to 4096 bytes
+    uint32_t magic;              // STORAGE_MAGIC
+    uint32_t version;            // STORAGE_VERSION
+    uint32_t total_blocks;       // Blocks across all segments
+    uint32_t free_blocks;        // Current free blocks
+    uint32_t block_size;         // Chosen at format time
+    uint32_t segment_count;      // Segment files in use
+    uint32_t segment_max_blocks; // Capacity of one segment (power of two)
+    uint32_t initial_blocks;     // Size of a freshly created segment
+    uint32_t checkpoint_gen;     // Bumped before the first write after a checkpoint
+    uint64_t version_floor;      // Highest version of a removed key, see storage_cas
+    uint8_t padding[4052];       // Fill to 4096 bytes
 } __attribute__((packed));
 
-struct data_block {
+// Header of every other segment
+struct segment_header {
+    uint32_t magic;              // SEGMENT_MAGIC
+    uint32_t version;            // STORAGE_VERSION
+    uint32_t segment_id;
+    uint32_t segment_max_blocks;
+} __attribute__((packed));
+
+// Every data block starts with this header; the payload fills the rest of
+// the block (block_size - 8 bytes)
+struct data_block_header {
     uint32_t next_block_id; // 0 = last block
     uint32_t data_size;     // Bytes used in this block
-    uint8_t data[4088];     // Actual data
 } __attribute__((packed));
 
+#define BLOCK_PAYLOAD(block_size) ((block_size) - sizeof(struct data_block_header))
+
+// Checkpoint file (<file>.ckpt): what open would otherwise rebuild by
+// scanning, written in one sequential pass on close and by
+// storage_checkpoint(). It is only used while its generation matches the
+// superblock's, i.e. nothing was written since. Layout: this header, a
+// checkpoint_segment per segment, every segment's free runs in order, the
+// Bloom filter blocks at filter_offset (page aligned, mapped in place) and
+// the expiry records at expiry_offset.
+struct checkpoint_header {
+    uint32_t magic;              // CHECKPOINT_MAGIC
+    uint32_t version;            // CHECKPOINT_VERSION
+    uint32_t generation;         // metadata_block.checkpoint_gen when written
+    uint32_t segment_count;
+    uint32_t block_size;
+    uint32_t reserved;
+    uint64_t key_count;          // Index entries
+    uint64_t extent_count;       // Free runs, all segments
+    uint64_t filter_offset;
+    uint64_t filter_blocks;      // 0 = no filter, rebuilt at open
+    uint64_t filter_capacity;
+    uint64_t filter_stale;
+    uint64_t expiry_offset;
+    uint64_t expiry_count;
+    uint64_t file_size;
+    uint64_t extent_sum;         // Segment table and runs
+    uint64_t filter_sum;
+    uint64_t expiry_sum;
+    uint64_t header_sum;         // This header, with header_sum = 0
+} __attribute__((packed));
+
+struct checkpoint_segment {
+    uint32_t nblocks;            // Segment size the runs describe
+    uint32_t extent_count;
+} __attribute__((packed));
+
+struct checkpoint_extent {
+    uint32_t start;              // Block index within the segment
+    uint32_t len;
+} __attribute__((packed));
+
+// Followed by key_len key bytes, no terminator
+struct checkpoint_expiry {
+    uint32_t expires_at;
+    uint16_t key_len;
+} __attribute__((packed));
+
+// Log engine files. <file> holds only a log_header; records are appended to
+// data files <file>.log.<id>, the highest id being the one written. Each
+// record is a log_record, key_len key bytes, then value_size value bytes.
+#define LOG_MAGIC 0x4C4F4753         // "LOGS"
+#define LOG_VERSION 3
+#define LOG_FILE_SUFFIX ".log."
+#define LOG_FILE_MAX_BYTES (64ULL << 20)  // A data file is closed past this
+
+#define LOG_RECORD_TOMBSTONE 0x01    // The key was deleted; no value follows
+
+struct log_header {
+    uint32_t magic;              // LOG_MAGIC
+    uint32_t version;            // LOG_VERSION
+    uint64_t file_max_bytes;
+    uint64_t version_floor;      // As in metadata_block, saved before merge drops tombstones
+} __attribute__((packed));
+
+struct log_record {
+    uint32_t crc;                // CRC-32 of the rest of the record
+    uint32_t value_size;
+    uint32_t expires_at;         // Unix time, 0 = never
+    uint16_t key_len;
+    uint8_t flags;               // LOG_RECORD_*
+    uint8_t reserved;
+    uint64_t version;            // Key version this record sets (tombstone: the one deleted)
+} __attribute__((packed));
+
+// Format-time options, only used when the storage file is created.
+// Zero fields take the defaults above.
+struct storage_format {
+    uint32_t block_size;         // Power of two, MIN_BLOCK_SIZE..MAX_BLOCK_SIZE
+    uint32_t segment_max_blocks; // Power of two, >= 4096
+    uint32_t initial_blocks;     // Multiple of 64, <= segment_max_blocks
+    uint32_t in_memory;          // Volatile: no files, see storage_open
+    uint32_t engine;             // STORAGE_ENGINE_*
+};
+
+// An open storage file (segments, index and allocation state). Handles are
+// independent: each may be used from one thread at a time, and different
+// handles from different threads at once.
+typedef struct storage_state storage_t;
+
 // Core C API - clean interface for C++ wrapping
-int storage_init(const char* filename);
-int storage_put(const char* key, const char* value, size_t value_size);
-int storage_get(const char* key, char* value, size_t* value_size);
-int storage_delete(const char* key);
-void storage_cleanup(void);
+// Open `filename`, creating it with `format` (NULL = defaults) if it does
+// not exist. Returns the handle, or NULL. format->engine picks the engine
+// of a new store; an existing one is opened by the engine that wrote it.
+// With format->in_memory (block engine only) the store is created empty in
+// anonymous memory (huge pages where available) and `filename` only names
+// it: nothing is read or written, and the contents are gone on close.
+storage_t* storage_open(const char* filename, const struct storage_format* format);
+void storage_close(storage_t* db);
+int storage_put(storage_t* db, const char* key, const char* value, size_t value_size);
+// PUT that expires the key `ttl_seconds` from now (0 = never). An expired
+// key reads as missing and is reclaimed by the first access that sees it.
+int storage_put_ttl(storage_t* db, const char* key, const char* value, size_t value_size,
+                    uint32_t ttl_seconds);
+int storage_get(storage_t* db, const char* key, char* value, size_t* value_size);
+int storage_delete(storage_t* db, const char* key);
+
+// Every write of a key bumps its version; a key that doesn't exist (or has
+// expired) is at KEY_VERSION_NONE. A key created anew starts above every
+// version the store has deleted or expired, so a version is never reused
+// for the same key and a CAS from before a delete can't match.
+#define KEY_VERSION_NONE 0
+#define KEY_VERSION_ANY UINT64_MAX   // storage_cas: write whatever the version
+
+// PUT only if the key is at `expected_version` (KEY_VERSION_NONE: only if
+// it doesn't exist), expiring at `expires_at` (Unix time, 0 = never) so the
+// caller's stamp is the one stored. Returns 0 and sets `version` to the new
+// version, 1 and sets it to the current one if that isn't
+// `expected_version`, or -1.
+int storage_cas(storage_t* db, const char* key, const char* value, size_t value_size,
+                uint32_t expires_at, uint64_t expected_version, uint64_t* version);
+
+// PUT that stores the key at exactly `version` rather than the next one,
+// expiring at `expires_at` (Unix time, 0 = never). For a follower, whose
+// keys carry the versions its primary gave them. Returns 0 or -1.
+int storage_put_version(storage_t* db, const char* key, const char* value, size_t value_size,
+                        uint32_t expires_at, uint64_t version);
+
+// Add `delta` to a value holding a decimal integer (a missing key counts as
+// 0) and store the result as decimal text, keeping the key's TTL. Returns 0
+// and sets `result` and `version`, 1 if the value is not an integer or the
+// sum overflows (nothing written), or -1.
+int storage_incr(storage_t* db, const char* key, int64_t delta, int64_t* result,
+                 uint64_t* version);
+
+// Per-key metadata from the index, without reading the value
+struct storage_key_info {
+    uint32_t value_size;
+    uint32_t expires_at;         // Unix time, 0 = never
+    uint64_t version;
+};
+
+// Returns 0 and fills `info`, or -1 if the key is missing or expired
+int storage_stat(storage_t* db, const char* key, struct storage_key_info* info);
+
+// Add `size` bytes to the end of a key's value, keeping its TTL; a missing
+// key is created. Returns 0 and, if `info` isn't NULL, fills it with the
+// key's state after the append, or -1.
+int storage_append(storage_t* db, const char* key, const char* data, size_t size,
+                   struct storage_key_info* info);
+
+// Called by storage_scan for each matching key, in key order. Return
+// nonzero to stop. The callback must not modify the storage.
+typedef int (*storage_scan_fn)(const char* key, const char* value, size_t value_size, void* arg);
+
+// Visit keys >= start and < end that begin with prefix. NULL or empty
+// arguments leave that bound open. Returns the number of keys visited, or -1.
+int storage_scan(storage_t* db, const char* start, const char* end, const char* prefix,
+                 storage_scan_fn fn, void* arg);
+
+// Point-in-time view for online backup. Creating one copies the index and
+// pins every block in use; from then on writes never touch a pinned block
+// (overwrites go to fresh blocks) and frees of pinned blocks are deferred
+// until release. One snapshot at a time. Returns 0, or -1 if one is already
+// held or it could not be taken.
+int storage_snapshot_create(storage_t* db);
+
+// storage_scan over the snapshot instead of the live index
+int storage_snapshot_scan(storage_t* db, const char* start, const char* end,
+                          const char* prefix, storage_scan_fn fn, void* arg);
+
+// Drop the snapshot and free the blocks only it still referenced
+void storage_snapshot_release(storage_t* db);
+
+// Commit pending metadata and, if anything changed since the last one, write
+// a new checkpoint so the next open needn't scan. Costs a walk of the index.
+// Returns 0, or -1 if it could not be written (the next open then scans).
+int storage_checkpoint(storage_t* db);
+
+// Called by storage_list_expiring for each key that has a TTL, and by
+// storage_expire for each key it reclaims
+typedef void (*storage_expiry_fn)(const char* key, uint32_t expires_at, void* arg);
+
+// Visit every key with a TTL, without reading values. Returns the number of
+// keys visited, or -1.
+int storage_list_expiring(storage_t* db, storage_expiry_fn fn, void* arg);
+
+// Reclaim whichever of `keys` have expired, committing once for the batch,
+// and pass each one reclaimed to `fn` (if not NULL). Keys rewritten since
+// they were scheduled are left alone. Returns the number reclaimed, or -1.
+int storage_expire(storage_t* db, const char* const* keys, size_t count,
+                   storage_expiry_fn fn, void* arg);
+
+// Running totals of storage_compact_step, kept by the caller. A break is a
+// link from one block of a chain to anything but the next block on disk.
+struct storage_compact_stats {
+    uint64_t chains_checked;
+    uint64_t chains_moved;       // Relocated into one contiguous run
+    uint64_t blocks_moved;
+    uint64_t breaks_found;
+    uint64_t breaks_removed;     // Breaks in the chains that were moved
+};
+
+// Relocate split chains into contiguous runs, one bounded step at a time.
+// Looks at keys in order from `cursor` (MAX_KEY_SIZE bytes, "" = the first
+// key) until about `budget` bytes have been read and written, and leaves the
+// key to resume from in `cursor`, "" once the pass is complete. A value only
+// moves when a single free run holds all of it; the new copy is written and
+// indexed before the old blocks are freed. Returns the bytes of I/O spent,
+// or -1.
+long storage_compact_step(storage_t* db, char* cursor, size_t budget,
+                          struct storage_compact_stats* stats);
+
+// Findings of storage_check. A leaked block is marked used but on no chain
+// that is kept; an unmarked one is on a kept chain but marked free.
+struct storage_check_report {
+    uint64_t keys;
+    uint64_t blocks_used;          // Blocks on intact chains
+    uint64_t broken_chains;        // Links out of range or headers that disagree
+    uint64_t cross_linked;         // Blocks on more than one intact chain
+    uint64_t leaked;
+    uint64_t unmarked;
+    uint64_t free_blocks_recorded; // In the superblock
+    uint64_t free_blocks_actual;   // What the chains leave free
+    uint64_t keys_dropped;         // By repair
+};
+
+// Called by storage_check for each key it would drop, with the reason
+typedef void (*storage_check_fn)(const char* key, const char* problem, void* arg);
+
+// Walk every chain on `threads` threads and cross-check the bitmaps and the
+// free count against them. With `repair`, keys whose chains are broken or
+// share blocks are dropped and the bitmaps rebuilt from the chains left.
+// Only for storage no one else has open. Returns 0 if it was clean (or has
+// been repaired), 1 if problems were found and left, -1 on error (always
+// for the log engine, which verifies its records at open instead).
+int storage_check(storage_t* db, unsigned threads, int repair,
+                  storage_check_fn fn, void* arg, struct storage_check_report* report);
+
+// Size and key count, whatever the engine
+struct storage_stats {
+    const char* engine;          // Engine name, "block" or "log"
+    uint64_t keys;
+    uint64_t bytes_total;        // Space the storage occupies
+    uint64_t bytes_used;         // Of which held by live data and metadata
+};
+
+void storage_stats(storage_t* db, struct storage_stats* stats);
+
+// Compress values of at least `threshold` bytes on PUT (0 disables).
+// Reads handle both forms regardless of this setting.
+void storage_set_compression(storage_t* db, size_t threshold);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,62 @@
+#ifndef CORE_STORAGE_ENGINE_H
+#define CORE_STORAGE_ENGINE_H
+
+#include "storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What an engine provides behind the storage.h API. The storage_* functions
+// pick the engine when the storage is opened and forward every call to it:
+// an existing file is opened by the engine whose magic it starts with, a
+// new one by storage_format.engine.
+//
+// A handle (storage_t) must begin with a `const struct storage_engine*`
+// naming its engine; past that its layout is the engine's own.
+struct storage_engine {
+    const char* name;
+    uint32_t magic;              // First 4 bytes of the storage file
+
+    storage_t* (*open)(const char* filename, const struct storage_format* format);
+    void (*close)(storage_t* db);
+    // storage_cas; storage_put passes KEY_VERSION_ANY and a NULL `version`.
+    // A TTL arrives as its absolute expiry time, stamped once by the caller.
+    int (*put)(storage_t* db, const char* key, const char* value, size_t value_size,
+               uint32_t expires_at, uint64_t expected_version, uint64_t* version);
+    int (*put_version)(storage_t* db, const char* key, const char* value, size_t value_size,
+                       uint32_t expires_at, uint64_t version);
+    int (*get)(storage_t* db, const char* key, char* value, size_t* value_size);
+    int (*remove)(storage_t* db, const char* key);
+    int (*stat)(storage_t* db, const char* key, struct storage_key_info* info);
+    int (*scan)(storage_t* db, const char* start, const char* end, const char* prefix,
+                storage_scan_fn fn, void* arg);
+    void (*stats)(storage_t* db, struct storage_stats* stats);
+
+    // Optional: left NULL, the storage_* call fails (or does nothing)
+    int (*snapshot_create)(storage_t* db);
+    int (*snapshot_scan)(storage_t* db, const char* start, const char* end,
+                         const char* prefix, storage_scan_fn fn, void* arg);
+    void (*snapshot_release)(storage_t* db);
+    int (*checkpoint)(storage_t* db);
+    int (*list_expiring)(storage_t* db, storage_expiry_fn fn, void* arg);
+    int (*expire)(storage_t* db, const char* const* keys, size_t count,
+                  storage_expiry_fn fn, void* arg);
+    long (*compact_step)(storage_t* db, char* cursor, size_t budget,
+                         struct storage_compact_stats* stats);
+    int (*check)(storage_t* db, unsigned threads, int repair, storage_check_fn fn, void* arg,
+                 struct storage_check_report* report);
+    void (*set_compression)(storage_t* db, size_t threshold);
+    // Left NULL, storage_append reads the value and PUTs it back extended
+    int (*append)(storage_t* db, const char* key, const char* data, size_t size,
+                  struct storage_key_info* info);
+};
+
+extern const struct storage_engine block_engine;  // storage.c
+extern const struct storage_engine log_engine;    // log_engine.c
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_STORAGE_ENGINE_H
@@ -0,0 +1,61 @@
+#ifndef CORE_TIMER_WHEEL_H
+#define CORE_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hierarchical timer wheel keyed by name. TIMER_WHEEL_LEVELS levels of
+// TIMER_WHEEL_SLOTS slots each; level n covers deadlines up to
+// TIMER_WHEEL_SLOTS^(n+1) ticks away and cascades into the level below when
+// its turn comes. Adding and expiring a timer are O(1) amortized.
+//
+// A key has at most one timer: scheduling it again moves the one it has,
+// so the wheel grows with the keys that have a deadline, not with how
+// often they are rewritten. Not thread-safe; the caller locks.
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 4   // 64^4 ticks, ~194 days at one tick per second
+
+struct timer_entry {
+    struct timer_entry* next;       // In its slot, or in a list of fired timers
+    struct timer_entry** pprev;     // The link to this entry while in a slot
+    struct timer_entry* hash_next;
+    uint64_t hash;
+    uint64_t expires;               // Tick at which the timer fires
+    char key[];
+};
+
+struct timer_wheel {
+    uint64_t now;            // Last tick processed
+    size_t count;
+    struct timer_entry** buckets;   // Key -> its pending timer
+    size_t bucket_count;            // Power of two
+    struct timer_entry* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+// Returns 0 or -1
+int timer_wheel_init(struct timer_wheel* w, uint64_t now);
+void timer_wheel_destroy(struct timer_wheel* w);
+
+// Schedule `key` for tick `expires`, replacing any timer it already has. A
+// deadline that is already due fires on the next advance. Returns 0 or -1.
+int timer_wheel_add(struct timer_wheel* w, const char* key, uint64_t expires);
+
+// Cancel the timer of `key`, if it has one
+void timer_wheel_remove(struct timer_wheel* w, const char* key);
+
+// Process every tick up to `now` and return the timers that fired as a list
+// (free with timer_wheel_free_list). They are no longer scheduled.
+struct timer_entry* timer_wheel_advance(struct timer_wheel* w, uint64_t now);
+
+void timer_wheel_free_list(struct timer_entry* list);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_TIMER_WHEEL_H
@@ -0,0 +1,88 @@
+#ifndef CORE_VALUE_CACHE_H
+#define CORE_VALUE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Byte-budgeted cache of hot values with S3-FIFO admission. New keys enter a
+// small FIFO (VALUE_CACHE_SMALL_PERCENT of the budget) and are promoted to
+// the main FIFO only if read again before they reach its tail; the rest
+// leave a ghost entry (key only) so a quick return goes straight to main.
+// One-hit keys therefore never displace the working set.
+#define VALUE_CACHE_SMALL_PERCENT 10
+#define VALUE_CACHE_MAX_FREQ 3
+#define DEFAULT_CACHE_BYTES (64ULL << 20)
+
+// Immutable, refcounted value. A reader keeps it alive after eviction or
+// replacement until it calls cache_value_release.
+struct cache_value {
+    uint32_t refs;
+    uint32_t expires_at;     // Unix time, 0 = never
+    uint64_t version;        // Storage's version of the key
+    size_t size;
+    char data[];
+};
+
+struct cache_entry;
+
+struct cache_queue {
+    struct cache_entry* head;  // Newest
+    struct cache_entry* tail;  // Next to evict
+    size_t count;
+    size_t bytes;
+};
+
+struct value_cache {
+    pthread_mutex_t lock;
+    size_t budget;           // Bytes for small + main, 0 = disabled
+    struct cache_entry** buckets;
+    size_t bucket_count;     // Power of two
+    size_t entry_count;      // Including ghosts
+    struct cache_queue small;
+    struct cache_queue main;
+    struct cache_queue ghost;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Returns 0 or -1. A zero budget gives a cache that never holds anything.
+int value_cache_init(struct value_cache* c, size_t budget);
+void value_cache_destroy(struct value_cache* c);
+
+// Take a reference to the cached value of `key`, or NULL on a miss (absent,
+// or expired as of `now`)
+struct cache_value* value_cache_get(struct value_cache* c, const char* key, uint32_t now);
+
+// Offer a value just read from storage. Admitted to the small queue, or to
+// main if the key was recently evicted.
+void value_cache_admit(struct value_cache* c, const char* key, const char* data,
+                       size_t size, uint32_t expires_at, uint64_t version);
+
+// A key was written: replace its value if it is resident, otherwise leave
+// the cache alone (writes alone never admit). A value older than the
+// resident one (by version) is ignored.
+void value_cache_update(struct value_cache* c, const char* key, const char* data,
+                        size_t size, uint32_t expires_at, uint64_t version);
+
+// `size` bytes were appended to a key that was at `base_version` and is
+// now at `version`. A resident copy of the base value is extended in place
+// of a read; any other older copy is dropped.
+void value_cache_append(struct value_cache* c, const char* key, const char* data,
+                        size_t size, uint64_t base_version, uint32_t expires_at,
+                        uint64_t version);
+
+// A key was deleted or expired
+void value_cache_remove(struct value_cache* c, const char* key);
+
+void cache_value_release(struct cache_value* v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CORE_VALUE_CACHE_H
@@ -14,13 +14,14 @@ class StorageEngine {
 private:
     std::string storage_file_;
     mutable std::mutex storage_mutex_;
+    storage_t* db_;
     bool initialized_;
 
 public:
     explicit StorageEngine(const std::string& storage_file);
     ~StorageEngine();
     
-    // Disable copy constructor and assignment (singleton-like behavior)
+    // Disable copy constructor and assignment (owns the storage handle)
     StorageEngine(const StorageEngine&) = delete;
     StorageEngine& operator=(const StorageEngine&) = delete;
     
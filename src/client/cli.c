@@ -6,13 +6,194 @@
 void show_usage(const char* program_name) {
     printf("Usage: %s <command> [arguments]\n", program_name);
     printf("\nCommands:\n");
-    printf("  put <key> <value>    Store a key-value pair\n");
+    printf("  put <key> <value> [ttl]  Store a key-value pair, expiring after ttl seconds\n");
     printf("  get <key>            Retrieve value for a key\n");
     printf("  delete <key>         Delete a key-value pair\n");
+    printf("  cas <key> <version> <value> [ttl]  Store only if the key is at this\n");
+    printf("                       version (from get; 0 = only if it doesn't exist)\n");
+    printf("  incr <key> [delta]   Add delta (default 1) to an integer value\n");
+    printf("  append <key> <value> Add value to the end of a key's value, without the\n");
+    printf("                       terminator put stores (so build the value with append)\n");
+    printf("  scan [prefix]        List keys (with values) in order, optionally by prefix\n");
+    printf("  range <start> [end]  List keys >= start and < end\n");
+    printf("  dump                 Dump the daemon's flight recorder to a file\n");
+    printf("  stats                Show cache and compaction counters\n");
+    printf("  backup <file>        Copy a consistent snapshot of all keys to a file\n");
+    printf("  restore <file>       PUT every key from a backup file\n");
     printf("\nExamples:\n");
     printf("  %s put mykey \"my value\"\n", program_name);
+    printf("  %s put session:42 \"token\" 3600\n", program_name);
     printf("  %s get mykey\n", program_name);
     printf("  %s delete mykey\n", program_name);
+    printf("  %s cas lease:7 3 owner-b 30\n", program_name);
+    printf("  %s incr hits:today\n", program_name);
+    printf("  %s append audit:42 \"login;\"\n", program_name);
+    printf("  %s scan session:42:\n", program_name);
+}
+
+static void print_scan_entry(const char* key, const char* value, size_t value_size, void* arg) {
+    unsigned* count = arg;
+    // String values are stored with their terminator
+    if (value_size > 0 && value[value_size - 1] == '\0') {
+        value_size--;
+    }
+    printf("%s = %.*s\n", key, (int)value_size, value);
+    (*count)++;
+}
+
+// Fetch every page of a scan; the daemon answers one request per connection
+static int run_scan(int fd, struct scan_request* req) {
+    unsigned count = 0;
+    char next_key[MAX_KEY_SIZE];
+
+    for (;;) {
+        int result = client_scan(fd, req, print_scan_entry, &count, next_key);
+        client_disconnect(fd);
+        if (result != 0) {
+            printf("SCAN failed (error %d)\n", result);
+            return result;
+        }
+        if (next_key[0] == '\0') {
+            break;
+        }
+
+        memcpy(req->start_key, next_key, sizeof(req->start_key));
+        fd = client_connect();
+        if (fd < 0) {
+            return -1;
+        }
+    }
+
+    printf("SCAN complete: %u keys\n", count);
+    return 0;
+}
+
+// Backup file: BACKUP_MAGIC, then (struct scan_entry, key, value) records
+#define BACKUP_MAGIC 0x5344424B  // "SDBK"
+
+struct backup_state {
+    FILE* out;
+    unsigned count;
+    int failed;
+};
+
+static void write_backup_entry(const char* key, const char* value, size_t value_size, void* arg) {
+    struct backup_state* b = arg;
+    struct scan_entry entry = {
+        .key_len = (uint16_t)strlen(key),
+        .value_size = (uint32_t)value_size
+    };
+    if (fwrite(&entry, sizeof(entry), 1, b->out) != 1 ||
+        fwrite(key, 1, entry.key_len, b->out) != entry.key_len ||
+        fwrite(value, 1, value_size, b->out) != value_size) {
+        b->failed = 1;
+    }
+    b->count++;
+}
+
+// One snapshot request on its own connection
+static int snapshot_op(struct snapshot_request* req, struct backup_state* b, char* next_key) {
+    int fd = client_connect();
+    if (fd < 0) {
+        return -1;
+    }
+    int result = client_snapshot(fd, req, b ? write_backup_entry : NULL, b, next_key);
+    client_disconnect(fd);
+    return result;
+}
+
+// Take a snapshot, page through it into `path`, release it
+static int run_backup(const char* path) {
+    struct backup_state b = { fopen(path, "wb"), 0, 0 };
+    if (!b.out) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        return -1;
+    }
+    uint32_t magic = BACKUP_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, b.out);
+
+    struct snapshot_request req;
+    char next_key[MAX_KEY_SIZE];
+    memset(&req, 0, sizeof(req));
+    req.op = SNAPSHOT_BEGIN;
+    int result = snapshot_op(&req, NULL, next_key);
+    if (result != 0) {
+        printf("BACKUP failed: could not take a snapshot (error %d)\n", result);
+        fclose(b.out);
+        return result;
+    }
+
+    req.op = SNAPSHOT_READ;
+    do {
+        result = snapshot_op(&req, &b, next_key);
+        memcpy(req.start_key, next_key, sizeof(req.start_key));
+    } while (result == 0 && !b.failed && next_key[0] != '\0');
+
+    // Released even if the copy failed
+    req.op = SNAPSHOT_END;
+    snapshot_op(&req, NULL, next_key);
+
+    if (fclose(b.out) != 0) {
+        b.failed = 1;
+    }
+    if (result != 0 || b.failed) {
+        printf("BACKUP failed (error %d)\n", result != 0 ? result : -1);
+        return -1;
+    }
+    printf("BACKUP complete: %u keys written to %s\n", b.count, path);
+    return 0;
+}
+
+// PUT every record of a backup file
+static int run_restore(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return -1;
+    }
+    uint32_t magic = 0;
+    if (fread(&magic, sizeof(magic), 1, in) != 1 || magic != BACKUP_MAGIC) {
+        fprintf(stderr, "%s is not a backup file\n", path);
+        fclose(in);
+        return -1;
+    }
+
+    unsigned count = 0;
+    int result = 0;
+    struct scan_entry entry;
+    char key[MAX_KEY_SIZE];
+    char value[MAX_VALUE_SIZE];
+    while (fread(&entry, sizeof(entry), 1, in) == 1) {
+        if (entry.key_len >= MAX_KEY_SIZE || entry.value_size > MAX_VALUE_SIZE ||
+            fread(key, 1, entry.key_len, in) != entry.key_len ||
+            fread(value, 1, entry.value_size, in) != entry.value_size) {
+            fprintf(stderr, "%s: truncated or corrupt record\n", path);
+            result = -1;
+            break;
+        }
+        key[entry.key_len] = '\0';
+
+        int fd = client_connect();
+        if (fd < 0) {
+            result = -1;
+            break;
+        }
+        result = client_put(fd, key, value, entry.value_size);
+        client_disconnect(fd);
+        if (result != 0) {
+            fprintf(stderr, "PUT of '%s' failed (error %d)\n", key, result);
+            break;
+        }
+        count++;
+    }
+    fclose(in);
+
+    if (result != 0) {
+        printf("RESTORE failed after %u keys\n", count);
+        return result;
+    }
+    printf("RESTORE complete: %u keys\n", count);
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -33,17 +214,27 @@ int main(int argc, char* argv[]) {
     int result = 0;
     
     if (strcmp(command, "put") == 0) {
-        if (argc != 4) {
-            fprintf(stderr, "Usage: %s put <key> <value>\n", argv[0]);
+        if (argc != 4 && argc != 5) {
+            fprintf(stderr, "Usage: %s put <key> <value> [ttl_seconds]\n", argv[0]);
             client_disconnect(fd);
             return 1;
         }
         
         const char* key = argv[2];
         const char* value = argv[3];
+        uint32_t ttl = 0;
+        if (argc == 5) {
+            char* end;
+            ttl = (uint32_t)strtoul(argv[4], &end, 10);
+            if (argv[4][0] == '\0' || *end != '\0') {
+                fprintf(stderr, "Invalid ttl: %s\n", argv[4]);
+                client_disconnect(fd);
+                return 1;
+            }
+        }
         
         printf("Storing key='%s' value='%s'\n", key, value);
-        result = client_put_string(fd, key, value);
+        result = client_put_ttl(fd, key, value, strlen(value) + 1, ttl);
         
         if (result == 0) {
             printf("PUT successful\n");
@@ -62,17 +253,111 @@ int main(int argc, char* argv[]) {
         char value[4096]; // Buffer for retrieved value
         
         printf("Retrieving key='%s'\n", key);
-        result = client_get_string(fd, key, value, sizeof(value));
+        size_t value_size = sizeof(value) - 1;
+        uint64_t version = 0;
+        result = client_get_version(fd, key, value, &value_size, &version);
         
         if (result == 0) {
+            value[value_size] = '\0';
             printf("GET successful\n");
             printf("Value: %s\n", value);
+            printf("Version: %llu\n", (unsigned long long)version);
         } else if (result == -1) {
             printf("Key not found\n");
         } else {
             printf("GET failed (error %d)\n", result);
         }
         
+    } else if (strcmp(command, "cas") == 0) {
+        if (argc != 5 && argc != 6) {
+            fprintf(stderr, "Usage: %s cas <key> <version> <value> [ttl_seconds]\n", argv[0]);
+            client_disconnect(fd);
+            return 1;
+        }
+        
+        const char* key = argv[2];
+        const char* value = argv[4];
+        char* end;
+        uint64_t expected = strtoull(argv[3], &end, 10);
+        if (argv[3][0] == '\0' || *end != '\0') {
+            fprintf(stderr, "Invalid version: %s\n", argv[3]);
+            client_disconnect(fd);
+            return 1;
+        }
+        uint32_t ttl = 0;
+        if (argc == 6) {
+            ttl = (uint32_t)strtoul(argv[5], &end, 10);
+            if (argv[5][0] == '\0' || *end != '\0') {
+                fprintf(stderr, "Invalid ttl: %s\n", argv[5]);
+                client_disconnect(fd);
+                return 1;
+            }
+        }
+        
+        uint64_t version = 0;
+        result = client_cas(fd, key, value, strlen(value) + 1, ttl, expected, &version);
+        
+        if (result == 0) {
+            printf("CAS successful, version %llu\n", (unsigned long long)version);
+        } else if (result == RESULT_VERSION_MISMATCH) {
+            printf("CAS failed: key is at version %llu\n", (unsigned long long)version);
+        } else {
+            printf("CAS failed (error %d)\n", result);
+        }
+        
+    } else if (strcmp(command, "incr") == 0) {
+        if (argc != 3 && argc != 4) {
+            fprintf(stderr, "Usage: %s incr <key> [delta]\n", argv[0]);
+            client_disconnect(fd);
+            return 1;
+        }
+        
+        int64_t delta = 1;
+        if (argc == 4) {
+            char* end;
+            delta = strtoll(argv[3], &end, 10);
+            if (argv[3][0] == '\0' || *end != '\0') {
+                fprintf(stderr, "Invalid delta: %s\n", argv[3]);
+                client_disconnect(fd);
+                return 1;
+            }
+        }
+        
+        int64_t value = 0;
+        uint64_t version = 0;
+        result = client_incr(fd, argv[2], delta, &value, &version);
+        
+        if (result == 0) {
+            printf("INCR successful\n");
+            printf("Value: %lld\n", (long long)value);
+            printf("Version: %llu\n", (unsigned long long)version);
+        } else if (result == RESULT_NOT_INTEGER) {
+            printf("INCR failed: value is not an integer\n");
+        } else {
+            printf("INCR failed (error %d)\n", result);
+        }
+        
+    } else if (strcmp(command, "append") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "Usage: %s append <key> <value>\n", argv[0]);
+            client_disconnect(fd);
+            return 1;
+        }
+        
+        uint32_t value_size = 0;
+        uint64_t version = 0;
+        result = client_append(fd, argv[2], argv[3], strlen(argv[3]), &value_size, &version);
+        
+        if (result == 0) {
+            printf("APPEND successful\n");
+            printf("Size: %u\n", value_size);
+            printf("Version: %llu\n", (unsigned long long)version);
+        } else if (result == RESULT_TOO_LARGE) {
+            printf("APPEND failed: value would exceed %d bytes\n", MAX_VALUE_SIZE);
+        } else {
+            printf("APPEND failed (error %d)\n", result);
+        }
+        
     } else if (strcmp(command, "delete") == 0) {
         if (argc != 3) {
             fprintf(stderr, "Usage: %s delete <key>\n", argv[0]);
@@ -93,6 +378,82 @@ int main(int argc, char* argv[]) {
             printf("DELETE failed (error %d)\n", result);
         }
         
+    } else if (strcmp(command, "scan") == 0 || strcmp(command, "range") == 0) {
+        int is_range = strcmp(command, "range") == 0;
+        if ((!is_range && argc > 3) || (is_range && (argc < 3 || argc > 4))) {
+            fprintf(stderr, "Usage: %s scan [prefix] | range <start> [end]\n", argv[0]);
+            client_disconnect(fd);
+            return 1;
+        }
+        
+        struct scan_request req;
+        memset(&req, 0, sizeof(req));
+        if (is_range) {
+            strncpy(req.start_key, argv[2], MAX_KEY_SIZE - 1);
+            if (argc == 4) {
+                strncpy(req.end_key, argv[3], MAX_KEY_SIZE - 1);
+            }
+        } else if (argc == 3) {
+            strncpy(req.prefix, argv[2], MAX_KEY_SIZE - 1);
+        }
+        
+        // run_scan owns the connection from here
+        return run_scan(fd, &req) == 0 ? 0 : 1;
+        
+    } else if (strcmp(command, "dump") == 0) {
+        struct dump_response resp;
+        result = client_dump_flight_recorder(fd, &resp);
+        
+        if (result == 0) {
+            printf("DUMP successful: %u records written to %s\n",
+                   resp.record_count, resp.path);
+        } else {
+            printf("DUMP failed (error %d)\n", result);
+        }
+        
+    } else if (strcmp(command, "backup") == 0 || strcmp(command, "restore") == 0) {
+        if (argc != 3) {
+            fprintf(stderr, "Usage: %s %s <file>\n", argv[0], command);
+            client_disconnect(fd);
+            return 1;
+        }
+        
+        // These open a connection per request
+        client_disconnect(fd);
+        result = strcmp(command, "backup") == 0 ? run_backup(argv[2]) : run_restore(argv[2]);
+        return result == 0 ? 0 : 1;
+        
+    } else if (strcmp(command, "stats") == 0) {
+        struct stats_response resp;
+        result = client_stats(fd, &resp);
+        
+        if (result == 0) {
+            printf("Cache: %llu hits, %llu misses\n",
+                   (unsigned long long)resp.cache_hits, (unsigned long long)resp.cache_misses);
+            printf("Storage: %.*s, %llu keys, %llu of %llu bytes used\n",
+                   (int)sizeof(resp.storage_engine), resp.storage_engine,
+                   (unsigned long long)resp.storage_keys,
+                   (unsigned long long)resp.storage_bytes_used,
+                   (unsigned long long)resp.storage_bytes_total);
+            printf("Compaction: %llu passes, %llu values moved (%llu blocks), %llu breaks removed\n",
+                   (unsigned long long)resp.compact_passes,
+                   (unsigned long long)resp.compact_chains_moved,
+                   (unsigned long long)resp.compact_blocks_moved,
+                   (unsigned long long)resp.compact_breaks_removed);
+            printf("Fragmentation: %llu breaks\n", (unsigned long long)resp.fragmentation);
+            if (resp.repl_role == REPL_ROLE_FOLLOWER) {
+                printf("Replication: follower at record %llu, %llu records (%llu ms) behind\n",
+                       (unsigned long long)resp.repl_seq,
+                       (unsigned long long)resp.repl_lag_records,
+                       (unsigned long long)resp.repl_lag_ms);
+            } else {
+                printf("Replication: primary at record %llu, %u followers\n",
+                       (unsigned long long)resp.repl_seq, resp.repl_followers);
+            }
+        } else {
+            printf("STATS failed (error %d)\n", result);
+        }
+        
     } else {
         fprintf(stderr, "Unknown command: %s\n", command);
         show_usage(argv[0]);
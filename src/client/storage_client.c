@@ -1,6 +1,7 @@
 #include "../../include/client/storage_client.h"
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -9,6 +10,11 @@
 
 static uint32_t sequence_counter = 1;
 
+// Replies are read into this thread's buffer, grown to the largest seen and
+// reused, so a steady stream of requests doesn't allocate
+static __thread char* reply_buf = NULL;
+static __thread size_t reply_cap = 0;
+
 // Connect to the storage daemon
 int client_connect(void) {
     int fd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -20,7 +26,8 @@ int client_connect(void) {
     struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    const char* path = getenv(SOCKET_ENV);
+    strncpy(addr.sun_path, path && path[0] ? path : SOCKET_PATH, sizeof(addr.sun_path) - 1);
     
     if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("Failed to connect to daemon");
@@ -38,32 +45,68 @@ void client_disconnect(int fd) {
     }
 }
 
-// Helper function to send a complete message
-static int send_message(int fd, const struct message_header* header, const void* payload) {
-    // Send header
-    ssize_t bytes_sent = write(fd, header, sizeof(*header));
-    if (bytes_sent != sizeof(*header)) {
-        perror("Failed to send message header");
-        return -1;
+// Read exactly `len` bytes; a reply can arrive in several pieces
+static int read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
     }
+    return 0;
+}
+
+// Helper function to send a complete message: header, payload and any
+// `extra` payload bytes after it in one writev, resumed after short writes
+static int send_message(int fd, const struct message_header* header, const void* payload,
+                        const void* extra, size_t extra_size) {
+    size_t payload_size = payload ? header->payload_size - extra_size : 0;
+    struct iovec iov[3] = {
+        { (void*)header, sizeof(*header) },
+        { (void*)payload, payload_size },
+        { (void*)extra, extra ? extra_size : 0 }
+    };
+    struct iovec* pos = iov;
+    int count = iov[2].iov_len > 0 ? 3 : iov[1].iov_len > 0 ? 2 : 1;
     
-    // Send payload if present
-    if (header->payload_size > 0 && payload) {
-        bytes_sent = write(fd, payload, header->payload_size);
-        if (bytes_sent != header->payload_size) {
-            perror("Failed to send message payload");
+    while (count > 0) {
+        ssize_t n = writev(fd, pos, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("Failed to send message");
             return -1;
         }
+        size_t sent = (size_t)n;
+        while (count > 0 && sent >= pos->iov_len) {
+            sent -= pos->iov_len;
+            pos++;
+            count--;
+        }
+        if (count > 0) {
+            pos->iov_base = (char*)pos->iov_base + sent;
+            pos->iov_len -= sent;
+        }
     }
     
     return 0;
 }
 
-// Helper function to receive a complete message
+// Helper function to receive a complete message. The payload stays valid
+// until the next call on this thread.
 static int receive_response(int fd, struct message_header* header, void** payload) {
     // Read header
-    ssize_t bytes_read = read(fd, header, sizeof(*header));
-    if (bytes_read != sizeof(*header)) {
+    if (read_full(fd, header, sizeof(*header)) != 0) {
         perror("Failed to read response header");
         return -1;
     }
@@ -71,16 +114,19 @@ static int receive_response(int fd, struct message_header* header, void** payloa
     // Read payload if present
     *payload = NULL;
     if (header->payload_size > 0) {
-        *payload = malloc(header->payload_size);
-        if (!*payload) {
-            perror("Failed to allocate payload buffer");
-            return -1;
+        if (header->payload_size > reply_cap) {
+            char* grown = realloc(reply_buf, header->payload_size);
+            if (!grown) {
+                perror("Failed to allocate payload buffer");
+                return -1;
+            }
+            reply_buf = grown;
+            reply_cap = header->payload_size;
         }
         
-        bytes_read = read(fd, *payload, header->payload_size);
-        if (bytes_read != header->payload_size) {
+        *payload = reply_buf;
+        if (read_full(fd, *payload, header->payload_size) != 0) {
             perror("Failed to read response payload");
-            free(*payload);
             *payload = NULL;
             return -1;
         }
@@ -91,36 +137,33 @@ static int receive_response(int fd, struct message_header* header, void** payloa
 
 // PUT operation
 int client_put(int fd, const char* key, const char* value, size_t value_size) {
+    return client_put_ttl(fd, key, value, value_size, 0);
+}
+
+// PUT that expires after `ttl_seconds` (0 = never)
+int client_put_ttl(int fd, const char* key, const char* value, size_t value_size,
+                   uint32_t ttl_seconds) {
     if (!key || !value || strlen(key) >= MAX_KEY_SIZE) {
         return -1;
     }
     
-    // Prepare request
-    size_t payload_size = sizeof(struct put_request) + value_size;
-    char* payload = malloc(payload_size);
-    if (!payload) {
-        return -1;
-    }
-    
-    struct put_request* req = (struct put_request*)payload;
-    memset(req->key, 0, MAX_KEY_SIZE);
-    strncpy(req->key, key, MAX_KEY_SIZE - 1);
-    req->value_size = value_size;
-    
-    // Copy value data after the request struct
-    memcpy(payload + sizeof(struct put_request), value, value_size);
+    // Prepare request; the value goes out straight from the caller's buffer
+    struct put_request req;
+    memset(req.key, 0, MAX_KEY_SIZE);
+    strncpy(req.key, key, MAX_KEY_SIZE - 1);
+    req.value_size = value_size;
+    req.ttl_seconds = ttl_seconds;
     
     // Prepare header
     struct message_header header = {
         .type = MSG_PUT_REQUEST,
-        .payload_size = payload_size,
+        .payload_size = sizeof(struct put_request) + value_size,
         .sequence_id = sequence_counter++,
         .reserved = 0
     };
     
     // Send request
-    int result = send_message(fd, &header, payload);
-    free(payload);
+    int result = send_message(fd, &header, &req, value, value_size);
     
     if (result < 0) {
         return -1;
@@ -148,15 +191,17 @@ int client_put(int fd, const char* key, const char* value, size_t value_size) {
         result = -1;
     }
     
-    if (resp_payload) {
-        free(resp_payload);
-    }
-    
     return result;
 }
 
 // GET operation
 int client_get(int fd, const char* key, char* value, size_t* value_size) {
+    return client_get_version(fd, key, value, value_size, NULL);
+}
+
+// GET that also returns the key's version (NULL = don't care)
+int client_get_version(int fd, const char* key, char* value, size_t* value_size,
+                       uint64_t* version) {
     if (!key || !value || !value_size || strlen(key) >= MAX_KEY_SIZE) {
         return -1;
     }
@@ -175,7 +220,7 @@ int client_get(int fd, const char* key, char* value, size_t* value_size) {
     };
     
     // Send request
-    int result = send_message(fd, &header, &req);
+    int result = send_message(fd, &header, &req, NULL, 0);
     if (result < 0) {
         return -1;
     }
@@ -203,6 +248,9 @@ int client_get(int fd, const char* key, char* value, size_t* value_size) {
                 char* value_data = (char*)resp_payload + sizeof(struct get_response);
                 memcpy(value, value_data, resp->value_size);
                 *value_size = resp->value_size;
+                if (version) {
+                    *version = resp->version;
+                }
                 result = 0;
             }
         } else {
@@ -217,10 +265,6 @@ int client_get(int fd, const char* key, char* value, size_t* value_size) {
         result = -1;
     }
     
-    if (resp_payload) {
-        free(resp_payload);
-    }
-    
     return result;
 }
 
@@ -244,7 +288,7 @@ int client_delete(int fd, const char* key) {
     };
     
     // Send request
-    int result = send_message(fd, &header, &req);
+    int result = send_message(fd, &header, &req, NULL, 0);
     if (result < 0) {
         return -1;
     }
@@ -271,8 +315,360 @@ int client_delete(int fd, const char* key) {
         result = -1;
     }
     
-    if (resp_payload) {
-        free(resp_payload);
+    return result;
+}
+
+// Send a request answered by one page of entries (SCAN, SNAPSHOT) and
+// hand the entries to `fn`
+static int page_exchange(int fd, uint32_t type, const void* req, uint32_t req_size,
+                         uint32_t resp_type, client_scan_fn fn, void* arg, char* next_key) {
+    next_key[0] = '\0';
+    
+    // Prepare header
+    struct message_header header = {
+        .type = type,
+        .payload_size = req_size,
+        .sequence_id = sequence_counter++,
+        .reserved = 0
+    };
+    
+    // Send request
+    int result = send_message(fd, &header, req, NULL, 0);
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Receive response
+    struct message_header resp_header;
+    void* resp_payload;
+    result = receive_response(fd, &resp_header, &resp_payload);
+    
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Check response type
+    if (resp_header.type == resp_type &&
+        resp_header.payload_size >= sizeof(struct scan_response)) {
+        struct scan_response* resp = (struct scan_response*)resp_payload;
+        result = resp->result;
+        
+        // Walk the entries, checking each against the payload size
+        const char* p = (const char*)resp_payload + sizeof(struct scan_response);
+        const char* end = (const char*)resp_payload + resp_header.payload_size;
+        for (uint32_t i = 0; result == 0 && i < resp->count; i++) {
+            struct scan_entry entry;
+            if ((size_t)(end - p) < sizeof(entry)) {
+                result = -1;
+                break;
+            }
+            memcpy(&entry, p, sizeof(entry));
+            p += sizeof(entry);
+            if (!fn || entry.key_len >= MAX_KEY_SIZE ||
+                (size_t)(end - p) < (size_t)entry.key_len + entry.value_size) {
+                result = -1;
+                break;
+            }
+            
+            char key[MAX_KEY_SIZE];
+            memcpy(key, p, entry.key_len);
+            key[entry.key_len] = '\0';
+            fn(key, p + entry.key_len, entry.value_size, arg);
+            p += entry.key_len + entry.value_size;
+        }
+        
+        if (result == 0 && resp->more) {
+            memcpy(next_key, resp->next_key, MAX_KEY_SIZE);
+            next_key[MAX_KEY_SIZE - 1] = '\0';
+        }
+    } else if (resp_header.type == MSG_ERROR) {
+        struct error_response* err = (struct error_response*)resp_payload;
+        fprintf(stderr, "Server error: %s\n", err->error_message);
+        result = err->error_code;
+    } else {
+        fprintf(stderr, "Unexpected response type: %u\n", resp_header.type);
+        result = -1;
+    }
+    
+    return result;
+}
+
+// SCAN operation - one page
+int client_scan(int fd, const struct scan_request* req, client_scan_fn fn, void* arg,
+                char* next_key) {
+    if (!req || !fn || !next_key) {
+        return -1;
+    }
+    return page_exchange(fd, MSG_SCAN_REQUEST, req, sizeof(*req), MSG_SCAN_RESPONSE,
+                         fn, arg, next_key);
+}
+
+// SNAPSHOT operation - begin, one page, or end
+int client_snapshot(int fd, const struct snapshot_request* req, client_scan_fn fn, void* arg,
+                    char* next_key) {
+    if (!req || !next_key) {
+        return -1;
+    }
+    return page_exchange(fd, MSG_SNAPSHOT_REQUEST, req, sizeof(*req), MSG_SNAPSHOT_RESPONSE,
+                         fn, arg, next_key);
+}
+
+// Ask the daemon to dump its flight recorder
+int client_dump_flight_recorder(int fd, struct dump_response* resp) {
+    if (!resp) {
+        return -1;
+    }
+    
+    // Prepare header (no payload)
+    struct message_header header = {
+        .type = MSG_DUMP_REQUEST,
+        .payload_size = 0,
+        .sequence_id = sequence_counter++,
+        .reserved = 0
+    };
+    
+    // Send request
+    int result = send_message(fd, &header, NULL, NULL, 0);
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Receive response
+    struct message_header resp_header;
+    void* resp_payload;
+    result = receive_response(fd, &resp_header, &resp_payload);
+    
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Check response type
+    if (resp_header.type == MSG_DUMP_RESPONSE &&
+        resp_header.payload_size == sizeof(struct dump_response)) {
+        memcpy(resp, resp_payload, sizeof(*resp));
+        result = resp->result;
+    } else if (resp_header.type == MSG_ERROR) {
+        struct error_response* err = (struct error_response*)resp_payload;
+        fprintf(stderr, "Server error: %s\n", err->error_message);
+        result = err->error_code;
+    } else {
+        fprintf(stderr, "Unexpected response type: %u\n", resp_header.type);
+        result = -1;
+    }
+    
+    return result;
+}
+
+// CAS operation: PUT only if the key is at `expected_version`. Sets
+// `version` to the new version, or to the current one on
+// RESULT_VERSION_MISMATCH.
+int client_cas(int fd, const char* key, const char* value, size_t value_size,
+               uint32_t ttl_seconds, uint64_t expected_version, uint64_t* version) {
+    if (!key || !value || !version || strlen(key) >= MAX_KEY_SIZE) {
+        return -1;
+    }
+    
+    // Prepare request; the value goes out straight from the caller's buffer
+    struct cas_request req;
+    memset(req.key, 0, MAX_KEY_SIZE);
+    strncpy(req.key, key, MAX_KEY_SIZE - 1);
+    req.expected_version = expected_version;
+    req.value_size = value_size;
+    req.ttl_seconds = ttl_seconds;
+    
+    // Prepare header
+    struct message_header header = {
+        .type = MSG_CAS_REQUEST,
+        .payload_size = sizeof(struct cas_request) + value_size,
+        .sequence_id = sequence_counter++,
+        .reserved = 0
+    };
+    
+    // Send request
+    int result = send_message(fd, &header, &req, value, value_size);
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Receive response
+    struct message_header resp_header;
+    void* resp_payload;
+    result = receive_response(fd, &resp_header, &resp_payload);
+    
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Check response type
+    if (resp_header.type == MSG_CAS_RESPONSE &&
+        resp_header.payload_size == sizeof(struct cas_response)) {
+        struct cas_response* resp = (struct cas_response*)resp_payload;
+        *version = resp->version;
+        result = resp->result;
+    } else if (resp_header.type == MSG_ERROR) {
+        struct error_response* err = (struct error_response*)resp_payload;
+        fprintf(stderr, "Server error: %s\n", err->error_message);
+        result = err->error_code;
+    } else {
+        fprintf(stderr, "Unexpected response type: %u\n", resp_header.type);
+        result = -1;
+    }
+    
+    return result;
+}
+
+// INCR operation: add `delta` to an integer value (a missing key counts as 0)
+int client_incr(int fd, const char* key, int64_t delta, int64_t* value, uint64_t* version) {
+    if (!key || !value || !version || strlen(key) >= MAX_KEY_SIZE) {
+        return -1;
+    }
+    
+    // Prepare request
+    struct incr_request req;
+    memset(req.key, 0, MAX_KEY_SIZE);
+    strncpy(req.key, key, MAX_KEY_SIZE - 1);
+    req.delta = delta;
+    
+    // Prepare header
+    struct message_header header = {
+        .type = MSG_INCR_REQUEST,
+        .payload_size = sizeof(struct incr_request),
+        .sequence_id = sequence_counter++,
+        .reserved = 0
+    };
+    
+    // Send request
+    int result = send_message(fd, &header, &req, NULL, 0);
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Receive response
+    struct message_header resp_header;
+    void* resp_payload;
+    result = receive_response(fd, &resp_header, &resp_payload);
+    
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Check response type
+    if (resp_header.type == MSG_INCR_RESPONSE &&
+        resp_header.payload_size == sizeof(struct incr_response)) {
+        struct incr_response* resp = (struct incr_response*)resp_payload;
+        *value = resp->value;
+        *version = resp->version;
+        result = resp->result;
+    } else if (resp_header.type == MSG_ERROR) {
+        struct error_response* err = (struct error_response*)resp_payload;
+        fprintf(stderr, "Server error: %s\n", err->error_message);
+        result = err->error_code;
+    } else {
+        fprintf(stderr, "Unexpected response type: %u\n", resp_header.type);
+        result = -1;
+    }
+    
+    return result;
+}
+
+// APPEND operation: add `size` bytes to the end of a value. Sets
+// `value_size` to the whole value's size and `version` to its new version.
+int client_append(int fd, const char* key, const char* data, size_t size,
+                  uint32_t* value_size, uint64_t* version) {
+    if (!key || (!data && size > 0) || !value_size || !version ||
+        strlen(key) >= MAX_KEY_SIZE) {
+        return -1;
+    }
+    
+    // Prepare request; the data goes out straight from the caller's buffer
+    struct append_request req;
+    memset(req.key, 0, MAX_KEY_SIZE);
+    strncpy(req.key, key, MAX_KEY_SIZE - 1);
+    req.value_size = size;
+    
+    // Prepare header
+    struct message_header header = {
+        .type = MSG_APPEND_REQUEST,
+        .payload_size = sizeof(struct append_request) + size,
+        .sequence_id = sequence_counter++,
+        .reserved = 0
+    };
+    
+    // Send request
+    int result = send_message(fd, &header, &req, data, size);
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Receive response
+    struct message_header resp_header;
+    void* resp_payload;
+    result = receive_response(fd, &resp_header, &resp_payload);
+    
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Check response type
+    if (resp_header.type == MSG_APPEND_RESPONSE &&
+        resp_header.payload_size == sizeof(struct append_response)) {
+        struct append_response* resp = (struct append_response*)resp_payload;
+        *value_size = resp->value_size;
+        *version = resp->version;
+        result = resp->result;
+    } else if (resp_header.type == MSG_ERROR) {
+        struct error_response* err = (struct error_response*)resp_payload;
+        fprintf(stderr, "Server error: %s\n", err->error_message);
+        result = err->error_code;
+    } else {
+        fprintf(stderr, "Unexpected response type: %u\n", resp_header.type);
+        result = -1;
+    }
+    
+    return result;
+}
+
+// Fetch the daemon's cache and compaction counters
+int client_stats(int fd, struct stats_response* resp) {
+    if (!resp) {
+        return -1;
+    }
+    
+    // Prepare header (no payload)
+    struct message_header header = {
+        .type = MSG_STATS_REQUEST,
+        .payload_size = 0,
+        .sequence_id = sequence_counter++,
+        .reserved = 0
+    };
+    
+    // Send request
+    int result = send_message(fd, &header, NULL, NULL, 0);
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Receive response
+    struct message_header resp_header;
+    void* resp_payload;
+    result = receive_response(fd, &resp_header, &resp_payload);
+    
+    if (result < 0) {
+        return -1;
+    }
+    
+    // Check response type
+    if (resp_header.type == MSG_STATS_RESPONSE &&
+        resp_header.payload_size == sizeof(struct stats_response)) {
+        memcpy(resp, resp_payload, sizeof(*resp));
+        result = resp->result;
+    } else if (resp_header.type == MSG_ERROR) {
+        struct error_response* err = (struct error_response*)resp_payload;
+        fprintf(stderr, "Server error: %s\n", err->error_message);
+        result = err->error_code;
+    } else {
+        fprintf(stderr, "Unexpected response type: %u\n", resp_header.type);
+        result = -1;
     }
     
     return result;
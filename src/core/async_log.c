@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../../include/core/async_log.h"
+
+#define RING_MASK (ASYNC_LOG_RING_SIZE - 1)
+
+_Static_assert((ASYNC_LOG_RING_SIZE & RING_MASK) == 0,
+               "ASYNC_LOG_RING_SIZE must be a power of two");
+
+// One ring slot. `seq` implements the bounded MPMC queue protocol: a slot is
+// free for the producer claiming position p when seq == p, and holds a
+// finished message for the consumer when seq == p + 1.
+struct log_slot {
+    atomic_size_t seq;
+    int priority;
+    char msg[ASYNC_LOG_MSG_SIZE];
+};
+
+static struct log_slot ring[ASYNC_LOG_RING_SIZE];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;  // Only touched by the drain thread
+
+static atomic_int logger_running = 0;
+static pthread_t drain_thread;
+
+// Rate limiting: a fixed one-second window shared by all producers
+static atomic_long rate_window;
+static atomic_uint rate_count;
+static atomic_ulong dropped_full;
+static atomic_ulong dropped_rate;
+
+static long coarse_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (long)ts.tv_sec;
+}
+
+static int rate_limit_exceeded(void) {
+    long now = coarse_seconds();
+    long window = atomic_load_explicit(&rate_window, memory_order_relaxed);
+
+    if (now != window &&
+        atomic_compare_exchange_strong(&rate_window, &window, now)) {
+        atomic_store_explicit(&rate_count, 0, memory_order_relaxed);
+    }
+
+    return atomic_fetch_add_explicit(&rate_count, 1, memory_order_relaxed)
+           >= ASYNC_LOG_RATE_LIMIT;
+}
+
+// Drain everything currently in the ring. Returns number of messages sent.
+static int drain_ring(void) {
+    int drained = 0;
+
+    for (;;) {
+        struct log_slot *slot = &ring[dequeue_pos & RING_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != dequeue_pos + 1) {
+            break;  // Empty, or producer still formatting
+        }
+
+        syslog(slot->priority, "%s", slot->msg);
+
+        atomic_store_explicit(&slot->seq, dequeue_pos + ASYNC_LOG_RING_SIZE,
+                              memory_order_release);
+        dequeue_pos++;
+        drained++;
+    }
+
+    unsigned long full = atomic_exchange(&dropped_full, 0);
+    unsigned long rate = atomic_exchange(&dropped_rate, 0);
+    if (full || rate) {
+        syslog(LOG_WARNING, "async_log: dropped %lu messages (ring full), %lu (rate limited)",
+               full, rate);
+    }
+
+    return drained;
+}
+
+static void* drain_main(void* arg) {
+    (void)arg;
+    struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = ASYNC_LOG_DRAIN_MS * 1000000L
+    };
+
+    while (atomic_load(&logger_running)) {
+        if (drain_ring() == 0) {
+            nanosleep(&interval, NULL);
+        }
+    }
+
+    // Flush whatever was queued before stop
+    drain_ring();
+    return NULL;
+}
+
+int async_log_start(void) {
+    if (atomic_load(&logger_running)) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < ASYNC_LOG_RING_SIZE; i++) {
+        atomic_store_explicit(&ring[i].seq, i, memory_order_relaxed);
+    }
+    atomic_store(&enqueue_pos, 0);
+    dequeue_pos = 0;
+
+    atomic_store(&logger_running, 1);
+    if (pthread_create(&drain_thread, NULL, drain_main, NULL) != 0) {
+        atomic_store(&logger_running, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+void async_log_stop(void) {
+    if (!atomic_exchange(&logger_running, 0)) {
+        return;
+    }
+    pthread_join(drain_thread, NULL);
+}
+
+void async_log(int priority, const char* fmt, ...) {
+    va_list args;
+
+    // Before the drain thread exists (startup, daemonization) log directly
+    if (!atomic_load_explicit(&logger_running, memory_order_relaxed)) {
+        va_start(args, fmt);
+        vsyslog(priority, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    if (rate_limit_exceeded()) {
+        atomic_fetch_add_explicit(&dropped_rate, 1, memory_order_relaxed);
+        return;
+    }
+
+    // Claim a slot
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    struct log_slot *slot;
+    for (;;) {
+        slot = &ring[pos & RING_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Ring full - never block the request path
+            atomic_fetch_add_explicit(&dropped_full, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->priority = priority;
+    va_start(args, fmt);
+    vsnprintf(slot->msg, sizeof(slot->msg), fmt, args);
+    va_end(args);
+
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "../../include/core/bloom.h"
+#include "../../include/core/hash.h"
+
+// Odd multipliers, one per lane; the top 5 bits of key * salt pick the bit
+static const uint32_t bloom_salt[BLOOM_LANES] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+// FNV-1a, then a final mix so the block index uses good high bits
+static uint64_t bloom_hash(const char* key) {
+    uint64_t h = fnv1a_64_str(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void make_mask(uint32_t key, struct bloom_block* mask) {
+    for (int i = 0; i < BLOOM_LANES; i++) {
+        mask->lane[i] = 1u << ((key * bloom_salt[i]) >> 27);
+    }
+}
+
+int bloom_init(struct bloom* b, size_t capacity) {
+    size_t bits = capacity * BLOOM_BITS_PER_KEY;
+    size_t count = 1;
+    while (count * sizeof(struct bloom_block) * 8 < bits) {
+        count <<= 1;
+    }
+
+    b->block_count = count;
+    b->capacity = capacity;
+    b->borrowed = 0;
+    b->blocks = aligned_alloc(sizeof(struct bloom_block), count * sizeof(struct bloom_block));
+    if (!b->blocks) {
+        b->block_count = 0;
+        return -1;
+    }
+    memset(b->blocks, 0, count * sizeof(struct bloom_block));
+    return 0;
+}
+
+void bloom_free(struct bloom* b) {
+    if (!b->borrowed) {
+        free(b->blocks);
+    }
+    b->blocks = NULL;
+    b->block_count = 0;
+    b->capacity = 0;
+    b->borrowed = 0;
+}
+
+int bloom_attach(struct bloom* b, struct bloom_block* blocks, size_t count, size_t capacity) {
+    if (count == 0 || (count & (count - 1)) != 0) {
+        return -1;
+    }
+    b->blocks = blocks;
+    b->block_count = count;
+    b->capacity = capacity;
+    b->borrowed = 1;
+    return 0;
+}
+
+void bloom_add(struct bloom* b, const char* key) {
+    if (!b->blocks) {
+        return;
+    }
+    uint64_t h = bloom_hash(key);
+    struct bloom_block* block = &b->blocks[(h >> 32) & (b->block_count - 1)];
+    struct bloom_block mask;
+    make_mask((uint32_t)h, &mask);
+    for (int i = 0; i < BLOOM_LANES; i++) {
+        block->lane[i] |= mask.lane[i];
+    }
+}
+
+int bloom_may_contain(const struct bloom* b, const char* key) {
+    if (!b->blocks) {
+        return 1;
+    }
+    uint64_t h = bloom_hash(key);
+    const struct bloom_block* block = &b->blocks[(h >> 32) & (b->block_count - 1)];
+    struct bloom_block mask;
+    make_mask((uint32_t)h, &mask);
+
+#if defined(__SSE2__)
+    // Both halves of the block at once: every mask bit must be set
+    __m128i lo = _mm_load_si128((const __m128i*)&block->lane[0]);
+    __m128i hi = _mm_load_si128((const __m128i*)&block->lane[4]);
+    __m128i mlo = _mm_load_si128((const __m128i*)&mask.lane[0]);
+    __m128i mhi = _mm_load_si128((const __m128i*)&mask.lane[4]);
+    __m128i missing = _mm_or_si128(_mm_andnot_si128(lo, mlo), _mm_andnot_si128(hi, mhi));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xffff;
+#else
+    uint32_t missing = 0;
+    for (int i = 0; i < BLOOM_LANES; i++) {
+        missing |= mask.lane[i] & ~block->lane[i];
+    }
+    return missing == 0;
+#endif
+}
@@ -0,0 +1,715 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "../../include/core/btree.h"
+#include "../../include/core/hash.h"
+
+#define BTREE_MAX_HEIGHT 16
+#define CHILD_SIZE sizeof(uint32_t)  // Internal node payload
+#define MIN_CELL (1 + 2 + CHILD_SIZE) // Suffix length, slot, smallest payload
+#define MAX_ITEMS (BTREE_PAGE_SIZE / MIN_CELL + 2)
+
+// Page 0 of the index file
+struct btree_header {
+    uint32_t magic;          // BTREE_MAGIC
+    uint32_t version;        // BTREE_VERSION
+    uint32_t page_size;      // BTREE_PAGE_SIZE
+    uint32_t value_size;
+    uint32_t root;
+    uint32_t height;
+    uint32_t page_count;
+    uint32_t reserved;
+    uint64_t entry_count;
+} __attribute__((packed));
+
+// Node page: header, shared key prefix, slot array of cell offsets, in
+// leaves a one-byte hash tag per slot, free space, then cells packed down
+// from the end of the page. A cell is the suffix length, the suffix and the
+// payload (value record or child page). Exact lookups match the tags 16 at
+// a time and only read the cells whose tag agrees.
+struct node_header {
+    uint8_t leaf;
+    uint8_t prefix_len;
+    uint16_t count;
+    uint32_t link;           // Leaf: right sibling (0 = none); internal: leftmost child
+} __attribute__((packed));
+
+// Decoded entry, used while rebuilding a node
+struct btree_item {
+    uint8_t len;
+    char key[BTREE_MAX_KEY];
+    uint8_t payload[BTREE_MAX_VALUE];
+};
+
+_Static_assert(BTREE_PAGE_SIZE <= 65536, "slot offsets are 16 bits");
+
+static size_t payload_size(const struct btree* t, int leaf) {
+    return leaf ? t->value_size : CHILD_SIZE;
+}
+
+static const struct node_header* node_hdr(const uint8_t* page) {
+    return (const struct node_header*)page;
+}
+
+static const uint8_t* node_cell(const uint8_t* page, uint32_t i) {
+    uint16_t off;
+    memcpy(&off, page + sizeof(struct node_header) + node_hdr(page)->prefix_len + i * 2, sizeof(off));
+    return page + off;
+}
+
+static const uint8_t* node_tags(const uint8_t* page) {
+    const struct node_header* h = node_hdr(page);
+    return page + sizeof(*h) + h->prefix_len + (size_t)h->count * 2;
+}
+
+// Tag of a key suffix: the top byte of its FNV-1a hash
+static uint8_t suffix_tag(const char* s, size_t len) {
+    return (uint8_t)(fnv1a_32(s, len) >> 24);
+}
+
+static uint32_t cell_child(const uint8_t* cell) {
+    uint32_t child;
+    memcpy(&child, cell + 1 + cell[0], sizeof(child));
+    return child;
+}
+
+static int key_compare(const char* a, size_t alen, const char* b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c != 0) {
+        return c;
+    }
+    return (alen > blen) - (alen < blen);
+}
+
+// First slot whose key is >= key; *exact is set when it is equal
+static uint32_t node_lower_bound(const uint8_t* page, const char* key, size_t klen, int* exact) {
+    const struct node_header* h = node_hdr(page);
+    const char* prefix = (const char*)page + sizeof(*h);
+    size_t plen = h->prefix_len;
+
+    *exact = 0;
+    int c = memcmp(key, prefix, klen < plen ? klen : plen);
+    if (c < 0 || (c == 0 && klen < plen)) {
+        return 0;
+    }
+    if (c > 0) {
+        return h->count;
+    }
+
+    // Key carries the node prefix: search the suffixes
+    const char* ks = key + plen;
+    size_t kslen = klen - plen;
+    uint32_t lo = 0, hi = h->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const uint8_t* cell = node_cell(page, mid);
+        c = key_compare(ks, kslen, (const char*)cell + 1, cell[0]);
+        if (c == 0) {
+            *exact = 1;
+            return mid;
+        }
+        if (c > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Slot holding exactly `key` in a leaf, or -1
+static int leaf_find(const uint8_t* page, const char* key, size_t klen) {
+    const struct node_header* h = node_hdr(page);
+    size_t plen = h->prefix_len;
+    if (klen < plen || memcmp(key, page + sizeof(*h), plen) != 0) {
+        return -1;
+    }
+    const char* ks = key + plen;
+    size_t kslen = klen - plen;
+    const uint8_t* tags = node_tags(page);
+    uint8_t tag = suffix_tag(ks, kslen);
+
+    uint32_t i = 0;
+#if defined(__SSE2__)
+    __m128i want = _mm_set1_epi8((char)tag);
+    for (; i + 16 <= h->count; i += 16) {
+        __m128i got = _mm_loadu_si128((const __m128i*)(tags + i));
+        unsigned hits = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(got, want));
+        while (hits) {
+            uint32_t slot = i + (uint32_t)__builtin_ctz(hits);
+            const uint8_t* cell = node_cell(page, slot);
+            if (cell[0] == kslen && memcmp(cell + 1, ks, kslen) == 0) {
+                return (int)slot;
+            }
+            hits &= hits - 1;
+        }
+    }
+#endif
+    for (; i < h->count; i++) {
+        if (tags[i] != tag) {
+            continue;
+        }
+        const uint8_t* cell = node_cell(page, i);
+        if (cell[0] == kslen && memcmp(cell + 1, ks, kslen) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static uint32_t node_child_for(const uint8_t* page, const char* key, size_t klen) {
+    int exact;
+    uint32_t i = node_lower_bound(page, key, klen, &exact);
+    if (exact) {
+        return cell_child(node_cell(page, i));
+    }
+    return i == 0 ? node_hdr(page)->link : cell_child(node_cell(page, i - 1));
+}
+
+static size_t common_prefix(const struct btree_item* a, const struct btree_item* b) {
+    size_t n = a->len < b->len ? a->len : b->len;
+    size_t i = 0;
+    while (i < n && a->key[i] == b->key[i]) {
+        i++;
+    }
+    return i;
+}
+
+static uint32_t decode_node(const struct btree* t, const uint8_t* page, struct btree_item* items) {
+    const struct node_header* h = node_hdr(page);
+    size_t psize = payload_size(t, h->leaf);
+
+    for (uint32_t i = 0; i < h->count; i++) {
+        const uint8_t* cell = node_cell(page, i);
+        items[i].len = (uint8_t)(h->prefix_len + cell[0]);
+        memcpy(items[i].key, page + sizeof(*h), h->prefix_len);
+        memcpy(items[i].key + h->prefix_len, cell + 1, cell[0]);
+        memcpy(items[i].payload, cell + 1 + cell[0], psize);
+    }
+    return h->count;
+}
+
+// Encoded size of items [from, to)
+static size_t encoded_size(const struct btree_item* items, uint32_t from, uint32_t to,
+                           const size_t* cum, int leaf) {
+    size_t n = to - from;
+    size_t prefix = n ? common_prefix(&items[from], &items[to - 1]) : 0;
+    return sizeof(struct node_header) + prefix + (leaf ? 3 : 2) * n + (cum[to] - cum[from]) -
+           n * prefix;
+}
+
+static int encode_node(const struct btree* t, uint8_t* page, const struct btree_item* items,
+                       uint32_t n, int leaf, uint32_t link) {
+    size_t psize = payload_size(t, leaf);
+    size_t prefix = n ? common_prefix(&items[0], &items[n - 1]) : 0;
+
+    size_t need = sizeof(struct node_header) + prefix;
+    for (uint32_t i = 0; i < n; i++) {
+        need += (leaf ? 3 : 2) + 1 + (items[i].len - prefix) + psize;
+    }
+    if (need > BTREE_PAGE_SIZE) {
+        return -1;
+    }
+
+    memset(page, 0, BTREE_PAGE_SIZE);
+    struct node_header h = {
+        .leaf = (uint8_t)leaf,
+        .prefix_len = (uint8_t)prefix,
+        .count = (uint16_t)n,
+        .link = link
+    };
+    memcpy(page, &h, sizeof(h));
+    if (n) {
+        memcpy(page + sizeof(h), items[0].key, prefix);
+    }
+
+    uint8_t* slots = page + sizeof(h) + prefix;
+    uint8_t* tags = slots + (size_t)n * 2;
+    size_t off = BTREE_PAGE_SIZE;
+    for (uint32_t i = 0; i < n; i++) {
+        size_t slen = items[i].len - prefix;
+        off -= 1 + slen + psize;
+        uint16_t off16 = (uint16_t)off;
+        memcpy(slots + i * 2, &off16, sizeof(off16));
+        if (leaf) {
+            tags[i] = suffix_tag(items[i].key + prefix, slen);
+        }
+        page[off] = (uint8_t)slen;
+        memcpy(page + off + 1, items[i].key + prefix, slen);
+        memcpy(page + off + 1 + slen, items[i].payload, psize);
+    }
+    return 0;
+}
+
+// Page cache
+
+static int ensure_cache(struct btree* t, uint32_t pages) {
+    if (pages <= t->cache_cap) {
+        return 0;
+    }
+    uint32_t cap = t->cache_cap ? t->cache_cap : 64;
+    while (cap < pages) {
+        cap *= 2;
+    }
+    uint8_t** p = realloc(t->pages, cap * sizeof(*p));
+    if (!p) {
+        return -1;
+    }
+    t->pages = p;
+    uint8_t* d = realloc(t->is_dirty, cap);
+    if (!d) {
+        return -1;
+    }
+    t->is_dirty = d;
+    memset(t->pages + t->cache_cap, 0, (cap - t->cache_cap) * sizeof(*p));
+    memset(t->is_dirty + t->cache_cap, 0, cap - t->cache_cap);
+    t->cache_cap = cap;
+    return 0;
+}
+
+static uint8_t* get_page(struct btree* t, uint32_t pgno) {
+    if (pgno >= t->page_count || ensure_cache(t, pgno + 1) != 0) {
+        return NULL;
+    }
+    if (!t->pages[pgno]) {
+        uint8_t* page = malloc(BTREE_PAGE_SIZE);
+        if (!page) {
+            return NULL;
+        }
+        off_t offset = (off_t)pgno * BTREE_PAGE_SIZE;
+        if (pread(t->fd, page, BTREE_PAGE_SIZE, offset) != BTREE_PAGE_SIZE) {
+            free(page);
+            return NULL;
+        }
+        t->pages[pgno] = page;
+    }
+    return t->pages[pgno];
+}
+
+static int mark_dirty(struct btree* t, uint32_t pgno) {
+    if (t->in_memory || t->is_dirty[pgno]) {
+        return 0;
+    }
+    if (t->dirty_count == t->dirty_cap) {
+        uint32_t cap = t->dirty_cap ? t->dirty_cap * 2 : 16;
+        uint32_t* d = realloc(t->dirty, cap * sizeof(*d));
+        if (!d) {
+            return -1;
+        }
+        t->dirty = d;
+        t->dirty_cap = cap;
+    }
+    t->dirty[t->dirty_count++] = pgno;
+    t->is_dirty[pgno] = 1;
+    return 0;
+}
+
+static uint32_t new_page(struct btree* t) {
+    uint32_t pgno = t->page_count;
+    if (ensure_cache(t, pgno + 1) != 0) {
+        return 0;
+    }
+    t->pages[pgno] = calloc(1, BTREE_PAGE_SIZE);
+    if (!t->pages[pgno]) {
+        return 0;
+    }
+    t->page_count++;
+    t->header_dirty = 1;
+    if (mark_dirty(t, pgno) != 0) {
+        return 0;
+    }
+    return pgno;
+}
+
+// Write `items` back to `pgno`, splitting into a new right sibling when they
+// no longer fit. Returns 0, 1 after a split (separator and new page in
+// `up`/`up_page`), or -1.
+static int store_node(struct btree* t, uint32_t pgno, struct btree_item* items, uint32_t n,
+                      int leaf, uint32_t link, struct btree_item* up, uint32_t* up_page) {
+    if (encode_node(t, t->pages[pgno], items, n, leaf, link) == 0) {
+        return mark_dirty(t, pgno);
+    }
+
+    // Pick the split point that balances the encoded halves
+    size_t psize = payload_size(t, leaf);
+    size_t cum[MAX_ITEMS + 2];
+    cum[0] = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        cum[i + 1] = cum[i] + 1 + items[i].len + psize;
+    }
+
+    uint32_t split = 0;
+    size_t best = (size_t)-1;
+    for (uint32_t s = 1; s < n; s++) {
+        size_t left = encoded_size(items, 0, s, cum, leaf);
+        // An internal split moves items[s] up, its child becomes the right link
+        size_t right = encoded_size(items, leaf ? s : s + 1, n, cum, leaf);
+        size_t worst = left > right ? left : right;
+        if (left <= BTREE_PAGE_SIZE && right <= BTREE_PAGE_SIZE && worst < best) {
+            best = worst;
+            split = s;
+        }
+    }
+    if (split == 0) {
+        return -1;
+    }
+
+    uint32_t right_pg = new_page(t);
+    if (right_pg == 0) {
+        return -1;
+    }
+
+    if (leaf) {
+        // Shortest separator that is > the left half and <= the right half
+        size_t sep = common_prefix(&items[split - 1], &items[split]) + 1;
+        up->len = (uint8_t)sep;
+        memcpy(up->key, items[split].key, sep);
+
+        encode_node(t, t->pages[right_pg], items + split, n - split, 1, link);
+        encode_node(t, t->pages[pgno], items, split, 1, right_pg);
+    } else {
+        uint32_t right_link;
+        memcpy(&right_link, items[split].payload, sizeof(right_link));
+        up->len = items[split].len;
+        memcpy(up->key, items[split].key, items[split].len);
+
+        encode_node(t, t->pages[right_pg], items + split + 1, n - split - 1, 0, right_link);
+        encode_node(t, t->pages[pgno], items, split, 0, link);
+    }
+    *up_page = right_pg;
+    return mark_dirty(t, pgno) == 0 ? 1 : -1;
+}
+
+// Descend to the leaf for `key`, recording the internal pages on the way
+static uint32_t find_leaf(struct btree* t, const char* key, size_t klen,
+                          uint32_t* path, uint32_t* depth) {
+    uint32_t pgno = t->root;
+    *depth = 0;
+    for (uint32_t level = t->height; level > 1; level--) {
+        const uint8_t* page = get_page(t, pgno);
+        if (!page) {
+            return 0;
+        }
+        if (path) {
+            path[(*depth)++] = pgno;
+        }
+        pgno = node_child_for(page, key, klen);
+    }
+    return get_page(t, pgno) ? pgno : 0;
+}
+
+static int write_header(struct btree* t) {
+    struct btree_header h = {
+        .magic = BTREE_MAGIC,
+        .version = BTREE_VERSION,
+        .page_size = BTREE_PAGE_SIZE,
+        .value_size = t->value_size,
+        .root = t->root,
+        .height = t->height,
+        .page_count = t->page_count,
+        .reserved = 0,
+        .entry_count = t->entry_count
+    };
+    uint8_t page[BTREE_PAGE_SIZE];
+    memset(page, 0, sizeof(page));
+    memcpy(page, &h, sizeof(h));
+    if (pwrite(t->fd, page, sizeof(page), 0) != sizeof(page)) {
+        return -1;
+    }
+    t->header_dirty = 0;
+    return 0;
+}
+
+int btree_open(struct btree* t, const char* path, uint32_t value_size, int create) {
+    memset(t, 0, sizeof(*t));
+    t->fd = -1;
+    if (value_size < CHILD_SIZE || value_size > BTREE_MAX_VALUE) {
+        return -1;
+    }
+
+    t->scratch = malloc((MAX_ITEMS + 1) * sizeof(*t->scratch));
+    if (!path) {
+        t->in_memory = 1;
+        create = 1;
+    } else {
+        t->fd = open(path, create ? (O_CREAT | O_TRUNC | O_RDWR) : O_RDWR, 0644);
+    }
+    if (!t->scratch || (!t->in_memory && t->fd < 0)) {
+        btree_close(t);
+        return -1;
+    }
+
+    if (create) {
+        // Header page plus an empty root leaf
+        t->value_size = value_size;
+        t->page_count = 1;
+        t->height = 1;
+        t->root = new_page(t);
+        if (t->root == 0 || encode_node(t, t->pages[t->root], NULL, 0, 1, 0) != 0 ||
+            btree_flush(t) != 0) {
+            btree_close(t);
+            if (path) {
+                unlink(path);
+            }
+            return -1;
+        }
+        return 0;
+    }
+
+    struct btree_header h;
+    if (pread(t->fd, &h, sizeof(h), 0) != sizeof(h) ||
+        h.magic != BTREE_MAGIC || h.version != BTREE_VERSION ||
+        h.page_size != BTREE_PAGE_SIZE || h.value_size != value_size ||
+        h.height == 0 || h.height > BTREE_MAX_HEIGHT ||
+        h.root == 0 || h.root >= h.page_count) {
+        btree_close(t);
+        return -1;
+    }
+    t->value_size = h.value_size;
+    t->root = h.root;
+    t->height = h.height;
+    t->page_count = h.page_count;
+    t->entry_count = h.entry_count;
+    return 0;
+}
+
+void btree_close(struct btree* t) {
+    if (t->fd >= 0) {
+        close(t->fd);
+    }
+    for (uint32_t i = 0; i < t->cache_cap; i++) {
+        free(t->pages[i]);
+    }
+    free(t->pages);
+    free(t->is_dirty);
+    free(t->dirty);
+    free(t->scratch);
+    memset(t, 0, sizeof(*t));
+    t->fd = -1;
+}
+
+int btree_clone(struct btree* dst, struct btree* src) {
+    memset(dst, 0, sizeof(*dst));
+    dst->fd = -1;
+    dst->in_memory = 1;
+    dst->value_size = src->value_size;
+    dst->root = src->root;
+    dst->height = src->height;
+    dst->entry_count = src->entry_count;
+    dst->page_count = 1;
+    dst->scratch = malloc((MAX_ITEMS + 1) * sizeof(*dst->scratch));
+    if (!dst->scratch || ensure_cache(dst, src->page_count) != 0) {
+        btree_close(dst);
+        return -1;
+    }
+    // Page 0 is the file header, which a tree in memory does without
+    for (uint32_t pgno = 1; pgno < src->page_count; pgno++) {
+        const uint8_t* page = get_page(src, pgno);
+        dst->pages[pgno] = page ? malloc(BTREE_PAGE_SIZE) : NULL;
+        if (!dst->pages[pgno]) {
+            btree_close(dst);
+            return -1;
+        }
+        memcpy(dst->pages[pgno], page, BTREE_PAGE_SIZE);
+        dst->page_count = pgno + 1;
+    }
+    return 0;
+}
+
+int btree_get(struct btree* t, const char* key, void* value) {
+    size_t klen = strlen(key);
+    uint32_t depth;
+    if (klen > BTREE_MAX_KEY) {
+        return -1;
+    }
+
+    uint32_t leaf = find_leaf(t, key, klen, NULL, &depth);
+    if (leaf == 0) {
+        return -1;
+    }
+    const uint8_t* page = t->pages[leaf];
+    int i = leaf_find(page, key, klen);
+    if (i < 0) {
+        return -1;
+    }
+    const uint8_t* cell = node_cell(page, (uint32_t)i);
+    memcpy(value, cell + 1 + cell[0], t->value_size);
+    return 0;
+}
+
+int btree_put(struct btree* t, const char* key, const void* value) {
+    size_t klen = strlen(key);
+    uint32_t path[BTREE_MAX_HEIGHT];
+    uint32_t depth;
+    if (klen > BTREE_MAX_KEY) {
+        return -1;
+    }
+
+    uint32_t leaf = find_leaf(t, key, klen, path, &depth);
+    if (leaf == 0) {
+        return -1;
+    }
+
+    struct btree_item* items = t->scratch;
+    int found = leaf_find(t->pages[leaf], key, klen);
+    int exact = found >= 0;
+    uint32_t pos = exact ? (uint32_t)found : node_lower_bound(t->pages[leaf], key, klen, &exact);
+    uint32_t link = node_hdr(t->pages[leaf])->link;
+    uint32_t n = decode_node(t, t->pages[leaf], items);
+
+    if (exact) {
+        memcpy(items[pos].payload, value, t->value_size);
+    } else {
+        memmove(&items[pos + 1], &items[pos], (n - pos) * sizeof(*items));
+        items[pos].len = (uint8_t)klen;
+        memcpy(items[pos].key, key, klen);
+        memcpy(items[pos].payload, value, t->value_size);
+        n++;
+        t->entry_count++;
+        t->header_dirty = 1;
+    }
+
+    struct btree_item up;
+    uint32_t up_page;
+    int rc = store_node(t, leaf, items, n, 1, link, &up, &up_page);
+
+    // Push separators up until a parent absorbs one
+    while (rc == 1 && depth > 0) {
+        uint32_t parent = path[--depth];
+        pos = node_lower_bound(t->pages[parent], up.key, up.len, &exact);
+        link = node_hdr(t->pages[parent])->link;
+        n = decode_node(t, t->pages[parent], items);
+
+        memmove(&items[pos + 1], &items[pos], (n - pos) * sizeof(*items));
+        items[pos].len = up.len;
+        memcpy(items[pos].key, up.key, up.len);
+        memcpy(items[pos].payload, &up_page, sizeof(up_page));
+        n++;
+
+        rc = store_node(t, parent, items, n, 0, link, &up, &up_page);
+    }
+
+    if (rc == 1) {
+        // Root split: grow the tree by one level
+        if (t->height >= BTREE_MAX_HEIGHT) {
+            return -1;
+        }
+        uint32_t root = new_page(t);
+        if (root == 0) {
+            return -1;
+        }
+        memcpy(items[0].payload, &up_page, sizeof(up_page));
+        items[0].len = up.len;
+        memcpy(items[0].key, up.key, up.len);
+        encode_node(t, t->pages[root], items, 1, 0, t->root);
+        t->root = root;
+        t->height++;
+        rc = 0;
+    }
+    return rc;
+}
+
+int btree_delete(struct btree* t, const char* key) {
+    size_t klen = strlen(key);
+    uint32_t depth;
+    if (klen > BTREE_MAX_KEY) {
+        return -1;
+    }
+
+    uint32_t leaf = find_leaf(t, key, klen, NULL, &depth);
+    if (leaf == 0) {
+        return -1;
+    }
+    int found = leaf_find(t->pages[leaf], key, klen);
+    if (found < 0) {
+        return -1;
+    }
+    uint32_t pos = (uint32_t)found;
+
+    struct btree_item* items = t->scratch;
+    uint32_t link = node_hdr(t->pages[leaf])->link;
+    uint32_t n = decode_node(t, t->pages[leaf], items);
+    memmove(&items[pos], &items[pos + 1], (n - pos - 1) * sizeof(*items));
+    n--;
+
+    // Fewer keys never need more space
+    encode_node(t, t->pages[leaf], items, n, 1, link);
+    t->entry_count--;
+    t->header_dirty = 1;
+    return mark_dirty(t, leaf);
+}
+
+int btree_flush(struct btree* t) {
+    if (t->in_memory) {
+        t->header_dirty = 0;
+        return 0;
+    }
+    for (uint32_t i = 0; i < t->dirty_count; i++) {
+        uint32_t pgno = t->dirty[i];
+        off_t offset = (off_t)pgno * BTREE_PAGE_SIZE;
+        if (pwrite(t->fd, t->pages[pgno], BTREE_PAGE_SIZE, offset) != BTREE_PAGE_SIZE) {
+            // Keep the remaining pages queued for the next flush
+            memmove(t->dirty, t->dirty + i, (t->dirty_count - i) * sizeof(*t->dirty));
+            t->dirty_count -= i;
+            return -1;
+        }
+        t->is_dirty[pgno] = 0;
+    }
+    t->dirty_count = 0;
+
+    if (t->header_dirty) {
+        return write_header(t);
+    }
+    return 0;
+}
+
+int btree_seek(struct btree* t, const char* key, struct btree_cursor* c) {
+    if (!key) {
+        key = "";
+    }
+    size_t klen = strlen(key);
+    uint32_t depth;
+    if (klen > BTREE_MAX_KEY) {
+        return -1;
+    }
+
+    uint32_t leaf = find_leaf(t, key, klen, NULL, &depth);
+    if (leaf == 0) {
+        return -1;
+    }
+    int exact;
+    c->tree = t;
+    c->page = leaf;
+    c->slot = node_lower_bound(t->pages[leaf], key, klen, &exact);
+    return 0;
+}
+
+int btree_next(struct btree_cursor* c, char* key, void* value) {
+    struct btree* t = c->tree;
+
+    while (c->page != 0) {
+        const uint8_t* page = get_page(t, c->page);
+        if (!page) {
+            return -1;
+        }
+        const struct node_header* h = node_hdr(page);
+        if (c->slot < h->count) {
+            const uint8_t* cell = node_cell(page, c->slot);
+            memcpy(key, page + sizeof(*h), h->prefix_len);
+            memcpy(key + h->prefix_len, cell + 1, cell[0]);
+            key[h->prefix_len + cell[0]] = '\0';
+            if (value) {
+                memcpy(value, cell + 1 + cell[0], t->value_size);
+            }
+            c->slot++;
+            return 0;
+        }
+        c->page = h->link;
+        c->slot = 0;
+    }
+    return 1;
+}
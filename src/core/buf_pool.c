@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../../include/core/buf_pool.h"
+
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_LARGE POOL_CLASSES  // Class of a buffer from plain malloc
+
+// In front of every buffer
+struct pool_hdr {
+    uint32_t cls;
+    uint32_t reserved;
+    union {
+        struct pool_hdr* next;   // Free: next in its list
+        size_t size;             // POOL_LARGE: bytes after the header
+    };
+};
+
+_Static_assert(sizeof(struct pool_hdr) == 16, "buffers must stay 16-byte aligned");
+
+struct pool_list {
+    struct pool_hdr* head;
+    uint32_t count;
+};
+
+// One thread's free buffers
+struct pool_cache {
+    struct pool_list free[POOL_CLASSES];
+    int registered;              // Handed to the exit destructor
+};
+
+static __thread struct pool_cache cache;
+static struct pool_list depot[POOL_CLASSES];
+static pthread_mutex_t depot_lock[POOL_CLASSES];
+static pthread_key_t cache_key;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+
+static size_t class_bytes(uint32_t cls) {
+    return (size_t)1 << (cls + POOL_MIN_SHIFT);
+}
+
+static uint32_t size_class(size_t size) {
+    if (size <= class_bytes(0)) {
+        return 0;
+    }
+    uint32_t shift = 64 - (uint32_t)__builtin_clzll((unsigned long long)(size - 1));
+    return shift > POOL_MAX_SHIFT ? POOL_LARGE : shift - POOL_MIN_SHIFT;
+}
+
+// Move up to `count` buffers from the head of `from` to `to`
+static void move_batch(struct pool_list* from, struct pool_list* to, uint32_t count) {
+    while (count-- > 0 && from->head) {
+        struct pool_hdr* h = from->head;
+        from->head = h->next;
+        from->count--;
+        h->next = to->head;
+        to->head = h;
+        to->count++;
+    }
+}
+
+// A thread that exits leaves its buffers to the depot
+static void cache_exit(void* arg) {
+    struct pool_cache* c = arg;
+    for (uint32_t cls = 0; cls < POOL_CLASSES; cls++) {
+        pthread_mutex_lock(&depot_lock[cls]);
+        move_batch(&c->free[cls], &depot[cls], c->free[cls].count);
+        pthread_mutex_unlock(&depot_lock[cls]);
+    }
+}
+
+static void pool_setup(void) {
+    for (uint32_t cls = 0; cls < POOL_CLASSES; cls++) {
+        pthread_mutex_init(&depot_lock[cls], NULL);
+    }
+    pthread_key_create(&cache_key, cache_exit);
+}
+
+static void cache_register(void) {
+    pthread_once(&setup_once, pool_setup);
+    if (!cache.registered) {
+        cache.registered = 1;
+        pthread_setspecific(cache_key, &cache);
+    }
+}
+
+void* pool_alloc(size_t size) {
+    uint32_t cls = size_class(size);
+    struct pool_hdr* h = NULL;
+
+    if (cls < POOL_CLASSES) {
+        struct pool_list* local = &cache.free[cls];
+        if (!local->head) {
+            cache_register();
+            pthread_mutex_lock(&depot_lock[cls]);
+            move_batch(&depot[cls], local, POOL_BATCH);
+            pthread_mutex_unlock(&depot_lock[cls]);
+        }
+        h = local->head;
+        if (h) {
+            local->head = h->next;
+            local->count--;
+        }
+    }
+    if (!h) {
+        size_t bytes = cls < POOL_CLASSES ? class_bytes(cls) : size;
+        h = malloc(sizeof(*h) + bytes);
+        if (!h) {
+            return NULL;
+        }
+        h->cls = cls;
+        h->size = bytes;
+    }
+    return h + 1;
+}
+
+void pool_free(void* p) {
+    if (!p) {
+        return;
+    }
+    struct pool_hdr* h = (struct pool_hdr*)p - 1;
+    if (h->cls >= POOL_CLASSES) {
+        free(h);
+        return;
+    }
+
+    struct pool_list* local = &cache.free[h->cls];
+    h->next = local->head;
+    local->head = h;
+    local->count++;
+    if (local->count <= POOL_LOCAL_MAX) {
+        return;
+    }
+
+    // Too many here: a batch goes to the depot, and past its cap to free()
+    struct pool_list spill = { NULL, 0 };
+    cache_register();
+    move_batch(local, &spill, POOL_BATCH);
+    pthread_mutex_lock(&depot_lock[h->cls]);
+    uint32_t room = depot[h->cls].count < POOL_DEPOT_MAX ? POOL_DEPOT_MAX - depot[h->cls].count : 0;
+    move_batch(&spill, &depot[h->cls], room);
+    pthread_mutex_unlock(&depot_lock[h->cls]);
+    while (spill.head) {
+        struct pool_hdr* next = spill.head->next;
+        free(spill.head);
+        spill.head = next;
+    }
+}
+
+void* pool_realloc(void* p, size_t size) {
+    if (!p) {
+        return pool_alloc(size);
+    }
+    struct pool_hdr* h = (struct pool_hdr*)p - 1;
+    size_t cap = h->cls < POOL_CLASSES ? class_bytes(h->cls) : h->size;
+    if (size <= cap && (h->cls < POOL_CLASSES || size_class(size) == POOL_LARGE)) {
+        return p;
+    }
+    void* grown = pool_alloc(size);
+    if (!grown) {
+        return NULL;
+    }
+    memcpy(grown, p, size < cap ? size : cap);
+    pool_free(p);
+    return grown;
+}
+
+// Arena chunk: header, then the bump region
+struct arena_chunk {
+    struct arena_chunk* next;
+    size_t used;
+    size_t cap;
+    size_t reserved;             // Keeps data 16-byte aligned
+    char data[];
+};
+
+void arena_init(struct arena* a) {
+    a->chunks = NULL;
+}
+
+void* arena_alloc(struct arena* a, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    struct arena_chunk* c = a->chunks;
+    if (!c || c->cap - c->used < size) {
+        size_t cap = ARENA_CHUNK - sizeof(*c);
+        if (size > cap) {
+            cap = size;
+        }
+        c = pool_alloc(sizeof(*c) + cap);
+        if (!c) {
+            return NULL;
+        }
+        c->used = 0;
+        c->cap = cap;
+        c->next = a->chunks;
+        a->chunks = c;
+    }
+    void* p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+void arena_release(struct arena* a) {
+    while (a->chunks) {
+        struct arena_chunk* next = a->chunks->next;
+        pool_free(a->chunks);
+        a->chunks = next;
+    }
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,39 +6,198 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <syslog.h>
 #include <pthread.h>
+#include <time.h>
+#include <stdarg.h>
 #include "../../include/core/daemon.h"
 #include "../../include/core/storage.h"
+#include "../../include/core/async_log.h"
+#include "../../include/core/flight_recorder.h"
+#include "../../include/core/timer_wheel.h"
+#include "../../include/core/value_cache.h"
+#include "../../include/core/repl_log.h"
+#include "../../include/core/buf_pool.h"
+
+// Response gathering per connection: pieces go out in one writev
+#define OUT_IOVS 8
+#define OUT_BYTES 2048
+
+// Log one in this many successful requests; errors are always logged
+#define REQUEST_TRACE_SAMPLE_RATE 256
+
+// Expired keys reclaimed per storage lock hold, so requests interleave
+#define EXPIRE_BATCH 256
+
+// Compaction: I/O budget of one step under the storage lock, and the pause
+// after a pass that found nothing to move
+#define COMPACT_STEP_BYTES (256 * 1024)
+#define COMPACT_IDLE_SECONDS 30
+
+// Replication: followers streaming from this primary at once, how often an
+// idle stream carries a heartbeat, and how much of the log goes per write
+#define REPL_MAX_FOLLOWERS 8
+#define REPL_HEARTBEAT_MS 1000
+#define REPL_STREAM_BUF (256 * 1024)
+#define REPL_RETRY_SECONDS 1
+
+// process_message handed the connection off (to a replication sender or a
+// shard owner)
+#define MESSAGE_KEPT_CONNECTION 1
+
+// A snapshot nobody has read for this long is released, so a backup client
+// that died doesn't pin blocks until restart
+#define SNAPSHOT_IDLE_SECONDS 300
+
+// Stores changed since their last checkpoint get a new one this often, so a
+// restart after a crash in a quiet period still skips the startup scan
+#define CHECKPOINT_SECONDS 600
 
 // Global daemon state
 static int server_socket = -1;
+static const char* socket_path = SOCKET_PATH;
 static volatile int daemon_running = 0;
-static pthread_mutex_t storage_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t flight_dump_requested = 0;
+
+// Keys are split over shards by hash (one by default), each with its own
+// storage file, lock and value cache. With more than one, GET/PUT/DELETE
+// run on the shard's owner thread, pinned to a CPU of its own, so requests
+// for different shards share nothing; the shard lock only orders the owner
+// against background work (expiry, compaction, scans, replication).
+struct shard {
+    storage_t* db;
+    pthread_mutex_t lock;        // db
+    struct value_cache cache;    // Hot values, in front of storage_get
+    struct timer_wheel expiry;   // TTL deadlines, one per key; under lock
+    pthread_t owner;
+    int started;                 // Owner thread running
+    int queue[2];                // Pipe of struct shard_job*, NULL = exit
+};
+static struct shard* shards = NULL;
+static uint32_t shard_count = 0;
+
+// Requests are recorded by the owner threads and, for the rest, the main loop
+_Static_assert(FLIGHT_RECORDER_MAX_THREADS >= MAX_SHARDS + 1,
+               "a flight recorder ring for every request-handling thread");
+
+// A request read by the main loop and handed to its shard's owner
+struct shard_job {
+    int client_fd;
+    uint64_t t_queued;
+    struct message_header header;
+    char* payload;
+};
+
+// TTL expiry: one-second ticks of every shard's wheel, driven by the
+// expiry thread
+static pthread_t expiry_thread;
+static volatile int expiry_running = 0;
+
+// Background compaction, rate limited by a token bucket. The counters are
+// guarded by compact_mutex.
+static pthread_t compact_thread;
+static volatile int compact_running = 0;
+static size_t compact_rate = 0;
+static struct storage_compact_stats compact_stats;
+static uint64_t compact_passes = 0;
+static uint64_t compact_fragmentation = 0;
+static pthread_mutex_t compact_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Primary side of replication: every PUT and DELETE is logged under its
+// shard's lock, one sender thread streams the log to each follower
+struct repl_sender {
+    pthread_t thread;
+    int fd;
+    int active;              // Streaming; cleared by the thread as it exits
+    int started;             // Thread not joined yet
+    struct replicate_request req;
+};
+static struct repl_log repl_log;
+static struct repl_sender repl_senders[REPL_MAX_FOLLOWERS];
+static pthread_mutex_t repl_mutex = PTHREAD_MUTEX_INITIALIZER;  // repl_senders
+static volatile int repl_running = 0;
+
+// Follower side: set in follower mode, which applies the primary's stream
+// and refuses writes. Progress is guarded by follow_mutex.
+static const char* follow_path = NULL;
+static pthread_t follow_thread;
+static volatile int follow_running = 0;
+static int follow_fd = -1;
+static uint64_t follow_epoch = 0;
+static uint64_t follow_applied = 0;      // Last record applied
+static uint64_t follow_primary_seq = 0;  // Last record the primary has
+static uint64_t follow_lag_ms = 0;
+static int follow_synced = 0;            // Full copy complete
+static pthread_mutex_t follow_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Last BEGIN or READ of the held snapshot, 0 = none. snapshot_mutex
+// serializes snapshot requests, taken before any shard lock.
+static time_t snapshot_used = 0;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Bytes of I/O the compactor may spend: refilled at `rate` per second up to
+// `burst`. A step may overdraw it; the debt is paid by waiting longer.
+struct token_bucket {
+    double tokens;
+    double rate;
+    double burst;
+    uint64_t last;           // flight_now() of the last refill
+};
 
 // Forward declarations
 static int create_daemon_process(void);
 static int setup_unix_socket(void);
 static void handle_signal(int sig);
 static void cleanup_daemon(void);
-static int process_message(int client_fd);
+static int process_message(int client_fd, uint64_t t_queued);
+static int write_all(int fd, const void* buf, size_t len);
+static int read_all(int fd, void* buf, size_t len);
+static int handle_message(int client_fd, const struct message_header* header, char* payload,
+                          uint64_t t_queued);
+static int expiry_start(void);
+static void expiry_stop(void);
+static int compact_start(size_t rate);
+static void compact_stop(void);
+static void repl_stop(void);
+static int follow_start(const char* primary);
+static void follow_stop(void);
+static int shards_open(const char* storage_file, const struct daemon_options* options);
+static void shards_close(void);
+static int shards_start(void);
+static void shards_stop(void);
+
+// One SCAN response page being built: message header, scan_response, entries
+struct scan_page {
+    char* buf;
+    size_t len;
+    size_t cap;
+    uint32_t count;
+    uint32_t limit;
+    int more;
+    char next_key[MAX_KEY_SIZE];
+};
 
 // Signal handler for graceful shutdown
 static void handle_signal(int sig) {
     switch (sig) {
         case SIGTERM:
         case SIGINT:
-            syslog(LOG_INFO, "Received shutdown signal %d", sig);
+            TRACE_INFO("Received shutdown signal %d", sig);
             daemon_running = 0;
             break;
         case SIGHUP:
-            syslog(LOG_INFO, "Received SIGHUP - ignoring for now");
+            TRACE_INFO("Received SIGHUP - ignoring for now");
+            break;
+        case SIGUSR1:
+            // Dump from the main loop, file I/O is not signal safe
+            flight_dump_requested = 1;
             break;
         default:
-            syslog(LOG_WARNING, "Received unexpected signal %d", sig);
+            TRACE_WARN("Received unexpected signal %d", sig);
             break;
     }
 }
@@ -80,7 +240,7 @@ static int create_daemon_process(void) {
     
     // Change working directory to root to avoid locking any directory
     if (chdir("/") < 0) {
-        syslog(LOG_ERR, "Failed to change directory to /: %s", strerror(errno));
+        TRACE_ERROR("Failed to change directory to /: %s", strerror(errno));
         return -1;
     }
     
@@ -113,36 +273,36 @@ static int setup_unix_socket(void) {
     // Create socket
     server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
     if (server_socket < 0) {
-        syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
+        TRACE_ERROR("Failed to create socket: %s", strerror(errno));
         return -1;
     }
     
     // Remove existing socket file if it exists
-    unlink(SOCKET_PATH);
+    unlink(socket_path);
     
     // Setup address
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
     
     // Bind socket
     if (bind(server_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        syslog(LOG_ERR, "Failed to bind socket: %s", strerror(errno));
+        TRACE_ERROR("Failed to bind socket: %s", strerror(errno));
         close(server_socket);
         return -1;
     }
     
     // Set socket permissions
-    chmod(SOCKET_PATH, 0666);
+    chmod(socket_path, 0666);
     
     // Listen for connections
     if (listen(server_socket, MAX_CLIENTS) < 0) {
-        syslog(LOG_ERR, "Failed to listen on socket: %s", strerror(errno));
+        TRACE_ERROR("Failed to listen on socket: %s", strerror(errno));
         close(server_socket);
         return -1;
     }
     
-    syslog(LOG_INFO, "Socket server listening on %s", SOCKET_PATH);
+    TRACE_INFO("Socket server listening on %s", socket_path);
     return 0;
 }
 
@@ -153,49 +313,95 @@ static void cleanup_daemon(void) {
         server_socket = -1;
     }
     
-    unlink(SOCKET_PATH);
-    storage_cleanup();
-    syslog(LOG_INFO, "Daemon cleanup completed");
+    unlink(socket_path);
+    shards_stop();
+    follow_stop();
+    repl_stop();
+    compact_stop();
+    expiry_stop();
+    repl_log_destroy(&repl_log);
+    shards_close();
+    TRACE_INFO("Daemon cleanup completed");
+    async_log_stop();
     closelog();
 }
 
 // Main daemon entry point
-int daemon_start(const char* storage_file) {
+int daemon_start(const char* storage_file, const struct daemon_options* options) {
     // Setup signal handlers before becoming daemon
     signal(SIGTERM, handle_signal);
     signal(SIGINT, handle_signal);
     signal(SIGHUP, handle_signal);
+    signal(SIGUSR1, handle_signal);
     signal(SIGPIPE, SIG_IGN); // Ignore broken pipe signals
     
     // Open syslog
     openlog("storage_daemon", LOG_PID | LOG_CONS, LOG_DAEMON);
-    syslog(LOG_INFO, "Starting storage daemon");
+    TRACE_INFO("Starting storage daemon");
     
     // Create daemon process
     if (create_daemon_process() < 0) {
-        syslog(LOG_ERR, "Failed to create daemon process");
+        TRACE_ERROR("Failed to create daemon process");
         return -1;
     }
     
+    // Start the async logger now that we are the final daemon process
+    if (async_log_start() < 0) {
+        TRACE_WARN("Failed to start async logger, logging synchronously");
+    }
+    
     // Initialize storage
-    if (storage_init(storage_file) < 0) {
-        syslog(LOG_ERR, "Failed to initialize storage");
+    if (shards_open(storage_file, options) < 0) {
+        TRACE_ERROR("Failed to initialize storage");
+        return -1;
+    }
+    if (repl_log_init(&repl_log, DEFAULT_REPL_LOG_BYTES) < 0) {
+        TRACE_ERROR("Failed to initialize replication log");
+        shards_close();
         return -1;
     }
+    if (options && options->socket_path) {
+        socket_path = options->socket_path;
+    }
     
     // Setup socket server
     if (setup_unix_socket() < 0) {
-        syslog(LOG_ERR, "Failed to setup socket server");
-        storage_cleanup();
+        TRACE_ERROR("Failed to setup socket server");
+        shards_close();
         return -1;
     }
     
     // Set daemon as running
     daemon_running = 1;
-    syslog(LOG_INFO, "Daemon started successfully");
+    if (expiry_start() < 0) {
+        TRACE_WARN("Failed to start expiry thread, expired keys reclaimed on access only");
+    }
+    if (options && options->compact_rate > 0 && compact_start(options->compact_rate) < 0) {
+        TRACE_WARN("Failed to start compaction thread");
+    }
+    if (shards_start() < 0) {
+        TRACE_ERROR("Failed to start shard owner threads");
+        cleanup_daemon();
+        return -1;
+    }
+    repl_running = 1;
+    if (options && options->follow && follow_start(options->follow) < 0) {
+        TRACE_ERROR("Failed to start following %s", options->follow);
+        cleanup_daemon();
+        return -1;
+    }
+    TRACE_INFO("Daemon started successfully");
     
     // Main server loop
     while (daemon_running) {
+        if (flight_dump_requested) {
+            flight_dump_requested = 0;
+            int records = flight_recorder_dump(FLIGHT_RECORDER_DUMP_PATH);
+            (void)records;  // Unread when TRACE_LEVEL compiles TRACE_INFO away
+            TRACE_INFO("Flight recorder dump to %s: %d records",
+                       FLIGHT_RECORDER_DUMP_PATH, records);
+        }
+        
         fd_set read_fds;
         struct timeval timeout;
         
@@ -210,7 +416,7 @@ int daemon_start(const char* storage_file) {
         
         if (activity < 0) {
             if (errno != EINTR) {
-                syslog(LOG_ERR, "Select error: %s", strerror(errno));
+                TRACE_ERROR("Select error: %s", strerror(errno));
                 break;
             }
             continue;
@@ -224,20 +430,23 @@ int daemon_start(const char* storage_file) {
         if (FD_ISSET(server_socket, &read_fds)) {
             // Accept new connection
             int client_fd = accept(server_socket, NULL, NULL);
+            uint64_t t_queued = flight_now();
             if (client_fd < 0) {
                 if (errno != EINTR) {
-                    syslog(LOG_ERR, "Accept error: %s", strerror(errno));
+                    TRACE_ERROR("Accept error: %s", strerror(errno));
                 }
                 continue;
             }
             
             // For now, handle client synchronously
             // TODO: In the threading step, we'll create a thread for each client
-            if (process_message(client_fd) < 0) {
-                syslog(LOG_WARNING, "Failed to process client message");
+            int handled = process_message(client_fd, t_queued);
+            if (handled < 0) {
+                TRACE_WARN("Failed to process client message");
+            }
+            if (handled != MESSAGE_KEPT_CONNECTION) {
+                close(client_fd);
             }
-            
-            close(client_fd);
         }
     }
     
@@ -245,250 +454,1837 @@ int daemon_start(const char* storage_file) {
     return 0;
 }
 
-// Process a single message from client
-static int process_message(int client_fd) {
-    struct message_header header;
-    
-    // Read message header
-    ssize_t bytes_read = read(client_fd, &header, sizeof(header));
-    if (bytes_read != sizeof(header)) {
-        syslog(LOG_WARNING, "Failed to read message header");
+// Shard of `key`: FNV-1a, fixed so keys are found where they were written
+static struct shard* shard_for(const char* key) {
+    return &shards[fnv1a_32_str(key) % shard_count];
+}
+
+// Storage file of shard `i`: the file itself when there is only one
+static void shard_path(const char* storage_file, uint32_t i, char* buf, size_t size) {
+    if (shard_count == 1) {
+        snprintf(buf, size, "%s", storage_file);
+    } else {
+        snprintf(buf, size, "%s%s%u", storage_file, SHARD_SUFFIX, i);
+    }
+}
+
+// Keys are routed by hash modulo the shard count, so a store must always be
+// opened with the count it was created with
+static int shards_check(const char* storage_file) {
+    char path[4096];
+    uint32_t present = 0;
+    for (uint32_t i = 0; i < shard_count; i++) {
+        shard_path(storage_file, i, path, sizeof(path));
+        present += access(path, F_OK) == 0;
+    }
+    snprintf(path, sizeof(path), "%s%s%u", storage_file, SHARD_SUFFIX, shard_count);
+    if (access(path, F_OK) == 0 || (shard_count > 1 && access(storage_file, F_OK) == 0)) {
+        TRACE_ERROR("%s was created with a different shard count", storage_file);
         return -1;
     }
-    
-    syslog(LOG_DEBUG, "Received message type %d, payload size %d", 
-           header.type, header.payload_size);
-    
-    // Validate payload size
-    if (header.payload_size > MAX_MESSAGE_SIZE) {
-        syslog(LOG_WARNING, "Payload size too large: %u", header.payload_size);
+    if (present != 0 && present != shard_count) {
+        TRACE_ERROR("%s: %u of %u shard files missing", storage_file,
+                    shard_count - present, shard_count);
         return -1;
     }
-    
-    // Allocate buffer for payload
-    char* payload = NULL;
-    if (header.payload_size > 0) {
-        payload = malloc(header.payload_size);
-        if (!payload) {
-            syslog(LOG_ERR, "Failed to allocate payload buffer");
+    return 0;
+}
+
+static int shards_open(const char* storage_file, const struct daemon_options* options) {
+    shard_count = options && options->shards > 1 ? options->shards : 1;
+    int in_memory = options && options->format.in_memory;
+    if (shard_count > MAX_SHARDS || (!in_memory && shards_check(storage_file) != 0)) {
+        return -1;
+    }
+    shards = calloc(shard_count, sizeof(*shards));
+    if (!shards) {
+        return -1;
+    }
+
+    // The cache budget is split evenly, as keys are
+    size_t cache_bytes = options ? options->cache_bytes : DEFAULT_CACHE_BYTES;
+    for (uint32_t i = 0; i < shard_count; i++) {
+        struct shard* sh = &shards[i];
+        char path[4096];
+        shard_path(storage_file, i, path, sizeof(path));
+        sh->queue[0] = sh->queue[1] = -1;
+        pthread_mutex_init(&sh->lock, NULL);
+        sh->db = storage_open(path, options ? &options->format : NULL);
+        if (!sh->db) {
+            TRACE_ERROR("Failed to open storage file %s", path);
+            shards_close();
             return -1;
         }
-        
-        // Read payload
-        bytes_read = read(client_fd, payload, header.payload_size);
-        if (bytes_read != header.payload_size) {
-            syslog(LOG_WARNING, "Failed to read payload");
-            free(payload);
+        if (options) {
+            storage_set_compression(sh->db, options->compress_threshold);
+        }
+        if (value_cache_init(&sh->cache, cache_bytes / shard_count) < 0) {
+            TRACE_ERROR("Failed to initialize value cache");
+            shards_close();
+            return -1;
+        }
+        if (timer_wheel_init(&sh->expiry, (uint64_t)time(NULL)) < 0) {
+            TRACE_ERROR("Failed to initialize expiry timers");
+            shards_close();
             return -1;
         }
     }
-    
-    // Process based on message type
-    switch (header.type) {
-        case MSG_PUT_REQUEST: {
-            struct put_request* req = (struct put_request*)payload;
-            
-            // Validate request
-            if (header.payload_size < sizeof(struct put_request)) {
-                syslog(LOG_WARNING, "Invalid PUT request size");
-                free(payload);
-                return -1;
-            }
-            
-            // Extract value data (follows the put_request struct)
-            char* value = payload + sizeof(struct put_request);
-            size_t expected_size = sizeof(struct put_request) + req->value_size;
-            
-            if (header.payload_size != expected_size) {
-                syslog(LOG_WARNING, "PUT request size mismatch");
-                free(payload);
-                return -1;
-            }
-            
-            // Call storage function with mutex protection
-            pthread_mutex_lock(&storage_mutex);
-            int result = storage_put(req->key, value, req->value_size);
-            pthread_mutex_unlock(&storage_mutex);
-            
-            syslog(LOG_INFO, "PUT key='%s' value_size=%u result=%d", 
-                   req->key, req->value_size, result);
-            
-            // Send response
-            struct message_header resp_header = {
-                .type = MSG_PUT_RESPONSE,
-                .payload_size = sizeof(struct put_response),
-                .sequence_id = header.sequence_id,
-                .reserved = 0
-            };
-            
-            struct put_response resp = {
-                .result = result
-            };
-            
-            write(client_fd, &resp_header, sizeof(resp_header));
-            write(client_fd, &resp, sizeof(resp));
+    if (shard_count > 1) {
+        TRACE_INFO("Storage split over %u shards", shard_count);
+    }
+    if (in_memory) {
+        TRACE_INFO("Storage is volatile: kept in memory only, lost on exit");
+    }
+    return 0;
+}
+
+static void shards_close(void) {
+    for (uint32_t i = 0; shards && i < shard_count; i++) {
+        if (shards[i].db) {
+            value_cache_destroy(&shards[i].cache);
+            timer_wheel_destroy(&shards[i].expiry);
+            storage_close(shards[i].db);
+        }
+        pthread_mutex_destroy(&shards[i].lock);
+    }
+    free(shards);
+    shards = NULL;
+    shard_count = 0;
+}
+
+// Run the requests queued for one shard until handed NULL
+static void* shard_main(void* arg) {
+    struct shard* sh = arg;
+    for (;;) {
+        struct shard_job* job;
+        ssize_t n = read(sh->queue[0], &job, sizeof(job));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n != sizeof(job) || !job) {
             break;
         }
-        
-        case MSG_GET_REQUEST: {
-            struct get_request* req = (struct get_request*)payload;
-            
-            // Validate request
-            if (header.payload_size != sizeof(struct get_request)) {
-                syslog(LOG_WARNING, "Invalid GET request size");
-                free(payload);
-                return -1;
+        if (handle_message(job->client_fd, &job->header, job->payload, job->t_queued) < 0) {
+            TRACE_WARN("Failed to process client message");
+        }
+        close(job->client_fd);
+        pool_free(job);
+    }
+    return NULL;
+}
+
+// One owner thread per shard, pinned round-robin over the online CPUs.
+// Nothing to do with a single shard: the main loop runs its requests.
+static int shards_start(void) {
+    if (shard_count < 2) {
+        return 0;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (uint32_t i = 0; i < shard_count; i++) {
+        struct shard* sh = &shards[i];
+        if (pipe(sh->queue) != 0 ||
+            pthread_create(&sh->owner, NULL, shard_main, sh) != 0) {
+            return -1;
+        }
+        sh->started = 1;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus > 0 ? i % (uint32_t)cpus : 0, &set);
+        if (pthread_setaffinity_np(sh->owner, sizeof(set), &set) != 0) {
+            TRACE_WARN("Could not pin shard %u to a CPU", i);
+        }
+    }
+    return 0;
+}
+
+// Let each owner finish what is queued, then join it
+static void shards_stop(void) {
+    for (uint32_t i = 0; shards && i < shard_count; i++) {
+        struct shard* sh = &shards[i];
+        if (sh->started) {
+            struct shard_job* stop = NULL;
+            write(sh->queue[1], &stop, sizeof(stop));
+            pthread_join(sh->owner, NULL);
+            sh->started = 0;
+        }
+        for (int end = 0; end < 2; end++) {
+            if (sh->queue[end] >= 0) {
+                close(sh->queue[end]);
+                sh->queue[end] = -1;
             }
-            
-            // First, get the value size
-            size_t value_size = 0;
-            pthread_mutex_lock(&storage_mutex);
-            int result = storage_get(req->key, NULL, &value_size);
-            
-            if (result == 0) {
-                // Allocate buffer for value
-                char* value_buffer = malloc(value_size);
-                if (value_buffer) {
-                    // Get the actual value
-                    result = storage_get(req->key, value_buffer, &value_size);
-                    pthread_mutex_unlock(&storage_mutex);
-                    
-                    if (result == 0) {
-                        syslog(LOG_INFO, "GET key='%s' value_size=%zu result=%d", 
-                               req->key, value_size, result);
-                        
-                        // Send success response with value
-                        struct message_header resp_header = {
-                            .type = MSG_GET_RESPONSE,
-                            .payload_size = sizeof(struct get_response) + value_size,
-                            .sequence_id = header.sequence_id,
-                            .reserved = 0
-                        };
-                        
-                        struct get_response resp = {
-                            .result = 0,
-                            .value_size = value_size
-                        };
-                        
-                        // Send response header and response struct
-                        write(client_fd, &resp_header, sizeof(resp_header));
-                        write(client_fd, &resp, sizeof(resp));
-                        
-                        // Send value data
-                        if (value_size > 0) {
-                            write(client_fd, value_buffer, value_size);
-                        }
-                    } else {
-                        // Error reading value
-                        syslog(LOG_WARNING, "GET key='%s' failed to read value: %d", 
-                               req->key, result);
-                        
-                        struct message_header resp_header = {
-                            .type = MSG_GET_RESPONSE,
-                            .payload_size = sizeof(struct get_response),
-                            .sequence_id = header.sequence_id,
-                            .reserved = 0
-                        };
-                        
-                        struct get_response resp = {
-                            .result = result,
-                            .value_size = 0
-                        };
-                        
-                        write(client_fd, &resp_header, sizeof(resp_header));
-                        write(client_fd, &resp, sizeof(resp));
-                    }
-                    
-                    free(value_buffer);
-                } else {
-                    pthread_mutex_unlock(&storage_mutex);
-                    syslog(LOG_ERR, "Failed to allocate value buffer for GET");
-                    result = -1;
+        }
+    }
+}
+
+// Every shard lock, always taken in index order
+static void shards_lock_all(void) {
+    for (uint32_t i = 0; i < shard_count; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+    }
+}
+
+static void shards_unlock_all(void) {
+    for (uint32_t i = shard_count; i-- > 0; ) {
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+// Drop the held snapshot of every shard. Called with snapshot_mutex held.
+static void snapshot_release(void) {
+    for (uint32_t i = 0; i < shard_count; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        storage_snapshot_release(shards[i].db);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    snapshot_used = 0;
+}
+
+// Give `key` a timer for its deadline, or none without one. Called with the
+// shard lock held, which also guards the shard's wheel.
+static void expiry_set(struct shard* sh, const char* key, uint32_t expires_at) {
+    if (expires_at == 0) {
+        timer_wheel_remove(&sh->expiry, key);
+    } else if (timer_wheel_add(&sh->expiry, key, expires_at) != 0) {
+        TRACE_WARN("No expiry timer for key '%s', reclaimed on access only", key);
+    }
+}
+
+// storage_list_expiring callback: schedule a key found at startup
+static void expiry_schedule(const char* key, uint32_t expires_at, void* arg) {
+    expiry_set(arg, key, expires_at);
+}
+
+// storage_expire callback: a reclaimed key's cached copy goes too. Keys
+// whose deadline moved stay cached; a copy past its own expiry time is
+// dropped by value_cache_get anyway.
+static void expiry_uncache(const char* key, uint32_t expires_at, void* arg) {
+    struct shard* sh = arg;
+    (void)expires_at;
+    value_cache_remove(&sh->cache, key);
+}
+
+// Reclaim one shard's fired timers, up to EXPIRE_BATCH keys per lock hold.
+// Returns the number of keys reclaimed.
+static int expiry_reclaim(struct shard* sh, struct timer_entry* fired) {
+    const char* keys[EXPIRE_BATCH];
+    int total = 0;
+
+    while (fired) {
+        struct timer_entry* batch = fired;
+        struct timer_entry* last = NULL;
+        size_t n = 0;
+        for (; fired && n < EXPIRE_BATCH; fired = fired->next) {
+            keys[n++] = fired->key;
+            last = fired;
+        }
+        last->next = NULL;
+
+        pthread_mutex_lock(&sh->lock);
+        int reclaimed = storage_expire(sh->db, keys, n, expiry_uncache, sh);
+        pthread_mutex_unlock(&sh->lock);
+        if (reclaimed < 0) {
+            TRACE_ERROR("Expiry batch of %zu keys failed", n);
+        } else {
+            total += reclaimed;
+        }
+        timer_wheel_free_list(batch);
+    }
+    return total;
+}
+
+// Tick every shard's wheel once a second and reclaim whatever fell due
+static void* expiry_main(void* arg) {
+    (void)arg;
+    time_t checkpointed = time(NULL);
+    while (expiry_running) {
+        sleep(1);
+
+        int total = 0;
+        for (uint32_t i = 0; i < shard_count; i++) {
+            struct shard* sh = &shards[i];
+            pthread_mutex_lock(&sh->lock);
+            struct timer_entry* fired = timer_wheel_advance(&sh->expiry, (uint64_t)time(NULL));
+            pthread_mutex_unlock(&sh->lock);
+            total += expiry_reclaim(sh, fired);
+        }
+        if (total > 0) {
+            TRACE_INFO("Expired %d keys", total);
+        }
+
+        pthread_mutex_lock(&snapshot_mutex);
+        if (snapshot_used != 0 && time(NULL) - snapshot_used > SNAPSHOT_IDLE_SECONDS) {
+            TRACE_WARN("Releasing snapshot idle for over %d seconds", SNAPSHOT_IDLE_SECONDS);
+            snapshot_release();
+        }
+        pthread_mutex_unlock(&snapshot_mutex);
+
+        if (time(NULL) - checkpointed >= CHECKPOINT_SECONDS) {
+            for (uint32_t i = 0; i < shard_count; i++) {
+                pthread_mutex_lock(&shards[i].lock);
+                if (storage_checkpoint(shards[i].db) != 0) {
+                    TRACE_WARN("Failed to checkpoint shard %u", i);
                 }
-            } else {
-                pthread_mutex_unlock(&storage_mutex);
-                syslog(LOG_INFO, "GET key='%s' not found: %d", req->key, result);
-            }
-            
-            // If we get here, it's an error case
-            if (result != 0) {
-                struct message_header resp_header = {
-                    .type = MSG_GET_RESPONSE,
-                    .payload_size = sizeof(struct get_response),
-                    .sequence_id = header.sequence_id,
-                    .reserved = 0
-                };
-                
-                struct get_response resp = {
-                    .result = result,
-                    .value_size = 0
-                };
-                
-                write(client_fd, &resp_header, sizeof(resp_header));
-                write(client_fd, &resp, sizeof(resp));
+                pthread_mutex_unlock(&shards[i].lock);
             }
+            checkpointed = time(NULL);
+        }
+    }
+    return NULL;
+}
+
+// Schedule every key that already has a TTL, then start ticking
+static int expiry_start(void) {
+    int scheduled = 0;
+    for (uint32_t i = 0; i < shard_count; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        int listed = storage_list_expiring(shards[i].db, expiry_schedule, &shards[i]);
+        pthread_mutex_unlock(&shards[i].lock);
+        if (listed < 0) {
+            TRACE_WARN("Failed to list keys with a TTL in shard %u", i);
+        } else {
+            scheduled += listed;
+        }
+    }
+    if (scheduled > 0) {
+        TRACE_INFO("Scheduled %d keys for expiry", scheduled);
+    }
+
+    expiry_running = 1;
+    if (pthread_create(&expiry_thread, NULL, expiry_main, NULL) != 0) {
+        expiry_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static void expiry_stop(void) {
+    if (!expiry_running) {
+        return;
+    }
+    expiry_running = 0;
+    pthread_join(expiry_thread, NULL);
+}
+
+// Sleep up to `ns`, waking early if the compactor is stopped
+static void compact_nap(uint64_t ns) {
+    uint64_t until = flight_now() + ns;
+    while (compact_running) {
+        uint64_t now = flight_now();
+        if (now >= until) {
             break;
         }
-        
-        case MSG_DELETE_REQUEST: {
-            struct delete_request* req = (struct delete_request*)payload;
-            
-            // Validate request
-            if (header.payload_size != sizeof(struct delete_request)) {
-                syslog(LOG_WARNING, "Invalid DELETE request size");
-                free(payload);
-                return -1;
-            }
-            
-            // Call storage function with mutex protection
-            pthread_mutex_lock(&storage_mutex);
-            int result = storage_delete(req->key);
-            pthread_mutex_unlock(&storage_mutex);
-            
-            syslog(LOG_INFO, "DELETE key='%s' result=%d", req->key, result);
-            
-            // Send response
-            struct message_header resp_header = {
-                .type = MSG_DELETE_RESPONSE,
-                .payload_size = sizeof(struct delete_response),
-                .sequence_id = header.sequence_id,
-                .reserved = 0
-            };
-            
-            struct delete_response resp = {
-                .result = result
-            };
-            
-            write(client_fd, &resp_header, sizeof(resp_header));
-            write(client_fd, &resp, sizeof(resp));
+        uint64_t left = until - now;
+        struct timespec ts = { 0, (long)(left < 100000000ULL ? left : 100000000ULL) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void bucket_refill(struct token_bucket* b) {
+    uint64_t now = flight_now();
+    b->tokens += b->rate * (double)(now - b->last) / 1e9;
+    if (b->tokens > b->burst) {
+        b->tokens = b->burst;
+    }
+    b->last = now;
+}
+
+// Wait until the bucket holds `want` bytes
+static void bucket_wait(struct token_bucket* b, double want) {
+    bucket_refill(b);
+    while (compact_running && b->tokens < want) {
+        compact_nap((uint64_t)((want - b->tokens) / b->rate * 1e9) + 1);
+        bucket_refill(b);
+    }
+}
+
+// Sweep the index of each shard in turn, over and over, one step per lock
+// hold, as the bucket allows. A pass covers every shard.
+static void* compact_main(void* arg) {
+    (void)arg;
+    char cursor[MAX_KEY_SIZE] = "";
+    uint32_t shard = 0;
+    struct storage_compact_stats totals = compact_stats;  // Only written here
+    struct storage_compact_stats pass_start = totals;
+    struct token_bucket bucket = {
+        .rate = (double)compact_rate,
+        .burst = (double)(compact_rate / 10 > COMPACT_STEP_BYTES ? compact_rate / 10 : COMPACT_STEP_BYTES),
+        .last = flight_now()
+    };
+    bucket.tokens = bucket.burst;
+
+    while (compact_running) {
+        bucket_wait(&bucket, COMPACT_STEP_BYTES);
+        if (!compact_running) {
             break;
         }
-        
-        default: {
-            syslog(LOG_WARNING, "Unknown message type: %u", header.type);
-            
-            struct message_header resp_header = {
-                .type = MSG_ERROR,
-                .payload_size = sizeof(struct error_response),
-                .sequence_id = header.sequence_id,
-                .reserved = 0
-            };
-            
-            struct error_response error_resp = {
-                .error_code = -1
-            };
-            snprintf(error_resp.error_message, sizeof(error_resp.error_message),
-                    "Unknown message type: %u", header.type);
-            
-            write(client_fd, &resp_header, sizeof(resp_header));
-            write(client_fd, &error_resp, sizeof(error_resp));
+
+        struct shard* sh = &shards[shard];
+        pthread_mutex_lock(&sh->lock);
+        long spent = storage_compact_step(sh->db, cursor, COMPACT_STEP_BYTES, &totals);
+        pthread_mutex_unlock(&sh->lock);
+
+        int shard_done = spent >= 0 && cursor[0] == '\0';
+        int pass_done = shard_done && shard + 1 == shard_count;
+        if (shard_done) {
+            shard = (shard + 1) % shard_count;
+        }
+        uint64_t moved = totals.chains_moved - pass_start.chains_moved;
+        pthread_mutex_lock(&compact_mutex);
+        compact_stats = totals;
+        if (pass_done) {
+            compact_passes++;
+            compact_fragmentation = (totals.breaks_found - pass_start.breaks_found) -
+                                    (totals.breaks_removed - pass_start.breaks_removed);
+            pass_start = totals;
+        }
+        pthread_mutex_unlock(&compact_mutex);
+
+        if (spent < 0) {
+            TRACE_ERROR("Compaction step failed, retrying in %d seconds", COMPACT_IDLE_SECONDS);
+            compact_nap((uint64_t)COMPACT_IDLE_SECONDS * 1000000000ULL);
+            continue;
+        }
+        bucket.tokens -= (double)spent;
+
+        if (pass_done) {
+            TRACE_INFO("Compaction pass: moved %llu values, %llu breaks left",
+                       (unsigned long long)moved, (unsigned long long)compact_fragmentation);
+            if (moved == 0) {
+                compact_nap((uint64_t)COMPACT_IDLE_SECONDS * 1000000000ULL);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int compact_start(size_t rate) {
+    compact_rate = rate;
+    compact_running = 1;
+    if (pthread_create(&compact_thread, NULL, compact_main, NULL) != 0) {
+        compact_running = 0;
+        return -1;
+    }
+    TRACE_INFO("Compaction running at up to %zu bytes/s", rate);
+    return 0;
+}
+
+static void compact_stop(void) {
+    if (!compact_running) {
+        return;
+    }
+    compact_running = 0;
+    pthread_join(compact_thread, NULL);
+}
+
+// Everything owed to one connection, sent with a single writev on flush.
+// Small pieces (headers, response structs) are copied into `buf`; large
+// ones (values, scan pages) are only referenced and must stay valid until
+// the flush.
+struct conn_out {
+    int fd;
+    int failed;              // A write failed, the rest is dropped
+    int iov_count;
+    size_t used;             // Bytes of buf
+    struct iovec iov[OUT_IOVS];
+    char buf[OUT_BYTES];
+};
+
+static void out_init(struct conn_out* out, int fd) {
+    out->fd = fd;
+    out->failed = 0;
+    out->iov_count = 0;
+    out->used = 0;
+}
+
+// Send what is queued, resuming after short writes. Returns 0 or -1.
+static int out_flush(struct conn_out* out) {
+    struct iovec* iov = out->iov;
+    int count = out->iov_count;
+    while (count > 0 && !out->failed) {
+        ssize_t n = writev(out->fd, iov, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            out->failed = 1;
             break;
         }
+        size_t sent = (size_t)n;
+        while (count > 0 && sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    out->iov_count = 0;
+    out->used = 0;
+    return out->failed ? -1 : 0;
+}
+
+// Queue `len` bytes at `data` by reference
+static void out_ref(struct conn_out* out, const void* data, size_t len) {
+    if (len == 0) {
+        return;
     }
+    if (out->iov_count == OUT_IOVS) {
+        out_flush(out);
+    }
+    out->iov[out->iov_count].iov_base = (void*)data;
+    out->iov[out->iov_count].iov_len = len;
+    out->iov_count++;
+}
+
+// Queue a copy of `len` bytes, merged with the previous copy when adjacent
+static void out_copy(struct conn_out* out, const void* data, size_t len) {
+    if (out->used + len > sizeof(out->buf)) {
+        out_flush(out);
+    }
+    if (len > sizeof(out->buf)) {
+        if (!out->failed && write_all(out->fd, data, len) != 0) {
+            out->failed = 1;
+        }
+        return;
+    }
+    char* dst = out->buf + out->used;
+    struct iovec* last = out->iov_count ? &out->iov[out->iov_count - 1] : NULL;
+    int merge = last && (char*)last->iov_base + last->iov_len == dst;
+    if (!merge && out->iov_count == OUT_IOVS) {
+        // Make room for its iovec before copying: a flush empties buf too
+        out_flush(out);
+        dst = out->buf;
+    }
+    memcpy(dst, data, len);
+    out->used += len;
+    if (merge) {
+        last->iov_len += len;
+    } else {
+        out_ref(out, dst, len);
+    }
+}
+
+// Queue a response: the message header and its fixed-size struct, copied.
+// `extra` payload bytes (queued by the caller with out_ref) follow it.
+static void out_reply(struct conn_out* out, uint32_t type, uint32_t sequence_id,
+                      const void* resp, size_t resp_size, size_t extra) {
+    struct message_header header = {
+        .type = type,
+        .payload_size = (uint32_t)(resp_size + extra),
+        .sequence_id = sequence_id,
+        .reserved = 0
+    };
+    out_copy(out, &header, sizeof(header));
+    out_copy(out, resp, resp_size);
+}
+
+// storage_scan callback: append entries until the page is full, then
+// remember where the next page starts
+static int scan_collect(const char* key, const char* value, size_t value_size, void* arg) {
+    struct scan_page* page = arg;
+    size_t key_len = strlen(key);
+    size_t need = sizeof(struct scan_entry) + key_len + value_size;
+    size_t payload = page->len - sizeof(struct message_header);
+
+    if ((page->limit && page->count >= page->limit) ||
+        (page->count > 0 && payload + need > SCAN_MAX_PAYLOAD)) {
+        page->more = 1;
+        strncpy(page->next_key, key, sizeof(page->next_key) - 1);
+        return 1;
+    }
+
+    // The first entry always goes in, even if it alone exceeds the cap
+    if (page->len + need > page->cap) {
+        size_t cap = page->len + need;
+        char* grown = pool_realloc(page->buf, cap);
+        if (!grown) {
+            page->more = 1;
+            strncpy(page->next_key, key, sizeof(page->next_key) - 1);
+            return 1;
+        }
+        page->buf = grown;
+        page->cap = cap;
+    }
+
+    struct scan_entry entry = {
+        .key_len = (uint16_t)key_len,
+        .value_size = (uint32_t)value_size
+    };
+    memcpy(page->buf + page->len, &entry, sizeof(entry));
+    memcpy(page->buf + page->len + sizeof(entry), key, key_len);
+    memcpy(page->buf + page->len + sizeof(entry) + key_len, value, value_size);
+    page->len += need;
+    page->count++;
+    return 0;
+}
+
+// Start an empty page: room for the message header, scan_response and
+// SCAN_MAX_PAYLOAD bytes of entries
+static int scan_page_init(struct scan_page* page, uint32_t limit) {
+    memset(page, 0, sizeof(*page));
+    page->limit = limit;
+    page->cap = sizeof(struct message_header) + sizeof(struct scan_response) + SCAN_MAX_PAYLOAD;
+    page->buf = pool_alloc(page->cap);
+    page->len = sizeof(struct message_header) + sizeof(struct scan_response);
+    return page->buf ? 0 : -1;
+}
+
+// Send a page built by scan_collect, header and all from its own buffer
+// (just the scan_response on failure), then free it
+static void send_scan_page(struct conn_out* out, uint32_t type, uint32_t sequence_id,
+                           struct scan_page* page, int result) {
+    struct scan_response resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.result = result;
+    
+    if (result == 0) {
+        resp.count = page->count;
+        resp.more = (uint8_t)page->more;
+        memcpy(resp.next_key, page->next_key, sizeof(resp.next_key));
+        
+        struct message_header resp_header = {
+            .type = type,
+            .payload_size = (uint32_t)(page->len - sizeof(struct message_header)),
+            .sequence_id = sequence_id,
+            .reserved = 0
+        };
+        memcpy(page->buf, &resp_header, sizeof(resp_header));
+        memcpy(page->buf + sizeof(resp_header), &resp, sizeof(resp));
+        out_ref(out, page->buf, page->len);
+    } else {
+        out_reply(out, type, sequence_id, &resp, sizeof(resp), 0);
+    }
+    out_flush(out);
+    pool_free(page->buf);
+    page->buf = NULL;
+}
+
+// Next entry of a shard's page in scan_shards, key copied out terminated
+struct scan_cursor {
+    struct scan_page page;
+    size_t pos;
+    char key[MAX_KEY_SIZE];
+    const char* value;
+    uint32_t value_size;
+};
+
+static int scan_cursor_next(struct scan_cursor* c) {
+    if (c->pos >= c->page.len) {
+        return 0;
+    }
+    struct scan_entry entry;
+    memcpy(&entry, c->page.buf + c->pos, sizeof(entry));
+    memcpy(c->key, c->page.buf + c->pos + sizeof(entry), entry.key_len);
+    c->key[entry.key_len] = '\0';
+    c->value = c->page.buf + c->pos + sizeof(entry) + entry.key_len;
+    c->value_size = entry.value_size;
+    c->pos += sizeof(entry) + entry.key_len + entry.value_size;
+    return 1;
+}
+
+// One shard's storage_scan, or storage_snapshot_scan, under its lock
+static int shard_scan(struct shard* sh, int snapshot, const char* start, const char* end,
+                      const char* prefix, struct scan_page* page) {
+    pthread_mutex_lock(&sh->lock);
+    int rc = snapshot ? storage_snapshot_scan(sh->db, start, end, prefix, scan_collect, page)
+                      : storage_scan(sh->db, start, end, prefix, scan_collect, page);
+    pthread_mutex_unlock(&sh->lock);
+    return rc < 0 ? -1 : 0;
+}
+
+// storage_scan (or the snapshot's) across every shard into one page: a page
+// from each shard, each under its own lock, merged in key order. Keys are
+// only complete below the smallest point a shard page stopped at, so the
+// merged page stops there too.
+static int scan_shards(int snapshot, const char* start, const char* end, const char* prefix,
+                       struct scan_page* page, struct arena* scratch) {
+    if (shard_count == 1) {
+        return shard_scan(&shards[0], snapshot, start, end, prefix, page);
+    }
+
+    struct scan_cursor* cursors = arena_alloc(scratch, shard_count * sizeof(*cursors));
+    if (!cursors) {
+        return -1;
+    }
+    memset(cursors, 0, shard_count * sizeof(*cursors));
+    int result = 0;
+    const char* bound = NULL;
+    for (uint32_t i = 0; i < shard_count && result == 0; i++) {
+        struct scan_cursor* c = &cursors[i];
+        if (scan_page_init(&c->page, page->limit) != 0) {
+            result = -1;
+            break;
+        }
+        result = shard_scan(&shards[i], snapshot, start, end, prefix, &c->page);
+        c->pos = sizeof(struct message_header) + sizeof(struct scan_response);
+        if (c->page.more && (!bound || strcmp(c->page.next_key, bound) < 0)) {
+            bound = c->page.next_key;
+        }
+        if (!scan_cursor_next(c)) {
+            c->key[0] = '\0';
+            c->value = NULL;
+        }
+    }
+
+    while (result == 0 && !page->more) {
+        struct scan_cursor* least = NULL;
+        for (uint32_t i = 0; i < shard_count; i++) {
+            if (cursors[i].value && (!least || strcmp(cursors[i].key, least->key) < 0)) {
+                least = &cursors[i];
+            }
+        }
+        if (!least || (bound && strcmp(least->key, bound) >= 0)) {
+            break;
+        }
+        if (scan_collect(least->key, least->value, least->value_size, page) != 0) {
+            break;
+        }
+        if (!scan_cursor_next(least)) {
+            least->value = NULL;
+        }
+    }
+    if (result == 0 && !page->more && bound) {
+        page->more = 1;
+        snprintf(page->next_key, sizeof(page->next_key), "%s", bound);
+    }
+
+    for (uint32_t i = 0; i < shard_count; i++) {
+        pool_free(cursors[i].page.buf);
+    }
+    return result;
+}
+
+// Reply with MSG_ERROR and a formatted message
+static void send_error(struct conn_out* out, uint32_t sequence_id, const char* fmt, ...) {
+    struct error_response error_resp = {
+        .error_code = -1
+    };
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(error_resp.error_message, sizeof(error_resp.error_message), fmt, args);
+    va_end(args);
+    
+    out_reply(out, MSG_ERROR, sequence_id, &error_resp, sizeof(error_resp), 0);
+}
+
+// Write all of `buf`, across short writes
+static int write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static uint64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int send_heartbeat(int fd) {
+    struct {
+        struct message_header header;
+        struct repl_heartbeat hb;
+    } __attribute__((packed)) msg = {
+        .header = {
+            .type = MSG_REPL_HEARTBEAT,
+            .payload_size = sizeof(struct repl_heartbeat)
+        },
+        .hb = {
+            .epoch = repl_log.epoch,
+            .last_seq = repl_log_last(&repl_log),
+            .time_ms = wall_ms()
+        }
+    };
+    return write_all(fd, &msg, sizeof(msg));
+}
+
+static int send_marker(int fd, uint8_t op, uint64_t seq) {
+    char frame[sizeof(struct message_header) + sizeof(struct repl_record)];
+    repl_frame_encode(frame, seq, op, "", NULL, 0, 0, 0);
+    return write_all(fd, frame, sizeof(frame));
+}
+
+// Stream a full copy to a follower: RESET, every live key as a PUT, SYNCED.
+// The log is enabled under every shard lock first, so every mutation after
+// `base` is in the log and replaying it over the (fuzzy) copy converges.
+static int repl_full_copy(int fd, uint64_t* sent) {
+    shards_lock_all();
+    uint64_t base = repl_log_enable(&repl_log);
+    shards_unlock_all();
+    TRACE_INFO("Replication: full copy to follower as of record %llu", (unsigned long long)base);
+
+    if (send_marker(fd, REPL_OP_RESET, base) != 0) {
+        return -1;
+    }
+
+    // Shard by shard; the follower routes each key itself
+    char cursor[MAX_KEY_SIZE] = "";
+    uint32_t shard = 0;
+    int more = 1;
+    while (shard < shard_count && repl_running) {
+        struct shard* sh = &shards[shard];
+        struct scan_page page;
+        if (scan_page_init(&page, 0) != 0) {
+            return -1;
+        }
+
+        // One page per lock hold; TTLs and versions come from the index in the same hold
+        pthread_mutex_lock(&sh->lock);
+        int rc = storage_scan(sh->db, cursor, NULL, NULL, scan_collect, &page);
+        size_t out_cap = 0;
+        const char* p = page.buf + sizeof(struct message_header) + sizeof(struct scan_response);
+        for (uint32_t i = 0; i < page.count; i++) {
+            struct scan_entry entry;
+            memcpy(&entry, p, sizeof(entry));
+            out_cap += repl_frame_size(entry.key_len, entry.value_size);
+            p += sizeof(entry) + entry.key_len + entry.value_size;
+        }
+        char* out = rc >= 0 ? malloc(out_cap > 0 ? out_cap : 1) : NULL;
+        size_t out_len = 0;
+        p = page.buf + sizeof(struct message_header) + sizeof(struct scan_response);
+        for (uint32_t i = 0; out && i < page.count; i++) {
+            struct scan_entry entry;
+            char key[MAX_KEY_SIZE];
+            memcpy(&entry, p, sizeof(entry));
+            memcpy(key, p + sizeof(entry), entry.key_len);
+            key[entry.key_len] = '\0';
+            struct storage_key_info info = { 0, 0, 0 };
+            storage_stat(sh->db, key, &info);
+            repl_frame_encode(out + out_len, base, REPL_OP_PUT, key,
+                              p + sizeof(entry) + entry.key_len, entry.value_size, info.expires_at,
+                              info.version);
+            out_len += repl_frame_size(entry.key_len, entry.value_size);
+            p += sizeof(entry) + entry.key_len + entry.value_size;
+        }
+        pthread_mutex_unlock(&sh->lock);
+
+        more = page.more;
+        memcpy(cursor, page.next_key, sizeof(cursor));
+        if (!more) {
+            cursor[0] = '\0';
+            shard++;
+        }
+        pool_free(page.buf);
+        if (!out || write_all(fd, out, out_len) != 0) {
+            free(out);
+            return -1;
+        }
+        free(out);
+    }
+
+    if (send_marker(fd, REPL_OP_SYNCED, base) != 0) {
+        return -1;
+    }
+    *sent = base;
+    return 0;
+}
+
+// Stream the log to one follower until it goes away or we shut down
+static void* repl_send_main(void* arg) {
+    struct repl_sender* sender = arg;
+    int fd = sender->fd;
+    char* buf = malloc(REPL_STREAM_BUF);
+
+    // Resume from the follower's position if this run's log still has it
+    uint64_t sent = sender->req.last_seq;
+    int need_copy = sender->req.epoch != repl_log.epoch || sender->req.last_seq == 0;
+    int rc = buf ? send_heartbeat(fd) : -1;
+    while (rc == 0 && repl_running) {
+        if (need_copy) {
+            rc = repl_full_copy(fd, &sent);
+            need_copy = 0;
+            continue;
+        }
+        uint64_t last;
+        long n = repl_log_read(&repl_log, sent, buf, REPL_STREAM_BUF, &last, REPL_HEARTBEAT_MS);
+        if (n < 0) {
+            need_copy = repl_running;  // Fell behind the log
+        } else if (n == 0) {
+            rc = send_heartbeat(fd);
+        } else {
+            rc = write_all(fd, buf, (size_t)n);
+            sent = last;
+        }
+    }
+
+    free(buf);
+    TRACE_INFO("Replication: follower disconnected at record %llu", (unsigned long long)sent);
+    pthread_mutex_lock(&repl_mutex);
+    close(sender->fd);
+    sender->fd = -1;
+    sender->active = 0;
+    pthread_mutex_unlock(&repl_mutex);
+    return NULL;
+}
+
+// Hand a subscribing follower's connection to a sender thread
+static int repl_subscribe(int client_fd, const struct replicate_request* req) {
+    pthread_mutex_lock(&repl_mutex);
+    struct repl_sender* sender = NULL;
+    for (int i = 0; i < REPL_MAX_FOLLOWERS && !sender; i++) {
+        if (!repl_senders[i].active) {
+            sender = &repl_senders[i];
+        }
+    }
+    int rc = -1;
+    if (sender && repl_running) {
+        if (sender->started) {
+            // Finished earlier; reap it before reusing the slot
+            pthread_join(sender->thread, NULL);
+            sender->started = 0;
+        }
+        sender->fd = client_fd;
+        sender->req = *req;
+        sender->active = 1;
+        if (pthread_create(&sender->thread, NULL, repl_send_main, sender) == 0) {
+            sender->started = 1;
+            rc = 0;
+        } else {
+            sender->fd = -1;
+            sender->active = 0;
+        }
+    }
+    pthread_mutex_unlock(&repl_mutex);
+    return rc;
+}
+
+// Followers streaming now
+static uint32_t repl_follower_count(void) {
+    uint32_t count = 0;
+    pthread_mutex_lock(&repl_mutex);
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        count += repl_senders[i].active ? 1 : 0;
+    }
+    pthread_mutex_unlock(&repl_mutex);
+    return count;
+}
+
+// Stop every sender: wake them from the log, cut their connections, join
+static void repl_stop(void) {
+    if (!repl_running) {
+        return;
+    }
+    repl_running = 0;
+    repl_log_close(&repl_log);
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        pthread_mutex_lock(&repl_mutex);
+        int started = repl_senders[i].started;
+        if (repl_senders[i].active) {
+            shutdown(repl_senders[i].fd, SHUT_RDWR);
+        }
+        repl_senders[i].started = 0;
+        pthread_mutex_unlock(&repl_mutex);
+        if (started) {
+            pthread_join(repl_senders[i].thread, NULL);
+        }
+    }
+}
+
+// storage_scan callback for follow_clear: collect up to EXPIRE_BATCH keys
+struct key_batch {
+    char keys[EXPIRE_BATCH][MAX_KEY_SIZE];
+    size_t count;
+};
+
+static int collect_key(const char* key, const char* value, size_t value_size, void* arg) {
+    struct key_batch* batch = arg;
+    (void)value;
+    (void)value_size;
+    strncpy(batch->keys[batch->count], key, MAX_KEY_SIZE - 1);
+    batch->keys[batch->count][MAX_KEY_SIZE - 1] = '\0';
+    return ++batch->count == EXPIRE_BATCH;
+}
+
+// Drop every key before a full copy, one shard at a time
+static void follow_clear(void) {
+    struct key_batch* batch = malloc(sizeof(*batch));
+    if (!batch) {
+        return;
+    }
+    for (uint32_t s = 0; s < shard_count; s++) {
+        struct shard* sh = &shards[s];
+        pthread_mutex_lock(&sh->lock);
+        do {
+            batch->count = 0;
+            storage_scan(sh->db, NULL, NULL, NULL, collect_key, batch);
+            for (size_t i = 0; i < batch->count; i++) {
+                storage_delete(sh->db, batch->keys[i]);
+                value_cache_remove(&sh->cache, batch->keys[i]);
+                expiry_set(sh, batch->keys[i], 0);
+            }
+        } while (batch->count == EXPIRE_BATCH);
+        pthread_mutex_unlock(&sh->lock);
+    }
+    free(batch);
+}
+
+// Apply one record from the primary
+static void follow_apply(const struct repl_record* rec, const char* key, const char* value) {
+    uint32_t now = (uint32_t)time(NULL);
+    struct shard* sh = shard_for(key);
+
+    // Records are applied in order by this one thread; the shard lock only
+    // keeps the owner threads and background work out
+    if (rec->op == REPL_OP_PUT || rec->op == REPL_OP_DELETE) {
+        pthread_mutex_lock(&sh->lock);
+    }
+    switch (rec->op) {
+        case REPL_OP_RESET:
+            pthread_mutex_lock(&follow_mutex);
+            follow_synced = 0;
+            follow_applied = 0;
+            pthread_mutex_unlock(&follow_mutex);
+            follow_clear();
+            break;
+        case REPL_OP_SYNCED:
+            pthread_mutex_lock(&follow_mutex);
+            follow_synced = 1;
+            follow_applied = rec->seq;
+            pthread_mutex_unlock(&follow_mutex);
+            TRACE_INFO("Replication: in sync as of record %llu", (unsigned long long)rec->seq);
+            break;
+        case REPL_OP_PUT:
+            if (rec->expires_at != 0 && rec->expires_at <= now) {
+                storage_delete(sh->db, key);  // Expired in transit
+                value_cache_remove(&sh->cache, key);
+                expiry_set(sh, key, 0);
+            } else {
+                // At the primary's version, so a CAS reads the same on both
+                if (storage_put_version(sh->db, key, value, rec->value_size, rec->expires_at,
+                                        rec->version) == 0) {
+                    value_cache_update(&sh->cache, key, value, rec->value_size, rec->expires_at,
+                                       rec->version);
+                    expiry_set(sh, key, rec->expires_at);
+                } else {
+                    TRACE_ERROR("Replication: failed to apply PUT of '%s'", key);
+                }
+            }
+            break;
+        case REPL_OP_DELETE:
+            storage_delete(sh->db, key);
+            value_cache_remove(&sh->cache, key);
+            expiry_set(sh, key, 0);
+            break;
+        default:
+            TRACE_WARN("Replication: unknown record op %u", rec->op);
+            break;
+    }
+    if (rec->op == REPL_OP_PUT || rec->op == REPL_OP_DELETE) {
+        pthread_mutex_unlock(&sh->lock);
+    }
+
+    pthread_mutex_lock(&follow_mutex);
+    if (follow_synced && (rec->op == REPL_OP_PUT || rec->op == REPL_OP_DELETE)) {
+        follow_applied = rec->seq;
+        uint64_t now_ms = wall_ms();
+        follow_lag_ms = now_ms > rec->time_ms ? now_ms - rec->time_ms : 0;
+    }
+    if (rec->seq > follow_primary_seq) {
+        follow_primary_seq = rec->seq;
+    }
+    pthread_mutex_unlock(&follow_mutex);
+}
+
+static int connect_socket(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Subscribe to the primary and apply its stream; reconnect when it drops
+static void* follow_main(void* arg) {
+    (void)arg;
+    char* payload = malloc(sizeof(struct repl_record) + MAX_KEY_SIZE + MAX_MESSAGE_SIZE);
+    int logged_down = 0;
+
+    while (payload && follow_running) {
+        int fd = connect_socket(follow_path);
+        if (fd < 0) {
+            if (!logged_down) {
+                TRACE_WARN("Replication: cannot reach primary at %s, retrying", follow_path);
+                logged_down = 1;
+            }
+            sleep(REPL_RETRY_SECONDS);
+            continue;
+        }
+        logged_down = 0;
+
+        pthread_mutex_lock(&follow_mutex);
+        struct {
+            struct message_header header;
+            struct replicate_request req;
+        } __attribute__((packed)) sub = {
+            .header = {
+                .type = MSG_REPLICATE_REQUEST,
+                .payload_size = sizeof(struct replicate_request)
+            },
+            .req = {
+                .protocol = REPL_PROTOCOL_VERSION,
+                .epoch = follow_synced ? follow_epoch : 0,
+                .last_seq = follow_synced ? follow_applied : 0
+            }
+        };
+        follow_fd = fd;
+        pthread_mutex_unlock(&follow_mutex);
+
+        int rc = write_all(fd, &sub, sizeof(sub));
+        while (rc == 0 && follow_running) {
+            struct message_header header;
+            if (read_all(fd, &header, sizeof(header)) != 0 ||
+                header.payload_size > sizeof(struct repl_record) + MAX_KEY_SIZE + MAX_MESSAGE_SIZE ||
+                read_all(fd, payload, header.payload_size) != 0) {
+                break;
+            }
+
+            if (header.type == MSG_REPL_HEARTBEAT &&
+                header.payload_size == sizeof(struct repl_heartbeat)) {
+                struct repl_heartbeat hb;
+                memcpy(&hb, payload, sizeof(hb));
+                pthread_mutex_lock(&follow_mutex);
+                follow_epoch = hb.epoch;
+                follow_primary_seq = hb.last_seq;
+                if (follow_synced && follow_applied >= hb.last_seq) {
+                    follow_lag_ms = 0;
+                }
+                pthread_mutex_unlock(&follow_mutex);
+            } else if (header.type == MSG_REPL_RECORD &&
+                       header.payload_size >= sizeof(struct repl_record)) {
+                struct repl_record rec;
+                memcpy(&rec, payload, sizeof(rec));
+                if (rec.key_len >= MAX_KEY_SIZE ||
+                    header.payload_size != sizeof(rec) + rec.key_len + rec.value_size) {
+                    break;
+                }
+                char key[MAX_KEY_SIZE];
+                memcpy(key, payload + sizeof(rec), rec.key_len);
+                key[rec.key_len] = '\0';
+                follow_apply(&rec, key, payload + sizeof(rec) + rec.key_len);
+            } else {
+                TRACE_WARN("Replication: unexpected message type %u", header.type);
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&follow_mutex);
+        follow_fd = -1;
+        pthread_mutex_unlock(&follow_mutex);
+        close(fd);
+        if (follow_running) {
+            TRACE_WARN("Replication: lost the primary at record %llu, reconnecting",
+                       (unsigned long long)follow_applied);
+            sleep(REPL_RETRY_SECONDS);
+        }
+    }
+    free(payload);
+    return NULL;
+}
+
+static int follow_start(const char* primary) {
+    follow_path = primary;
+    follow_running = 1;
+    if (pthread_create(&follow_thread, NULL, follow_main, NULL) != 0) {
+        follow_running = 0;
+        follow_path = NULL;
+        return -1;
+    }
+    TRACE_INFO("Following primary at %s (read-only)", primary);
+    return 0;
+}
+
+static void follow_stop(void) {
+    if (!follow_running) {
+        return;
+    }
+    follow_running = 0;
+    pthread_mutex_lock(&follow_mutex);
+    if (follow_fd >= 0) {
+        shutdown(follow_fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&follow_mutex);
+    pthread_join(follow_thread, NULL);
+}
+
+// Process a single message from client: read it, then run it here or hand
+// it to the owner of the key's shard
+static int process_message(int client_fd, uint64_t t_queued) {
+    struct message_header header;
+    
+    // Read message header
+    if (read_all(client_fd, &header, sizeof(header)) != 0) {
+        TRACE_WARN("Failed to read message header");
+        return -1;
+    }
+    
+    TRACE_DEBUG("Received message type %d, payload size %d", 
+           header.type, header.payload_size);
+    
+    // Validate payload size
+    if (header.payload_size > MAX_MESSAGE_SIZE) {
+        TRACE_WARN("Payload size too large: %u", header.payload_size);
+        return -1;
+    }
+    
+    // Allocate buffer for payload
+    char* payload = NULL;
+    if (header.payload_size > 0) {
+        payload = pool_alloc(header.payload_size);
+        if (!payload) {
+            TRACE_ERROR("Failed to allocate payload buffer");
+            return -1;
+        }
+        
+        // Read payload, however many reads it arrives in
+        if (read_all(client_fd, payload, header.payload_size) != 0) {
+            TRACE_WARN("Failed to read payload");
+            pool_free(payload);
+            return -1;
+        }
+    }
+    
+    // Requests for one key go to that key's shard owner, when there are owners.
+    // Each of these payloads starts with the key
+    if ((header.type == MSG_PUT_REQUEST || header.type == MSG_GET_REQUEST ||
+         header.type == MSG_DELETE_REQUEST || header.type == MSG_CAS_REQUEST ||
+         header.type == MSG_INCR_REQUEST || header.type == MSG_APPEND_REQUEST) &&
+        header.payload_size >= MAX_KEY_SIZE) {
+        payload[MAX_KEY_SIZE - 1] = '\0';
+        struct shard* sh = shard_for(payload);
+        struct shard_job* job = sh->started ? pool_alloc(sizeof(*job)) : NULL;
+        if (job) {
+            job->client_fd = client_fd;
+            job->t_queued = t_queued;
+            job->header = header;
+            job->payload = payload;
+            if (write(sh->queue[1], &job, sizeof(job)) == sizeof(job)) {
+                return MESSAGE_KEPT_CONNECTION;
+            }
+            pool_free(job);
+        }
+    }
+    
+    return handle_message(client_fd, &header, payload, t_queued);
+}
+
+// Run one request; frees the payload
+static int handle_message(int client_fd, const struct message_header* hdr, char* payload,
+                          uint64_t t_queued) {
+    struct message_header header = *hdr;
+    struct flight_record rec = {
+        .t_queued = t_queued,
+        .t_started = flight_now(),
+        .sequence_id = header.sequence_id,
+        .op = FLIGHT_OP_OTHER
+    };
+    struct conn_out out;
+    out_init(&out, client_fd);
+    struct arena scratch;        // This request's temporaries
+    arena_init(&scratch);
+    
+    // A follower only changes by replaying its primary
+    if (follow_path && (header.type == MSG_PUT_REQUEST || header.type == MSG_DELETE_REQUEST ||
+                        header.type == MSG_CAS_REQUEST || header.type == MSG_INCR_REQUEST ||
+                        header.type == MSG_APPEND_REQUEST || header.type == MSG_REPLICATE_REQUEST)) {
+        send_error(&out, header.sequence_id, "read-only follower of %s", follow_path);
+        out_flush(&out);
+        pool_free(payload);
+        return 0;
+    }
+    
+    // Process based on message type
+    switch (header.type) {
+        case MSG_PUT_REQUEST: {
+            struct put_request* req = (struct put_request*)payload;
+            
+            // Validate request
+            if (header.payload_size < sizeof(struct put_request)) {
+                TRACE_WARN("Invalid PUT request size");
+                pool_free(payload);
+                return -1;
+            }
+            
+            // Extract value data (follows the put_request struct)
+            char* value = payload + sizeof(struct put_request);
+            size_t expected_size = sizeof(struct put_request) + req->value_size;
+            
+            if (header.payload_size != expected_size) {
+                TRACE_WARN("PUT request size mismatch");
+                pool_free(payload);
+                return -1;
+            }
+            
+            rec.op = FLIGHT_OP_PUT;
+            rec.key_hash = flight_key_hash(req->key);
+            rec.value_size = req->value_size;
+            
+            // One stamp for the index, the cache, followers and the wheel
+            uint32_t expires_at = req->ttl_seconds ? (uint32_t)time(NULL) + req->ttl_seconds : 0;
+            
+            // Call storage function with the shard locked
+            struct shard* sh = shard_for(req->key);
+            pthread_mutex_lock(&sh->lock);
+            rec.t_locked = flight_now();
+            uint64_t version = 0;
+            int result = storage_cas(sh->db, req->key, value, req->value_size, expires_at,
+                                     KEY_VERSION_ANY, &version);
+            if (result == 0) {
+                // Logged in the order applied, under the same lock
+                repl_log_append(&repl_log, REPL_OP_PUT, req->key, value, req->value_size,
+                                expires_at, version);
+                expiry_set(sh, req->key, expires_at);
+            }
+            rec.t_done = flight_now();
+            pthread_mutex_unlock(&sh->lock);
+            rec.result = result;
+            
+            if (result == 0) {
+                value_cache_update(&sh->cache, req->key, value, req->value_size, expires_at,
+                                   version);
+            }
+            TRACE_SAMPLED(TRACE_INFO, REQUEST_TRACE_SAMPLE_RATE,
+                          "PUT key='%s' value_size=%u result=%d",
+                          req->key, req->value_size, result);
+            
+            struct put_response resp = {
+                .result = result
+            };
+            out_reply(&out, MSG_PUT_RESPONSE, header.sequence_id, &resp, sizeof(resp), 0);
+            break;
+        }
+        
+        case MSG_CAS_REQUEST: {
+            struct cas_request* req = (struct cas_request*)payload;
+            
+            // Validate request
+            if (header.payload_size < sizeof(struct cas_request) ||
+                header.payload_size != sizeof(struct cas_request) + req->value_size) {
+                TRACE_WARN("Invalid CAS request size");
+                pool_free(payload);
+                return -1;
+            }
+            char* value = payload + sizeof(struct cas_request);
+            
+            rec.op = FLIGHT_OP_CAS;
+            rec.key_hash = flight_key_hash(req->key);
+            rec.value_size = req->value_size;
+            
+            uint32_t expires_at = req->ttl_seconds ? (uint32_t)time(NULL) + req->ttl_seconds : 0;
+            
+            // Compare and write in one hold of the lock
+            struct shard* sh = shard_for(req->key);
+            uint64_t version = 0;
+            pthread_mutex_lock(&sh->lock);
+            rec.t_locked = flight_now();
+            int result = storage_cas(sh->db, req->key, value, req->value_size, expires_at,
+                                     req->expected_version, &version);
+            if (result == 0) {
+                repl_log_append(&repl_log, REPL_OP_PUT, req->key, value, req->value_size,
+                                expires_at, version);
+                expiry_set(sh, req->key, expires_at);
+            }
+            rec.t_done = flight_now();
+            pthread_mutex_unlock(&sh->lock);
+            rec.result = result;
+            
+            if (result == 0) {
+                value_cache_update(&sh->cache, req->key, value, req->value_size, expires_at,
+                                   version);
+            }
+            TRACE_SAMPLED(TRACE_INFO, REQUEST_TRACE_SAMPLE_RATE,
+                          "CAS key='%s' expected=%llu version=%llu result=%d", req->key,
+                          (unsigned long long)req->expected_version,
+                          (unsigned long long)version, result);
+            
+            struct cas_response resp = {
+                .result = result == 1 ? RESULT_VERSION_MISMATCH : result,
+                .version = version
+            };
+            out_reply(&out, MSG_CAS_RESPONSE, header.sequence_id, &resp, sizeof(resp), 0);
+            break;
+        }
+        
+        case MSG_INCR_REQUEST: {
+            struct incr_request* req = (struct incr_request*)payload;
+            
+            // Validate request
+            if (header.payload_size != sizeof(struct incr_request)) {
+                TRACE_WARN("Invalid INCR request size");
+                pool_free(payload);
+                return -1;
+            }
+            
+            rec.op = FLIGHT_OP_INCR;
+            rec.key_hash = flight_key_hash(req->key);
+            
+            // Read, add and write in one hold of the lock. Followers and the
+            // cache see the new value as a plain PUT.
+            struct shard* sh = shard_for(req->key);
+            int64_t value = 0;
+            uint64_t version = 0;
+            char text[32];
+            int text_len = 0;
+            struct storage_key_info info = { 0, 0, 0 };
+            pthread_mutex_lock(&sh->lock);
+            rec.t_locked = flight_now();
+            int result = storage_incr(sh->db, req->key, req->delta, &value, &version);
+            if (result == 0) {
+                storage_stat(sh->db, req->key, &info);
+                text_len = snprintf(text, sizeof(text), "%lld", (long long)value);
+                repl_log_append(&repl_log, REPL_OP_PUT, req->key, text, (uint32_t)text_len,
+                                info.expires_at, version);
+            }
+            rec.t_done = flight_now();
+            pthread_mutex_unlock(&sh->lock);
+            rec.result = result;
+            rec.value_size = (uint32_t)text_len;
+            
+            if (result == 0) {
+                value_cache_update(&sh->cache, req->key, text, (size_t)text_len, info.expires_at,
+                                   version);
+            }
+            
+            TRACE_SAMPLED(TRACE_INFO, REQUEST_TRACE_SAMPLE_RATE,
+                          "INCR key='%s' delta=%lld value=%lld result=%d", req->key,
+                          (long long)req->delta, (long long)value, result);
+            
+            struct incr_response resp = {
+                .result = result == 1 ? RESULT_NOT_INTEGER : result,
+                .value = value,
+                .version = version
+            };
+            out_reply(&out, MSG_INCR_RESPONSE, header.sequence_id, &resp, sizeof(resp), 0);
+            break;
+        }
+        
+        case MSG_APPEND_REQUEST: {
+            struct append_request* req = (struct append_request*)payload;
+            
+            // Validate request
+            if (header.payload_size < sizeof(struct append_request) ||
+                header.payload_size != sizeof(struct append_request) + req->value_size) {
+                TRACE_WARN("Invalid APPEND request size");
+                pool_free(payload);
+                return -1;
+            }
+            char* data = payload + sizeof(struct append_request);
+            
+            rec.op = FLIGHT_OP_APPEND;
+            rec.key_hash = flight_key_hash(req->key);
+            rec.value_size = req->value_size;
+            
+            // Replaying an append over a full copy would apply it twice, so
+            // followers get the whole value as a PUT. It is only assembled
+            // while one is subscribed; otherwise the append stays in place.
+            struct shard* sh = shard_for(req->key);
+            struct storage_key_info info = { 0, 0, 0 };
+            int result = 0;
+            char* full = NULL;
+            pthread_mutex_lock(&sh->lock);
+            rec.t_locked = flight_now();
+            int exists = storage_stat(sh->db, req->key, &info) == 0;
+            size_t old_size = exists ? info.value_size : 0;
+            uint64_t base_version = exists ? info.version : KEY_VERSION_NONE;
+            if (old_size + req->value_size > MAX_VALUE_SIZE) {
+                result = RESULT_TOO_LARGE;
+            } else if (repl_log_enabled(&repl_log)) {
+                size_t size = old_size;
+                full = arena_alloc(&scratch, old_size + req->value_size + 1);
+                if (!full || (exists && storage_get(sh->db, req->key, full, &size) != 0)) {
+                    result = -1;
+                } else {
+                    memcpy(full + old_size, data, req->value_size);
+                }
+            }
+            if (result == 0) {
+                result = storage_append(sh->db, req->key, data, req->value_size, &info);
+            }
+            if (result == 0) {
+                repl_log_append(&repl_log, REPL_OP_PUT, req->key, full,
+                                full ? info.value_size : 0, info.expires_at, info.version);
+            }
+            rec.t_done = flight_now();
+            pthread_mutex_unlock(&sh->lock);
+            rec.result = result;
+            
+            // A cached copy takes the new bytes too, or the whole value when
+            // it was assembled for followers
+            if (result == 0 && full) {
+                value_cache_update(&sh->cache, req->key, full, info.value_size, info.expires_at,
+                                   info.version);
+            } else if (result == 0) {
+                value_cache_append(&sh->cache, req->key, data, req->value_size, base_version,
+                                   info.expires_at, info.version);
+            }
+            
+            TRACE_SAMPLED(TRACE_INFO, REQUEST_TRACE_SAMPLE_RATE,
+                          "APPEND key='%s' size=%u value_size=%u result=%d", req->key,
+                          req->value_size, info.value_size, result);
+            
+            struct append_response resp = {
+                .result = result,
+                .value_size = result == 0 ? info.value_size : 0,
+                .version = result == 0 ? info.version : 0
+            };
+            out_reply(&out, MSG_APPEND_RESPONSE, header.sequence_id, &resp, sizeof(resp), 0);
+            break;
+        }
+        
+        case MSG_GET_REQUEST: {
+            struct get_request* req = (struct get_request*)payload;
+            
+            // Validate request
+            if (header.payload_size != sizeof(struct get_request)) {
+                TRACE_WARN("Invalid GET request size");
+                pool_free(payload);
+                return -1;
+            }
+            
+            rec.op = FLIGHT_OP_GET;
+            rec.key_hash = flight_key_hash(req->key);
+            
+            // Hot keys are answered from the cache without the shard lock
+            struct shard* sh = shard_for(req->key);
+            int result = 0;
+            struct cache_value* cached = value_cache_get(&sh->cache, req->key,
+                                                         (uint32_t)time(NULL));
+            char* value_buffer = NULL;
+            const char* value = NULL;
+            size_t value_size = 0;
+            uint64_t version = 0;
+            
+            if (cached) {
+                rec.t_locked = flight_now();
+                value = cached->data;
+                value_size = cached->size;
+                version = cached->version;
+            } else {
+                // Miss: size the value, read it and offer it to the cache
+                struct storage_key_info info;
+                pthread_mutex_lock(&sh->lock);
+                rec.t_locked = flight_now();
+                result = storage_stat(sh->db, req->key, &info);
+                if (result == 0) {
+                    value_size = info.value_size;
+                    version = info.version;
+                    value_buffer = arena_alloc(&scratch, value_size > 0 ? value_size : 1);
+                    if (!value_buffer) {
+                        TRACE_ERROR("Failed to allocate value buffer for GET");
+                        result = -1;
+                    } else {
+                        result = storage_get(sh->db, req->key, value_buffer, &value_size);
+                        if (result == 0) {
+                            value = value_buffer;
+                            value_cache_admit(&sh->cache, req->key, value, value_size,
+                                              info.expires_at, info.version);
+                        } else {
+                            TRACE_WARN("GET key='%s' failed to read value: %d",
+                                       req->key, result);
+                        }
+                    }
+                }
+                pthread_mutex_unlock(&sh->lock);
+            }
+            rec.t_done = flight_now();
+            rec.value_size = value_size;
+            rec.result = result;
+            
+            TRACE_SAMPLED(TRACE_INFO, REQUEST_TRACE_SAMPLE_RATE,
+                          "GET key='%s' value_size=%zu result=%d cached=%d",
+                          req->key, value_size, result, cached != NULL);
+            
+            if (result != 0) {
+                value_size = 0;
+                version = 0;
+            }
+            
+            // Header, response struct and the value in one writev, sent
+            // before the value's buffer is let go
+            struct get_response resp = {
+                .result = result,
+                .value_size = value_size,
+                .version = version
+            };
+            out_reply(&out, MSG_GET_RESPONSE, header.sequence_id, &resp, sizeof(resp), value_size);
+            out_ref(&out, value, value_size);
+            out_flush(&out);
+            
+            cache_value_release(cached);
+            break;
+        }
+        
+        case MSG_DELETE_REQUEST: {
+            struct delete_request* req = (struct delete_request*)payload;
+            
+            // Validate request
+            if (header.payload_size != sizeof(struct delete_request)) {
+                TRACE_WARN("Invalid DELETE request size");
+                pool_free(payload);
+                return -1;
+            }
+            
+            rec.op = FLIGHT_OP_DELETE;
+            rec.key_hash = flight_key_hash(req->key);
+            
+            // Call storage function with the shard locked
+            struct shard* sh = shard_for(req->key);
+            pthread_mutex_lock(&sh->lock);
+            rec.t_locked = flight_now();
+            int result = storage_delete(sh->db, req->key);
+            if (result == 0) {
+                repl_log_append(&repl_log, REPL_OP_DELETE, req->key, NULL, 0, 0, 0);
+                expiry_set(sh, req->key, 0);
+            }
+            rec.t_done = flight_now();
+            pthread_mutex_unlock(&sh->lock);
+            rec.result = result;
+            value_cache_remove(&sh->cache, req->key);
+            
+            TRACE_SAMPLED(TRACE_INFO, REQUEST_TRACE_SAMPLE_RATE,
+                          "DELETE key='%s' result=%d", req->key, result);
+            
+            struct delete_response resp = {
+                .result = result
+            };
+            out_reply(&out, MSG_DELETE_RESPONSE, header.sequence_id, &resp, sizeof(resp), 0);
+            break;
+        }
+        
+        case MSG_DUMP_REQUEST: {
+            int records = flight_recorder_dump(FLIGHT_RECORDER_DUMP_PATH);
+            TRACE_INFO("Flight recorder dump to %s: %d records",
+                       FLIGHT_RECORDER_DUMP_PATH, records);
+            
+            struct dump_response resp;
+            memset(&resp, 0, sizeof(resp));
+            resp.result = (records < 0) ? -1 : 0;
+            resp.record_count = (records < 0) ? 0 : (uint32_t)records;
+            strncpy(resp.path, FLIGHT_RECORDER_DUMP_PATH, sizeof(resp.path) - 1);
+            out_reply(&out, MSG_DUMP_RESPONSE, header.sequence_id, &resp, sizeof(resp), 0);
+            break;
+        }
+        
+        case MSG_STATS_REQUEST: {
+            struct stats_response resp;
+            memset(&resp, 0, sizeof(resp));
+            
+            for (uint32_t i = 0; i < shard_count; i++) {
+                pthread_mutex_lock(&shards[i].cache.lock);
+                resp.cache_hits += shards[i].cache.hits;
+                resp.cache_misses += shards[i].cache.misses;
+                pthread_mutex_unlock(&shards[i].cache.lock);
+                
+                struct storage_stats st;
+                pthread_mutex_lock(&shards[i].lock);
+                storage_stats(shards[i].db, &st);
+                pthread_mutex_unlock(&shards[i].lock);
+                snprintf(resp.storage_engine, sizeof(resp.storage_engine), "%s", st.engine);
+                resp.storage_keys += st.keys;
+                resp.storage_bytes_total += st.bytes_total;
+                resp.storage_bytes_used += st.bytes_used;
+            }
+            
+            pthread_mutex_lock(&compact_mutex);
+            resp.compact_passes = compact_passes;
+            resp.compact_chains_moved = compact_stats.chains_moved;
+            resp.compact_blocks_moved = compact_stats.blocks_moved;
+            resp.compact_breaks_removed = compact_stats.breaks_removed;
+            resp.fragmentation = compact_fragmentation;
+            pthread_mutex_unlock(&compact_mutex);
+            
+            pthread_mutex_lock(&follow_mutex);
+            if (follow_path) {
+                resp.repl_role = REPL_ROLE_FOLLOWER;
+                resp.repl_seq = follow_applied;
+                resp.repl_lag_records = follow_synced && follow_primary_seq > follow_applied ?
+                                        follow_primary_seq - follow_applied : 0;
+                resp.repl_lag_ms = follow_lag_ms;
+            }
+            pthread_mutex_unlock(&follow_mutex);
+            if (!follow_path) {
+                resp.repl_role = REPL_ROLE_PRIMARY;
+                resp.repl_seq = repl_log_last(&repl_log);
+                resp.repl_followers = repl_follower_count();
+            }
+            
+            out_reply(&out, MSG_STATS_RESPONSE, header.sequence_id, &resp, sizeof(resp), 0);
+            break;
+        }
+        
+        case MSG_SCAN_REQUEST: {
+            struct scan_request* req = (struct scan_request*)payload;
+            
+            // Validate request
+            if (header.payload_size != sizeof(struct scan_request)) {
+                TRACE_WARN("Invalid SCAN request size");
+                pool_free(payload);
+                return -1;
+            }
+            req->start_key[MAX_KEY_SIZE - 1] = '\0';
+            req->end_key[MAX_KEY_SIZE - 1] = '\0';
+            req->prefix[MAX_KEY_SIZE - 1] = '\0';
+            
+            rec.op = FLIGHT_OP_SCAN;
+            rec.key_hash = flight_key_hash(req->prefix[0] ? req->prefix : req->start_key);
+            
+            struct scan_page page;
+            int result = -1;
+            if (scan_page_init(&page, req->limit) == 0) {
+                rec.t_locked = flight_now();
+                result = scan_shards(0, req->start_key, req->end_key, req->prefix, &page,
+                                     &scratch);
+                rec.t_done = flight_now();
+            } else {
+                TRACE_ERROR("Failed to allocate SCAN response buffer");
+            }
+            rec.result = result;
+            rec.value_size = page.count;
+            
+            TRACE_SAMPLED(TRACE_INFO, REQUEST_TRACE_SAMPLE_RATE,
+                          "SCAN prefix='%s' start='%s' count=%u more=%d result=%d",
+                          req->prefix, req->start_key, page.count, page.more, result);
+            
+            send_scan_page(&out, MSG_SCAN_RESPONSE, header.sequence_id, &page, result);
+            break;
+        }
+        
+        case MSG_SNAPSHOT_REQUEST: {
+            struct snapshot_request* req = (struct snapshot_request*)payload;
+            
+            // Validate request
+            if (header.payload_size != sizeof(struct snapshot_request)) {
+                TRACE_WARN("Invalid SNAPSHOT request size");
+                pool_free(payload);
+                return -1;
+            }
+            req->start_key[MAX_KEY_SIZE - 1] = '\0';
+            
+            rec.op = FLIGHT_OP_SCAN;
+            rec.key_hash = flight_key_hash(req->start_key);
+            
+            // One page per lock hold, so writers interleave with the backup
+            struct scan_page page;
+            int result = -1;
+            if (scan_page_init(&page, req->limit) == 0) {
+                pthread_mutex_lock(&snapshot_mutex);
+                rec.t_locked = flight_now();
+                if (req->op == SNAPSHOT_BEGIN && snapshot_used == 0) {
+                    // Every shard at the same instant
+                    shards_lock_all();
+                    result = 0;
+                    for (uint32_t i = 0; i < shard_count && result == 0; i++) {
+                        result = storage_snapshot_create(shards[i].db);
+                        for (uint32_t j = 0; result != 0 && j < i; j++) {
+                            storage_snapshot_release(shards[j].db);
+                        }
+                    }
+                    shards_unlock_all();
+                } else if (req->op == SNAPSHOT_READ && snapshot_used != 0) {
+                    result = scan_shards(1, req->start_key, NULL, NULL, &page, &scratch);
+                } else if (req->op == SNAPSHOT_END) {
+                    snapshot_release();
+                    result = 0;
+                }
+                if (result == 0 && req->op != SNAPSHOT_END) {
+                    snapshot_used = time(NULL);
+                }
+                rec.t_done = flight_now();
+                pthread_mutex_unlock(&snapshot_mutex);
+            } else {
+                TRACE_ERROR("Failed to allocate SNAPSHOT response buffer");
+            }
+            rec.result = result;
+            rec.value_size = page.count;
+            
+            if (req->op != SNAPSHOT_READ || result != 0) {
+                TRACE_INFO("SNAPSHOT op=%u result=%d", req->op, result);
+            }
+            
+            send_scan_page(&out, MSG_SNAPSHOT_RESPONSE, header.sequence_id, &page, result);
+            break;
+        }
+        
+        case MSG_REPLICATE_REQUEST: {
+            // Validate request
+            if (header.payload_size != sizeof(struct replicate_request)) {
+                TRACE_WARN("Invalid REPLICATE request size");
+                pool_free(payload);
+                return -1;
+            }
+            
+            struct replicate_request* req = (struct replicate_request*)payload;
+            if (req->protocol != REPL_PROTOCOL_VERSION) {
+                TRACE_WARN("Replication: follower speaks protocol %u, not %d", req->protocol,
+                           REPL_PROTOCOL_VERSION);
+                send_error(&out, header.sequence_id, "replication protocol %u not supported",
+                           req->protocol);
+                break;
+            }
+            
+            // The connection now belongs to a sender thread
+            if (repl_subscribe(client_fd, req) == 0) {
+                TRACE_INFO("Replication: follower subscribed");
+                pool_free(payload);
+                return MESSAGE_KEPT_CONNECTION;
+            }
+            TRACE_WARN("Replication: no room for another follower");
+            send_error(&out, header.sequence_id, "too many followers (max %d)",
+                       REPL_MAX_FOLLOWERS);
+            break;
+        }
+        
+        default: {
+            TRACE_WARN("Unknown message type: %u", header.type);
+            send_error(&out, header.sequence_id, "Unknown message type: %u", header.type);
+            break;
+        }
+    }
+    
+    out_flush(&out);
+    arena_release(&scratch);
+    rec.t_done = rec.t_done ? rec.t_done : flight_now();
+    flight_record(&rec);
     
     // Clean up
     if (payload) {
-        free(payload);
+        pool_free(payload);
     }
     
     return 0;
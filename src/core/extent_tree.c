@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include "../../include/core/extent_tree.h"
+
+// Does node `n` sort before the key (len, start) in treap `w`?
+static int before(int w, const struct extent* n, uint32_t len, uint32_t start) {
+    if (w == EXTENT_BY_SIZE && n->len != len) {
+        return n->len < len;
+    }
+    return n->start < start;
+}
+
+// Split treap `n` into nodes before the key (l) and the rest (r)
+static void split(int w, struct extent* n, uint32_t len, uint32_t start,
+                  struct extent** l, struct extent** r) {
+    if (!n) {
+        *l = *r = NULL;
+    } else if (before(w, n, len, start)) {
+        split(w, n->child[w][1], len, start, &n->child[w][1], r);
+        *l = n;
+    } else {
+        split(w, n->child[w][0], len, start, l, &n->child[w][0]);
+        *r = n;
+    }
+}
+
+// Join two treaps where every node of `l` sorts before every node of `r`
+static struct extent* merge(int w, struct extent* l, struct extent* r) {
+    if (!l) return r;
+    if (!r) return l;
+    if (l->priority > r->priority) {
+        l->child[w][1] = merge(w, l->child[w][1], r);
+        return l;
+    }
+    r->child[w][0] = merge(w, l, r->child[w][0]);
+    return r;
+}
+
+static void insert(struct extent_tree* t, int w, struct extent* n) {
+    struct extent *l, *r;
+    n->child[w][0] = n->child[w][1] = NULL;
+    split(w, t->root[w], n->len, n->start, &l, &r);
+    t->root[w] = merge(w, merge(w, l, n), r);
+}
+
+static void erase(struct extent_tree* t, int w, struct extent* n) {
+    struct extent *l, *m, *r;
+    split(w, t->root[w], n->len, n->start, &l, &r);
+    split(w, r, n->len, n->start + 1, &m, &r);  // m is just `n`
+    t->root[w] = merge(w, l, r);
+}
+
+static uint32_t next_priority(struct extent_tree* t) {
+    t->seed ^= t->seed << 13;  // xorshift32
+    t->seed ^= t->seed >> 17;
+    t->seed ^= t->seed << 5;
+    return t->seed;
+}
+
+void extent_tree_init(struct extent_tree* t) {
+    t->root[0] = t->root[1] = NULL;
+    t->count = 0;
+    t->free_blocks = 0;
+    t->seed = 2463534242u;
+}
+
+static void free_nodes(struct extent* n) {
+    while (n) {
+        free_nodes(n->child[EXTENT_BY_START][0]);
+        struct extent* right = n->child[EXTENT_BY_START][1];
+        free(n);
+        n = right;
+    }
+}
+
+void extent_tree_clear(struct extent_tree* t) {
+    free_nodes(t->root[EXTENT_BY_START]);
+    extent_tree_init(t);
+}
+
+int extent_tree_free(struct extent_tree* t, uint32_t start, uint32_t len) {
+    if (len == 0) {
+        return 0;
+    }
+
+    // Neighbours by start: last run before `start`, first run after it
+    struct extent* pred = NULL;
+    struct extent* succ = NULL;
+    for (struct extent* n = t->root[EXTENT_BY_START]; n; ) {
+        if (n->start < start) {
+            pred = n;
+            n = n->child[EXTENT_BY_START][1];
+        } else {
+            succ = n;
+            n = n->child[EXTENT_BY_START][0];
+        }
+    }
+    int join_left = pred && pred->start + pred->len == start;
+    int join_right = succ && start + len == succ->start;
+
+    if (join_left && join_right) {
+        erase(t, EXTENT_BY_START, succ);
+        erase(t, EXTENT_BY_SIZE, succ);
+        erase(t, EXTENT_BY_SIZE, pred);
+        pred->len += len + succ->len;
+        insert(t, EXTENT_BY_SIZE, pred);
+        free(succ);
+        t->count--;
+    } else if (join_left) {
+        erase(t, EXTENT_BY_SIZE, pred);
+        pred->len += len;
+        insert(t, EXTENT_BY_SIZE, pred);
+    } else if (join_right) {
+        // Moving the start down stays between the same neighbours, so only
+        // the size order changes
+        erase(t, EXTENT_BY_SIZE, succ);
+        succ->start = start;
+        succ->len += len;
+        insert(t, EXTENT_BY_SIZE, succ);
+    } else {
+        struct extent* n = malloc(sizeof(*n));
+        if (!n) {
+            return -1;
+        }
+        n->start = start;
+        n->len = len;
+        n->priority = next_priority(t);
+        insert(t, EXTENT_BY_START, n);
+        insert(t, EXTENT_BY_SIZE, n);
+        t->count++;
+    }
+    t->free_blocks += len;
+    return 0;
+}
+
+uint32_t extent_tree_alloc(struct extent_tree* t, uint32_t want, uint32_t* start) {
+    // Smallest run of at least `want` blocks
+    struct extent* fit = NULL;
+    for (struct extent* n = t->root[EXTENT_BY_SIZE]; n; ) {
+        if (before(EXTENT_BY_SIZE, n, want, 0)) {
+            n = n->child[EXTENT_BY_SIZE][1];
+        } else {
+            fit = n;
+            n = n->child[EXTENT_BY_SIZE][0];
+        }
+    }
+    if (!fit) {
+        // Nothing big enough: hand out the largest run
+        fit = t->root[EXTENT_BY_SIZE];
+        while (fit && fit->child[EXTENT_BY_SIZE][1]) {
+            fit = fit->child[EXTENT_BY_SIZE][1];
+        }
+        if (!fit) {
+            return 0;
+        }
+    }
+
+    uint32_t take = fit->len < want ? fit->len : want;
+    *start = fit->start;
+    erase(t, EXTENT_BY_SIZE, fit);
+    if (take == fit->len) {
+        erase(t, EXTENT_BY_START, fit);
+        free(fit);
+        t->count--;
+    } else {
+        fit->start += take;
+        fit->len -= take;
+        insert(t, EXTENT_BY_SIZE, fit);
+    }
+    t->free_blocks -= take;
+    return take;
+}
+
+uint32_t extent_tree_largest(const struct extent_tree* t) {
+    const struct extent* n = t->root[EXTENT_BY_SIZE];
+    while (n && n->child[EXTENT_BY_SIZE][1]) {
+        n = n->child[EXTENT_BY_SIZE][1];
+    }
+    return n ? n->len : 0;
+}
+
+static void walk_runs(const struct extent* n, extent_fn fn, void* arg) {
+    while (n) {
+        walk_runs(n->child[EXTENT_BY_START][0], fn, arg);
+        fn(n->start, n->len, arg);
+        n = n->child[EXTENT_BY_START][1];
+    }
+}
+
+void extent_tree_foreach(const struct extent_tree* t, extent_fn fn, void* arg) {
+    walk_runs(t->root[EXTENT_BY_START], fn, arg);
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../../include/core/flight_recorder.h"
+
+#define RING_MASK (FLIGHT_RECORDER_ENTRIES - 1)
+
+_Static_assert((FLIGHT_RECORDER_ENTRIES & RING_MASK) == 0,
+               "FLIGHT_RECORDER_ENTRIES must be a power of two");
+
+// Single writer (the owning thread), readers only during dumps. A dump that
+// races with the writer may see the one record being overwritten torn; that
+// is an accepted trade for keeping the write path free of fences.
+struct flight_ring {
+    atomic_uint_fast64_t head;
+    struct flight_record records[FLIGHT_RECORDER_ENTRIES];
+};
+
+static struct flight_ring* rings[FLIGHT_RECORDER_MAX_THREADS];
+static atomic_int ring_count = 0;
+static __thread struct flight_ring* thread_ring = NULL;
+static __thread int thread_ring_failed = 0;
+
+static struct flight_ring* register_thread_ring(void) {
+    int slot = atomic_fetch_add(&ring_count, 1);
+    if (slot >= FLIGHT_RECORDER_MAX_THREADS) {
+        atomic_fetch_sub(&ring_count, 1);
+        thread_ring_failed = 1;
+        return NULL;
+    }
+
+    struct flight_ring* ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        thread_ring_failed = 1;
+        return NULL;
+    }
+
+    __atomic_store_n(&rings[slot], ring, __ATOMIC_RELEASE);
+    thread_ring = ring;
+    return ring;
+}
+
+void flight_record(const struct flight_record* rec) {
+    struct flight_ring* ring = thread_ring;
+    if (!ring) {
+        if (thread_ring_failed || !(ring = register_thread_ring())) {
+            return;
+        }
+    }
+
+    uint_fast64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->records[head & RING_MASK] = *rec;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static const char* op_name(uint16_t op) {
+    switch (op) {
+        case FLIGHT_OP_PUT:    return "PUT";
+        case FLIGHT_OP_GET:    return "GET";
+        case FLIGHT_OP_DELETE: return "DELETE";
+        case FLIGHT_OP_SCAN:   return "SCAN";
+        case FLIGHT_OP_CAS:    return "CAS";
+        case FLIGHT_OP_INCR:   return "INCR";
+        case FLIGHT_OP_APPEND: return "APPEND";
+        default:               return "OTHER";
+    }
+}
+
+static uint64_t phase(uint64_t from, uint64_t to) {
+    return (from && to >= from) ? to - from : 0;
+}
+
+int flight_recorder_dump(const char* path) {
+    // Truncated only once it is known to be ours
+    int fd = open(path, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+        ftruncate(fd, 0) != 0) {
+        close(fd);
+        return -1;
+    }
+    FILE* out = fdopen(fd, "w");
+    if (!out) {
+        close(fd);
+        return -1;
+    }
+
+    int threads = atomic_load(&ring_count);
+    if (threads > FLIGHT_RECORDER_MAX_THREADS) {
+        threads = FLIGHT_RECORDER_MAX_THREADS;
+    }
+
+    fprintf(out, "# storage_daemon flight recorder pid=%d threads=%d now_ns=%llu\n",
+            (int)getpid(), threads, (unsigned long long)flight_now());
+    fprintf(out, "# thread op seq key_hash value_size queue_ns lock_ns io_ns total_ns result t_queued\n");
+
+    int written = 0;
+    for (int t = 0; t < threads; t++) {
+        struct flight_ring* ring = __atomic_load_n(&rings[t], __ATOMIC_ACQUIRE);
+        if (!ring) {
+            continue;
+        }
+
+        uint_fast64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint_fast64_t start = head > FLIGHT_RECORDER_ENTRIES ? head - FLIGHT_RECORDER_ENTRIES : 0;
+
+        for (uint_fast64_t i = start; i < head; i++) {
+            const struct flight_record* r = &ring->records[i & RING_MASK];
+            fprintf(out, "%d %s %u %08x %u %llu %llu %llu %llu %d %llu\n",
+                    t, op_name(r->op), r->sequence_id, r->key_hash, r->value_size,
+                    (unsigned long long)phase(r->t_queued, r->t_started),
+                    (unsigned long long)phase(r->t_started, r->t_locked),
+                    (unsigned long long)phase(r->t_locked, r->t_done),
+                    (unsigned long long)phase(r->t_queued, r->t_done),
+                    r->result, (unsigned long long)r->t_queued);
+            written++;
+        }
+    }
+
+    if (fclose(out) != 0) {
+        return -1;
+    }
+    return written;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "../../include/core/storage.h"
+
+// Exit codes, as fsck(8) has them
+#define FSCK_OK 0
+#define FSCK_REPAIRED 1
+#define FSCK_UNREPAIRED 4
+#define FSCK_ERROR 8
+
+static void show_usage(const char* program_name) {
+    printf("Usage: %s [options] <storage_file>\n", program_name);
+    printf("\nOptions:\n");
+    printf("  -j, --threads <N>  Walk block chains on N threads (default: one per CPU)\n");
+    printf("  -r, --repair       Drop keys whose chains are broken or share blocks,\n");
+    printf("                     and rebuild the allocation bitmaps from the rest\n");
+    printf("  -h, --help         Show this help message\n");
+    printf("\nStop the daemon first: the storage must not be open anywhere else.\n");
+    printf("A sharded daemon keeps one storage per shard, <storage_file>.shard<i>;\n");
+    printf("check each of them.\n");
+    printf("\nExit status: %d clean, %d repaired, %d problems left, %d error\n",
+           FSCK_OK, FSCK_REPAIRED, FSCK_UNREPAIRED, FSCK_ERROR);
+}
+
+static void print_problem(const char* key, const char* problem, void* arg) {
+    int repair = *(int*)arg;
+    printf("  %s: %s%s\n", key, problem, repair ? ", dropped" : "");
+}
+
+int main(int argc, char* argv[]) {
+    static const struct option long_options[] = {
+        {"threads", required_argument, NULL, 'j'},
+        {"repair", no_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cpus > 0 ? (unsigned)cpus : 1;
+    int repair = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:rh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j': {
+                char* end;
+                unsigned long n = strtoul(optarg, &end, 10);
+                if (*end != '\0' || n < 1 || n > 1024) {
+                    fprintf(stderr, "Error: Threads must be from 1 to 1024\n");
+                    return FSCK_ERROR;
+                }
+                threads = (unsigned)n;
+                break;
+            }
+            case 'r':
+                repair = 1;
+                break;
+            case 'h':
+                show_usage(argv[0]);
+                return FSCK_OK;
+            default:
+                show_usage(argv[0]);
+                return FSCK_ERROR;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Error: Storage file path required\n\n");
+        show_usage(argv[0]);
+        return FSCK_ERROR;
+    }
+    const char* storage_file = argv[optind];
+
+    // storage_open would create it
+    if (access(storage_file, R_OK | W_OK) != 0) {
+        fprintf(stderr, "Error: Cannot access %s\n", storage_file);
+        return FSCK_ERROR;
+    }
+    storage_t* db = storage_open(storage_file, NULL);
+    if (!db) {
+        fprintf(stderr, "Error: Cannot open %s (superblock, segment headers or index unreadable)\n",
+                storage_file);
+        return FSCK_ERROR;
+    }
+
+    struct storage_check_report report;
+    int rc = storage_check(db, threads, repair, print_problem, &repair, &report);
+    if (rc < 0) {
+        fprintf(stderr, "Error: Check of %s failed\n", storage_file);
+        storage_close(db);
+        return FSCK_ERROR;
+    }
+
+    printf("%s: %llu keys, %llu blocks in use, %u threads\n", storage_file,
+           (unsigned long long)report.keys, (unsigned long long)report.blocks_used, threads);
+    printf("  broken chains:       %llu\n", (unsigned long long)report.broken_chains);
+    printf("  cross-linked blocks: %llu\n", (unsigned long long)report.cross_linked);
+    printf("  leaked blocks:       %llu\n", (unsigned long long)report.leaked);
+    printf("  unmarked blocks:     %llu\n", (unsigned long long)report.unmarked);
+    printf("  free blocks:         %llu recorded, %llu actual\n",
+           (unsigned long long)report.free_blocks_recorded,
+           (unsigned long long)report.free_blocks_actual);
+
+    int status = FSCK_OK;
+    if (rc > 0) {
+        printf("Problems found; run with --repair to fix them\n");
+        status = FSCK_UNREPAIRED;
+    } else if (repair && (report.keys_dropped > 0 || report.leaked > 0 || report.unmarked > 0 ||
+                          report.free_blocks_recorded != report.free_blocks_actual)) {
+        printf("Repaired: %llu keys dropped, bitmaps rebuilt\n",
+               (unsigned long long)report.keys_dropped);
+        status = FSCK_REPAIRED;
+    } else {
+        printf("Clean\n");
+    }
+    storage_close(db);
+    return status;
+}
@@ -0,0 +1,1088 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "../../include/core/storage.h"
+#include "../../include/core/storage_engine.h"
+#include "../../include/core/async_log.h"
+#include "../../include/core/buf_pool.h"
+#include "../../include/core/hash.h"
+
+// Bitcask-style engine: every write is an append to the active data file,
+// and an in-memory hash table (the keydir) maps each key to its newest
+// record. Reads are one pread. Space held by overwritten and deleted
+// records is reclaimed by merging: the live records of a mostly dead file
+// are appended again and the file removed, a bounded step at a time from
+// storage_compact_step. Opening replays every data file in id order.
+
+#define KEYDIR_MIN_BUCKETS 1024
+#define LOG_MERGE_DEAD_PERCENT 50    // Merge a closed file once this much is dead
+#define LOG_READ_BYTES (256 * 1024)  // Replay and merge read this much at a time
+#define LOG_MERGING "merge"          // Compaction cursor while a file is half merged
+
+struct log_file {
+    uint32_t id;
+    int fd;
+    uint64_t size;               // Bytes of whole records
+    uint64_t live;               // Of which current values and tombstones
+    uint64_t tombstones;         // Of which tombstones
+};
+
+struct keydir_entry {
+    struct keydir_entry* next;   // Bucket chain
+    struct log_file* file;
+    uint64_t offset;             // Of the record
+    uint64_t hash;
+    uint64_t version;
+    uint32_t value_size;
+    uint32_t expires_at;
+    uint16_t key_len;
+    char key[];                  // NUL terminated
+};
+
+struct log_state {
+    const struct storage_engine* engine;  // &log_engine, see storage_engine.h
+    char* filename;
+    uint64_t file_max;
+    struct log_file** files;     // Ascending id, the last one active
+    uint32_t file_count;
+    uint32_t file_cap;
+    struct keydir_entry** buckets;
+    size_t bucket_count;         // Power of two
+    size_t key_count;
+    uint64_t version_floor;      // Highest version deleted, see append_tombstone
+    struct log_file* merging;    // File being merged, NULL = none
+    uint64_t merge_offset;
+    struct keydir_entry** snapshot;  // Sorted copies while a snapshot is held
+    size_t snapshot_count;
+    int snapshot_active;
+};
+
+// Sequential reads through one buffer, refilled as a caller moves on
+struct log_reader {
+    int fd;
+    char* buf;
+    size_t cap;
+    uint64_t base;               // File offset of buf[0]
+    size_t len;
+};
+
+static struct log_state* log_of(storage_t* db) {
+    return (struct log_state*)db;
+}
+
+static size_t record_size(uint32_t key_len, uint32_t value_size) {
+    return sizeof(struct log_record) + key_len + value_size;
+}
+
+// CRC-32 (IEEE), table built once
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_setup(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = data;
+    crc = ~crc;
+    while (len--) {
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(const struct log_record* h, const char* key, const char* value) {
+    uint32_t crc = crc_update(0, (const char*)h + sizeof(h->crc), sizeof(*h) - sizeof(h->crc));
+    crc = crc_update(crc, key, h->key_len);
+    return crc_update(crc, value, h->value_size);
+}
+
+// Keydir
+
+static struct keydir_entry* keydir_find(struct log_state* ls, const char* key, size_t len) {
+    uint64_t h = fnv1a_64(key, len);
+    struct keydir_entry* e = ls->buckets[h & (ls->bucket_count - 1)];
+    while (e && (e->hash != h || e->key_len != len || memcmp(e->key, key, len) != 0)) {
+        e = e->next;
+    }
+    return e;
+}
+
+static int keydir_grow(struct log_state* ls) {
+    size_t count = ls->bucket_count * 2;
+    struct keydir_entry** buckets = calloc(count, sizeof(*buckets));
+    if (!buckets) {
+        return -1;
+    }
+    for (size_t i = 0; i < ls->bucket_count; i++) {
+        struct keydir_entry* e = ls->buckets[i];
+        while (e) {
+            struct keydir_entry* next = e->next;
+            e->next = buckets[e->hash & (count - 1)];
+            buckets[e->hash & (count - 1)] = e;
+            e = next;
+        }
+    }
+    free(ls->buckets);
+    ls->buckets = buckets;
+    ls->bucket_count = count;
+    return 0;
+}
+
+// Point `key` at a record, accounting the record it replaces as dead
+static int keydir_set(struct log_state* ls, const char* key, size_t len, struct log_file* f,
+                      uint64_t offset, uint32_t value_size, uint32_t expires_at,
+                      uint64_t version) {
+    struct keydir_entry* e = keydir_find(ls, key, len);
+    if (e) {
+        e->file->live -= record_size(e->key_len, e->value_size);
+    } else {
+        if (ls->key_count >= ls->bucket_count && keydir_grow(ls) != 0) {
+            return -1;
+        }
+        e = malloc(sizeof(*e) + len + 1);
+        if (!e) {
+            return -1;
+        }
+        e->hash = fnv1a_64(key, len);
+        e->key_len = (uint16_t)len;
+        memcpy(e->key, key, len);
+        e->key[len] = '\0';
+        e->next = ls->buckets[e->hash & (ls->bucket_count - 1)];
+        ls->buckets[e->hash & (ls->bucket_count - 1)] = e;
+        ls->key_count++;
+    }
+    e->file = f;
+    e->offset = offset;
+    e->value_size = value_size;
+    e->expires_at = expires_at;
+    e->version = version;
+    f->live += record_size((uint32_t)len, value_size);
+    return 0;
+}
+
+static void keydir_remove(struct log_state* ls, const char* key, size_t len) {
+    uint64_t h = fnv1a_64(key, len);
+    struct keydir_entry** link = &ls->buckets[h & (ls->bucket_count - 1)];
+    while (*link) {
+        struct keydir_entry* e = *link;
+        if (e->hash == h && e->key_len == len && memcmp(e->key, key, len) == 0) {
+            e->file->live -= record_size(e->key_len, e->value_size);
+            *link = e->next;
+            free(e);
+            ls->key_count--;
+            return;
+        }
+        link = &e->next;
+    }
+}
+
+static void keydir_free(struct log_state* ls) {
+    for (size_t i = 0; i < ls->bucket_count; i++) {
+        while (ls->buckets[i]) {
+            struct keydir_entry* next = ls->buckets[i]->next;
+            free(ls->buckets[i]);
+            ls->buckets[i] = next;
+        }
+    }
+    free(ls->buckets);
+    ls->buckets = NULL;
+    ls->bucket_count = 0;
+    ls->key_count = 0;
+}
+
+// Data files
+
+static void file_path(struct log_state* ls, uint32_t id, char* buf, size_t size) {
+    snprintf(buf, size, "%s%s%u", ls->filename, LOG_FILE_SUFFIX, id);
+}
+
+static int files_add(struct log_state* ls, struct log_file* f) {
+    if (ls->file_count == ls->file_cap) {
+        uint32_t cap = ls->file_cap ? ls->file_cap * 2 : 16;
+        struct log_file** files = realloc(ls->files, cap * sizeof(*files));
+        if (!files) {
+            return -1;
+        }
+        ls->files = files;
+        ls->file_cap = cap;
+    }
+    ls->files[ls->file_count++] = f;
+    return 0;
+}
+
+static struct log_file* active_file(struct log_state* ls) {
+    return ls->files[ls->file_count - 1];
+}
+
+// Start data file `id` and make it the active one
+static struct log_file* file_create(struct log_state* ls, uint32_t id) {
+    char path[4096];
+    file_path(ls, id, path, sizeof(path));
+    struct log_file* f = calloc(1, sizeof(*f));
+    if (!f) {
+        return NULL;
+    }
+    f->id = id;
+    f->fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (f->fd < 0 || files_add(ls, f) != 0) {
+        if (f->fd >= 0) {
+            close(f->fd);
+            unlink(path);
+        }
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+// Ids of the data files of `filename`, ascending. Returns the count or -1.
+static int list_files(const char* filename, uint32_t** ids) {
+    const char* slash = strrchr(filename, '/');
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - filename) + 1 : 1, slash ? filename : ".");
+    char prefix[4096];
+    snprintf(prefix, sizeof(prefix), "%s%s", slash ? slash + 1 : filename, LOG_FILE_SUFFIX);
+    size_t prefix_len = strlen(prefix);
+
+    DIR* d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
+    int count = 0;
+    int cap = 0;
+    *ids = NULL;
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL) {
+        const char* num = de->d_name + prefix_len;
+        if (strncmp(de->d_name, prefix, prefix_len) != 0 || *num < '0' || *num > '9') {
+            continue;
+        }
+        char* end;
+        unsigned long id = strtoul(num, &end, 10);
+        if (*end != '\0' || id > UINT32_MAX) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            uint32_t* grown = realloc(*ids, (size_t)cap * sizeof(**ids));
+            if (!grown) {
+                closedir(d);
+                free(*ids);
+                return -1;
+            }
+            *ids = grown;
+        }
+        (*ids)[count++] = (uint32_t)id;
+    }
+    closedir(d);
+
+    for (int i = 1; i < count; i++) {
+        uint32_t id = (*ids)[i];
+        int j = i;
+        for (; j > 0 && (*ids)[j - 1] > id; j--) {
+            (*ids)[j] = (*ids)[j - 1];
+        }
+        (*ids)[j] = id;
+    }
+    return count;
+}
+
+// `n` bytes at file offset `off`, or NULL past the end
+static const char* reader_at(struct log_reader* r, uint64_t off, size_t n) {
+    if (off >= r->base && off + n <= r->base + r->len) {
+        return r->buf + (off - r->base);
+    }
+    if (n > r->cap) {
+        char* grown = pool_realloc(r->buf, n);
+        if (!grown) {
+            return NULL;
+        }
+        r->buf = grown;
+        r->cap = n;
+    }
+    ssize_t got = pread(r->fd, r->buf, r->cap, (off_t)off);
+    if (got < (ssize_t)n) {
+        return NULL;
+    }
+    r->base = off;
+    r->len = (size_t)got;
+    return r->buf;
+}
+
+// The record at `off` of a reader's file, checked. Returns its header and
+// sets `rec` to its bytes, or NULL at the end or at a bad record.
+static const struct log_record* read_record(struct log_reader* r, uint64_t off, uint64_t end,
+                                            const char** rec) {
+    if (off + sizeof(struct log_record) > end) {
+        return NULL;
+    }
+    const char* p = reader_at(r, off, sizeof(struct log_record));
+    if (!p) {
+        return NULL;
+    }
+    struct log_record h;
+    memcpy(&h, p, sizeof(h));
+    size_t total = record_size(h.key_len, h.value_size);
+    if (h.key_len == 0 || h.key_len >= MAX_KEY_SIZE || off + total > end ||
+        ((h.flags & LOG_RECORD_TOMBSTONE) && h.value_size != 0)) {
+        return NULL;
+    }
+    p = reader_at(r, off, total);
+    if (!p) {
+        return NULL;
+    }
+    const char* key = p + sizeof(h);
+    if (record_crc(&h, key, key + h.key_len) != h.crc) {
+        return NULL;
+    }
+    *rec = p;
+    return (const struct log_record*)p;
+}
+
+// Rebuild the keydir entries for one data file. A torn record at the end of
+// the last file is cut off; anywhere else the rest of the file is skipped.
+static int file_replay(struct log_state* ls, struct log_file* f, int last) {
+    struct stat st;
+    if (fstat(f->fd, &st) != 0) {
+        return -1;
+    }
+    uint64_t end = (uint64_t)st.st_size;
+    struct log_reader r = { f->fd, pool_alloc(LOG_READ_BYTES), LOG_READ_BYTES, 0, 0 };
+    if (!r.buf) {
+        return -1;
+    }
+
+    uint64_t off = 0;
+    const char* rec;
+    const struct log_record* h;
+    while ((h = read_record(&r, off, end, &rec)) != NULL) {
+        const char* key = rec + sizeof(*h);
+        size_t total = record_size(h->key_len, h->value_size);
+        if (h->flags & LOG_RECORD_TOMBSTONE) {
+            keydir_remove(ls, key, h->key_len);
+            if (h->version > ls->version_floor) {
+                ls->version_floor = h->version;
+            }
+            f->live += total;
+            f->tombstones += total;
+        } else if (keydir_set(ls, key, h->key_len, f, off, h->value_size, h->expires_at,
+                              h->version) != 0) {
+            pool_free(r.buf);
+            return -1;
+        }
+        off += total;
+    }
+    pool_free(r.buf);
+
+    if (off < end) {
+        TRACE_WARN("log: %s%s%u: bad record at offset %llu, %llu bytes after it ignored",
+                   ls->filename, LOG_FILE_SUFFIX, f->id, (unsigned long long)off,
+                   (unsigned long long)(end - off));
+        if (last && ftruncate(f->fd, (off_t)off) == 0) {
+            end = off;
+        }
+    }
+    f->size = end;
+    return 0;
+}
+
+// Append one record to the active file, moving on to a new file when it is
+// full. Sets `file` and `offset` to where it went.
+static int log_append(struct log_state* ls, const char* key, size_t key_len, const char* value,
+                      uint32_t value_size, uint32_t expires_at, uint64_t version, uint8_t flags,
+                      struct log_file** file, uint64_t* offset) {
+    struct log_file* f = active_file(ls);
+    if (f->size >= ls->file_max) {
+        struct log_file* next = file_create(ls, f->id + 1);
+        if (!next) {
+            TRACE_ERROR("log: failed to start data file %u: %s", f->id + 1, strerror(errno));
+            return -1;
+        }
+        TRACE_INFO("log: data file %u full, writing to %u", f->id, next->id);
+        f = next;
+    }
+
+    struct log_record h = {
+        .crc = 0,
+        .value_size = value_size,
+        .expires_at = expires_at,
+        .key_len = (uint16_t)key_len,
+        .flags = flags,
+        .reserved = 0,
+        .version = version
+    };
+    h.crc = record_crc(&h, key, value);
+    struct iovec iov[3] = {
+        { &h, sizeof(h) },
+        { (void*)key, key_len },
+        { (void*)value, value_size }
+    };
+    size_t total = record_size((uint32_t)key_len, value_size);
+    // A short write is overwritten by the next append
+    if (pwritev(f->fd, iov, value_size ? 3 : 2, (off_t)f->size) != (ssize_t)total) {
+        TRACE_ERROR("log: append to data file %u failed: %s", f->id, strerror(errno));
+        return -1;
+    }
+    *file = f;
+    *offset = f->size;
+    f->size += total;
+    return 0;
+}
+
+// A tombstone carries the version it deletes, which stays retired: the key
+// starts above the highest one when it is written again
+static int append_tombstone(struct log_state* ls, const char* key, size_t key_len,
+                            uint64_t version) {
+    struct log_file* f;
+    uint64_t offset;
+    if (log_append(ls, key, key_len, NULL, 0, 0, version, LOG_RECORD_TOMBSTONE,
+                   &f, &offset) != 0) {
+        return -1;
+    }
+    if (version > ls->version_floor) {
+        ls->version_floor = version;
+    }
+    f->live += record_size((uint32_t)key_len, 0);
+    f->tombstones += record_size((uint32_t)key_len, 0);
+    return 0;
+}
+
+static int entry_expired(const struct keydir_entry* e, uint32_t now) {
+    return e->expires_at != 0 && e->expires_at <= now;
+}
+
+// Keydir lookup that treats an expired key as missing (and deletes it)
+static struct keydir_entry* lookup_live(struct log_state* ls, const char* key) {
+    size_t len = strlen(key);
+    struct keydir_entry* e = keydir_find(ls, key, len);
+    if (e && entry_expired(e, (uint32_t)time(NULL))) {
+        if (append_tombstone(ls, key, len, e->version) == 0) {
+            keydir_remove(ls, key, len);
+        }
+        return NULL;
+    }
+    return e;
+}
+
+static int read_entry_value(const struct keydir_entry* e, char* value) {
+    off_t off = (off_t)(e->offset + sizeof(struct log_record) + e->key_len);
+    return pread(e->file->fd, value, e->value_size, off) == (ssize_t)e->value_size ? 0 : -1;
+}
+
+static void log_close(storage_t* db);
+
+static storage_t* log_open(const char* filename, const struct storage_format* format) {
+    if (format && format->in_memory) {
+        return NULL;  // Volatile storage is the block engine's
+    }
+    struct log_state* ls = calloc(1, sizeof(*ls));
+    if (!ls) {
+        return NULL;
+    }
+    ls->engine = &log_engine;
+    ls->filename = strdup(filename);
+    ls->bucket_count = KEYDIR_MIN_BUCKETS;
+    ls->buckets = calloc(ls->bucket_count, sizeof(*ls->buckets));
+    pthread_once(&crc_once, crc_setup);
+    if (!ls->filename || !ls->buckets) {
+        log_close((storage_t*)ls);
+        return NULL;
+    }
+
+    uint32_t* ids = NULL;
+    int count;
+    struct log_header h;
+    int fd = open(filename, O_RDWR);
+    if (fd < 0) {
+        // New store: drop whatever data files a previous one of this name left
+        count = list_files(filename, &ids);
+        for (int i = 0; i < count; i++) {
+            char path[4096];
+            file_path(ls, ids[i], path, sizeof(path));
+            unlink(path);
+        }
+        free(ids);
+        ids = NULL;
+        count = 0;
+
+        h.magic = LOG_MAGIC;
+        h.version = LOG_VERSION;
+        h.file_max_bytes = LOG_FILE_MAX_BYTES;
+        h.version_floor = 0;
+        fd = open(filename, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+            if (fd >= 0) {
+                close(fd);
+                unlink(filename);
+            }
+            log_close((storage_t*)ls);
+            return NULL;
+        }
+    } else {
+        count = list_files(filename, &ids);
+        if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != LOG_MAGIC ||
+            h.version != LOG_VERSION || h.file_max_bytes == 0 || count < 0) {
+            close(fd);
+            free(ids);
+            log_close((storage_t*)ls);
+            return NULL;
+        }
+    }
+    close(fd);
+    ls->file_max = h.file_max_bytes;
+    ls->version_floor = h.version_floor;
+
+    for (int i = 0; i < count; i++) {
+        char path[4096];
+        file_path(ls, ids[i], path, sizeof(path));
+        struct log_file* f = calloc(1, sizeof(*f));
+        if (f) {
+            f->id = ids[i];
+            f->fd = open(path, O_RDWR);
+        }
+        if (!f || f->fd < 0 || files_add(ls, f) != 0) {
+            if (f && f->fd >= 0) {
+                close(f->fd);
+            }
+            free(f);
+            free(ids);
+            TRACE_ERROR("log: failed to open data file %s", path);
+            log_close((storage_t*)ls);
+            return NULL;
+        }
+        if (file_replay(ls, f, i == count - 1) != 0) {
+            free(ids);
+            TRACE_ERROR("log: failed to read data file %s", path);
+            log_close((storage_t*)ls);
+            return NULL;
+        }
+    }
+    free(ids);
+
+    if (ls->file_count == 0 && !file_create(ls, 0)) {
+        log_close((storage_t*)ls);
+        return NULL;
+    }
+    TRACE_INFO("log: %s opened, %zu keys in %u data files", filename, ls->key_count,
+               ls->file_count);
+    return (storage_t*)ls;
+}
+
+static void log_snapshot_release(storage_t* db);
+
+static void log_close(storage_t* db) {
+    struct log_state* ls = log_of(db);
+    log_snapshot_release(db);
+    for (uint32_t i = 0; i < ls->file_count; i++) {
+        if (i == ls->file_count - 1) {
+            fdatasync(ls->files[i]->fd);
+        }
+        close(ls->files[i]->fd);
+        free(ls->files[i]);
+    }
+    free(ls->files);
+    keydir_free(ls);
+    free(ls->filename);
+    free(ls);
+}
+
+// PUT with an absolute expiry time. `new_version` KEY_VERSION_NONE numbers
+// the write after the key's last one.
+static int log_write(struct log_state* ls, const char* key, const char* value, size_t value_size,
+                     uint32_t expires_at, uint64_t expected_version, uint64_t new_version,
+                     uint64_t* version) {
+    if (!key || !value || value_size > UINT32_MAX) {
+        return -1;
+    }
+    size_t len = strlen(key);
+    if (len == 0 || len >= MAX_KEY_SIZE) {
+        return -1;
+    }
+
+    // An expired key counts as absent, but its numbering goes on
+    uint32_t now = (uint32_t)time(NULL);
+    struct keydir_entry* e = keydir_find(ls, key, len);
+    uint64_t current = e && !entry_expired(e, now) ? e->version : KEY_VERSION_NONE;
+    if (expected_version != KEY_VERSION_ANY && expected_version != current) {
+        if (version) {
+            *version = current;
+        }
+        return 1;
+    }
+
+    uint64_t next = new_version != KEY_VERSION_NONE ? new_version
+                  : e ? e->version + 1 : ls->version_floor + 1;
+    struct log_file* f;
+    uint64_t offset;
+    if (log_append(ls, key, len, value, (uint32_t)value_size, expires_at, next, 0,
+                   &f, &offset) != 0 ||
+        keydir_set(ls, key, len, f, offset, (uint32_t)value_size, expires_at, next) != 0) {
+        return -1;
+    }
+    if (version) {
+        *version = next;
+    }
+    return 0;
+}
+
+static int log_put(storage_t* db, const char* key, const char* value, size_t value_size,
+                   uint32_t expires_at, uint64_t expected_version, uint64_t* version) {
+    return log_write(log_of(db), key, value, value_size, expires_at, expected_version,
+                     KEY_VERSION_NONE, version);
+}
+
+static int log_put_version(storage_t* db, const char* key, const char* value,
+                           size_t value_size, uint32_t expires_at, uint64_t version) {
+    return log_write(log_of(db), key, value, value_size, expires_at, KEY_VERSION_ANY, version,
+                     NULL);
+}
+
+static int log_get(storage_t* db, const char* key, char* value, size_t* value_size) {
+    struct log_state* ls = log_of(db);
+    if (!key || !value_size) {
+        return -1;
+    }
+    struct keydir_entry* e = lookup_live(ls, key);
+    if (!e) {
+        return -1;
+    }
+    if (!value) {
+        *value_size = e->value_size;
+        return 0;
+    }
+    if (*value_size < e->value_size) {
+        *value_size = e->value_size;
+        return -1;
+    }
+    if (read_entry_value(e, value) != 0) {
+        TRACE_ERROR("GET: failed to read value for key '%s'", key);
+        return -1;
+    }
+    *value_size = e->value_size;
+    return 0;
+}
+
+static int log_delete(storage_t* db, const char* key) {
+    struct log_state* ls = log_of(db);
+    if (!key) {
+        return -1;
+    }
+    size_t len = strlen(key);
+    struct keydir_entry* e = keydir_find(ls, key, len);
+    if (!e || append_tombstone(ls, key, len, e->version) != 0) {
+        return -1;
+    }
+    keydir_remove(ls, key, len);
+    return 0;
+}
+
+static int log_stat(storage_t* db, const char* key, struct storage_key_info* info) {
+    struct log_state* ls = log_of(db);
+    if (!key || !info) {
+        return -1;
+    }
+    struct keydir_entry* e = lookup_live(ls, key);
+    if (!e) {
+        return -1;
+    }
+    info->value_size = e->value_size;
+    info->expires_at = e->expires_at;
+    info->version = e->version;
+    return 0;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    return strcmp((*(struct keydir_entry* const*)a)->key, (*(struct keydir_entry* const*)b)->key);
+}
+
+// Visit `entries` (sorted) from the first key >= the bounds, as storage_scan
+static int scan_sorted(struct keydir_entry** entries, size_t count, const char* start,
+                       const char* end, const char* prefix, storage_scan_fn fn, void* arg) {
+    start = start ? start : "";
+    end = end ? end : "";
+    prefix = prefix ? prefix : "";
+    size_t prefix_len = strlen(prefix);
+    const char* from = strcmp(prefix, start) > 0 ? prefix : start;
+
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(entries[mid]->key, from) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    char* buf = NULL;
+    size_t buf_cap = 0;
+    int visited = 0;
+    int rc = 0;
+    uint32_t now = (uint32_t)time(NULL);
+    for (size_t i = lo; i < count; i++) {
+        const struct keydir_entry* e = entries[i];
+        if (strncmp(e->key, prefix, prefix_len) != 0 || (end[0] && strcmp(e->key, end) >= 0)) {
+            break;
+        }
+        if (entry_expired(e, now)) {
+            continue;
+        }
+        if (e->value_size > buf_cap) {
+            char* grown = pool_realloc(buf, e->value_size);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            buf = grown;
+            buf_cap = e->value_size;
+        }
+        if (read_entry_value(e, buf) != 0) {
+            TRACE_ERROR("SCAN: failed to read value for key '%s'", e->key);
+            rc = -1;
+            break;
+        }
+        visited++;
+        if (fn(e->key, buf, e->value_size, arg) != 0) {
+            break;
+        }
+    }
+    pool_free(buf);
+    return rc < 0 ? -1 : visited;
+}
+
+// The keydir has no order, so a scan gathers the keys in range and sorts them
+static int log_scan(storage_t* db, const char* start, const char* end, const char* prefix,
+                    storage_scan_fn fn, void* arg) {
+    struct log_state* ls = log_of(db);
+    if (!fn) {
+        return -1;
+    }
+    const char* lo = start ? start : "";
+    const char* hi = end ? end : "";
+    const char* pfx = prefix ? prefix : "";
+    size_t pfx_len = strlen(pfx);
+
+    struct keydir_entry** match = pool_alloc((ls->key_count ? ls->key_count : 1) * sizeof(*match));
+    if (!match) {
+        return -1;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < ls->bucket_count; i++) {
+        for (struct keydir_entry* e = ls->buckets[i]; e; e = e->next) {
+            if (strncmp(e->key, pfx, pfx_len) == 0 && strcmp(e->key, lo) >= 0 &&
+                (!hi[0] || strcmp(e->key, hi) < 0)) {
+                match[count++] = e;
+            }
+        }
+    }
+    qsort(match, count, sizeof(*match), compare_entries);
+    int visited = scan_sorted(match, count, start, end, prefix, fn, arg);
+    pool_free(match);
+    return visited;
+}
+
+static void log_stats(storage_t* db, struct storage_stats* stats) {
+    struct log_state* ls = log_of(db);
+    stats->engine = log_engine.name;
+    stats->keys = ls->key_count;
+    for (uint32_t i = 0; i < ls->file_count; i++) {
+        stats->bytes_total += ls->files[i]->size;
+        stats->bytes_used += ls->files[i]->live;
+    }
+}
+
+// A snapshot copies the keydir, sorted; merges wait until it is released so
+// every file it points into stays
+static int log_snapshot_create(storage_t* db) {
+    struct log_state* ls = log_of(db);
+    if (ls->snapshot_active) {
+        return -1;
+    }
+    ls->snapshot = malloc((ls->key_count ? ls->key_count : 1) * sizeof(*ls->snapshot));
+    if (!ls->snapshot) {
+        return -1;
+    }
+    ls->snapshot_active = 1;
+    ls->snapshot_count = 0;
+    for (size_t i = 0; i < ls->bucket_count; i++) {
+        for (struct keydir_entry* e = ls->buckets[i]; e; e = e->next) {
+            struct keydir_entry* copy = malloc(sizeof(*e) + e->key_len + 1);
+            if (!copy) {
+                log_snapshot_release(db);
+                return -1;
+            }
+            memcpy(copy, e, sizeof(*e) + e->key_len + 1);
+            copy->next = NULL;
+            ls->snapshot[ls->snapshot_count++] = copy;
+        }
+    }
+    qsort(ls->snapshot, ls->snapshot_count, sizeof(*ls->snapshot), compare_entries);
+    TRACE_INFO("log: snapshot taken, %zu keys", ls->snapshot_count);
+    return 0;
+}
+
+static int log_snapshot_scan(storage_t* db, const char* start, const char* end,
+                             const char* prefix, storage_scan_fn fn, void* arg) {
+    struct log_state* ls = log_of(db);
+    if (!ls->snapshot_active || !fn) {
+        return -1;
+    }
+    return scan_sorted(ls->snapshot, ls->snapshot_count, start, end, prefix, fn, arg);
+}
+
+static void log_snapshot_release(storage_t* db) {
+    struct log_state* ls = log_of(db);
+    for (size_t i = 0; i < ls->snapshot_count; i++) {
+        free(ls->snapshot[i]);
+    }
+    free(ls->snapshot);
+    ls->snapshot = NULL;
+    ls->snapshot_count = 0;
+    ls->snapshot_active = 0;
+}
+
+// Nothing to rebuild at open but the keydir, so a checkpoint only makes
+// what was appended durable
+static int log_checkpoint(storage_t* db) {
+    struct log_state* ls = log_of(db);
+    return fdatasync(active_file(ls)->fd);
+}
+
+static int log_list_expiring(storage_t* db, storage_expiry_fn fn, void* arg) {
+    struct log_state* ls = log_of(db);
+    if (!fn) {
+        return -1;
+    }
+    int visited = 0;
+    for (size_t i = 0; i < ls->bucket_count; i++) {
+        for (struct keydir_entry* e = ls->buckets[i]; e; e = e->next) {
+            if (e->expires_at != 0) {
+                fn(e->key, e->expires_at, arg);
+                visited++;
+            }
+        }
+    }
+    return visited;
+}
+
+static int log_expire(storage_t* db, const char* const* keys, size_t count,
+                      storage_expiry_fn fn, void* arg) {
+    struct log_state* ls = log_of(db);
+    if (!keys && count > 0) {
+        return -1;
+    }
+    uint32_t now = (uint32_t)time(NULL);
+    int reclaimed = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(keys[i]);
+        struct keydir_entry* e = keydir_find(ls, keys[i], len);
+        if (!e || !entry_expired(e, now)) {
+            continue;  // Deleted or rewritten since it was scheduled
+        }
+        uint32_t expires_at = e->expires_at;
+        if (append_tombstone(ls, keys[i], len, e->version) != 0) {
+            return -1;
+        }
+        keydir_remove(ls, keys[i], len);
+        reclaimed++;
+        if (fn) {
+            fn(keys[i], expires_at, arg);
+        }
+    }
+    return reclaimed;
+}
+
+// The closed file with the largest dead share past LOG_MERGE_DEAD_PERCENT.
+// Tombstones count as live except in the oldest file, where they are dropped.
+static struct log_file* merge_candidate(struct log_state* ls) {
+    struct log_file* best = NULL;
+    uint64_t best_dead = 0;
+    uint64_t best_size = 1;
+    for (uint32_t i = 0; i + 1 < ls->file_count; i++) {
+        struct log_file* f = ls->files[i];
+        uint64_t dead = f->size - f->live + (i == 0 ? f->tombstones : 0);
+        if (f->size == 0 || dead * 100 < f->size * LOG_MERGE_DEAD_PERCENT) {
+            continue;
+        }
+        if (!best || dead * best_size > best_dead * f->size) {
+            best = f;
+            best_dead = dead;
+            best_size = f->size;
+        }
+    }
+    return best;
+}
+
+// Keep the version floor in the header, for when the tombstones that set
+// it are gone
+static int save_version_floor(struct log_state* ls) {
+    int fd = open(ls->filename, O_RDWR);
+    if (fd < 0) {
+        return -1;
+    }
+    uint64_t floor = ls->version_floor;
+    int rc = pwrite(fd, &floor, sizeof(floor), offsetof(struct log_header, version_floor)) ==
+             (ssize_t)sizeof(floor) && fdatasync(fd) == 0 ? 0 : -1;
+    close(fd);
+    return rc;
+}
+
+static void merge_finish(struct log_state* ls, struct log_file* f) {
+    char path[4096];
+    file_path(ls, f->id, path, sizeof(path));
+    uint32_t i = 0;
+    while (ls->files[i] != f) {
+        i++;
+    }
+    memmove(&ls->files[i], &ls->files[i + 1], (ls->file_count - i - 1) * sizeof(*ls->files));
+    ls->file_count--;
+    close(f->fd);
+    unlink(path);
+    TRACE_INFO("log: merged data file %u (%llu bytes)", f->id, (unsigned long long)f->size);
+    free(f);
+}
+
+// Merge step: append the live records of one mostly dead file again, up to
+// about `budget` bytes of I/O, and remove the file once it is done. In the
+// stats a chain is a record looked at or moved, a break a dead one dropped.
+static long log_compact_step(storage_t* db, char* cursor, size_t budget,
+                             struct storage_compact_stats* stats) {
+    struct log_state* ls = log_of(db);
+    if (!cursor || !stats) {
+        return -1;
+    }
+    if (ls->snapshot_active) {
+        cursor[0] = '\0';
+        return 0;
+    }
+    if (!ls->merging) {
+        ls->merging = merge_candidate(ls);
+        ls->merge_offset = 0;
+        if (!ls->merging) {
+            cursor[0] = '\0';  // Nothing worth merging
+            return 0;
+        }
+    }
+
+    struct log_file* f = ls->merging;
+    int oldest = f == ls->files[0];
+    struct log_reader r = { f->fd, pool_alloc(LOG_READ_BYTES), LOG_READ_BYTES, 0, 0 };
+    if (!r.buf) {
+        return -1;
+    }
+    long spent = 0;
+    int rc = 0;
+    while (ls->merge_offset < f->size && (spent == 0 || (size_t)spent < budget)) {
+        const char* rec;
+        const struct log_record* h = read_record(&r, ls->merge_offset, f->size, &rec);
+        if (!h) {
+            // Skipped at open as well: nothing past it is in the keydir
+            ls->merge_offset = f->size;
+            break;
+        }
+        struct log_record hdr = *h;
+        char key[MAX_KEY_SIZE];
+        memcpy(key, rec + sizeof(hdr), hdr.key_len);
+        key[hdr.key_len] = '\0';
+        size_t total = record_size(hdr.key_len, hdr.value_size);
+        struct keydir_entry* e = keydir_find(ls, key, hdr.key_len);
+        stats->chains_checked++;
+        spent += (long)total;
+
+        struct log_file* to;
+        uint64_t offset;
+        if (hdr.flags & LOG_RECORD_TOMBSTONE) {
+            // Still needed while an older file may hold the key
+            if (!e && !oldest) {
+                if (append_tombstone(ls, key, hdr.key_len, hdr.version) != 0) {
+                    rc = -1;
+                    break;
+                }
+                stats->chains_moved++;
+                spent += (long)total;
+            } else {
+                stats->breaks_found++;
+                stats->breaks_removed++;
+            }
+        } else if (e && e->file == f && e->offset == ls->merge_offset) {
+            if (log_append(ls, key, hdr.key_len, rec + sizeof(hdr) + hdr.key_len, hdr.value_size,
+                           hdr.expires_at, hdr.version, 0, &to, &offset) != 0) {
+                rc = -1;
+                break;
+            }
+            f->live -= total;
+            to->live += total;
+            e->file = to;
+            e->offset = offset;
+            stats->chains_moved++;
+            spent += (long)total;
+        } else {
+            stats->breaks_found++;
+            stats->breaks_removed++;
+        }
+        ls->merge_offset += total;
+    }
+    pool_free(r.buf);
+    if (rc != 0) {
+        return -1;
+    }
+
+    if (ls->merge_offset >= f->size) {
+        // The copies must be on disk before the originals go, and the
+        // oldest file's dropped tombstones must be covered by the floor
+        if (fdatasync(active_file(ls)->fd) != 0 || (oldest && save_version_floor(ls) != 0)) {
+            return -1;
+        }
+        stats->blocks_moved++;
+        merge_finish(ls, f);
+        ls->merging = NULL;
+        if (merge_candidate(ls)) {
+            snprintf(cursor, MAX_KEY_SIZE, "%s", LOG_MERGING);  // The pass goes on to the next
+        } else {
+            cursor[0] = '\0';
+        }
+    } else {
+        snprintf(cursor, MAX_KEY_SIZE, "%s", LOG_MERGING);
+    }
+    return spent;
+}
+
+const struct storage_engine log_engine = {
+    .name = "log",
+    .magic = LOG_MAGIC,
+    .open = log_open,
+    .close = log_close,
+    .put = log_put,
+    .put_version = log_put_version,
+    .get = log_get,
+    .remove = log_delete,
+    .stat = log_stat,
+    .scan = log_scan,
+    .stats = log_stats,
+    .snapshot_create = log_snapshot_create,
+    .snapshot_scan = log_snapshot_scan,
+    .snapshot_release = log_snapshot_release,
+    .checkpoint = log_checkpoint,
+    .list_expiring = log_list_expiring,
+    .expire = log_expire,
+    .compact_step = log_compact_step,
+    .check = NULL,
+    .set_compression = NULL
+};
@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <string.h>
+#include "../../include/core/lz.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5   // Block always ends with at least this many literals
+#define LZ_MFLIMIT 12        // No match may start this close to the end
+#define LZ_SKIP_TRIGGER 6    // Probe less often the longer nothing matches
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Length of the common prefix of `m` and `r`, stopping at `limit`
+static size_t match_length(const uint8_t* m, const uint8_t* r, const uint8_t* limit) {
+    const uint8_t* start = m;
+    while (m + 8 <= limit) {
+        uint64_t diff = read64(m) ^ read64(r);
+        if (diff) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return (size_t)(m - start) + ((size_t)__builtin_ctzll(diff) >> 3);
+#else
+            return (size_t)(m - start) + ((size_t)__builtin_clzll(diff) >> 3);
+#endif
+        }
+        m += 8;
+        r += 8;
+    }
+    while (m < limit && *m == *r) {
+        m++;
+        r++;
+    }
+    return (size_t)(m - start);
+}
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Length continuation bytes after a saturated 4-bit token field
+static uint8_t* put_length(uint8_t* op, const uint8_t* oend, size_t len) {
+    while (len >= 255) {
+        if (op >= oend) return NULL;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend) return NULL;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// One sequence: literals, then a match (match_len 0 = final literal run)
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* oend,
+                             const uint8_t* lit, size_t lit_len,
+                             size_t offset, size_t match_len) {
+    if (op >= oend) return NULL;
+    uint8_t* token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15 && !(op = put_length(op, oend, lit_len - 15))) return NULL;
+
+    if ((size_t)(oend - op) < lit_len) return NULL;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len == 0) {
+        return op;
+    }
+
+    if (oend - op < 2) return NULL;
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+
+    size_t ml = match_len - LZ_MIN_MATCH;
+    *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+    if (ml >= 15 && !(op = put_length(op, oend, ml - 15))) return NULL;
+    return op;
+}
+
+size_t lz_compress(const void* src, size_t src_len, void* dst, size_t dst_cap) {
+    const uint8_t* base = src;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    const uint8_t* end = base + src_len;
+    uint8_t* op = dst;
+    const uint8_t* oend = op + dst_cap;
+    uint32_t table[1 << LZ_HASH_BITS];
+
+    memset(table, 0, sizeof(table));
+
+    if (src_len > LZ_MFLIMIT) {
+        const uint8_t* mflimit = end - LZ_MFLIMIT;
+        const uint8_t* matchlimit = end - LZ_LAST_LITERALS;
+        ip++;
+
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            const uint8_t* ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+                ip += 1 + ((size_t)(ip - anchor) >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+
+            // Extend backwards over pending literals, then forwards
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* m = ip + LZ_MIN_MATCH;
+            m += match_length(m, ref + LZ_MIN_MATCH, matchlimit);
+
+            op = put_sequence(op, oend, anchor, (size_t)(ip - anchor),
+                              (size_t)(ip - ref), (size_t)(m - ip));
+            if (!op) {
+                return 0;
+            }
+            ip = m;
+            anchor = ip;
+
+            // Seed the table inside the match so the next probe has a chance
+            if (ip < mflimit) {
+                table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+            }
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    if (!op) {
+        return 0;
+    }
+    return (size_t)(op - (uint8_t*)dst);
+}
+
+// Read continuation bytes of a saturated length field
+static int get_length(const uint8_t** ip, const uint8_t* iend, size_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz_decompress(const void* src, size_t src_len, void* dst, size_t* dst_len) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = ip + src_len;
+    uint8_t* out = dst;
+    uint8_t* op = out;
+    const uint8_t* oend = out + *dst_len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && get_length(&ip, iend, &lit_len) != 0) return -1;
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == iend) {
+            break;  // Final literal run
+        }
+
+        if (iend - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out)) return -1;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && get_length(&ip, iend, &match_len) != 0) return -1;
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) return -1;
+
+        const uint8_t* match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            // Overlapping copy repeats the last `offset` bytes; everything
+            // from `match` to `op` is periodic, so the chunk can double
+            while (match_len > 0) {
+                size_t chunk = (size_t)(op - match);
+                if (chunk > match_len) chunk = match_len;
+                memcpy(op, match, chunk);
+                op += chunk;
+                match_len -= chunk;
+            }
+        }
+    }
+
+    *dst_len = (size_t)(op - out);
+    return 0;
+}
@@ -1,38 +1,186 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/un.h>
 #include "../../include/core/daemon.h"
+#include "../../include/core/value_cache.h"
+
+#define MEMORY_STORE_NAME "memory"  // Names a volatile store given no path
 
 void show_usage(const char* program_name) {
     printf("Usage: %s [options] <storage_file>\n", program_name);
     printf("\nOptions:\n");
+    printf("  -b, --block-size <bytes>  Block size for a new storage file, power of two\n");
+    printf("                            from %d to %d (default %d)\n",
+           MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, DEFAULT_BLOCK_SIZE);
+    printf("  -c, --compress-threshold <bytes>  Compress values at least this large\n");
+    printf("                            (default %d, 0 disables)\n", DEFAULT_COMPRESS_THRESHOLD);
+    printf("  -m, --cache-mb <MB>       Memory for the hot value cache\n");
+    printf("                            (default %llu, 0 disables)\n", DEFAULT_CACHE_BYTES >> 20);
+    printf("  -k, --compact-mbps <MB/s> Disk bandwidth for background compaction\n");
+    printf("                            (default %d, 0 disables)\n", DEFAULT_COMPACT_MBPS);
+    printf("  -n, --shards <N>          Split keys over N storage files, each served by\n");
+    printf("                            a thread pinned to its own CPU (0 = one per CPU,\n");
+    printf("                            at most %d; default 1)\n", MAX_SHARDS);
+    printf("  -s, --socket <path>       Listen on this Unix socket (default %s)\n", SOCKET_PATH);
+    printf("  -f, --follow <socket>     Run as a read-only replica of the daemon\n");
+    printf("                            listening on <socket>\n");
+    printf("  -e, --engine <block|log>  Engine for a new storage file: block chains\n");
+    printf("                            under a B+tree (default), or append-only log\n");
+    printf("                            files under an in-memory hash index\n");
+    printf("  -M, --memory              Keep everything in memory (huge pages where\n");
+    printf("                            available): no files, contents lost on exit\n");
     printf("  -h, --help     Show this help message\n");
     printf("\nArguments:\n");
-    printf("  storage_file   Path to the storage file (will be created if it doesn't exist)\n");
+    printf("  storage_file   Path to the storage file (will be created if it doesn't exist);\n");
+    printf("                 with --memory only a name, default \"%s\"\n", MEMORY_STORE_NAME);
     printf("\nExample:\n");
     printf("  %s /var/lib/storage/data.db\n", program_name);
     printf("  %s ./storage.db\n", program_name);
+    printf("  %s --block-size 512 ./small_values.db\n", program_name);
+    printf("  %s --shards 0 ./storage.db\n", program_name);
+    printf("  %s -s /tmp/replica.sock -f %s ./replica.db\n", program_name, SOCKET_PATH);
+    printf("  %s --engine log ./writes.db\n", program_name);
+    printf("  %s --memory --shards 0\n", program_name);
     printf("\nThe daemon will:\n");
     printf("  - Run in the background\n");
-    printf("  - Listen on /tmp/storage_daemon.sock\n");
+    printf("  - Listen on %s (clients honour $%s)\n", SOCKET_PATH, SOCKET_ENV);
     printf("  - Log to syslog\n");
     printf("  - Handle SIGTERM/SIGINT for graceful shutdown\n");
 }
 
 int main(int argc, char* argv[]) {
+    static const struct option long_options[] = {
+        {"block-size", required_argument, NULL, 'b'},
+        {"compress-threshold", required_argument, NULL, 'c'},
+        {"cache-mb", required_argument, NULL, 'm'},
+        {"compact-mbps", required_argument, NULL, 'k'},
+        {"shards", required_argument, NULL, 'n'},
+        {"socket", required_argument, NULL, 's'},
+        {"follow", required_argument, NULL, 'f'},
+        {"engine", required_argument, NULL, 'e'},
+        {"memory", no_argument, NULL, 'M'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    struct daemon_options options;
+    memset(&options, 0, sizeof(options));
+    options.compress_threshold = DEFAULT_COMPRESS_THRESHOLD;
+    options.cache_bytes = DEFAULT_CACHE_BYTES;
+    options.compact_rate = (size_t)DEFAULT_COMPACT_MBPS << 20;
+
     // Parse command line arguments
-    if (argc < 2) {
-        show_usage(argv[0]);
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:c:m:k:n:s:f:e:Mh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b': {
+                char* end;
+                unsigned long size = strtoul(optarg, &end, 10);
+                if (*end != '\0' || size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE ||
+                    (size & (size - 1)) != 0) {
+                    fprintf(stderr, "Error: Block size must be a power of two from %d to %d\n",
+                            MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+                    return 1;
+                }
+                options.format.block_size = (uint32_t)size;
+                break;
+            }
+            case 'c': {
+                char* end;
+                unsigned long threshold = strtoul(optarg, &end, 10);
+                if (*end != '\0' || optarg[0] == '\0') {
+                    fprintf(stderr, "Error: Invalid compression threshold: %s\n", optarg);
+                    return 1;
+                }
+                options.compress_threshold = threshold;
+                break;
+            }
+            case 'm': {
+                char* end;
+                unsigned long mb = strtoul(optarg, &end, 10);
+                if (*end != '\0' || optarg[0] == '\0') {
+                    fprintf(stderr, "Error: Invalid cache size: %s\n", optarg);
+                    return 1;
+                }
+                options.cache_bytes = (size_t)mb << 20;
+                break;
+            }
+            case 'k': {
+                char* end;
+                unsigned long mbps = strtoul(optarg, &end, 10);
+                if (*end != '\0' || optarg[0] == '\0') {
+                    fprintf(stderr, "Error: Invalid compaction rate: %s\n", optarg);
+                    return 1;
+                }
+                options.compact_rate = (size_t)mbps << 20;
+                break;
+            }
+            case 'n': {
+                char* end;
+                unsigned long count = strtoul(optarg, &end, 10);
+                if (*end != '\0' || optarg[0] == '\0' || count > MAX_SHARDS) {
+                    fprintf(stderr, "Error: Shard count must be from 0 to %d\n", MAX_SHARDS);
+                    return 1;
+                }
+                if (count == 0) {
+                    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    count = cpus < 1 ? 1 : cpus > MAX_SHARDS ? MAX_SHARDS : (unsigned long)cpus;
+                }
+                options.shards = (uint32_t)count;
+                break;
+            }
+            case 's':
+            case 'f':
+                // The daemon changes to / once detached
+                if (optarg[0] != '/') {
+                    fprintf(stderr, "Error: Socket path must be absolute: %s\n", optarg);
+                    return 1;
+                }
+                if (strlen(optarg) >= sizeof(((struct sockaddr_un*)0)->sun_path)) {
+                    fprintf(stderr, "Error: Socket path too long: %s\n", optarg);
+                    return 1;
+                }
+                if (opt == 's') {
+                    options.socket_path = optarg;
+                } else {
+                    options.follow = optarg;
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "block") == 0) {
+                    options.format.engine = STORAGE_ENGINE_BLOCK;
+                } else if (strcmp(optarg, "log") == 0) {
+                    options.format.engine = STORAGE_ENGINE_LOG;
+                } else {
+                    fprintf(stderr, "Error: Engine must be block or log: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'M':
+                options.format.in_memory = 1;
+                break;
+            case 'h':
+                show_usage(argv[0]);
+                return 0;
+            default:
+                show_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (options.format.in_memory && options.format.engine != STORAGE_ENGINE_BLOCK) {
+        fprintf(stderr, "Error: --memory uses the block engine\n");
         return 1;
     }
     
-    // Check for help flag
-    if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+    if (optind >= argc && !options.format.in_memory) {
         show_usage(argv[0]);
-        return 0;
+        return 1;
     }
     
-    const char* storage_file = argv[1];
+    const char* storage_file = optind < argc ? argv[optind] : MEMORY_STORE_NAME;
     
     // Validate storage file path
     if (strlen(storage_file) == 0) {
@@ -40,13 +188,17 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    printf("Starting storage daemon with file: %s\n", storage_file);
+    if (options.format.in_memory) {
+        printf("Starting storage daemon with volatile storage: %s\n", storage_file);
+    } else {
+        printf("Starting storage daemon with file: %s\n", storage_file);
+    }
     printf("The daemon will run in the background.\n");
     printf("Check syslog for daemon messages: sudo tail -f /var/log/syslog | grep storage_daemon\n");
     printf("Connect using: ./storage_client put key value\n");
     
     // Start the daemon
-    int result = daemon_start(storage_file);
+    int result = daemon_start(storage_file, &options);
     
     if (result != 0) {
         fprintf(stderr, "Failed to start daemon\n");
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "../../include/core/repl_log.h"
+#include "../../include/core/daemon.h"
+#include "../../include/core/buf_pool.h"
+
+#define SLOT(seq) ((seq) & (REPL_LOG_RECORDS - 1))
+
+static uint64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+size_t repl_frame_size(size_t key_len, uint32_t value_size) {
+    return sizeof(struct message_header) + sizeof(struct repl_record) + key_len + value_size;
+}
+
+void repl_frame_encode(char* buf, uint64_t seq, uint8_t op, const char* key,
+                       const char* value, uint32_t value_size, uint32_t expires_at,
+                       uint64_t version) {
+    size_t key_len = strlen(key);
+    struct message_header header = {
+        .type = MSG_REPL_RECORD,
+        .payload_size = (uint32_t)(sizeof(struct repl_record) + key_len + value_size),
+        .sequence_id = (uint32_t)seq,
+        .reserved = 0
+    };
+    struct repl_record rec = {
+        .seq = seq,
+        .time_ms = wall_ms(),
+        .version = version,
+        .expires_at = expires_at,
+        .value_size = value_size,
+        .key_len = (uint16_t)key_len,
+        .op = op
+    };
+    memcpy(buf, &header, sizeof(header));
+    buf += sizeof(header);
+    memcpy(buf, &rec, sizeof(rec));
+    buf += sizeof(rec);
+    memcpy(buf, key, key_len);
+    if (value_size > 0) {
+        memcpy(buf + key_len, value, value_size);
+    }
+}
+
+static size_t frame_bytes(const char* frame) {
+    struct message_header header;
+    memcpy(&header, frame, sizeof(header));
+    return sizeof(header) + header.payload_size;
+}
+
+// Drop the oldest record
+static void drop_oldest(struct repl_log* log) {
+    char** slot = &log->frames[SLOT(log->first_seq)];
+    log->bytes -= frame_bytes(*slot);
+    pool_free(*slot);
+    *slot = NULL;
+    log->first_seq++;
+}
+
+int repl_log_init(struct repl_log* log, size_t budget) {
+    memset(log, 0, sizeof(*log));
+    log->frames = calloc(REPL_LOG_RECORDS, sizeof(*log->frames));
+    if (!log->frames) {
+        return -1;
+    }
+    log->budget = budget;
+    log->first_seq = log->next_seq = 1;
+    log->epoch = ((uint64_t)time(NULL) << 20) ^ (uint64_t)clock();
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->grown, NULL);
+    return 0;
+}
+
+void repl_log_destroy(struct repl_log* log) {
+    if (!log->frames) {
+        return;
+    }
+    while (log->first_seq < log->next_seq) {
+        drop_oldest(log);
+    }
+    free(log->frames);
+    log->frames = NULL;
+    pthread_cond_destroy(&log->grown);
+    pthread_mutex_destroy(&log->lock);
+}
+
+void repl_log_close(struct repl_log* log) {
+    pthread_mutex_lock(&log->lock);
+    log->closed = 1;
+    pthread_cond_broadcast(&log->grown);
+    pthread_mutex_unlock(&log->lock);
+}
+
+uint64_t repl_log_enable(struct repl_log* log) {
+    pthread_mutex_lock(&log->lock);
+    __atomic_store_n(&log->enabled, 1, __ATOMIC_RELEASE);
+    uint64_t last = log->next_seq - 1;
+    pthread_mutex_unlock(&log->lock);
+    return last;
+}
+
+uint64_t repl_log_append(struct repl_log* log, uint8_t op, const char* key,
+                         const char* value, uint32_t value_size, uint32_t expires_at,
+                         uint64_t version) {
+    size_t size = repl_frame_size(strlen(key), value_size);
+    // Built outside the lock; a disabled log only counts
+    char* frame = __atomic_load_n(&log->enabled, __ATOMIC_ACQUIRE) ? pool_alloc(size) : NULL;
+
+    pthread_mutex_lock(&log->lock);
+    uint64_t seq = log->next_seq++;
+    if (!frame) {
+        // Disabled, or out of memory: readers behind this point resync
+        while (log->first_seq < log->next_seq - 1) {
+            drop_oldest(log);
+        }
+        log->first_seq = log->next_seq;
+    } else {
+        repl_frame_encode(frame, seq, op, key, value, value_size, expires_at, version);
+        while (log->first_seq < seq &&
+               (seq - log->first_seq >= REPL_LOG_RECORDS || log->bytes + size > log->budget)) {
+            drop_oldest(log);
+        }
+        log->frames[SLOT(seq)] = frame;
+        log->bytes += size;
+        pthread_cond_broadcast(&log->grown);
+    }
+    pthread_mutex_unlock(&log->lock);
+    return seq;
+}
+
+long repl_log_read(struct repl_log* log, uint64_t after, char* buf, size_t cap,
+                   uint64_t* last, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    while (!log->closed && after + 1 >= log->next_seq && after + 1 >= log->first_seq) {
+        if (pthread_cond_timedwait(&log->grown, &log->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (log->closed || after + 1 < log->first_seq || after >= log->next_seq) {
+        pthread_mutex_unlock(&log->lock);
+        return -1;  // Dropped already (or from a different run)
+    }
+
+    size_t len = 0;
+    uint64_t seq = after + 1;
+    while (seq < log->next_seq) {
+        const char* frame = log->frames[SLOT(seq)];
+        size_t size = frame_bytes(frame);
+        if (len > 0 && len + size > cap) {
+            break;
+        }
+        if (size > cap) {
+            pthread_mutex_unlock(&log->lock);
+            return -1;
+        }
+        memcpy(buf + len, frame, size);
+        len += size;
+        seq++;
+    }
+    pthread_mutex_unlock(&log->lock);
+    *last = seq - 1;
+    return (long)len;
+}
+
+int repl_log_enabled(struct repl_log* log) {
+    return __atomic_load_n(&log->enabled, __ATOMIC_ACQUIRE);
+}
+
+uint64_t repl_log_last(struct repl_log* log) {
+    pthread_mutex_lock(&log->lock);
+    uint64_t last = log->next_seq - 1;
+    pthread_mutex_unlock(&log->lock);
+    return last;
+}
@@ -1,440 +1,2688 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
 #include "../../include/core/storage.h"
+#include "../../include/core/storage_engine.h"
+#include "../../include/core/async_log.h"
+#include "../../include/core/lz.h"
+#include "../../include/core/btree.h"
+#include "../../include/core/bloom.h"
+#include "../../include/core/extent_tree.h"
+#include "../../include/core/buf_pool.h"
 
-// Global storage file descriptor
-static int storage_fd = -1;
-static char* storage_filename = NULL;
+#define BITS_PER_WORD 64
+#define FILTER_MIN_KEYS 1024  // Smallest key filter, in keys
+#define RUN_BUF_BYTES (256 * 1024)  // Contiguous blocks moved per syscall
+#define COMPACT_BATCH 32            // Keys looked at per compaction step
+#define CHECKPOINT_ALIGN 4096       // Filter offset in the checkpoint, for mmap
+#define HUGE_PAGE_BYTES (2UL << 20) // Volatile segments this aligned try MAP_HUGETLB
 
-// Helper function to find a free block in the bitmap
-static int find_free_block(struct metadata_block *meta) {
-    for (int i = 0; i < TOTAL_BLOCKS; i++) {
-        int byte_index = i / 8;
-        int bit_index = i % 8;
-        
-        if (!(meta->bitmap[byte_index] & (1 << bit_index))) {
-            return i;  // Found a free block
+_Static_assert(sizeof(struct metadata_block) == SUPERBLOCK_SIZE, "metadata_block must fill the superblock");
+
+// Block codecs. Each supported block size gets its own instantiation so the
+// payload size is a compile-time constant: blocks_needed() becomes a
+// multiply-shift instead of a runtime division, and encode/decode copy
+// fixed-size regions. The codec is picked once when storage is opened.
+struct block_codec {
+    uint32_t block_size;
+    uint32_t block_shift;
+    uint32_t payload;
+    size_t (*blocks_needed)(size_t value_size);
+    void (*encode)(void* block, uint32_t next, const char* data, size_t len);
+    const char* (*decode)(const void* block, uint32_t* next, size_t* len);
+};
+
+#define DEFINE_BLOCK_CODEC(SHIFT)                                               \
+    static size_t blocks_needed_##SHIFT(size_t value_size) {                    \
+        return (value_size + BLOCK_PAYLOAD(1u << SHIFT) - 1) /                  \
+               BLOCK_PAYLOAD(1u << SHIFT);                                      \
+    }                                                                           \
+    static void encode_block_##SHIFT(void* block, uint32_t next,                \
+                                     const char* data, size_t len) {            \
+        struct data_block_header* h = block;                                    \
+        h->next_block_id = next;                                                \
+        h->data_size = (uint32_t)len;                                           \
+        memcpy(h + 1, data, len);                                               \
+    }                                                                           \
+    static const char* decode_block_##SHIFT(const void* block, uint32_t* next,  \
+                                            size_t* len) {                      \
+        const struct data_block_header* h = block;                              \
+        *next = h->next_block_id;                                               \
+        *len = h->data_size <= BLOCK_PAYLOAD(1u << SHIFT)                       \
+             ? h->data_size : BLOCK_PAYLOAD(1u << SHIFT);                       \
+        return (const char*)(h + 1);                                            \
+    }
+
+#define BLOCK_CODEC_ENTRY(SHIFT) {                                              \
+        1u << SHIFT, SHIFT, BLOCK_PAYLOAD(1u << SHIFT),                         \
+        blocks_needed_##SHIFT, encode_block_##SHIFT, decode_block_##SHIFT       \
+    }
+
+DEFINE_BLOCK_CODEC(9)
+DEFINE_BLOCK_CODEC(10)
+DEFINE_BLOCK_CODEC(11)
+DEFINE_BLOCK_CODEC(12)
+DEFINE_BLOCK_CODEC(13)
+DEFINE_BLOCK_CODEC(14)
+DEFINE_BLOCK_CODEC(15)
+DEFINE_BLOCK_CODEC(16)
+
+static const struct block_codec block_codecs[] = {
+    BLOCK_CODEC_ENTRY(9),  BLOCK_CODEC_ENTRY(10), BLOCK_CODEC_ENTRY(11),
+    BLOCK_CODEC_ENTRY(12), BLOCK_CODEC_ENTRY(13), BLOCK_CODEC_ENTRY(14),
+    BLOCK_CODEC_ENTRY(15), BLOCK_CODEC_ENTRY(16)
+};
+
+static const struct block_codec* find_codec(uint32_t block_size) {
+    for (size_t i = 0; i < sizeof(block_codecs) / sizeof(block_codecs[0]); i++) {
+        if (block_codecs[i].block_size == block_size) {
+            return &block_codecs[i];
+        }
+    }
+    return NULL;
+}
+
+// One segment file. The allocation bitmap is what goes to disk; free space
+// is also kept as a tree of free runs, rebuilt from the bitmap at open, so
+// allocating a contiguous run is a best-fit lookup rather than a scan.
+struct segment {
+    int fd;
+    char* mem;               // Volatile storage: the segment itself, no fd
+    size_t mem_bytes;
+    int huge;                // mem is on MAP_HUGETLB pages
+    uint32_t nblocks;        // Current size (file size / block size)
+    uint32_t free_blocks;
+    uint64_t *bitmap;        // 1 bit per block, 1 = used
+    struct extent_tree extents;  // Free runs
+    uint8_t *dirty;          // On-disk bitmap blocks needing writeback
+    uint32_t dirty_lo;
+    uint32_t dirty_hi;       // Exclusive, 0 = nothing dirty
+    uint64_t *pinned;        // Bitmap as of the snapshot, NULL = none
+    uint64_t *deferred;      // Pinned blocks freed since, freed on release
+    uint32_t pinned_words;   // Segment size when the snapshot was taken
+};
+
+// One open storage: its segment files, key index and allocation state.
+// Every call takes the handle, so separate handles share nothing.
+struct storage_state {
+    const struct storage_engine* engine;  // &block_engine, see storage_engine.h
+    char* filename;
+    struct metadata_block meta;         // Cached superblock
+    struct segment segments[MAX_SEGMENTS];
+    uint32_t segment_count;
+    const struct block_codec* codec;
+    uint32_t header_blocks;             // Per segment, superblock/header
+    uint32_t bitmap_blocks;             // Per segment, from the format
+    uint32_t words_per_bitmap_block;
+    uint32_t alloc_segment;             // Lowest segment with free blocks
+    int meta_dirty;                     // Superblock counts changed
+    char* run_buf;                      // RUN_BUF_BYTES for batched I/O
+    uint32_t run_blocks;                // Blocks that fit in run_buf
+    size_t compress_threshold;
+    struct btree key_index;             // Ordered key -> index_entry
+    struct bloom key_filter;            // Every key in key_index, maybe more
+    size_t filter_stale;                // Deletes since the last rebuild
+    struct btree snapshot_index;        // Index clone, while a snapshot is held
+    int snapshot_active;
+    void* ckpt_map;                     // Checkpoint read at open (private mapping)
+    size_t ckpt_size;
+    int ckpt_gen_live;                  // A checkpoint file may carry meta's generation
+    int ckpt_current;                   // The checkpoint file matches the files as they are
+    int ckpt_loaded;                    // ...and it is the one at ckpt_map
+    int in_memory;                      // Segments and index in memory only
+};
+
+static int checkpoint_invalidate(storage_t* db);
+static int checkpoint_extents(storage_t* db, uint32_t seg);
+static void block_close(storage_t* db);
+static void block_snapshot_release(storage_t* db);
+
+static int storage_ready(storage_t* db) {
+    return db->segment_count > 0 && (db->segments[0].fd >= 0 || db->segments[0].mem);
+}
+
+static uint32_t reserved_blocks(storage_t* db) {
+    return db->header_blocks + db->bitmap_blocks;
+}
+
+static void segment_path(storage_t* db, uint32_t seg, char* buf, size_t size) {
+    if (seg == 0) {
+        snprintf(buf, size, "%s", db->filename);
+    } else {
+        snprintf(buf, size, "%s.%u", db->filename, seg);
+    }
+}
+
+// Block I/O - one positioned syscall per block. `len` lets callers read or
+// write just the used prefix of a block.
+static int read_block_bytes(storage_t* db, uint32_t addr, void* buf, size_t len) {
+    uint32_t seg = BLOCK_SEGMENT(addr);
+    if (seg >= db->segment_count || BLOCK_INDEX(addr) >= db->segments[seg].nblocks) {
+        return -1;
+    }
+    off_t offset = (off_t)BLOCK_INDEX(addr) << db->codec->block_shift;
+    if (db->segments[seg].mem) {
+        memcpy(buf, db->segments[seg].mem + offset, len);
+        return 0;
+    }
+    return pread(db->segments[seg].fd, buf, len, offset) == (ssize_t)len ? 0 : -1;
+}
+
+// Write `len` bytes starting `at` bytes into the block (APPEND fills a tail)
+static int write_block_at(storage_t* db, uint32_t addr, size_t at, const void* buf, size_t len) {
+    uint32_t seg = BLOCK_SEGMENT(addr);
+    if (seg >= db->segment_count || BLOCK_INDEX(addr) >= db->segments[seg].nblocks) {
+        return -1;
+    }
+    off_t offset = ((off_t)BLOCK_INDEX(addr) << db->codec->block_shift) + (off_t)at;
+    if (db->segments[seg].mem) {
+        memcpy(db->segments[seg].mem + offset, buf, len);
+        return 0;
+    }
+    return pwrite(db->segments[seg].fd, buf, len, offset) == (ssize_t)len ? 0 : -1;
+}
+
+static int write_block_bytes(storage_t* db, uint32_t addr, const void* buf, size_t len) {
+    return write_block_at(db, addr, 0, buf, len);
+}
+
+static int write_block(storage_t* db, uint32_t addr, const void* buf) {
+    return write_block_bytes(db, addr, buf, db->codec->block_size);
+}
+
+static void mark_dirty(storage_t* db, struct segment* s, uint32_t word) {
+    uint32_t blk = word / db->words_per_bitmap_block;
+    db->meta_dirty = 1;  // Every bitmap change moves the free count
+    s->dirty[blk] = 1;
+    if (s->dirty_hi == 0) {
+        s->dirty_lo = blk;
+        s->dirty_hi = blk + 1;
+    } else {
+        if (blk < s->dirty_lo) s->dirty_lo = blk;
+        if (blk >= s->dirty_hi) s->dirty_hi = blk + 1;
+    }
+}
+
+// Helper function to mark a block as used
+static void mark_block_used(storage_t* db, uint32_t addr) {
+    struct segment* s = &db->segments[BLOCK_SEGMENT(addr)];
+    uint32_t index = BLOCK_INDEX(addr);
+    uint32_t word = index / BITS_PER_WORD;
+
+    s->bitmap[word] |= 1ULL << (index % BITS_PER_WORD);
+    s->free_blocks--;
+    db->meta.free_blocks--;
+    mark_dirty(db, s, word);
+}
+
+// Whether the held snapshot may still read the block at `addr`
+static int block_pinned(storage_t* db, uint32_t addr) {
+    const struct segment* s = &db->segments[BLOCK_SEGMENT(addr)];
+    uint32_t index = BLOCK_INDEX(addr);
+    return s->pinned && index / BITS_PER_WORD < s->pinned_words &&
+           (s->pinned[index / BITS_PER_WORD] >> (index % BITS_PER_WORD)) & 1;
+}
+
+// Helper function to mark a block as free and return it to the free runs
+static void mark_block_free(storage_t* db, uint32_t addr) {
+    uint32_t seg = BLOCK_SEGMENT(addr);
+    struct segment* s = &db->segments[seg];
+    uint32_t index = BLOCK_INDEX(addr);
+    uint32_t word = index / BITS_PER_WORD;
+
+    if (block_pinned(db, addr)) {
+        // Stays allocated until the snapshot is released
+        s->deferred[word] |= 1ULL << (index % BITS_PER_WORD);
+        return;
+    }
+
+    if (extent_tree_free(&s->extents, index, 1) != 0) {
+        // Stays free in the bitmap and comes back at the next open
+        TRACE_WARN("storage: no memory to track free block %u", addr);
+    }
+    s->bitmap[word] &= ~(1ULL << (index % BITS_PER_WORD));
+    s->free_blocks++;
+    db->meta.free_blocks++;
+    mark_dirty(db, s, word);
+
+    if (seg < db->alloc_segment) {
+        db->alloc_segment = seg;
+    }
+}
+
+// Write back the bitmap blocks touched since the last flush. Volatile
+// storage never reads them back, so there they are only marked clean.
+static int flush_bitmaps(storage_t* db) {
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        struct segment* s = &db->segments[seg];
+        if (s->mem) {
+            memset(s->dirty + s->dirty_lo, 0, s->dirty_hi - s->dirty_lo);
+            s->dirty_lo = s->dirty_hi = 0;
+            continue;
+        }
+        for (uint32_t blk = s->dirty_lo; blk < s->dirty_hi; blk++) {
+            if (!s->dirty[blk]) {
+                continue;
+            }
+            if (checkpoint_invalidate(db) != 0) {
+                return -1;
+            }
+            const uint64_t* words = s->bitmap + (size_t)blk * db->words_per_bitmap_block;
+            if (write_block(db, BLOCK_ADDR(seg, db->header_blocks + blk), words) != 0) {
+                return -1;
+            }
+            s->dirty[blk] = 0;
+        }
+        s->dirty_lo = s->dirty_hi = 0;
+    }
+    return 0;
+}
+
+// Extend a segment file from old_blocks to new_blocks with fallocate
+// (ftruncate where the filesystem does not support it)
+static int extend_file(storage_t* db, int fd, uint32_t old_blocks, uint32_t new_blocks) {
+    off_t offset = (off_t)old_blocks << db->codec->block_shift;
+    off_t len = (off_t)(new_blocks - old_blocks) << db->codec->block_shift;
+
+    if (fallocate(fd, 0, offset, len) == 0) {
+        return 0;
+    }
+    if (errno != EOPNOTSUPP) {
+        return -1;
+    }
+    return ftruncate(fd, offset + len);
+}
+
+// Map `nblocks` of anonymous memory for a volatile segment: explicit huge
+// pages when the size allows and the pool has them, otherwise normal pages
+// with transparent huge pages requested
+static int memory_map(storage_t* db, struct segment* s, uint32_t nblocks) {
+    size_t bytes = (size_t)nblocks << db->codec->block_shift;
+    void* p = MAP_FAILED;
+    s->huge = 0;
+    if (bytes % HUGE_PAGE_BYTES == 0) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        s->huge = p != MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return -1;
+        }
+        madvise(p, bytes, MADV_HUGEPAGE);
+    }
+    s->mem = p;
+    s->mem_bytes = bytes;
+    return 0;
+}
+
+// Grow a volatile segment to `nblocks`, moving it if it has to. Huge page
+// mappings the kernel can't resize are copied into a new one.
+static int memory_grow(storage_t* db, struct segment* s, uint32_t nblocks) {
+    size_t bytes = (size_t)nblocks << db->codec->block_shift;
+    void* p = mremap(s->mem, s->mem_bytes, bytes, MREMAP_MAYMOVE);
+    if (p != MAP_FAILED) {
+        if (!s->huge) {
+            madvise(p, bytes, MADV_HUGEPAGE);
+        }
+        s->mem = p;
+        s->mem_bytes = bytes;
+        return 0;
+    }
+
+    struct segment grown = *s;
+    if (memory_map(db, &grown, nblocks) != 0) {
+        return -1;
+    }
+    memcpy(grown.mem, s->mem, s->mem_bytes);
+    munmap(s->mem, s->mem_bytes);
+    s->mem = grown.mem;
+    s->mem_bytes = grown.mem_bytes;
+    s->huge = grown.huge;
+    return 0;
+}
+
+static void segment_free(struct segment* s) {
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    if (s->mem) {
+        munmap(s->mem, s->mem_bytes);
+    }
+    free(s->bitmap);
+    extent_tree_clear(&s->extents);
+    free(s->dirty);
+    free(s->pinned);
+    free(s->deferred);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
+
+static int segment_alloc_maps(storage_t* db, struct segment* s) {
+    // Bitmap is sized to whole on-disk bitmap blocks so writeback can send
+    // full blocks straight from memory
+    s->bitmap = calloc((size_t)db->bitmap_blocks * db->words_per_bitmap_block, sizeof(uint64_t));
+    s->dirty = calloc(db->bitmap_blocks, 1);
+    extent_tree_init(&s->extents);
+    return (s->bitmap && s->dirty) ? 0 : -1;
+}
+
+// Rebuild the free count and the free runs from the bitmap
+static int segment_index_bitmap(struct segment* s) {
+    uint32_t nwords = s->nblocks / BITS_PER_WORD;
+    uint32_t run_start = 0;
+    uint32_t run_len = 0;
+
+    extent_tree_clear(&s->extents);
+    s->free_blocks = 0;
+    for (uint32_t w = 0; w < nwords; w++) {
+        uint64_t bits = s->bitmap[w];
+        if (bits == 0 && run_len > 0 && run_start + run_len == w * BITS_PER_WORD) {
+            run_len += BITS_PER_WORD;  // Whole free word extends the run
+            continue;
+        }
+        for (uint32_t b = 0; b < BITS_PER_WORD && bits != ~0ULL; b++) {
+            if (bits & (1ULL << b)) {
+                continue;
+            }
+            uint32_t index = w * BITS_PER_WORD + b;
+            if (run_len > 0 && run_start + run_len == index) {
+                run_len++;
+                continue;
+            }
+            if (run_len > 0 && extent_tree_free(&s->extents, run_start, run_len) != 0) {
+                return -1;
+            }
+            run_start = index;
+            run_len = 1;
+        }
+    }
+    if (run_len > 0 && extent_tree_free(&s->extents, run_start, run_len) != 0) {
+        return -1;
+    }
+    s->free_blocks = (uint32_t)s->extents.free_blocks;
+    return 0;
+}
+
+// Create segment `seg` on disk: header (or superblock for segment 0, written
+// by the caller), bitmap region with the reserved blocks marked used
+static int segment_create(storage_t* db, uint32_t seg) {
+    char path[4096];
+    segment_path(db, seg, path, sizeof(path));
+
+    struct segment* s = &db->segments[seg];
+    if (db->in_memory) {
+        if (memory_map(db, s, db->meta.initial_blocks) != 0 || segment_alloc_maps(db, s) != 0) {
+            segment_free(s);
+            return -1;
+        }
+        path[0] = '\0';  // Nothing to unlink on failure
+    } else {
+        s->fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (s->fd < 0) {
+            return -1;
+        }
+        if (segment_alloc_maps(db, s) != 0 || extend_file(db, s->fd, 0, db->meta.initial_blocks) != 0) {
+            segment_free(s);
+            unlink(path);
+            return -1;
+        }
+    }
+    s->nblocks = db->meta.initial_blocks;
+    db->segment_count = seg + 1;
+
+    if (seg > 0) {
+        struct segment_header hdr = {
+            .magic = SEGMENT_MAGIC,
+            .version = STORAGE_VERSION,
+            .segment_id = seg,
+            .segment_max_blocks = db->meta.segment_max_blocks
+        };
+        if (write_block_bytes(db, BLOCK_ADDR(seg, 0), &hdr, sizeof(hdr)) != 0) {
+            segment_free(s);
+            db->segment_count = seg;
+            if (path[0]) {
+                unlink(path);
+            }
+            return -1;
+        }
+    }
+
+    // Take the reserved blocks, then index and account the rest
+    for (uint32_t i = 0; i < reserved_blocks(db); i++) {
+        s->bitmap[i / BITS_PER_WORD] |= 1ULL << (i % BITS_PER_WORD);
+        mark_dirty(db, s, i / BITS_PER_WORD);
+    }
+    if (segment_index_bitmap(s) != 0) {
+        segment_free(s);
+        db->segment_count = seg;
+        if (path[0]) {
+            unlink(path);
+        }
+        return -1;
+    }
+    db->meta.free_blocks += s->free_blocks;
+    db->meta.total_blocks += s->nblocks;
+    return 0;
+}
+
+// Open an existing segment and load its bitmap. Returns 1 if its free runs
+// came from the checkpoint, 0 if they were rebuilt from the bitmap, -1.
+static int segment_load(storage_t* db, uint32_t seg) {
+    char path[4096];
+    segment_path(db, seg, path, sizeof(path));
+
+    struct segment* s = &db->segments[seg];
+    if (s->fd < 0) {
+        s->fd = open(path, O_RDWR);
+        if (s->fd < 0) {
+            return -1;
+        }
+    }
+
+    struct stat st;
+    if (fstat(s->fd, &st) != 0 || st.st_size % db->codec->block_size != 0 ||
+        (st.st_size >> db->codec->block_shift) > db->meta.segment_max_blocks ||
+        (st.st_size >> db->codec->block_shift) % BITS_PER_WORD != 0 ||
+        segment_alloc_maps(db, s) != 0) {
+        segment_free(s);
+        return -1;
+    }
+    s->nblocks = (uint32_t)(st.st_size >> db->codec->block_shift);
+    db->segment_count = seg + 1 > db->segment_count ? seg + 1 : db->segment_count;
+
+    if (seg > 0) {
+        struct segment_header hdr;
+        if (read_block_bytes(db, BLOCK_ADDR(seg, 0), &hdr, sizeof(hdr)) != 0 ||
+            hdr.magic != SEGMENT_MAGIC || hdr.version != STORAGE_VERSION ||
+            hdr.segment_id != seg || hdr.segment_max_blocks != db->meta.segment_max_blocks) {
+            return -1;
+        }
+    }
+
+    size_t bytes = (size_t)db->bitmap_blocks << db->codec->block_shift;
+    off_t offset = (off_t)db->header_blocks << db->codec->block_shift;
+    if (pread(s->fd, s->bitmap, bytes, offset) != (ssize_t)bytes) {
+        return -1;
+    }
+    int from_checkpoint = checkpoint_extents(db, seg) == 0;
+    if (!from_checkpoint && segment_index_bitmap(s) != 0) {
+        return -1;
+    }
+
+    db->meta.total_blocks += s->nblocks;
+    db->meta.free_blocks += s->free_blocks;
+    return from_checkpoint;
+}
+
+// Make room for at least one more block: grow the last segment, or start a
+// new one once it reaches segment_max_blocks
+static int grow_storage(storage_t* db) {
+    uint32_t last = db->segment_count - 1;
+    struct segment* s = &db->segments[last];
+
+    if (s->nblocks < db->meta.segment_max_blocks) {
+        uint32_t grow_max = (uint32_t)(SEGMENT_GROW_MAX_BYTES >> db->codec->block_shift);
+        uint32_t grow = s->nblocks;
+        if (grow > grow_max) grow = grow_max;
+        if (grow > db->meta.segment_max_blocks - s->nblocks) {
+            grow = db->meta.segment_max_blocks - s->nblocks;
+        }
+
+        if (s->mem ? memory_grow(db, s, s->nblocks + grow) != 0
+                   : extend_file(db, s->fd, s->nblocks, s->nblocks + grow) != 0) {
+            TRACE_ERROR("storage: failed to grow segment %u: %s", last, strerror(errno));
+            return -1;
+        }
+        if (extent_tree_free(&s->extents, s->nblocks, grow) != 0) {
+            return -1;
+        }
+        s->nblocks += grow;
+        s->free_blocks += grow;
+        db->meta.free_blocks += grow;
+        db->meta.total_blocks += grow;
+        db->meta_dirty = 1;
+        TRACE_INFO("storage: grew segment %u to %u blocks", last, s->nblocks);
+        return 0;
+    }
+
+    if (db->segment_count >= MAX_SEGMENTS) {
+        return -1;
+    }
+    if (segment_create(db, db->segment_count) != 0) {
+        TRACE_ERROR("storage: failed to create segment %u: %s", db->segment_count, strerror(errno));
+        return -1;
+    }
+    db->meta.segment_count = db->segment_count;
+    TRACE_INFO("storage: created segment %u", db->segment_count - 1);
+    return 0;
+}
+
+// Allocate up to `want` contiguous blocks from the lowest segment with free
+// space (best fit within it), growing the storage when everything is in
+// use. Stores the first address in `addr`; returns the count, 0 if full.
+static uint32_t alloc_run(storage_t* db, uint32_t want, uint32_t* addr) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        for (uint32_t seg = db->alloc_segment; seg < db->segment_count; seg++) {
+            struct segment* s = &db->segments[seg];
+            uint32_t index;
+            uint32_t got = extent_tree_alloc(&s->extents, want, &index);
+            if (got == 0) {
+                continue;
+            }
+            db->alloc_segment = seg;
+            for (uint32_t i = 0; i < got; i++) {
+                mark_block_used(db, BLOCK_ADDR(seg, index + i));
+            }
+            *addr = BLOCK_ADDR(seg, index);
+            return got;
+        }
+        if (attempt == 0 && grow_storage(db) != 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Allocate exactly `want` contiguous blocks from existing free space, never
+// growing the storage. Returns 0 and the first address, or -1.
+static int alloc_contiguous(storage_t* db, uint32_t want, uint32_t* addr) {
+    for (uint32_t seg = db->alloc_segment; seg < db->segment_count; seg++) {
+        struct segment* s = &db->segments[seg];
+        uint32_t index;
+        if (extent_tree_largest(&s->extents) < want ||
+            extent_tree_alloc(&s->extents, want, &index) != want) {
+            continue;
+        }
+        for (uint32_t i = 0; i < want; i++) {
+            mark_block_used(db, BLOCK_ADDR(seg, index + i));
+        }
+        *addr = BLOCK_ADDR(seg, index);
+        return 0;
+    }
+    return -1;
+}
+
+// Helper function to read metadata from the superblock
+static int read_metadata(storage_t* db, struct metadata_block *out) {
+    if (!storage_ready(db)) return -1;
+
+    if (db->in_memory) {
+        *out = db->meta;  // The cached copy is the only one
+        return 0;
+    }
+    if (pread(db->segments[0].fd, out, sizeof(*out), 0) != sizeof(*out)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Helper function to write metadata to the superblock
+static int write_metadata(storage_t* db, const struct metadata_block *in) {
+    if (!storage_ready(db)) return -1;
+
+    if (db->in_memory) {
+        return 0;
+    }
+    if (pwrite(db->segments[0].fd, in, sizeof(*in), 0) != sizeof(*in)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Persist bitmap, index pages and superblock after a mutation
+static int commit_metadata(storage_t* db) {
+    if ((db->key_index.dirty_count > 0 || db->key_index.header_dirty || db->meta_dirty) &&
+        checkpoint_invalidate(db) != 0) {
+        return -1;
+    }
+    if (flush_bitmaps(db) != 0 || btree_flush(&db->key_index) != 0) {
+        return -1;
+    }
+    // An update that reused its blocks leaves the superblock as it was
+    if (!db->meta_dirty) {
+        return 0;
+    }
+    if (write_metadata(db, &db->meta) != 0) {
+        return -1;
+    }
+    db->meta_dirty = 0;
+    return 0;
+}
+
+static int index_open(storage_t* db, int create) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%s", db->filename, INDEX_SUFFIX);
+    return btree_open(&db->key_index, db->in_memory ? NULL : path, sizeof(struct index_entry), create);
+}
+
+// Size the key filter for twice the current key count and refill it from
+// the index. Deleted keys can't be cleared from a Bloom filter, so this also
+// runs once they make up half of what it was sized for.
+static int rebuild_filter(storage_t* db) {
+    size_t capacity = (size_t)db->key_index.entry_count * 2;
+    if (capacity < FILTER_MIN_KEYS) {
+        capacity = FILTER_MIN_KEYS;
+    }
+    bloom_free(&db->key_filter);
+    db->filter_stale = 0;
+    if (bloom_init(&db->key_filter, capacity) != 0) {
+        TRACE_WARN("storage: no memory for key filter, lookups go to the index");
+        return -1;
+    }
+
+    struct btree_cursor cursor;
+    if (btree_seek(&db->key_index, NULL, &cursor) != 0) {
+        bloom_free(&db->key_filter);
+        return -1;
+    }
+    char key[BTREE_MAX_KEY + 1];
+    struct index_entry entry;
+    int rc;
+    while ((rc = btree_next(&cursor, key, &entry)) == 0) {
+        bloom_add(&db->key_filter, key);
+    }
+    if (rc < 0) {
+        bloom_free(&db->key_filter);  // Fails open: "maybe" for every key
+        return -1;
+    }
+    return 0;
+}
+
+// Keep the filter sized and fresh after the index changed
+static void maintain_filter(storage_t* db) {
+    if (db->key_index.entry_count > db->key_filter.capacity ||
+        db->filter_stale > db->key_filter.capacity / 2) {
+        rebuild_filter(db);
+    }
+}
+
+// Checksum of checkpoint sections, fed in pieces of any size: a 64-bit
+// multiply-xor over little-endian words, then the length
+struct ckpt_sum {
+    uint64_t h;
+    uint64_t word;
+    uint64_t bytes;
+};
+
+static void sum_init(struct ckpt_sum* s) {
+    s->h = 0xcbf29ce484222325ULL;
+    s->word = 0;
+    s->bytes = 0;
+}
+
+static void sum_mix(struct ckpt_sum* s, uint64_t w) {
+    s->h = (s->h ^ w) * 0x100000001b3ULL;
+    s->h ^= s->h >> 32;
+}
+
+static void sum_update(struct ckpt_sum* s, const void* data, size_t len) {
+    const uint8_t* p = data;
+    for (; len > 0 && (s->bytes & 7) != 0; len--, s->bytes++) {
+        s->word |= (uint64_t)*p++ << (8 * (s->bytes & 7));
+        if ((s->bytes & 7) == 7) {
+            sum_mix(s, s->word);
+            s->word = 0;
+        }
+    }
+    for (; len >= 8; len -= 8, p += 8, s->bytes += 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        sum_mix(s, w);
+    }
+    for (; len > 0; len--, s->bytes++) {
+        s->word |= (uint64_t)*p++ << (8 * (s->bytes & 7));
+    }
+}
+
+static uint64_t sum_final(struct ckpt_sum* s) {
+    if ((s->bytes & 7) != 0) {
+        sum_mix(s, s->word);
+    }
+    sum_mix(s, s->bytes);
+    return s->h;
+}
+
+static uint64_t sum_of(const void* data, size_t len) {
+    struct ckpt_sum s;
+    sum_init(&s);
+    sum_update(&s, data, len);
+    return sum_final(&s);
+}
+
+static uint64_t header_sum(const struct checkpoint_header* h) {
+    struct checkpoint_header copy = *h;
+    copy.header_sum = 0;
+    return sum_of(&copy, sizeof(copy));
+}
+
+static void checkpoint_path(storage_t* db, const char* suffix, char* buf, size_t size) {
+    snprintf(buf, size, "%s%s%s", db->filename, CHECKPOINT_SUFFIX, suffix);
+}
+
+// Before the first write after a checkpoint, move the superblock to a new
+// generation so a crash from here on can't pair it with the old checkpoint
+static int checkpoint_invalidate(storage_t* db) {
+    db->ckpt_current = 0;
+    db->ckpt_loaded = 0;
+    if (!db->ckpt_gen_live) {
+        return 0;
+    }
+    db->meta.checkpoint_gen = db->meta.checkpoint_gen + 1 ? db->meta.checkpoint_gen + 1 : 1;
+    if (write_metadata(db, &db->meta) != 0) {
+        return -1;
+    }
+    db->ckpt_gen_live = 0;
+    return 0;
+}
+
+// Sequential checkpoint output through run_buf. Only ckpt_put is summed.
+struct ckpt_writer {
+    int fd;
+    char* buf;
+    size_t len;
+    size_t cap;
+    uint64_t offset;             // Bytes emitted so far
+    struct ckpt_sum sum;
+    int failed;
+};
+
+static void ckpt_flush(struct ckpt_writer* w) {
+    size_t done = 0;
+    while (!w->failed && done < w->len) {
+        ssize_t n = write(w->fd, w->buf + done, w->len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            w->failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+    w->len = 0;
+}
+
+static void ckpt_raw(struct ckpt_writer* w, const void* data, size_t len) {
+    const char* p = data;
+    w->offset += len;
+    while (len > 0) {
+        size_t n = w->cap - w->len < len ? w->cap - w->len : len;
+        if (p) {
+            memcpy(w->buf + w->len, p, n);
+            p += n;
+        } else {
+            memset(w->buf + w->len, 0, n);
+        }
+        w->len += n;
+        len -= n;
+        if (w->len == w->cap) {
+            ckpt_flush(w);
+        }
+    }
+}
+
+static void ckpt_put(struct ckpt_writer* w, const void* data, size_t len) {
+    sum_update(&w->sum, data, len);
+    ckpt_raw(w, data, len);
+}
+
+static uint64_t ckpt_section(struct ckpt_writer* w) {
+    uint64_t sum = sum_final(&w->sum);
+    sum_init(&w->sum);
+    return sum;
+}
+
+static void put_extent(uint32_t start, uint32_t len, void* arg) {
+    struct checkpoint_extent ext = { .start = start, .len = len };
+    ckpt_put(arg, &ext, sizeof(ext));
+}
+
+// Write the checkpoint sections to `fd` and fill in `h`
+static int checkpoint_write(storage_t* db, int fd, struct checkpoint_header* h) {
+    struct ckpt_writer w = {
+        .fd = fd,
+        .buf = db->run_buf,
+        .cap = (size_t)db->run_blocks << db->codec->block_shift
+    };
+    sum_init(&w.sum);
+    ckpt_raw(&w, NULL, sizeof(*h));  // Filled in last
+
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        struct checkpoint_segment cs = {
+            .nblocks = db->segments[seg].nblocks,
+            .extent_count = (uint32_t)db->segments[seg].extents.count
+        };
+        ckpt_put(&w, &cs, sizeof(cs));
+        h->extent_count += cs.extent_count;
+    }
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        extent_tree_foreach(&db->segments[seg].extents, put_extent, &w);
+    }
+    h->extent_sum = ckpt_section(&w);
+
+    if (db->key_filter.blocks) {
+        ckpt_raw(&w, NULL, (CHECKPOINT_ALIGN - w.offset % CHECKPOINT_ALIGN) % CHECKPOINT_ALIGN);
+        h->filter_offset = w.offset;
+        h->filter_blocks = db->key_filter.block_count;
+        h->filter_capacity = db->key_filter.capacity;
+        h->filter_stale = db->filter_stale;
+        ckpt_put(&w, db->key_filter.blocks, db->key_filter.block_count * sizeof(struct bloom_block));
+    }
+    h->filter_sum = ckpt_section(&w);
+
+    h->expiry_offset = w.offset;
+    struct btree_cursor cursor;
+    if (btree_seek(&db->key_index, NULL, &cursor) != 0) {
+        return -1;
+    }
+    char key[BTREE_MAX_KEY + 1];
+    struct index_entry entry;
+    int rc;
+    while ((rc = btree_next(&cursor, key, &entry)) == 0) {
+        if (entry.expires_at != 0) {
+            struct checkpoint_expiry rec = {
+                .expires_at = entry.expires_at,
+                .key_len = (uint16_t)strlen(key)
+            };
+            ckpt_put(&w, &rec, sizeof(rec));
+            ckpt_put(&w, key, rec.key_len);
+            h->expiry_count++;
+        }
+    }
+    h->expiry_sum = ckpt_section(&w);
+    ckpt_flush(&w);
+    if (rc < 0 || w.failed) {
+        return -1;
+    }
+
+    h->magic = CHECKPOINT_MAGIC;
+    h->version = CHECKPOINT_VERSION;
+    h->generation = db->meta.checkpoint_gen;
+    h->segment_count = db->segment_count;
+    h->block_size = db->codec->block_size;
+    h->key_count = db->key_index.entry_count;
+    h->file_size = w.offset;
+    h->header_sum = header_sum(h);
+    return pwrite(fd, h, sizeof(*h), 0) == sizeof(*h) ? 0 : -1;
+}
+
+static int block_checkpoint(storage_t* db) {
+    if (db->in_memory) {
+        return storage_ready(db) ? 0 : -1;  // Nothing outlives the process
+    }
+    // Not for a store whose open failed part way
+    if (!storage_ready(db) || db->key_index.fd < 0 || commit_metadata(db) != 0) {
+        return -1;
+    }
+    if (db->ckpt_current) {
+        return 0;  // Nothing written since the last one
+    }
+    // Generation 0 never matches, so a new store starts at 1
+    if (db->meta.checkpoint_gen == 0) {
+        db->meta.checkpoint_gen = 1;
+        if (write_metadata(db, &db->meta) != 0) {
+            return -1;
+        }
+    }
+
+    // Written aside and renamed over, so the file is whole or absent
+    char tmp[4096];
+    char path[4096];
+    checkpoint_path(db, ".tmp", tmp, sizeof(tmp));
+    checkpoint_path(db, "", path, sizeof(path));
+    int fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    struct checkpoint_header h;
+    memset(&h, 0, sizeof(h));
+    int rc = checkpoint_write(db, fd, &h);
+    if (rc == 0 && fdatasync(fd) != 0) {
+        rc = -1;
+    }
+    close(fd);
+    if (rc != 0 || rename(tmp, path) != 0) {
+        TRACE_WARN("storage: failed to write checkpoint %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    db->ckpt_gen_live = 1;
+    db->ckpt_current = 1;
+    return 0;
+}
+
+// Map the checkpoint if it belongs to the superblock's generation and every
+// section but the expiry list (checked when read) is intact
+static int checkpoint_map(storage_t* db) {
+    if (db->meta.checkpoint_gen == 0) {
+        return -1;
+    }
+    char path[4096];
+    checkpoint_path(db, "", path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct checkpoint_header)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    // Private and writable: the filter is updated in place without touching the file
+    char* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    struct checkpoint_header h;
+    memcpy(&h, map, sizeof(h));
+    uint64_t table = sizeof(h);
+    uint64_t runs = table + (uint64_t)h.segment_count * sizeof(struct checkpoint_segment);
+    uint64_t filter_bytes = h.filter_blocks * sizeof(struct bloom_block);
+    const char* why = NULL;
+    if (h.magic != CHECKPOINT_MAGIC || h.version != CHECKPOINT_VERSION ||
+        h.header_sum != header_sum(&h) || h.file_size != size) {
+        why = "damaged";
+    } else if (h.generation != db->meta.checkpoint_gen) {
+        why = "stale";
+    } else if (h.segment_count != db->meta.segment_count ||
+               h.block_size != db->codec->block_size ||
+               h.extent_count > size / sizeof(struct checkpoint_extent) ||
+               runs + h.extent_count * sizeof(struct checkpoint_extent) > size ||
+               h.filter_blocks > size / sizeof(struct bloom_block) ||
+               (h.filter_blocks && (h.filter_offset % CHECKPOINT_ALIGN != 0 ||
+                                    h.filter_offset < runs ||
+                                    h.filter_offset + filter_bytes > size)) ||
+               h.expiry_offset > size) {
+        why = "inconsistent";
+    } else if (sum_of(map + table, runs - table + h.extent_count * sizeof(struct checkpoint_extent))
+                   != h.extent_sum ||
+               sum_of(map + h.filter_offset, filter_bytes) != h.filter_sum) {
+        why = "damaged";
+    }
+    if (why) {
+        TRACE_WARN("storage: checkpoint %s is %s, scanning instead", path, why);
+        munmap(map, size);
+        return -1;
+    }
+    db->ckpt_map = map;
+    db->ckpt_size = size;
+    return 0;
+}
+
+// Load segment `seg`'s free runs from the mapped checkpoint instead of
+// scanning its bitmap. Returns -1 (tree left empty) if the checkpoint has
+// nothing usable for it, e.g. the segment grew after it was written.
+static int checkpoint_extents(storage_t* db, uint32_t seg) {
+    if (!db->ckpt_map) {
+        return -1;
+    }
+    const char* map = db->ckpt_map;
+    struct checkpoint_header h;
+    memcpy(&h, map, sizeof(h));
+    if (seg >= h.segment_count) {
+        return -1;
+    }
+
+    struct checkpoint_segment cs;
+    uint64_t first = 0;
+    for (uint32_t i = 0; i < seg; i++) {
+        memcpy(&cs, map + sizeof(h) + i * sizeof(cs), sizeof(cs));
+        first += cs.extent_count;
+    }
+    memcpy(&cs, map + sizeof(h) + seg * sizeof(cs), sizeof(cs));
+    struct segment* s = &db->segments[seg];
+    if (cs.nblocks != s->nblocks || first + cs.extent_count > h.extent_count) {
+        return -1;
+    }
+
+    const char* runs = map + sizeof(h) + h.segment_count * sizeof(cs);
+    extent_tree_clear(&s->extents);
+    for (uint64_t i = first; i < first + cs.extent_count; i++) {
+        struct checkpoint_extent ext;
+        memcpy(&ext, runs + i * sizeof(ext), sizeof(ext));
+        if (ext.len == 0 || ext.start < reserved_blocks(db) || ext.start > s->nblocks - ext.len ||
+            extent_tree_free(&s->extents, ext.start, ext.len) != 0) {
+            extent_tree_clear(&s->extents);
+            return -1;
+        }
+    }
+    s->free_blocks = (uint32_t)s->extents.free_blocks;
+    return 0;
+}
+
+// Use the mapped checkpoint's key filter in place
+static int checkpoint_filter(storage_t* db) {
+    struct checkpoint_header h;
+    memcpy(&h, db->ckpt_map, sizeof(h));
+    if (h.filter_blocks == 0 || h.key_count != db->key_index.entry_count) {
+        return -1;
+    }
+    bloom_free(&db->key_filter);
+    if (bloom_attach(&db->key_filter, (struct bloom_block*)((char*)db->ckpt_map + h.filter_offset),
+                     h.filter_blocks, h.filter_capacity) != 0) {
+        return -1;
+    }
+    db->filter_stale = h.filter_stale;
+    return 0;
+}
+
+// storage_list_expiring from the checkpoint. Returns -1 if its list is damaged.
+static int checkpoint_list_expiring(storage_t* db, storage_expiry_fn fn, void* arg) {
+    const char* map = db->ckpt_map;
+    struct checkpoint_header h;
+    memcpy(&h, map, sizeof(h));
+    if (sum_of(map + h.expiry_offset, db->ckpt_size - h.expiry_offset) != h.expiry_sum) {
+        TRACE_WARN("storage: checkpoint expiry list is damaged, scanning the index");
+        return -1;
+    }
+
+    // Checked whole first, so nothing is reported from a list that turns out bad
+    for (int pass = 0; pass < 2; pass++) {
+        size_t pos = h.expiry_offset;
+        for (uint64_t i = 0; i < h.expiry_count; i++) {
+            struct checkpoint_expiry rec;
+            if (pos + sizeof(rec) > db->ckpt_size) {
+                return -1;
+            }
+            memcpy(&rec, map + pos, sizeof(rec));
+            pos += sizeof(rec);
+            if (rec.key_len > BTREE_MAX_KEY || pos + rec.key_len > db->ckpt_size) {
+                return -1;
+            }
+            if (pass == 1) {
+                char key[BTREE_MAX_KEY + 1];
+                memcpy(key, map + pos, rec.key_len);
+                key[rec.key_len] = '\0';
+                fn(key, rec.expires_at, arg);
+            }
+            pos += rec.key_len;
+        }
+    }
+    return h.expiry_count > INT32_MAX ? INT32_MAX : (int)h.expiry_count;
+}
+
+// Fill in defaults for zero fields and check the geometry is usable
+static int resolve_format(struct storage_format* f) {
+    if (f->block_size == 0) {
+        f->block_size = DEFAULT_BLOCK_SIZE;
+    }
+    const struct block_codec* c = find_codec(f->block_size);
+    if (!c) {
+        return -1;
+    }
+
+    if (f->segment_max_blocks == 0) {
+        uint64_t blocks = DEFAULT_SEGMENT_MAX_BYTES >> c->block_shift;
+        f->segment_max_blocks = blocks > (1u << SEGMENT_SHIFT) ? (1u << SEGMENT_SHIFT) : (uint32_t)blocks;
+    }
+    if (f->initial_blocks == 0) {
+        uint64_t blocks = DEFAULT_INITIAL_BYTES >> c->block_shift;
+        f->initial_blocks = blocks > f->segment_max_blocks ? f->segment_max_blocks : (uint32_t)blocks;
+    }
+
+    uint32_t smax = f->segment_max_blocks;
+    if (smax < 4096 || smax > (1u << SEGMENT_SHIFT) || (smax & (smax - 1)) != 0) {
+        return -1;
+    }
+
+    uint32_t headers = SUPERBLOCK_SIZE > c->block_size ? SUPERBLOCK_SIZE / c->block_size : 1;
+    uint32_t bitmap = (smax + c->block_size * 8 - 1) / (c->block_size * 8);
+    if (f->initial_blocks % BITS_PER_WORD != 0 || f->initial_blocks > smax ||
+        f->initial_blocks <= headers + bitmap) {
+        return -1;
+    }
+    return 0;
+}
+
+// Derive the in-memory geometry from a resolved format
+static int apply_format(storage_t* db, const struct storage_format* f) {
+    db->codec = find_codec(f->block_size);
+    if (!db->codec) {
+        return -1;
+    }
+    uint32_t block_size = db->codec->block_size;
+    db->header_blocks = SUPERBLOCK_SIZE > block_size ? SUPERBLOCK_SIZE / block_size : 1;
+    db->bitmap_blocks = (f->segment_max_blocks + block_size * 8 - 1) / (block_size * 8);
+    db->words_per_bitmap_block = block_size * 8 / BITS_PER_WORD;
+
+    db->run_blocks = RUN_BUF_BYTES >> db->codec->block_shift;
+    if (db->run_blocks == 0) {
+        db->run_blocks = 1;
+    }
+    free(db->run_buf);
+    db->run_buf = malloc((size_t)db->run_blocks << db->codec->block_shift);
+    return db->run_buf ? 0 : -1;
+}
+
+static void storage_reset(storage_t* db) {
+    for (uint32_t i = 0; i < MAX_SEGMENTS; i++) {
+        if (i < db->segment_count) {
+            segment_free(&db->segments[i]);
+        }
+        db->segments[i].fd = -1;
+    }
+    db->segment_count = 0;
+    db->alloc_segment = 0;
+    db->header_blocks = 0;
+    db->bitmap_blocks = 0;
+    db->codec = NULL;
+    btree_close(&db->key_index);
+    bloom_free(&db->key_filter);
+    db->filter_stale = 0;
+    if (db->ckpt_map) {
+        munmap(db->ckpt_map, db->ckpt_size);
+        db->ckpt_map = NULL;
+    }
+    db->ckpt_gen_live = db->ckpt_current = db->ckpt_loaded = 0;
+    free(db->run_buf);
+    db->run_buf = NULL;
+    db->run_blocks = 0;
+    memset(&db->meta, 0, sizeof(db->meta));
+}
+
+// Called by walk_chain for each block with the value bytes it holds
+typedef void (*chain_block_fn)(uint32_t addr, const char* data, size_t len, void* arg);
+
+// Visit the blocks of a chain holding `size` bytes. Once a link shows the
+// chain continues in the next block on disk, the following blocks are read
+// with one pread (up to run_blocks), falling back to one block per read
+// where the chain jumps.
+static int walk_chain(storage_t* db, uint32_t block_id, size_t size,
+                      chain_block_fn fn, void* arg) {
+    size_t bytes_read = 0;
+    uint32_t batch = 1;
+
+    while (block_id != 0 && bytes_read < size) {
+        uint32_t seg = BLOCK_SEGMENT(block_id);
+        if (seg >= db->segment_count || BLOCK_INDEX(block_id) >= db->segments[seg].nblocks) {
+            return -1;
+        }
+
+        // The stored size bounds how much of the last block can be in use
+        size_t remaining = size - bytes_read;
+        uint32_t n = (uint32_t)db->codec->blocks_needed(remaining);
+        uint32_t room = db->segments[seg].nblocks - BLOCK_INDEX(block_id);
+        if (n > batch) n = batch;
+        if (n > room) n = room;
+        size_t tail = remaining - (size_t)(n - 1) * db->codec->payload;
+        size_t len = ((size_t)(n - 1) << db->codec->block_shift) + sizeof(struct data_block_header) +
+                     (tail < db->codec->payload ? tail : db->codec->payload);
+
+        TRACE_DEBUG("Reading %u blocks at %u", n, block_id);
+
+        if (read_block_bytes(db, block_id, db->run_buf, len) != 0) {
+            TRACE_ERROR("GET: read failed for block %u", block_id);
+            return -1;
+        }
+
+        int contiguous = 1;
+        for (uint32_t i = 0; i < n && contiguous && bytes_read < size; i++) {
+            uint32_t next;
+            size_t data_size;
+            const char* data = db->codec->decode(db->run_buf + ((size_t)i << db->codec->block_shift),
+                                                 &next, &data_size);
+
+            // Calculate how much data to copy from this block
+            size_t want = size - bytes_read;
+            if (want > db->codec->payload) {
+                want = db->codec->payload;
+            }
+            size_t to_copy = (want < data_size) ? want : data_size;
+
+            fn(block_id, data, to_copy, arg);
+            bytes_read += to_copy;
+            contiguous = next == block_id + 1;
+            block_id = next;
+        }
+        batch = contiguous ? db->run_blocks : 1;
+    }
+
+    return bytes_read == size ? 0 : -1;
+}
+
+static void copy_block(uint32_t addr, const char* data, size_t len, void* arg) {
+    char** dst = arg;
+    (void)addr;
+    memcpy(*dst, data, len);
+    *dst += len;
+}
+
+// Read `size` bytes of a block chain into `buf`
+static int read_chain(storage_t* db, uint32_t block_id, char* buf, size_t size) {
+    return walk_chain(db, block_id, size, copy_block, &buf);
+}
+
+struct chain_list {
+    uint32_t* pos;
+    uint32_t* end;
+};
+
+static void collect_block(uint32_t addr, const char* data, size_t len, void* arg) {
+    struct chain_list* list = arg;
+    (void)data;
+    (void)len;
+    if (list->pos < list->end) {
+        *list->pos = addr;
+    }
+    list->pos++;  // Counts past the end so a malformed chain is caught
+}
+
+// Fill `chain` with the block addresses of `entry`'s value, in order
+static int chain_blocks(storage_t* db, const struct index_entry* entry, uint32_t* chain) {
+    struct chain_list list = { chain, chain + db->codec->blocks_needed(entry->stored_size) };
+    if (walk_chain(db, entry->first_block_id, entry->stored_size, collect_block, &list) != 0) {
+        return -1;
+    }
+    return list.pos == list.end ? 0 : -1;
+}
+
+// Write `size` bytes across the blocks in `chain`, each block linked to the
+// next. Blocks that are adjacent on disk go out in one pwrite.
+static int write_chain(storage_t* db, const uint32_t* chain, size_t blocks,
+                       const char* data, size_t size) {
+    size_t bytes_written = 0;
+    for (size_t i = 0; i < blocks; ) {
+        size_t n = 1;
+        while (i + n < blocks && n < db->run_blocks && chain[i + n] == chain[i] + n) {
+            n++;
+        }
+
+        size_t len = 0;
+        for (size_t j = 0; j < n; j++) {
+            size_t to_write = size - bytes_written;
+            if (to_write > db->codec->payload) {
+                to_write = db->codec->payload;
+            }
+            uint32_t next = (i + j + 1 < blocks) ? chain[i + j + 1] : 0;
+            db->codec->encode(db->run_buf + (j << db->codec->block_shift), next,
+                              data + bytes_written, to_write);
+            bytes_written += to_write;
+            // Only the used prefix of the value's last block goes to disk
+            len = (j << db->codec->block_shift) + sizeof(struct data_block_header) + to_write;
+        }
+
+        TRACE_DEBUG("PUT: Writing %zu blocks at %u (segment %u index %u)",
+                    n, chain[i], BLOCK_SEGMENT(chain[i]), BLOCK_INDEX(chain[i]));
+
+        if (write_block_bytes(db, chain[i], db->run_buf, len) != 0) {
+            TRACE_ERROR("PUT: write failed for block %u", chain[i]);
+            return -1;
+        }
+        i += n;
+    }
+    return 0;
+}
+
+static storage_t* block_open(const char *filename, const struct storage_format *format) {
+    struct storage_format f = {0, 0, 0, 0, 0};
+    if (format) {
+        f = *format;
+    }
+
+    storage_t* db = calloc(1, sizeof(*db));
+    if (!db) {
+        return NULL;
+    }
+    db->engine = &block_engine;
+    db->compress_threshold = DEFAULT_COMPRESS_THRESHOLD;
+    db->key_index.fd = -1;
+    db->snapshot_index.fd = -1;
+
+    storage_reset(db);
+    db->filename = strdup(filename);
+    if (!db->filename) {
+        block_close(db);
+        return NULL;
+    }
+    db->in_memory = f.in_memory != 0;
+
+    // Try to open existing file (volatile storage always starts empty)
+    int fd = db->in_memory ? -1 : open(filename, O_RDWR);
+
+    if (fd == -1) {
+        // File doesn't exist, create new one
+        if (resolve_format(&f) != 0 || apply_format(db, &f) != 0) {
+            block_close(db);
+            return NULL;
+        }
+
+        db->meta.magic = STORAGE_MAGIC;
+        db->meta.version = STORAGE_VERSION;
+        db->meta.block_size = f.block_size;
+        db->meta.segment_max_blocks = f.segment_max_blocks;
+        db->meta.initial_blocks = f.initial_blocks;
+        db->meta.segment_count = 1;
+
+        // Whatever a previous store of this name left behind
+        if (!db->in_memory) {
+            char path[4096];
+            checkpoint_path(db, "", path, sizeof(path));
+            unlink(path);
+        }
+
+        if (segment_create(db, 0) != 0 || index_open(db, 1) != 0 || commit_metadata(db) != 0) {
+            block_close(db);
+            return NULL;
+        }
+    } else {
+        // File exists, validate it. The stored geometry wins over `format`.
+        db->segments[0].fd = fd;
+        db->segment_count = 1;
+        if (read_metadata(db, &db->meta) != 0 ||
+            db->meta.magic != STORAGE_MAGIC || db->meta.version != STORAGE_VERSION ||
+            db->meta.segment_count == 0 || db->meta.segment_count > MAX_SEGMENTS) {
+            block_close(db);
+            return NULL;
+        }
+        struct storage_format existing = {
+            .block_size = db->meta.block_size,
+            .segment_max_blocks = db->meta.segment_max_blocks,
+            .initial_blocks = db->meta.initial_blocks
+        };
+        if (resolve_format(&existing) != 0 || apply_format(db, &existing) != 0) {
+            block_close(db);
+            return NULL;
+        }
+
+        // Totals are recomputed from the segment bitmaps, free runs come
+        // from the checkpoint where it still fits. Segment 0 keeps the
+        // descriptor opened above.
+        checkpoint_map(db);
+        uint32_t count = db->meta.segment_count;
+        db->meta.total_blocks = 0;
+        db->meta.free_blocks = 0;
+        int from_checkpoint = db->ckpt_map != NULL;
+        for (uint32_t seg = 0; seg < count; seg++) {
+            int loaded = segment_load(db, seg);
+            if (loaded < 0) {
+                TRACE_ERROR("storage: failed to load segment %u", seg);
+                block_close(db);
+                return NULL;
+            }
+            from_checkpoint &= loaded;
+        }
+        if (index_open(db, 0) != 0) {
+            TRACE_ERROR("storage: failed to open key index");
+            block_close(db);
+            return NULL;
+        }
+        if (!db->ckpt_map || checkpoint_filter(db) != 0) {
+            from_checkpoint = 0;
+            rebuild_filter(db);
+        }
+        db->ckpt_gen_live = db->meta.checkpoint_gen != 0;
+        db->ckpt_current = db->ckpt_loaded = from_checkpoint;
+        return db;
+    }
+
+    rebuild_filter(db);
+    return db;
+}
+
+// Read a value described by `entry` into `value` (entry->value_size bytes)
+static int read_value(storage_t* db, const struct index_entry* entry, char* value) {
+    // Compressed chains are staged and then decoded straight into `value`
+    char* dst = value;
+    char* staging = NULL;
+    if (entry->flags & ENTRY_FLAG_COMPRESSED) {
+        staging = pool_alloc(entry->stored_size);
+        if (!staging) {
+            return -1;
         }
+        dst = staging;
     }
-    return -1;  // No free blocks
+
+    if (read_chain(db, entry->first_block_id, dst, entry->stored_size) != 0) {
+        pool_free(staging);
+        return -1;
+    }
+
+    if (staging) {
+        size_t out_size = entry->value_size;
+        int rc = lz_decompress(staging, entry->stored_size, value, &out_size);
+        pool_free(staging);
+        if (rc != 0 || out_size != entry->value_size) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_block(uint32_t addr, const char* data, size_t len, void* arg) {
+    (void)data;
+    (void)len;
+    mark_block_free(arg, addr);
+}
+
+// Return the blocks of `entry`'s value to free space
+static int free_chain(storage_t* db, const struct index_entry* entry) {
+    return walk_chain(db, entry->first_block_id, entry->stored_size, free_block, db);
+}
+
+// A removed key's version is never handed out again: the key starts above it
+static void retire_version(storage_t* db, const struct index_entry* entry) {
+    if (entry->version > db->meta.version_floor) {
+        db->meta.version_floor = entry->version;
+        db->meta_dirty = 1;
+    }
+}
+
+static int entry_expired(const struct index_entry* entry, uint32_t now) {
+    return entry->expires_at != 0 && entry->expires_at <= now;
+}
+
+// Drop an expired key found by a read: free its chain and index entry
+static int reclaim_expired(storage_t* db, const char* key, const struct index_entry* entry) {
+    TRACE_DEBUG("Reclaiming expired key '%s'", key);
+    if (free_chain(db, entry) != 0) {
+        return -1;
+    }
+    btree_delete(&db->key_index, key);
+    retire_version(db, entry);
+    db->filter_stale++;
+    return commit_metadata(db);
+}
+
+// Index lookup that treats an expired key as missing (and reclaims it)
+static int lookup_live(storage_t* db, const char* key, struct index_entry* entry) {
+    if (!bloom_may_contain(&db->key_filter, key)) {
+        return -1;  // Definitely absent, no index access
+    }
+    if (btree_get(&db->key_index, key, entry) != 0) {
+        return -1;
+    }
+    if (entry_expired(entry, (uint32_t)time(NULL))) {
+        reclaim_expired(db, key, entry);
+        return -1;
+    }
+    return 0;
+}
+
+// Undo a PUT that failed once it had started writing: the blocks it took
+// go back. Blocks it reused from the old chain may already hold new bytes,
+// and the old ones are gone, so rather than leave the index pointing at a
+// torn value (whose links may run into the freed blocks) the key is dropped
+// along with its whole old chain.
+static void abandon_write(storage_t* db, const char* key, const struct index_entry* old,
+                          const uint32_t* chain, size_t reused, size_t allocated,
+                          const uint32_t* old_chain, size_t old_blocks) {
+    for (size_t j = reused; j < allocated; j++) {
+        mark_block_free(db, chain[j]);
+    }
+    if (reused == 0) {
+        flush_bitmaps(db);
+        return;
+    }
+    TRACE_ERROR("PUT: dropping key '%s', its old value was partly overwritten", key);
+    for (size_t j = 0; j < old_blocks; j++) {
+        mark_block_free(db, old_chain[j]);
+    }
+    btree_delete(&db->key_index, key);
+    retire_version(db, old);
+    db->filter_stale++;
+    commit_metadata(db);
+}
+
+// PUT with an absolute expiry time; `compress` 0 stores the value raw.
+// `new_version` KEY_VERSION_NONE numbers the write after the key's last one.
+static int write_value(storage_t* db, const char* key, const char* value, size_t value_size,
+                       uint32_t expires_at, uint64_t expected_version, uint64_t new_version,
+                       uint64_t* version, int compress) {
+    if (!storage_ready(db) || !key || !value) {
+        return -1;
+    }
+
+    // Check key length
+    if (strlen(key) >= MAX_KEY_SIZE) {
+        return -1;
+    }
+
+    // An existing key's chain is rewritten in place: its blocks are reused
+    // in order, extra ones are allocated and surplus ones freed
+    struct index_entry old;
+    int exists = bloom_may_contain(&db->key_filter, key) &&
+                 btree_get(&db->key_index, key, &old) == 0;
+    struct index_entry entry;
+
+    // An expired key counts as absent, but its numbering goes on
+    uint64_t current = exists && !entry_expired(&old, (uint32_t)time(NULL)) ? old.version
+                                                                           : KEY_VERSION_NONE;
+    if (expected_version != KEY_VERSION_ANY && expected_version != current) {
+        if (version) {
+            *version = current;
+        }
+        return 1;
+    }
+
+    // Compress when it saves at least an eighth; otherwise store raw
+    const char* data = value;
+    size_t stored_size = value_size;
+    uint8_t flags = 0;
+    char* packed = NULL;
+    if (compress && db->compress_threshold && value_size >= db->compress_threshold) {
+        packed = pool_alloc(value_size);
+        size_t packed_size = packed ? lz_compress(value, value_size, packed, value_size - value_size / 8) : 0;
+        if (packed_size > 0) {
+            data = packed;
+            stored_size = packed_size;
+            flags |= ENTRY_FLAG_COMPRESSED;
+        } else {
+            pool_free(packed);
+            packed = NULL;
+        }
+    }
+
+    size_t blocks_needed = db->codec->blocks_needed(stored_size);
+    size_t old_blocks = exists ? db->codec->blocks_needed(old.stored_size) : 0;
+
+    // The chain is known up front so each block is written exactly once
+    // with its next pointer already set. New runs come best-fit from the
+    // free-space tree, so a value usually lands in one contiguous stretch.
+    uint32_t* chain = NULL;
+    if (blocks_needed + old_blocks > 0) {
+        chain = pool_alloc((blocks_needed + old_blocks) * sizeof(*chain));
+        if (!chain) {
+            pool_free(packed);
+            return -1;
+        }
+    }
+    uint32_t* old_chain = chain + blocks_needed;
+    if (old_blocks > 0 && chain_blocks(db, &old, old_chain) != 0) {
+        TRACE_ERROR("PUT: failed to read the existing chain of key '%s'", key);
+        pool_free(chain);
+        pool_free(packed);
+        return -1;
+    }
+    // Blocks a snapshot still reads are never written over
+    size_t reused = 0;
+    while (reused < old_blocks && reused < blocks_needed && !block_pinned(db, old_chain[reused])) {
+        chain[reused] = old_chain[reused];
+        reused++;
+    }
+
+    size_t allocated = reused;
+    while (allocated < blocks_needed) {
+        uint32_t addr;
+        uint32_t got = alloc_run(db, (uint32_t)(blocks_needed - allocated), &addr);
+        if (got == 0) {
+            // Out of space - give back what we took
+            for (size_t j = reused; j < allocated; j++) {
+                mark_block_free(db, chain[j]);
+            }
+            flush_bitmaps(db);
+            pool_free(chain);
+            pool_free(packed);
+            return -1;
+        }
+        for (uint32_t k = 0; k < got; k++) {
+            chain[allocated++] = addr + k;
+        }
+    }
+
+    if (write_chain(db, chain, blocks_needed, data, stored_size) != 0) {
+        abandon_write(db, key, &old, chain, reused, blocks_needed, old_chain, old_blocks);
+        pool_free(chain);
+        pool_free(packed);
+        return -1;
+    }
+    pool_free(packed);
+
+    // Update key entry
+    entry.first_block_id = blocks_needed > 0 ? chain[0] : 0;
+    entry.last_block_id = blocks_needed > 0 ? chain[blocks_needed - 1] : 0;
+    entry.value_size = value_size;
+    entry.stored_size = stored_size;
+    entry.flags = flags;
+    entry.expires_at = expires_at;
+    entry.version = new_version != KEY_VERSION_NONE ? new_version
+                    : exists ? old.version + 1 : db->meta.version_floor + 1;
+
+    if (btree_put(&db->key_index, key, &entry) != 0) {
+        TRACE_ERROR("PUT: index update failed for key '%s'", key);
+        abandon_write(db, key, &old, chain, reused, blocks_needed, old_chain, old_blocks);
+        pool_free(chain);
+        return -1;
+    }
+    if (!exists) {
+        bloom_add(&db->key_filter, key);
+        maintain_filter(db);
+    }
+
+    // Old blocks that were not rewritten go back (a shorter value's tail)
+    for (size_t j = reused; j < old_blocks; j++) {
+        mark_block_free(db, old_chain[j]);
+    }
+    pool_free(chain);
+
+    // Write updated metadata
+    if (commit_metadata(db) != 0) {
+        return -1;
+    }
+
+    if (version) {
+        *version = entry.version;
+    }
+    return 0;  // Success
+}
+
+static int block_put(storage_t* db, const char* key, const char* value, size_t value_size,
+                     uint32_t expires_at, uint64_t expected_version, uint64_t* version) {
+    return write_value(db, key, value, value_size, expires_at, expected_version, KEY_VERSION_NONE,
+                       version, 1);
+}
+
+static int block_put_version(storage_t* db, const char* key, const char* value,
+                             size_t value_size, uint32_t expires_at, uint64_t version) {
+    return write_value(db, key, value, value_size, expires_at, KEY_VERSION_ANY, version, NULL, 1);
+}
+
+// APPEND that can't go in place: write the whole result again, raw, so the
+// appends after it can
+static int append_rewrite(storage_t* db, const char* key, const struct index_entry* old,
+                          const char* data, size_t size, uint64_t* version) {
+    size_t old_size = old ? old->value_size : 0;
+    char* value = pool_alloc(old_size + size > 0 ? old_size + size : 1);
+    if (!value) {
+        return -1;
+    }
+    if (old && read_value(db, old, value) != 0) {
+        pool_free(value);
+        return -1;
+    }
+    if (size > 0) {
+        memcpy(value + old_size, data, size);
+    }
+    int rc = write_value(db, key, value, old_size + size, old ? old->expires_at : 0,
+                         KEY_VERSION_ANY, KEY_VERSION_NONE, version, 0);
+    pool_free(value);
+    return rc;
+}
+
+// Fill the free room of the chain's last block, then link new blocks after
+// it for the rest: the cost depends on `size`, not on the value. New blocks
+// go first and the tail's header last, so a crash leaves the old value.
+static int block_append(storage_t* db, const char* key, const char* data, size_t size,
+                        struct storage_key_info* info) {
+    if (!storage_ready(db) || strlen(key) >= MAX_KEY_SIZE) {
+        return -1;
+    }
+
+    struct index_entry entry;
+    int exists = lookup_live(db, key, &entry) == 0;
+    if (exists && entry.value_size + (uint64_t)size > UINT32_MAX) {
+        return -1;
+    }
+    size_t payload = db->codec->payload;
+    size_t blocks = exists ? db->codec->blocks_needed(entry.stored_size) : 0;
+    // Compressed bytes can't be extended, and a snapshot's blocks aren't
+    // written to (see block_put)
+    if (!exists || (entry.flags & ENTRY_FLAG_COMPRESSED) ||
+        (blocks > 0 && block_pinned(db, entry.last_block_id))) {
+        uint64_t version;
+        if (append_rewrite(db, key, exists ? &entry : NULL, data, size, &version) != 0) {
+            return -1;
+        }
+        if (info) {
+            info->value_size = (uint32_t)((exists ? entry.value_size : 0) + size);
+            info->expires_at = exists ? entry.expires_at : 0;
+            info->version = version;
+        }
+        return 0;
+    }
+
+    size_t tail_used = blocks > 0 ? entry.stored_size - (blocks - 1) * payload : payload;
+    size_t fill = payload - tail_used < size ? payload - tail_used : size;
+    size_t extra = db->codec->blocks_needed(size - fill);
+
+    uint32_t* chain = NULL;
+    if (extra > 0) {
+        chain = pool_alloc(extra * sizeof(*chain));
+        if (!chain) {
+            return -1;
+        }
+    }
+    size_t allocated = 0;
+    int rc = 0;
+    while (rc == 0 && allocated < extra) {
+        uint32_t addr;
+        uint32_t got = alloc_run(db, (uint32_t)(extra - allocated), &addr);
+        for (uint32_t k = 0; k < got; k++) {
+            chain[allocated++] = addr + k;
+        }
+        rc = got > 0 ? 0 : -1;
+    }
+    if (rc == 0 && extra > 0) {
+        rc = write_chain(db, chain, extra, data + fill, size - fill);
+    }
+    uint32_t tail = entry.last_block_id;
+    int linked = 0;
+    if (rc == 0 && blocks > 0 && (fill > 0 || extra > 0)) {
+        struct data_block_header h = { extra > 0 ? chain[0] : 0, (uint32_t)(tail_used + fill) };
+        if (fill > 0) {
+            rc = write_block_at(db, tail, sizeof(h) + tail_used, data, fill);
+        }
+        if (rc == 0) {
+            rc = write_block_bytes(db, tail, &h, sizeof(h));
+            linked = rc == 0;
+        }
+    }
+
+    if (extra > 0) {
+        if (blocks == 0) {
+            entry.first_block_id = chain[0];
+        }
+        entry.last_block_id = chain[extra - 1];
+    }
+    entry.value_size += (uint32_t)size;
+    entry.stored_size += (uint32_t)size;
+    entry.version++;
+    if (rc == 0 && btree_put(&db->key_index, key, &entry) != 0) {
+        TRACE_ERROR("APPEND: index update failed for key '%s'", key);
+        rc = -1;
+    }
+    if (rc != 0) {
+        // Put the tail back as the end of the chain
+        if (linked) {
+            struct data_block_header h = { 0, (uint32_t)tail_used };
+            write_block_bytes(db, tail, &h, sizeof(h));
+        }
+        for (size_t j = 0; j < allocated; j++) {
+            mark_block_free(db, chain[j]);
+        }
+        flush_bitmaps(db);
+        pool_free(chain);
+        return -1;
+    }
+    pool_free(chain);
+
+    if (commit_metadata(db) != 0) {
+        return -1;
+    }
+    if (info) {
+        info->value_size = entry.value_size;
+        info->expires_at = entry.expires_at;
+        info->version = entry.version;
+    }
+    return 0;
 }
 
-// Helper function to mark a block as used
-static void mark_block_used(struct metadata_block *meta, int block_id) {
-    int byte_index = block_id / 8;
-    int bit_index = block_id % 8;
-    meta->bitmap[byte_index] |= (1 << bit_index);
-    meta->free_blocks--;
-}
+static int block_get(storage_t* db, const char* key, char* value, size_t* value_size) {
+    if (!storage_ready(db) || !key || !value_size) {
+        TRACE_DEBUG("storage_get - Invalid parameters");
+        return -1;
+    }
+
+    TRACE_DEBUG("storage_get - Looking for key: '%s'", key);
+
+    // Find key
+    struct index_entry entry;
+    if (lookup_live(db, key, &entry) != 0) {
+        TRACE_DEBUG("storage_get - Key not found");
+        return -1;  // Key not found
+    }
+
+    TRACE_DEBUG("Key found - first_block_id: %u, value_size: %u",
+           entry.first_block_id, entry.value_size);
+
+    // If value is null, caller just wants the size
+    if (value == NULL) {
+        *value_size = entry.value_size;
+        return 0;  // Success - size returned
+    }
+
+    // Check buffer size
+    if (*value_size < entry.value_size) {
+        *value_size = entry.value_size;
+        return -1;  // Buffer too small
+    }
+
+    if (read_value(db, &entry, value) != 0) {
+        TRACE_ERROR("GET: failed to read value for key '%s'", key);
+        return -1;
+    }
 
-// Helper function to mark a block as free
-static void mark_block_free(struct metadata_block *meta, int block_id) {
-    int byte_index = block_id / 8;
-    int bit_index = block_id % 8;
-    meta->bitmap[byte_index] &= ~(1 << bit_index);
-    meta->free_blocks++;
+    *value_size = entry.value_size;
+    return 0;  // Success
 }
 
-// Helper function to read metadata from Block 0
-static int read_metadata(struct metadata_block *meta) {
-    if (storage_fd < 0) return -1;
-    
-    if (lseek(storage_fd, 0, SEEK_SET) == -1) {
+static int block_stat(storage_t* db, const char* key, struct storage_key_info* info) {
+    if (!storage_ready(db) || !key || !info) {
         return -1;
     }
-    
-    if (read(storage_fd, meta, sizeof(*meta)) != sizeof(*meta)) {
+
+    struct index_entry entry;
+    if (lookup_live(db, key, &entry) != 0) {
         return -1;
     }
-    
+    info->value_size = entry.value_size;
+    info->expires_at = entry.expires_at;
+    info->version = entry.version;
     return 0;
 }
 
-// Helper function to write metadata to Block 0
-static int write_metadata(struct metadata_block *meta) {
-    if (storage_fd < 0) return -1;
-    
-    if (lseek(storage_fd, 0, SEEK_SET) == -1) {
+static int block_delete(storage_t* db, const char* key) {
+    if (!storage_ready(db) || !key) {
         return -1;
     }
-    
-    if (write(storage_fd, meta, sizeof(*meta)) != sizeof(*meta)) {
+
+    // Find key
+    struct index_entry entry;
+    if (!bloom_may_contain(&db->key_filter, key) || btree_get(&db->key_index, key, &entry) != 0) {
+        return -1;  // Key not found
+    }
+
+    // Free all blocks used by this key
+    if (free_chain(db, &entry) != 0) {
         return -1;
     }
-    
-    return 0;
+
+    // Remove the key from the index
+    btree_delete(&db->key_index, key);
+    retire_version(db, &entry);
+    db->filter_stale++;
+    maintain_filter(db);
+
+    // Write updated metadata
+    if (commit_metadata(db) != 0) {
+        return -1;
+    }
+
+    return 0;  // Success
 }
 
-int storage_init(const char *filename) {
-    // Save filename for later use
-    if (storage_filename) {
-        free(storage_filename);
+// storage_scan over `index`: the live one or the snapshot's
+static int scan_index(storage_t* db, struct btree* index, const char* start, const char* end,
+                      const char* prefix, storage_scan_fn fn, void* arg) {
+    start = start ? start : "";
+    end = end ? end : "";
+    prefix = prefix ? prefix : "";
+    size_t prefix_len = strlen(prefix);
+
+    // Everything with the prefix sorts at or after the prefix itself
+    const char* from = strcmp(prefix, start) > 0 ? prefix : start;
+    struct btree_cursor cursor;
+    if (btree_seek(index, from, &cursor) != 0) {
+        return -1;
     }
-    storage_filename = strdup(filename);
-    
-    // Try to open existing file
-    storage_fd = open(filename, O_RDWR);
-    
-    if (storage_fd == -1) {
-        // File doesn't exist, create new one
-        storage_fd = open(filename, O_CREAT | O_RDWR, 0644);
-        if (storage_fd == -1) {
-            return -1;
+
+    char key[BTREE_MAX_KEY + 1];
+    struct index_entry entry;
+    char* buf = NULL;
+    size_t buf_cap = 0;
+    int visited = 0;
+    int rc;
+    uint32_t now = (uint32_t)time(NULL);
+
+    while ((rc = btree_next(&cursor, key, &entry)) == 0) {
+        if (strncmp(key, prefix, prefix_len) != 0 || (end[0] && strcmp(key, end) >= 0)) {
+            break;  // Past the prefix range or the end bound
+        }
+        if (entry_expired(&entry, now)) {
+            continue;  // Left for the expiry pass; the callback can't modify
+        }
+
+        if (entry.value_size > buf_cap) {
+            char* grown = pool_realloc(buf, entry.value_size);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            buf = grown;
+            buf_cap = entry.value_size;
+        }
+        if (read_value(db, &entry, buf) != 0) {
+            TRACE_ERROR("SCAN: failed to read value for key '%s'", key);
+            rc = -1;
+            break;
+        }
+
+        visited++;
+        if (fn(key, buf, entry.value_size, arg) != 0) {
+            break;
         }
-        
-        // Create 64MB file
-        if (lseek(storage_fd, 64 * 1024 * 1024 - 1, SEEK_SET) == -1) {
-            close(storage_fd);
-            storage_fd = -1;
+    }
+
+    pool_free(buf);
+    return rc < 0 ? -1 : visited;
+}
+
+static int block_scan(storage_t* db, const char* start, const char* end, const char* prefix,
+                      storage_scan_fn fn, void* arg) {
+    if (!storage_ready(db) || !fn) {
+        return -1;
+    }
+    return scan_index(db, &db->key_index, start, end, prefix, fn, arg);
+}
+
+// Copy the index file for a snapshot: a reflink where the filesystem can
+// share extents, otherwise an in-kernel copy
+static int clone_index(storage_t* db, const char* path) {
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ioctl(fd, FICLONE, db->key_index.fd) == 0) {
+        close(fd);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(db->key_index.fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    off_t in = 0;
+    while (in < st.st_size) {
+        ssize_t n = copy_file_range(db->key_index.fd, &in, fd, NULL, (size_t)(st.st_size - in), 0);
+        if (n <= 0) {
+            close(fd);
             return -1;
         }
-        write(storage_fd, "", 1);
-        
-        // Go back to start and initialize metadata
-        lseek(storage_fd, 0, SEEK_SET);
-        
-        struct metadata_block meta;
-        memset(&meta, 0, sizeof(meta));
-        meta.magic = 0xDEADBEEF;
-        meta.version = 1;
-        meta.total_blocks = TOTAL_BLOCKS;
-        meta.free_blocks = TOTAL_BLOCKS - 1;  // Block 0 is used for metadata
-        
-        // Initialize bitmap - all blocks free except block 0
-        memset(meta.bitmap, 0, sizeof(meta.bitmap));
-        meta.bitmap[0] = 0x01;  // Mark Block 0 as used
-        
-        // Initialize all key entries as invalid
-        for (int i = 0; i < MAX_KEYS; i++) {
-            meta.entries[i].is_valid = 0;
-        }
-        
-        // Write metadata to Block 0
-        if (write(storage_fd, &meta, sizeof(meta)) != sizeof(meta)) {
-            close(storage_fd);
-            storage_fd = -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static int block_snapshot_create(storage_t* db) {
+    if (!storage_ready(db) || db->snapshot_active) {
+        return -1;
+    }
+    if (commit_metadata(db) != 0) {
+        return -1;
+    }
+
+    if (db->in_memory) {
+        if (btree_clone(&db->snapshot_index, &db->key_index) != 0) {
+            TRACE_ERROR("storage: failed to copy the index for a snapshot");
             return -1;
         }
     } else {
-        // File exists, validate it
-        struct metadata_block meta;
-        if (read_metadata(&meta) != 0) {
-            close(storage_fd);
-            storage_fd = -1;
+        // The clone is unlinked once open, so nothing is left behind by a crash
+        char path[4096];
+        snprintf(path, sizeof(path), "%s%s.snap", db->filename, INDEX_SUFFIX);
+        if (clone_index(db, path) != 0 ||
+            btree_open(&db->snapshot_index, path, sizeof(struct index_entry), 0) != 0) {
+            TRACE_ERROR("storage: failed to copy the index for a snapshot: %s", strerror(errno));
+            unlink(path);
             return -1;
         }
-        
-        // Validate metadata
-        if (meta.magic != 0xDEADBEEF || meta.version != 1) {
-            close(storage_fd);
-            storage_fd = -1;
+        unlink(path);
+    }
+
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        struct segment* s = &db->segments[seg];
+        uint32_t words = s->nblocks / BITS_PER_WORD;
+        s->pinned = malloc((size_t)words * sizeof(uint64_t));
+        s->deferred = calloc(words, sizeof(uint64_t));
+        if (!s->pinned || !s->deferred) {
+            block_snapshot_release(db);
             return -1;
         }
+        memcpy(s->pinned, s->bitmap, (size_t)words * sizeof(uint64_t));
+        s->pinned_words = words;
     }
-    
-    return 0;  // Success
+    db->snapshot_active = 1;
+    TRACE_INFO("storage: snapshot taken, %llu keys",
+               (unsigned long long)db->snapshot_index.entry_count);
+    return 0;
 }
 
-int storage_put(const char* key, const char* value, size_t value_size) {
-    if (storage_fd < 0 || !key || !value) {
+static int block_snapshot_scan(storage_t* db, const char* start, const char* end,
+                               const char* prefix, storage_scan_fn fn, void* arg) {
+    if (!storage_ready(db) || !db->snapshot_active || !fn) {
         return -1;
     }
-    
-    // Check key length
-    if (strlen(key) >= MAX_KEY_SIZE) {
-        return -1;
+    return scan_index(db, &db->snapshot_index, start, end, prefix, fn, arg);
+}
+
+static void block_snapshot_release(storage_t* db) {
+    uint32_t freed = 0;
+    db->snapshot_active = 0;
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        struct segment* s = &db->segments[seg];
+        uint64_t* deferred = s->deferred;
+        uint32_t words = s->pinned_words;
+        free(s->pinned);
+        s->pinned = NULL;
+        s->deferred = NULL;
+        s->pinned_words = 0;
+        if (!deferred) {
+            continue;
+        }
+        // Unpinned now, so these really are freed
+        for (uint32_t w = 0; w < words; w++) {
+            for (uint64_t bits = deferred[w]; bits; bits &= bits - 1) {
+                uint32_t index = w * BITS_PER_WORD + (uint32_t)__builtin_ctzll(bits);
+                mark_block_free(db, BLOCK_ADDR(seg, index));
+                freed++;
+            }
+        }
+        free(deferred);
+    }
+    btree_close(&db->snapshot_index);
+    if (freed > 0) {
+        commit_metadata(db);
+        TRACE_INFO("storage: snapshot released, %u blocks freed", freed);
     }
-    
-    // Read metadata
-    struct metadata_block meta;
-    if (read_metadata(&meta) != 0) {
+}
+
+static int block_list_expiring(storage_t* db, storage_expiry_fn fn, void* arg) {
+    if (!storage_ready(db) || !fn) {
         return -1;
     }
-    
-    // Find if key already exists or find empty slot
-    int empty_slot = -1;
-    for (int i = 0; i < MAX_KEYS; i++) {
-        if (meta.entries[i].is_valid) {
-            if (strcmp(meta.entries[i].key, key) == 0) {
-                // Key exists, need to free old blocks first
-                // TODO: Implement freeing old blocks
-                empty_slot = i;
-                break;
-            }
-        } else if (empty_slot == -1) {
-            empty_slot = i;
+    if (db->ckpt_loaded) {
+        int listed = checkpoint_list_expiring(db, fn, arg);
+        if (listed >= 0) {
+            return listed;
         }
     }
-    
-    if (empty_slot == -1) {
-        return -1;  // No space for new key
+
+    struct btree_cursor cursor;
+    if (btree_seek(&db->key_index, NULL, &cursor) != 0) {
+        return -1;
+    }
+
+    char key[BTREE_MAX_KEY + 1];
+    struct index_entry entry;
+    int visited = 0;
+    int rc;
+    while ((rc = btree_next(&cursor, key, &entry)) == 0) {
+        if (entry.expires_at != 0) {
+            fn(key, entry.expires_at, arg);
+            visited++;
+        }
     }
-    
-    // Calculate blocks needed based on data area size, not full struct size
-    int blocks_needed = (value_size + sizeof(((struct data_block*)0)->data) - 1) / sizeof(((struct data_block*)0)->data);
-    if ((uint32_t)blocks_needed > meta.free_blocks) {
-        return -1;  // Not enough space
+    return rc < 0 ? -1 : visited;
+}
+
+static int block_expire(storage_t* db, const char* const* keys, size_t count,
+                        storage_expiry_fn fn, void* arg) {
+    if (!storage_ready(db) || (!keys && count > 0)) {
+        return -1;
     }
-    
-    // Allocate blocks and write data
-    int first_block = -1;
-    int prev_block = -1;
-    size_t bytes_written = 0;
-    
-    while (bytes_written < value_size) {
-        int block_id = find_free_block(&meta);
-        if (block_id == -1) {
-            return -1;  // No free blocks (shouldn't happen)
-        }
-        
-        mark_block_used(&meta, block_id);
-        
-        if (first_block == -1) {
-            first_block = block_id;
-        }
-        
-        // Prepare data block
-        struct data_block block;
-        memset(&block, 0, sizeof(block));
-        
-        size_t to_write = value_size - bytes_written;
-        if (to_write > sizeof(block.data)) {
-            to_write = sizeof(block.data);
-        }
-        
-        memcpy(block.data, value + bytes_written, to_write);
-        block.data_size = to_write;
-        block.next_block_id = 0;  // Will be updated if there's a next block
-        
-        // Write block to file - must write full BLOCK_SIZE to maintain alignment
-        printf("DEBUG PUT: Writing block %d at offset %ld\n", block_id, (long)(block_id * BLOCK_SIZE));
-        printf("DEBUG PUT: Block data_size: %u, next_block_id: %u\n", block.data_size, block.next_block_id);
-        printf("DEBUG PUT: Writing data: '%.10s'\n", block.data);
-        
-        if (lseek(storage_fd, block_id * BLOCK_SIZE, SEEK_SET) == -1) {
-            printf("DEBUG PUT: lseek failed for block %d\n", block_id);
-            return -1;
+
+    uint32_t now = (uint32_t)time(NULL);
+    int reclaimed = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct index_entry entry;
+        if (btree_get(&db->key_index, keys[i], &entry) != 0 || !entry_expired(&entry, now)) {
+            continue;  // Deleted or rewritten since it was scheduled
         }
-        
-        // Create a full block buffer and zero-pad it
-        char block_buffer[BLOCK_SIZE];
-        memset(block_buffer, 0, BLOCK_SIZE);
-        memcpy(block_buffer, &block, sizeof(block));
-        
-        if (write(storage_fd, block_buffer, BLOCK_SIZE) != BLOCK_SIZE) {
-            printf("DEBUG PUT: write failed for block %d\n", block_id);
+        if (free_chain(db, &entry) != 0) {
             return -1;
         }
-        
-        // Update previous block's next pointer
-        if (prev_block != -1) {
-            if (lseek(storage_fd, prev_block * BLOCK_SIZE, SEEK_SET) == -1) {
-                return -1;
-            }
-            
-            // Read the full block to preserve data alignment
-            char prev_block_buffer[BLOCK_SIZE];
-            if (read(storage_fd, prev_block_buffer, BLOCK_SIZE) != BLOCK_SIZE) {
-                return -1;
-            }
-            
-            // Update the next_block_id in the data structure
-            struct data_block *prev = (struct data_block*)prev_block_buffer;
-            prev->next_block_id = block_id;
-            
-            // Write back the full block
-            lseek(storage_fd, prev_block * BLOCK_SIZE, SEEK_SET);
-            write(storage_fd, prev_block_buffer, BLOCK_SIZE);
-        }
-        
-        bytes_written += to_write;
-        prev_block = block_id;
-    }
-    
-    // Update key entry
-    strcpy(meta.entries[empty_slot].key, key);
-    meta.entries[empty_slot].first_block_id = first_block;
-    meta.entries[empty_slot].value_size = value_size;
-    meta.entries[empty_slot].is_valid = 1;
-    
-    // Write updated metadata
-    if (write_metadata(&meta) != 0) {
+        btree_delete(&db->key_index, keys[i]);
+        retire_version(db, &entry);
+        db->filter_stale++;
+        reclaimed++;
+        if (fn) {
+            fn(keys[i], entry.expires_at, arg);
+        }
+    }
+    maintain_filter(db);
+
+    // One commit for the whole batch
+    if (reclaimed > 0 && commit_metadata(db) != 0) {
         return -1;
     }
-    
-    return 0;  // Success
+    return reclaimed;
+}
+
+// A chain read by the compactor: its bytes, block addresses and breaks
+struct compact_chain {
+    char* data;
+    uint32_t* blocks;
+    size_t count;
+    size_t max;
+    uint32_t breaks;
+};
+
+static void compact_block(uint32_t addr, const char* data, size_t len, void* arg) {
+    struct compact_chain* c = arg;
+    if (c->count > 0 && addr != c->blocks[c->count - 1] + 1) {
+        c->breaks++;
+    }
+    if (c->count < c->max) {
+        c->blocks[c->count] = addr;
+    }
+    c->count++;
+    memcpy(c->data, data, len);
+    c->data += len;
 }
 
-int storage_get(const char* key, char* value, size_t* value_size) {
-    if (storage_fd < 0 || !key || !value_size) {
-        printf("DEBUG: storage_get - Invalid parameters\n");
+// Move one key's chain into a single free run if it is split. Returns the
+// bytes read and written, or -1.
+static long compact_key(storage_t* db, const char* key, struct storage_compact_stats* stats) {
+    struct index_entry entry;
+    if (btree_get(&db->key_index, key, &entry) != 0 || entry.stored_size == 0 ||
+        entry_expired(&entry, (uint32_t)time(NULL))) {
+        return 0;  // Gone, empty, or left to expiry
+    }
+
+    size_t blocks = db->codec->blocks_needed(entry.stored_size);
+    char* data = malloc(entry.stored_size);
+    uint32_t* old = malloc(blocks * sizeof(*old));
+    if (!data || !old) {
+        free(data);
+        free(old);
         return -1;
     }
-    
-    printf("DEBUG: storage_get - Looking for key: '%s'\n", key);
-    
-    // Read metadata
-    struct metadata_block meta;
-    if (read_metadata(&meta) != 0) {
-        printf("DEBUG: storage_get - Failed to read metadata\n");
+
+    struct compact_chain c = { data, old, 0, blocks, 0 };
+    long spent = (long)blocks << db->codec->block_shift;
+    stats->chains_checked++;
+    if (walk_chain(db, entry.first_block_id, entry.stored_size, compact_block, &c) != 0 ||
+        c.count != blocks) {
+        TRACE_ERROR("compact: failed to read the chain of key '%s'", key);
+        free(data);
+        free(old);
         return -1;
     }
-    
-    // Find key
-    int found = -1;
-    for (int i = 0; i < MAX_KEYS; i++) {
-        if (meta.entries[i].is_valid) {
-            printf("DEBUG: Found valid key[%d]: '%s'\n", i, meta.entries[i].key);
-            if (strcmp(meta.entries[i].key, key) == 0) {
-                found = i;
-                printf("DEBUG: Key match found at index %d\n", i);
-                break;
-            }
+    stats->breaks_found += c.breaks;
+
+    uint32_t addr;
+    if (c.breaks == 0 || db->snapshot_active ||
+        alloc_contiguous(db, (uint32_t)blocks, &addr) != 0) {
+        free(data);
+        free(old);
+        return spent;  // Contiguous, pinned by a snapshot, or no run long enough yet
+    }
+
+    // New copy first, then the index, then the old blocks: a crash at any
+    // point leaves the key readable (at worst the old blocks leak)
+    uint32_t* fresh = malloc(blocks * sizeof(*fresh));
+    int rc = fresh ? 0 : -1;
+    for (size_t i = 0; fresh && i < blocks; i++) {
+        fresh[i] = addr + (uint32_t)i;
+    }
+    if (rc == 0) {
+        rc = write_chain(db, fresh, blocks, data, entry.stored_size);
+    }
+    if (rc == 0) {
+        entry.first_block_id = addr;
+        entry.last_block_id = addr + (uint32_t)blocks - 1;
+        rc = btree_put(&db->key_index, key, &entry);
+    }
+    if (rc == 0) {
+        rc = commit_metadata(db);
+    }
+    free(fresh);
+    free(data);
+
+    if (rc != 0) {
+        TRACE_ERROR("compact: failed to move key '%s'", key);
+        for (size_t i = 0; i < blocks; i++) {
+            mark_block_free(db, addr + (uint32_t)i);
         }
+        free(old);
+        return -1;
     }
-    
-    if (found == -1) {
-        printf("DEBUG: storage_get - Key not found\n");
-        return -1;  // Key not found
+    for (size_t i = 0; i < blocks; i++) {
+        mark_block_free(db, old[i]);
     }
-    
-    printf("DEBUG: Key found - first_block_id: %u, value_size: %u\n", 
-           meta.entries[found].first_block_id, meta.entries[found].value_size);
-    
-    // If value is null, caller just wants the size
-    if (value == NULL) {
-        *value_size = meta.entries[found].value_size;
-        return 0;  // Success - size returned
+    free(old);
+
+    stats->chains_moved++;
+    stats->blocks_moved += blocks;
+    stats->breaks_removed += c.breaks;
+    return spent * 2;
+}
+
+static long block_compact_step(storage_t* db, char* cursor, size_t budget,
+                               struct storage_compact_stats* stats) {
+    if (!storage_ready(db) || !cursor || !stats) {
+        return -1;
     }
-    
-    // Check buffer size
-    if (*value_size < meta.entries[found].value_size) {
-        *value_size = meta.entries[found].value_size;
-        return -1;  // Buffer too small
+
+    // Keys are collected first so the moves don't disturb the cursor; one
+    // extra tells where the next step resumes
+    char keys[COMPACT_BATCH + 1][BTREE_MAX_KEY + 1];
+    struct btree_cursor it;
+    if (btree_seek(&db->key_index, cursor[0] ? cursor : NULL, &it) != 0) {
+        return -1;
     }
-    
-    // Read data blocks
-    int block_id = meta.entries[found].first_block_id;
-    size_t bytes_read = 0;
-    
-    printf("DEBUG: Starting to read data blocks, first block_id: %d\n", block_id);
-    
-    while (block_id != 0 && bytes_read < meta.entries[found].value_size) {
-        printf("DEBUG: Reading block %d at offset %ld\n", block_id, (long)(block_id * BLOCK_SIZE));
-        
-        // Read full block to maintain alignment
-        if (lseek(storage_fd, block_id * BLOCK_SIZE, SEEK_SET) == -1) {
-            printf("DEBUG: lseek failed for block %d\n", block_id);
+    struct index_entry entry;
+    size_t count = 0;
+    int rc = 0;
+    while (count <= COMPACT_BATCH && (rc = btree_next(&it, keys[count], &entry)) == 0) {
+        count++;
+    }
+    if (rc < 0) {
+        return -1;
+    }
+
+    long spent = 0;
+    size_t i = 0;
+    // At least one key per step, however large its value
+    while (i < count && i < COMPACT_BATCH && (i == 0 || (size_t)spent < budget)) {
+        long cost = compact_key(db, keys[i], stats);
+        if (cost > 0) {
+            spent += cost;
+        }
+        i++;  // A key that failed to move is retried next pass
+    }
+
+    if (i < count) {
+        memcpy(cursor, keys[i], MAX_KEY_SIZE);
+        cursor[MAX_KEY_SIZE - 1] = '\0';
+    } else {
+        cursor[0] = '\0';  // Pass complete
+    }
+    if (commit_metadata(db) != 0) {
+        return -1;
+    }
+    return spent;
+}
+
+// Offline check. The index is copied out once, then worker threads each walk
+// a share of the chains, claiming every block they reach in a shared map with
+// an atomic OR: a bit someone else already set is a block on two chains.
+// Workers then compare their share of that map with the on-disk bitmap.
+enum { CHECK_WALK, CHECK_OWNERS, CHECK_COMPARE };
+enum { KEY_BROKEN = 1, KEY_SHARED = 2 };
+
+struct check_key {
+    char* key;
+    struct index_entry entry;
+    uint8_t state;               // KEY_*, set by the thread that walks it
+};
+
+struct check_state {
+    storage_t* db;
+    struct check_key* keys;
+    size_t key_count;
+    uint64_t* reach[MAX_SEGMENTS];   // Blocks some chain uses
+    uint64_t* shared[MAX_SEGMENTS];  // Blocks more than one chain uses
+    unsigned threads;
+    int phase;                       // CHECK_*
+};
+
+struct check_worker {
+    struct check_state* c;
+    pthread_t thread;
+    unsigned index;
+    uint64_t blocks;
+    uint64_t cross_linked;
+    uint64_t leaked;
+    uint64_t unmarked;
+};
+
+static int claim_block(struct check_state* c, uint32_t seg, uint32_t index) {
+    uint64_t bit = 1ULL << (index % BITS_PER_WORD);
+    uint64_t old = __atomic_fetch_or(&c->reach[seg][index / BITS_PER_WORD], bit, __ATOMIC_RELAXED);
+    if (old & bit) {
+        __atomic_fetch_or(&c->shared[seg][index / BITS_PER_WORD], bit, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+// Follow one chain by its block headers alone. Returns 0, or -1 if a link
+// leaves the data area or a header disagrees with the index entry.
+static int check_chain(struct check_state* c, const struct index_entry* entry,
+                       struct check_worker* w, int* shared) {
+    storage_t* db = c->db;
+    size_t blocks = db->codec->blocks_needed(entry->stored_size);
+    size_t remaining = entry->stored_size;
+    uint32_t addr = entry->first_block_id;
+
+    if (blocks == 0) {
+        return addr == 0 && entry->last_block_id == 0 ? 0 : -1;
+    }
+    for (size_t i = 0; i < blocks; i++) {
+        uint32_t seg = BLOCK_SEGMENT(addr);
+        uint32_t index = BLOCK_INDEX(addr);
+        if (addr == 0 || seg >= db->segment_count || index < reserved_blocks(db) ||
+            index >= db->segments[seg].nblocks) {
+            return -1;
+        }
+        if (c->phase == CHECK_WALK) {
+            w->blocks++;
+            w->cross_linked += claim_block(c, seg, index);
+        } else if ((c->shared[seg][index / BITS_PER_WORD] >> (index % BITS_PER_WORD)) & 1) {
+            *shared = 1;
+        }
+
+        struct data_block_header h;
+        off_t offset = (off_t)index << db->codec->block_shift;
+        if (pread(db->segments[seg].fd, &h, sizeof(h), offset) != (ssize_t)sizeof(h)) {
             return -1;
         }
-        
-        char block_buffer[BLOCK_SIZE];
-        ssize_t bytes_read_from_file = read(storage_fd, block_buffer, BLOCK_SIZE);
-        if (bytes_read_from_file != BLOCK_SIZE) {
-            printf("DEBUG: read failed - expected %d bytes, got %zd\n", BLOCK_SIZE, bytes_read_from_file);
+        size_t want = remaining < db->codec->payload ? remaining : db->codec->payload;
+        if (h.data_size != want || (i + 1 == blocks) != (h.next_block_id == 0) ||
+            (i + 1 == blocks && addr != entry->last_block_id)) {
             return -1;
         }
-        
-        // Extract data block structure
-        struct data_block *block = (struct data_block*)block_buffer;
-        
-        printf("DEBUG: Block data_size: %u, next_block_id: %u\n", block->data_size, block->next_block_id);
-        printf("DEBUG: First few bytes of data: '%.10s'\n", block->data);
-        
-        // Calculate how much data to copy from this block
-        size_t remaining = meta.entries[found].value_size - bytes_read;
-        size_t to_copy = (remaining < block->data_size) ? remaining : block->data_size;
-        
-        printf("DEBUG: Remaining: %zu, block data_size: %u, to_copy: %zu\n", remaining, block->data_size, to_copy);
-        
-        // Copy data
-        memcpy(value + bytes_read, block->data, to_copy);
-        bytes_read += to_copy;
-        
-        // Move to next block
-        block_id = block->next_block_id;
-    }
-    
-    *value_size = bytes_read;
-    return 0;  // Success
+        remaining -= want;
+        addr = h.next_block_id;
+    }
+    return 0;
 }
 
-int storage_delete(const char* key) {
-    if (storage_fd < 0 || !key) {
-        return -1;
+static void* check_main(void* arg) {
+    struct check_worker* w = arg;
+    struct check_state* c = w->c;
+    storage_t* db = c->db;
+
+    if (c->phase != CHECK_COMPARE) {
+        size_t from = c->key_count * w->index / c->threads;
+        size_t to = c->key_count * (w->index + 1) / c->threads;
+        for (size_t i = from; i < to; i++) {
+            struct check_key* k = &c->keys[i];
+            int shared = 0;
+            if (c->phase == CHECK_WALK) {
+                if (k->state == 0 && check_chain(c, &k->entry, w, &shared) != 0) {
+                    k->state |= KEY_BROKEN;
+                }
+            } else if (k->state == 0) {
+                check_chain(c, &k->entry, w, &shared);
+                k->state |= shared ? KEY_SHARED : 0;
+            }
+        }
+        return NULL;
+    }
+
+    uint32_t reserved = reserved_blocks(db);
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        const struct segment* s = &db->segments[seg];
+        uint32_t nwords = s->nblocks / BITS_PER_WORD;
+        uint32_t from = (uint32_t)((uint64_t)nwords * w->index / c->threads);
+        uint32_t to = (uint32_t)((uint64_t)nwords * (w->index + 1) / c->threads);
+        for (uint32_t i = from; i < to; i++) {
+            uint64_t expect = c->reach[seg][i];
+            for (uint32_t b = 0; b < BITS_PER_WORD && i * BITS_PER_WORD + b < reserved; b++) {
+                expect |= 1ULL << b;
+            }
+            w->leaked += (uint64_t)__builtin_popcountll(s->bitmap[i] & ~expect);
+            w->unmarked += (uint64_t)__builtin_popcountll(expect & ~s->bitmap[i]);
+        }
     }
-    
-    // Read metadata
-    struct metadata_block meta;
-    if (read_metadata(&meta) != 0) {
+    return NULL;
+}
+
+// Run one phase on every thread and add up what they counted
+static int check_run(struct check_state* c, int phase, struct check_worker* total) {
+    struct check_worker* workers = calloc(c->threads, sizeof(*workers));
+    if (!workers) {
         return -1;
     }
-    
-    // Find key
-    int found = -1;
-    for (int i = 0; i < MAX_KEYS; i++) {
-        if (meta.entries[i].is_valid && strcmp(meta.entries[i].key, key) == 0) {
-            found = i;
+    c->phase = phase;
+    unsigned started = 0;
+    for (; started < c->threads; started++) {
+        workers[started].c = c;
+        workers[started].index = started;
+        if (pthread_create(&workers[started].thread, NULL, check_main, &workers[started]) != 0) {
             break;
         }
     }
-    
-    if (found == -1) {
-        return -1;  // Key not found
+    // Shares of threads that failed to start are done here
+    for (unsigned i = started; i < c->threads; i++) {
+        workers[i].c = c;
+        workers[i].index = i;
+        check_main(&workers[i]);
     }
-    
-    // Free all blocks used by this key
-    int block_id = meta.entries[found].first_block_id;
-    
-    while (block_id != 0) {
-        // Read full block to get next block
-        if (lseek(storage_fd, block_id * BLOCK_SIZE, SEEK_SET) == -1) {
+    memset(total, 0, sizeof(*total));
+    for (unsigned i = 0; i < c->threads; i++) {
+        if (i < started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        total->blocks += workers[i].blocks;
+        total->cross_linked += workers[i].cross_linked;
+        total->leaked += workers[i].leaked;
+        total->unmarked += workers[i].unmarked;
+    }
+    free(workers);
+    return 0;
+}
+
+static void check_free(struct check_state* c) {
+    for (size_t i = 0; i < c->key_count; i++) {
+        free(c->keys[i].key);
+    }
+    free(c->keys);
+    for (uint32_t seg = 0; seg < MAX_SEGMENTS; seg++) {
+        free(c->reach[seg]);
+        free(c->shared[seg]);
+    }
+}
+
+// Forget which blocks were reached, before walking again
+static void check_clear(struct check_state* c) {
+    for (uint32_t seg = 0; seg < c->db->segment_count; seg++) {
+        size_t bytes = (c->db->segments[seg].nblocks / BITS_PER_WORD + 1) * sizeof(uint64_t);
+        memset(c->reach[seg], 0, bytes);
+        memset(c->shared[seg], 0, bytes);
+    }
+}
+
+static int check_load_keys(struct check_state* c) {
+    size_t cap = (size_t)c->db->key_index.entry_count + 1;
+    c->keys = calloc(cap, sizeof(*c->keys));
+    if (!c->keys) {
+        return -1;
+    }
+
+    struct btree_cursor cursor;
+    if (btree_seek(&c->db->key_index, NULL, &cursor) != 0) {
+        return -1;
+    }
+    char key[BTREE_MAX_KEY + 1];
+    struct index_entry entry;
+    int rc;
+    while ((rc = btree_next(&cursor, key, &entry)) == 0) {
+        if (c->key_count == cap) {
+            struct check_key* grown = realloc(c->keys, cap * 2 * sizeof(*grown));
+            if (!grown) {
+                return -1;
+            }
+            memset(grown + cap, 0, cap * sizeof(*grown));
+            c->keys = grown;
+            cap *= 2;
+        }
+        struct check_key* k = &c->keys[c->key_count];
+        k->key = strdup(key);
+        if (!k->key) {
             return -1;
         }
-        
-        char block_buffer[BLOCK_SIZE];
-        if (read(storage_fd, block_buffer, BLOCK_SIZE) != BLOCK_SIZE) {
+        k->entry = entry;
+        c->key_count++;
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+// Rewrite every bitmap as the reserved blocks plus the blocks reachable from
+// the index, then rebuild the free runs and counts to match
+static int check_rebuild_bitmaps(storage_t* db, struct check_state* c) {
+    uint32_t reserved = reserved_blocks(db);
+    db->meta.total_blocks = 0;
+    db->meta.free_blocks = 0;
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        struct segment* s = &db->segments[seg];
+        uint32_t nwords = s->nblocks / BITS_PER_WORD;
+        for (uint32_t i = 0; i < nwords; i++) {
+            s->bitmap[i] = c->reach[seg][i];
+            mark_dirty(db, s, i);
+        }
+        for (uint32_t index = 0; index < reserved; index++) {
+            s->bitmap[index / BITS_PER_WORD] |= 1ULL << (index % BITS_PER_WORD);
+        }
+        if (segment_index_bitmap(s) != 0) {
             return -1;
         }
-        
-        struct data_block *block = (struct data_block*)block_buffer;
-        
-        // Store next block ID before marking current block as free
-        int next_block = block->next_block_id;
-        
-        // Mark block as free
-        mark_block_free(&meta, block_id);
-        
-        // Move to next block
-        block_id = next_block;
-    }
-    
-    // Mark key entry as invalid
-    meta.entries[found].is_valid = 0;
-    memset(meta.entries[found].key, 0, MAX_KEY_SIZE);
-    meta.entries[found].first_block_id = 0;
-    meta.entries[found].value_size = 0;
-    
-    // Write updated metadata
-    if (write_metadata(&meta) != 0) {
+        db->meta.total_blocks += s->nblocks;
+        db->meta.free_blocks += s->free_blocks;
+    }
+    db->alloc_segment = 0;
+    db->meta_dirty = 1;
+    return 0;
+}
+
+static int block_check(storage_t* db, unsigned threads, int repair,
+                       storage_check_fn fn, void* arg, struct storage_check_report* report) {
+    if (!storage_ready(db) || db->key_index.fd < 0 || !report || db->snapshot_active) {
         return -1;
     }
-    
-    return 0;  // Success
+    memset(report, 0, sizeof(*report));
+
+    struct metadata_block recorded;
+    if (read_metadata(db, &recorded) != 0) {
+        return -1;
+    }
+    report->free_blocks_recorded = recorded.free_blocks;
+
+    struct check_state c;
+    memset(&c, 0, sizeof(c));
+    c.db = db;
+    c.threads = threads > 0 ? threads : 1;
+    int rc = -1;
+    for (uint32_t seg = 0; seg < db->segment_count; seg++) {
+        size_t words = db->segments[seg].nblocks / BITS_PER_WORD;
+        c.reach[seg] = calloc(words + 1, sizeof(uint64_t));
+        c.shared[seg] = calloc(words + 1, sizeof(uint64_t));
+        if (!c.reach[seg] || !c.shared[seg]) {
+            goto out;
+        }
+    }
+    if (check_load_keys(&c) != 0) {
+        goto out;
+    }
+    report->keys = c.key_count;
+
+    // Broken chains first, then blocks shared between the chains left; a
+    // broken chain's stray links aren't allowed to implicate anyone else
+    struct check_worker total;
+    if (check_run(&c, CHECK_WALK, &total) != 0) {
+        goto out;
+    }
+    size_t bad = 0;
+    for (size_t i = 0; i < c.key_count; i++) {
+        bad += c.keys[i].state != 0;
+    }
+    report->broken_chains = bad;
+    if (bad > 0 && (check_clear(&c), check_run(&c, CHECK_WALK, &total) != 0)) {
+        goto out;
+    }
+    report->cross_linked = total.cross_linked;
+    if (total.cross_linked > 0) {
+        if (check_run(&c, CHECK_OWNERS, &total) != 0) {
+            goto out;
+        }
+        check_clear(&c);
+        if (check_run(&c, CHECK_WALK, &total) != 0) {
+            goto out;
+        }
+    }
+
+    bad = 0;
+    for (size_t i = 0; i < c.key_count; i++) {
+        struct check_key* k = &c.keys[i];
+        if (k->state == 0) {
+            continue;
+        }
+        bad++;
+        if (fn) {
+            fn(k->key, k->state & KEY_BROKEN ? "broken chain" : "shares blocks with another key", arg);
+        }
+    }
+
+    report->blocks_used = total.blocks;
+    if (check_run(&c, CHECK_COMPARE, &total) != 0) {
+        goto out;
+    }
+    report->leaked = total.leaked;
+    report->unmarked = total.unmarked;
+    report->free_blocks_actual = db->meta.total_blocks - (uint64_t)db->segment_count * reserved_blocks(db) -
+                                 report->blocks_used;
+
+    int problems = bad > 0 || report->leaked > 0 || report->unmarked > 0 ||
+                   report->free_blocks_recorded != report->free_blocks_actual;
+    if (!problems) {
+        rc = 0;
+        goto out;
+    }
+    if (!repair) {
+        rc = 1;
+        goto out;
+    }
+
+    for (size_t i = 0; i < c.key_count; i++) {
+        if (c.keys[i].state != 0 && btree_delete(&db->key_index, c.keys[i].key) == 0) {
+            retire_version(db, &c.keys[i].entry);
+            report->keys_dropped++;
+        }
+    }
+    rebuild_filter(db);
+    if (check_rebuild_bitmaps(db, &c) != 0 || commit_metadata(db) != 0) {
+        goto out;
+    }
+    rc = 0;
+
+out:
+    check_free(&c);
+    return rc;
+}
+
+static void block_set_compression(storage_t* db, size_t threshold) {
+    db->compress_threshold = threshold;
 }
 
-void storage_cleanup(void) {
-    if (storage_fd >= 0) {
-        close(storage_fd);
-        storage_fd = -1;
+static void block_close(storage_t* db) {
+    if (!db) {
+        return;
     }
-    
-    if (storage_filename) {
-        free(storage_filename);
-        storage_filename = NULL;
+    if (storage_ready(db)) {
+        block_snapshot_release(db);
+        if (block_checkpoint(db) != 0) {
+            flush_bitmaps(db);
+        }
     }
+    storage_reset(db);
+    free(db->filename);
+    free(db);
+}
+
+static void block_stats(storage_t* db, struct storage_stats* stats) {
+    stats->engine = block_engine.name;
+    stats->keys = db->key_index.entry_count;
+    stats->bytes_total = (uint64_t)db->meta.total_blocks * db->meta.block_size;
+    stats->bytes_used = (uint64_t)(db->meta.total_blocks - db->meta.free_blocks) * db->meta.block_size;
 }
+
+const struct storage_engine block_engine = {
+    .name = "block",
+    .magic = STORAGE_MAGIC,
+    .open = block_open,
+    .close = block_close,
+    .put = block_put,
+    .put_version = block_put_version,
+    .get = block_get,
+    .remove = block_delete,
+    .stat = block_stat,
+    .scan = block_scan,
+    .stats = block_stats,
+    .snapshot_create = block_snapshot_create,
+    .snapshot_scan = block_snapshot_scan,
+    .snapshot_release = block_snapshot_release,
+    .checkpoint = block_checkpoint,
+    .list_expiring = block_list_expiring,
+    .expire = block_expire,
+    .compact_step = block_compact_step,
+    .check = block_check,
+    .set_compression = block_set_compression,
+    .append = block_append
+};
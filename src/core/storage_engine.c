@@ -0,0 +1,249 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "../../include/core/storage.h"
+#include "../../include/core/storage_engine.h"
+
+static const struct storage_engine* const engines[] = {
+    [STORAGE_ENGINE_BLOCK] = &block_engine,
+    [STORAGE_ENGINE_LOG] = &log_engine
+};
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+static const struct storage_engine* engine_of(storage_t* db) {
+    return *(const struct storage_engine* const*)db;
+}
+
+// The engine that wrote `filename`, NULL if it doesn't exist yet. A file no
+// engine claims goes to the block engine, whose checks reject it.
+static const struct storage_engine* engine_of_file(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    uint32_t magic = 0;
+    ssize_t n = pread(fd, &magic, sizeof(magic), 0);
+    close(fd);
+    for (size_t i = 0; n == sizeof(magic) && i < ENGINE_COUNT; i++) {
+        if (engines[i]->magic == magic) {
+            return engines[i];
+        }
+    }
+    return &block_engine;
+}
+
+storage_t* storage_open(const char* filename, const struct storage_format* format) {
+    if (!filename) {
+        return NULL;
+    }
+    uint32_t id = format ? format->engine : STORAGE_ENGINE_BLOCK;
+    if (id >= ENGINE_COUNT) {
+        return NULL;
+    }
+    const struct storage_engine* engine = format && format->in_memory ? NULL : engine_of_file(filename);
+    if (!engine) {
+        engine = engines[id];
+    }
+    return engine->open(filename, format);
+}
+
+void storage_close(storage_t* db) {
+    if (db) {
+        engine_of(db)->close(db);
+    }
+}
+
+int storage_put(storage_t* db, const char* key, const char* value, size_t value_size) {
+    return engine_of(db)->put(db, key, value, value_size, 0, KEY_VERSION_ANY, NULL);
+}
+
+int storage_put_ttl(storage_t* db, const char* key, const char* value, size_t value_size,
+                    uint32_t ttl_seconds) {
+    uint32_t expires_at = ttl_seconds ? (uint32_t)time(NULL) + ttl_seconds : 0;
+    return engine_of(db)->put(db, key, value, value_size, expires_at, KEY_VERSION_ANY, NULL);
+}
+
+int storage_cas(storage_t* db, const char* key, const char* value, size_t value_size,
+                uint32_t expires_at, uint64_t expected_version, uint64_t* version) {
+    return engine_of(db)->put(db, key, value, value_size, expires_at, expected_version, version);
+}
+
+int storage_put_version(storage_t* db, const char* key, const char* value, size_t value_size,
+                        uint32_t expires_at, uint64_t version) {
+    if (version == KEY_VERSION_NONE || version == KEY_VERSION_ANY) {
+        return -1;
+    }
+    return engine_of(db)->put_version(db, key, value, value_size, expires_at, version);
+}
+
+// Longest decimal int64 with its sign
+#define INCR_MAX_DIGITS 20
+
+// A read and a conditional write; the caller's lock makes them one step
+int storage_incr(storage_t* db, const char* key, int64_t delta, int64_t* result,
+                 uint64_t* version) {
+    const struct storage_engine* e = engine_of(db);
+    if (!key || !result) {
+        return -1;
+    }
+
+    struct storage_key_info info = { 0, 0, KEY_VERSION_NONE };
+    int64_t current = 0;
+    if (e->stat(db, key, &info) == 0) {
+        char stored[INCR_MAX_DIGITS + 2];  // And a terminator
+        size_t size = sizeof(stored) - 1;
+        if (info.value_size == 0 || info.value_size > size) {
+            return 1;
+        }
+        if (e->get(db, key, stored, &size) != 0) {
+            return -1;
+        }
+        // Values written as C strings carry their terminator
+        if (stored[size - 1] == '\0') {
+            size--;
+        }
+        stored[size] = '\0';
+        char* end;
+        errno = 0;
+        current = strtoll(stored, &end, 10);
+        int digit = stored[0] >= '0' && stored[0] <= '9';
+        if ((!digit && stored[0] != '-') || *end != '\0' || errno != 0) {
+            return 1;
+        }
+    }
+    if (__builtin_add_overflow(current, delta, &current)) {
+        return 1;
+    }
+
+    char text[INCR_MAX_DIGITS + 1];
+    int len = snprintf(text, sizeof(text), "%lld", (long long)current);
+    int rc = e->put(db, key, text, (size_t)len, info.expires_at, info.version, version);
+    if (rc == 0) {
+        *result = current;
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+// The whole value is read and written again; the caller's lock makes it one step
+int storage_append(storage_t* db, const char* key, const char* data, size_t size,
+                   struct storage_key_info* info) {
+    const struct storage_engine* e = engine_of(db);
+    if (!key || (!data && size > 0)) {
+        return -1;
+    }
+    if (e->append) {
+        return e->append(db, key, data, size, info);
+    }
+
+    struct storage_key_info current = { 0, 0, KEY_VERSION_NONE };
+    size_t old_size = 0;
+    if (e->stat(db, key, &current) == 0) {
+        old_size = current.value_size;
+    }
+    if (old_size + size > UINT32_MAX) {
+        return -1;
+    }
+    char* value = malloc(old_size + size > 0 ? old_size + size : 1);
+    if (!value) {
+        return -1;
+    }
+    size_t got = old_size;
+    if (current.version != KEY_VERSION_NONE &&
+        (e->get(db, key, value, &got) != 0 || got != old_size)) {
+        free(value);
+        return -1;
+    }
+    if (size > 0) {
+        memcpy(value + old_size, data, size);
+    }
+    int rc = e->put(db, key, value, old_size + size, current.expires_at, current.version, NULL);
+    free(value);
+    if (rc != 0) {
+        return -1;
+    }
+    return info ? e->stat(db, key, info) : 0;
+}
+
+int storage_get(storage_t* db, const char* key, char* value, size_t* value_size) {
+    return engine_of(db)->get(db, key, value, value_size);
+}
+
+int storage_delete(storage_t* db, const char* key) {
+    return engine_of(db)->remove(db, key);
+}
+
+int storage_stat(storage_t* db, const char* key, struct storage_key_info* info) {
+    return engine_of(db)->stat(db, key, info);
+}
+
+int storage_scan(storage_t* db, const char* start, const char* end, const char* prefix,
+                 storage_scan_fn fn, void* arg) {
+    return engine_of(db)->scan(db, start, end, prefix, fn, arg);
+}
+
+void storage_stats(storage_t* db, struct storage_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    engine_of(db)->stats(db, stats);
+}
+
+int storage_snapshot_create(storage_t* db) {
+    const struct storage_engine* e = engine_of(db);
+    return e->snapshot_create ? e->snapshot_create(db) : -1;
+}
+
+int storage_snapshot_scan(storage_t* db, const char* start, const char* end,
+                          const char* prefix, storage_scan_fn fn, void* arg) {
+    const struct storage_engine* e = engine_of(db);
+    return e->snapshot_scan ? e->snapshot_scan(db, start, end, prefix, fn, arg) : -1;
+}
+
+void storage_snapshot_release(storage_t* db) {
+    const struct storage_engine* e = engine_of(db);
+    if (e->snapshot_release) {
+        e->snapshot_release(db);
+    }
+}
+
+int storage_checkpoint(storage_t* db) {
+    const struct storage_engine* e = engine_of(db);
+    return e->checkpoint ? e->checkpoint(db) : 0;
+}
+
+int storage_list_expiring(storage_t* db, storage_expiry_fn fn, void* arg) {
+    const struct storage_engine* e = engine_of(db);
+    return e->list_expiring ? e->list_expiring(db, fn, arg) : 0;
+}
+
+int storage_expire(storage_t* db, const char* const* keys, size_t count,
+                   storage_expiry_fn fn, void* arg) {
+    const struct storage_engine* e = engine_of(db);
+    return e->expire ? e->expire(db, keys, count, fn, arg) : 0;
+}
+
+long storage_compact_step(storage_t* db, char* cursor, size_t budget,
+                          struct storage_compact_stats* stats) {
+    const struct storage_engine* e = engine_of(db);
+    if (!e->compact_step) {
+        cursor[0] = '\0';  // Nothing to do, pass complete
+        return 0;
+    }
+    return e->compact_step(db, cursor, budget, stats);
+}
+
+int storage_check(storage_t* db, unsigned threads, int repair,
+                  storage_check_fn fn, void* arg, struct storage_check_report* report) {
+    const struct storage_engine* e = engine_of(db);
+    return e->check ? e->check(db, threads, repair, fn, arg, report) : -1;
+}
+
+void storage_set_compression(storage_t* db, size_t threshold) {
+    const struct storage_engine* e = engine_of(db);
+    if (e->set_compression) {
+        e->set_compression(db, threshold);
+    }
+}
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/core/timer_wheel.h"
+#include "../../include/core/hash.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SPAN(level) (1ULL << (TIMER_WHEEL_SLOT_BITS * ((level) + 1)))
+#define INITIAL_BUCKETS 256
+
+// Put a timer in the slot for its deadline, firing no earlier than tick
+// `earliest` (the current tick while cascading, the next one otherwise)
+static void place(struct timer_wheel* w, struct timer_entry* t, uint64_t earliest) {
+    uint64_t expires = t->expires < earliest ? earliest : t->expires;
+
+    uint64_t delta = expires - w->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= LEVEL_SPAN(level)) {
+        level++;
+    }
+    if (delta >= LEVEL_SPAN(level)) {
+        // Beyond the top level: park in its farthest slot and re-place when
+        // it cascades
+        expires = w->now + LEVEL_SPAN(level) - 1;
+    }
+
+    uint32_t slot = (uint32_t)(expires >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+    struct timer_entry** head = &w->slots[level][slot];
+    t->next = *head;
+    if (*head) {
+        (*head)->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+}
+
+// Take a timer out of its slot
+static void unplace(struct timer_entry* t) {
+    *t->pprev = t->next;
+    if (t->next) {
+        t->next->pprev = t->pprev;
+    }
+}
+
+static struct timer_entry** bucket_of(struct timer_wheel* w, uint64_t hash) {
+    return &w->buckets[hash & (w->bucket_count - 1)];
+}
+
+static struct timer_entry* find(struct timer_wheel* w, const char* key, uint64_t hash) {
+    struct timer_entry* t = *bucket_of(w, hash);
+    while (t && (t->hash != hash || strcmp(t->key, key) != 0)) {
+        t = t->hash_next;
+    }
+    return t;
+}
+
+static void table_unlink(struct timer_wheel* w, struct timer_entry* t) {
+    struct timer_entry** p = bucket_of(w, t->hash);
+    while (*p != t) {
+        p = &(*p)->hash_next;
+    }
+    *p = t->hash_next;
+    w->count--;
+}
+
+// Double the bucket array once it averages one timer per bucket
+static void maybe_grow(struct timer_wheel* w) {
+    if (w->count < w->bucket_count) {
+        return;
+    }
+    size_t count = w->bucket_count * 2;
+    struct timer_entry** buckets = calloc(count, sizeof(*buckets));
+    if (!buckets) {
+        return;  // Longer chains, still correct
+    }
+    for (size_t i = 0; i < w->bucket_count; i++) {
+        struct timer_entry* t = w->buckets[i];
+        while (t) {
+            struct timer_entry* next = t->hash_next;
+            t->hash_next = buckets[t->hash & (count - 1)];
+            buckets[t->hash & (count - 1)] = t;
+            t = next;
+        }
+    }
+    free(w->buckets);
+    w->buckets = buckets;
+    w->bucket_count = count;
+}
+
+int timer_wheel_init(struct timer_wheel* w, uint64_t now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+    w->bucket_count = INITIAL_BUCKETS;
+    w->buckets = calloc(w->bucket_count, sizeof(*w->buckets));
+    return w->buckets ? 0 : -1;
+}
+
+void timer_wheel_destroy(struct timer_wheel* w) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            timer_wheel_free_list(w->slots[level][slot]);
+            w->slots[level][slot] = NULL;
+        }
+    }
+    free(w->buckets);
+    w->buckets = NULL;
+    w->bucket_count = 0;
+    w->count = 0;
+}
+
+int timer_wheel_add(struct timer_wheel* w, const char* key, uint64_t expires) {
+    uint64_t hash = fnv1a_64_str(key);
+    struct timer_entry* t = find(w, key, hash);
+    if (t) {
+        // Rescheduled: move the timer the key already has
+        unplace(t);
+        t->expires = expires;
+        place(w, t, w->now + 1);
+        return 0;
+    }
+
+    size_t len = strlen(key);
+    t = malloc(sizeof(*t) + len + 1);
+    if (!t) {
+        return -1;
+    }
+    t->hash = hash;
+    t->expires = expires;
+    memcpy(t->key, key, len + 1);
+    t->hash_next = *bucket_of(w, hash);
+    *bucket_of(w, hash) = t;
+    w->count++;
+    place(w, t, w->now + 1);
+    maybe_grow(w);
+    return 0;
+}
+
+void timer_wheel_remove(struct timer_wheel* w, const char* key) {
+    if (w->count == 0) {
+        return;  // Most writes carry no TTL; skip the hash
+    }
+    struct timer_entry* t = find(w, key, fnv1a_64_str(key));
+    if (t) {
+        unplace(t);
+        table_unlink(w, t);
+        free(t);
+    }
+}
+
+// Move one slot of `level` down the hierarchy
+static void cascade(struct timer_wheel* w, int level, uint32_t slot) {
+    struct timer_entry* t = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    while (t) {
+        struct timer_entry* next = t->next;
+        place(w, t, w->now);
+        t = next;
+    }
+}
+
+struct timer_entry* timer_wheel_advance(struct timer_wheel* w, uint64_t now) {
+    struct timer_entry* fired = NULL;
+
+    while (w->now < now) {
+        w->now++;
+
+        // When a level wraps, bring the next level's current slot down
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((w->now & ((1ULL << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            uint32_t slot = (uint32_t)(w->now >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+            cascade(w, level, slot);
+        }
+
+        uint32_t slot = (uint32_t)w->now & SLOT_MASK;
+        struct timer_entry* t = w->slots[0][slot];
+        w->slots[0][slot] = NULL;
+        while (t) {
+            struct timer_entry* next = t->next;
+            if (t->expires <= w->now) {
+                table_unlink(w, t);
+                t->pprev = NULL;
+                t->next = fired;
+                fired = t;
+            } else {
+                place(w, t, w->now + 1);  // Parked beyond the top level
+            }
+            t = next;
+        }
+    }
+    return fired;
+}
+
+void timer_wheel_free_list(struct timer_entry* list) {
+    while (list) {
+        struct timer_entry* next = list->next;
+        free(list);
+        list = next;
+    }
+}
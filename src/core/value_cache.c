@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/core/value_cache.h"
+#include "../../include/core/hash.h"
+
+struct cache_entry {
+    struct cache_entry* hash_next;
+    struct cache_entry* newer;   // Toward the queue head
+    struct cache_entry* older;   // Toward the queue tail
+    struct cache_queue* queue;
+    struct cache_value* value;   // NULL for ghosts
+    uint64_t hash;
+    uint8_t freq;                // Reads since admission or last demotion
+    char key[];
+};
+
+// Bytes an entry holds against the budget
+static size_t entry_charge(const struct cache_entry* e) {
+    size_t charge = sizeof(*e) + strlen(e->key) + 1;
+    if (e->value) {
+        charge += sizeof(*e->value) + e->value->size;
+    }
+    return charge;
+}
+
+// A value of `size` bytes, left for the caller to fill
+static struct cache_value* alloc_value(size_t size, uint32_t expires_at, uint64_t version) {
+    struct cache_value* v = malloc(sizeof(*v) + size);
+    if (!v) {
+        return NULL;
+    }
+    v->refs = 1;  // The cache's own reference
+    v->expires_at = expires_at;
+    v->version = version;
+    v->size = size;
+    return v;
+}
+
+static struct cache_value* make_value(const char* data, size_t size, uint32_t expires_at,
+                                      uint64_t version) {
+    struct cache_value* v = alloc_value(size, expires_at, version);
+    if (v) {
+        memcpy(v->data, data, size);
+    }
+    return v;
+}
+
+void cache_value_release(struct cache_value* v) {
+    if (v && __atomic_sub_fetch(&v->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(v);
+    }
+}
+
+static struct cache_entry* find(struct value_cache* c, const char* key, uint64_t hash) {
+    struct cache_entry* e = c->buckets[hash & (c->bucket_count - 1)];
+    while (e && (e->hash != hash || strcmp(e->key, key) != 0)) {
+        e = e->hash_next;
+    }
+    return e;
+}
+
+// Double the bucket array once it averages one entry per bucket
+static void maybe_grow(struct value_cache* c) {
+    if (c->entry_count < c->bucket_count) {
+        return;
+    }
+    size_t count = c->bucket_count * 2;
+    struct cache_entry** buckets = calloc(count, sizeof(*buckets));
+    if (!buckets) {
+        return;  // Longer chains, still correct
+    }
+    for (size_t i = 0; i < c->bucket_count; i++) {
+        struct cache_entry* e = c->buckets[i];
+        while (e) {
+            struct cache_entry* next = e->hash_next;
+            e->hash_next = buckets[e->hash & (count - 1)];
+            buckets[e->hash & (count - 1)] = e;
+            e = next;
+        }
+    }
+    free(c->buckets);
+    c->buckets = buckets;
+    c->bucket_count = count;
+}
+
+static void table_unlink(struct value_cache* c, struct cache_entry* e) {
+    struct cache_entry** p = &c->buckets[e->hash & (c->bucket_count - 1)];
+    while (*p != e) {
+        p = &(*p)->hash_next;
+    }
+    *p = e->hash_next;
+    c->entry_count--;
+}
+
+static void queue_push(struct cache_queue* q, struct cache_entry* e) {
+    e->queue = q;
+    e->newer = NULL;
+    e->older = q->head;
+    if (q->head) {
+        q->head->newer = e;
+    } else {
+        q->tail = e;
+    }
+    q->head = e;
+    q->count++;
+    q->bytes += entry_charge(e);
+}
+
+static void queue_unlink(struct cache_entry* e) {
+    struct cache_queue* q = e->queue;
+    if (e->newer) e->newer->older = e->older; else q->head = e->older;
+    if (e->older) e->older->newer = e->newer; else q->tail = e->newer;
+    q->count--;
+    q->bytes -= entry_charge(e);
+    e->queue = NULL;
+}
+
+static void drop_entry(struct value_cache* c, struct cache_entry* e) {
+    queue_unlink(e);
+    table_unlink(c, e);
+    cache_value_release(e->value);
+    free(e);
+}
+
+// Ghosts remember about as many keys as the cache holds
+static void trim_ghosts(struct value_cache* c) {
+    while (c->ghost.count > 0 && c->ghost.count > c->small.count + c->main.count) {
+        drop_entry(c, c->ghost.tail);
+    }
+}
+
+// Small queue tail: promote if it was read again, otherwise keep only its key
+static void evict_small(struct value_cache* c) {
+    struct cache_entry* e = c->small.tail;
+    queue_unlink(e);
+    if (e->freq > 0) {
+        e->freq = 0;
+        queue_push(&c->main, e);
+        return;
+    }
+    cache_value_release(e->value);
+    e->value = NULL;
+    queue_push(&c->ghost, e);
+    trim_ghosts(c);
+}
+
+// Main queue tail: reinsert while it has reads left (CLOCK-style), else drop
+static void evict_main(struct value_cache* c) {
+    for (;;) {
+        struct cache_entry* e = c->main.tail;
+        if (e->freq == 0) {
+            drop_entry(c, e);
+            return;
+        }
+        e->freq--;
+        queue_unlink(e);
+        queue_push(&c->main, e);
+    }
+}
+
+static void evict(struct value_cache* c) {
+    size_t small_target = c->budget / 100 * VALUE_CACHE_SMALL_PERCENT;
+    while (c->small.bytes + c->main.bytes > c->budget) {
+        if (c->small.count > 0 && (c->small.bytes > small_target || c->main.count == 0)) {
+            evict_small(c);
+        } else {
+            evict_main(c);
+        }
+    }
+    trim_ghosts(c);
+}
+
+// Swap in a new value for a resident entry, keeping its queue position
+static void replace_value(struct value_cache* c, struct cache_entry* e, struct cache_value* v) {
+    struct cache_queue* q = e->queue;
+    q->bytes -= entry_charge(e);
+    cache_value_release(e->value);
+    e->value = v;
+    q->bytes += entry_charge(e);
+    evict(c);
+}
+
+int value_cache_init(struct value_cache* c, size_t budget) {
+    memset(c, 0, sizeof(*c));
+    c->budget = budget;
+    c->bucket_count = 1024;
+    c->buckets = calloc(c->bucket_count, sizeof(*c->buckets));
+    if (!c->buckets) {
+        return -1;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    return 0;
+}
+
+void value_cache_destroy(struct value_cache* c) {
+    if (!c->buckets) {
+        return;
+    }
+    for (size_t i = 0; i < c->bucket_count; i++) {
+        struct cache_entry* e = c->buckets[i];
+        while (e) {
+            struct cache_entry* next = e->hash_next;
+            cache_value_release(e->value);
+            free(e);
+            e = next;
+        }
+    }
+    free(c->buckets);
+    c->buckets = NULL;
+    pthread_mutex_destroy(&c->lock);
+}
+
+struct cache_value* value_cache_get(struct value_cache* c, const char* key, uint32_t now) {
+    uint64_t hash = fnv1a_64_str(key);
+    struct cache_value* v = NULL;
+
+    pthread_mutex_lock(&c->lock);
+    struct cache_entry* e = find(c, key, hash);
+    if (e && e->value) {
+        if (e->value->expires_at != 0 && e->value->expires_at <= now) {
+            drop_entry(c, e);
+        } else {
+            if (e->freq < VALUE_CACHE_MAX_FREQ) {
+                e->freq++;
+            }
+            v = e->value;
+            __atomic_add_fetch(&v->refs, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (v) {
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return v;
+}
+
+void value_cache_admit(struct value_cache* c, const char* key, const char* data,
+                       size_t size, uint32_t expires_at, uint64_t version) {
+    // Anything bigger than the small queue would flush it in one go
+    size_t key_len = strlen(key);
+    if (sizeof(struct cache_entry) + key_len + 1 + sizeof(struct cache_value) + size >
+        c->budget / 100 * VALUE_CACHE_SMALL_PERCENT) {
+        return;
+    }
+    struct cache_value* v = make_value(data, size, expires_at, version);
+    if (!v) {
+        return;
+    }
+    uint64_t hash = fnv1a_64_str(key);
+
+    pthread_mutex_lock(&c->lock);
+    struct cache_entry* e = find(c, key, hash);
+    if (e && e->value) {
+        replace_value(c, e, v);
+    } else if (e) {
+        // Evicted recently and wanted again: straight to main
+        queue_unlink(e);
+        e->value = v;
+        e->freq = 0;
+        queue_push(&c->main, e);
+        evict(c);
+    } else {
+        e = malloc(sizeof(*e) + key_len + 1);
+        if (!e) {
+            pthread_mutex_unlock(&c->lock);
+            cache_value_release(v);
+            return;
+        }
+        memcpy(e->key, key, key_len + 1);
+        e->hash = hash;
+        e->value = v;
+        e->freq = 0;
+        e->hash_next = c->buckets[hash & (c->bucket_count - 1)];
+        c->buckets[hash & (c->bucket_count - 1)] = e;
+        c->entry_count++;
+        queue_push(&c->small, e);
+        evict(c);
+        maybe_grow(c);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+void value_cache_update(struct value_cache* c, const char* key, const char* data,
+                        size_t size, uint32_t expires_at, uint64_t version) {
+    uint64_t hash = fnv1a_64_str(key);
+
+    pthread_mutex_lock(&c->lock);
+    struct cache_entry* e = find(c, key, hash);
+    // Writers update after dropping the storage lock, so a later write of
+    // the key may have got here first
+    if (e && e->value && e->value->version <= version) {
+        struct cache_value* v = NULL;
+        if (sizeof(*e) + strlen(key) + 1 + sizeof(*v) + size <=
+            c->budget / 100 * VALUE_CACHE_SMALL_PERCENT) {
+            v = make_value(data, size, expires_at, version);
+        }
+        if (v) {
+            replace_value(c, e, v);
+        } else {
+            drop_entry(c, e);  // Too large now, or out of memory
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+void value_cache_append(struct value_cache* c, const char* key, const char* data,
+                        size_t size, uint64_t base_version, uint32_t expires_at,
+                        uint64_t version) {
+    uint64_t hash = fnv1a_64_str(key);
+
+    pthread_mutex_lock(&c->lock);
+    struct cache_entry* e = find(c, key, hash);
+    if (e && e->value && e->value->version < version) {
+        const struct cache_value* old = e->value;
+        struct cache_value* v = NULL;
+        if (old->version == base_version &&
+            sizeof(*e) + strlen(key) + 1 + sizeof(*v) + old->size + size <=
+            c->budget / 100 * VALUE_CACHE_SMALL_PERCENT) {
+            v = alloc_value(old->size + size, expires_at, version);
+        }
+        if (v) {
+            memcpy(v->data, old->data, old->size);
+            memcpy(v->data + old->size, data, size);
+            replace_value(c, e, v);
+        } else {
+            drop_entry(c, e);  // Missed an earlier write, too large now, or out of memory
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+void value_cache_remove(struct value_cache* c, const char* key) {
+    uint64_t hash = fnv1a_64_str(key);
+
+    pthread_mutex_lock(&c->lock);
+    struct cache_entry* e = find(c, key, hash);
+    if (e) {
+        drop_entry(c, e);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
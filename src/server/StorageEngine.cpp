@@ -5,7 +5,7 @@
 namespace storage {
 
 StorageEngine::StorageEngine(const std::string& storage_file)
-    : storage_file_(storage_file), initialized_(false) {
+    : storage_file_(storage_file), db_(nullptr), initialized_(false) {
 }
 
 StorageEngine::~StorageEngine() {
@@ -14,7 +14,9 @@ StorageEngine::~StorageEngine() {
 
 StorageEngine::StorageEngine(StorageEngine&& other) noexcept
     : storage_file_(std::move(other.storage_file_)),
+      db_(other.db_),
       initialized_(other.initialized_) {
+    other.db_ = nullptr;
     other.initialized_ = false;
 }
 
@@ -22,7 +24,9 @@ StorageEngine& StorageEngine::operator=(StorageEngine&& other) noexcept {
     if (this != &other) {
         cleanup();
         storage_file_ = std::move(other.storage_file_);
+        db_ = other.db_;
         initialized_ = other.initialized_;
+        other.db_ = nullptr;
         other.initialized_ = false;
     }
     return *this;
@@ -35,8 +39,8 @@ bool StorageEngine::initialize() {
         return true;
     }
     
-    int result = storage_init(storage_file_.c_str());
-    if (result == 0) {
+    db_ = storage_open(storage_file_.c_str(), nullptr);
+    if (db_) {
         initialized_ = true;
         return true;
     }
@@ -55,7 +59,7 @@ bool StorageEngine::put(const std::string& key, const std::vector<uint8_t>& valu
     
     std::lock_guard<std::mutex> lock(storage_mutex_);
     
-    int result = storage_put(key.c_str(), 
+    int result = storage_put(db_, key.c_str(),
                               reinterpret_cast<const char*>(value.data()), 
                               value.size());
     
@@ -81,7 +85,7 @@ std::optional<std::vector<uint8_t>> StorageEngine::get(const std::string& key) {
     
     // First, try to get the size
     size_t buffer_size = 0;
-    int result = storage_get(key.c_str(), nullptr, &buffer_size);
+    int result = storage_get(db_, key.c_str(), nullptr, &buffer_size);
     
     if (result != 0) {
         return std::nullopt;
@@ -89,7 +93,7 @@ std::optional<std::vector<uint8_t>> StorageEngine::get(const std::string& key) {
     
     // Allocate buffer and get the actual data
     std::vector<uint8_t> buffer(buffer_size);
-    result = storage_get(key.c_str(), 
+    result = storage_get(db_, key.c_str(),
                           reinterpret_cast<char*>(buffer.data()), 
                           &buffer_size);
     
@@ -126,7 +130,7 @@ bool StorageEngine::remove(const std::string& key) {
     
     std::lock_guard<std::mutex> lock(storage_mutex_);
     
-    int result = storage_delete(key.c_str());
+    int result = storage_delete(db_, key.c_str());
     return result == 0;
 }
 
@@ -151,7 +155,8 @@ StorageEngine::Stats StorageEngine::getStats() const {
 void StorageEngine::cleanup() {
     if (initialized_) {
         std::lock_guard<std::mutex> lock(storage_mutex_);
-        storage_cleanup();
+        storage_close(db_);
+        db_ = nullptr;
         initialized_ = false;
     }
 }
@@ -0,0 +1,417 @@
+// In-process microbenchmark for the storage layer primitives.
+//
+// storage.c is compiled directly into this translation unit so the static
+// helpers (alloc_run, read_metadata, write_metadata) can be timed in
+// isolation next to the public PUT/GET/DELETE paths. Syscalls are counted by
+// wrapping the libc I/O entry points at link time (see BENCH_WRAP in the
+// Makefile), so no external tooling is needed.
+//
+// Usage: storage_bench [--memory] [storage_file] [block_size]
+// The default file lives on tmpfs so the numbers reflect CPU and syscall
+// cost rather than the backing device. --memory runs against volatile
+// storage instead, the baseline with no I/O at all.
+
+#include "../../src/core/storage.c"
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define DEFAULT_BENCH_FILE "/dev/shm/storage_bench.db"
+#define BENCH_BYTES_PER_SIZE (64UL * 1024 * 1024)
+#define BENCH_MAX_ITERS 20000
+#define BENCH_MIN_ITERS 16
+
+// The storage under test
+static storage_t *db = NULL;
+
+// Syscall counting via -Wl,--wrap
+static unsigned long syscall_count = 0;
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+off_t __real_lseek(int fd, off_t offset, int whence);
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __real_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+    syscall_count++;
+    return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+    syscall_count++;
+    return __real_write(fd, buf, count);
+}
+
+off_t __wrap_lseek(int fd, off_t offset, int whence) {
+    syscall_count++;
+    return __real_lseek(fd, offset, whence);
+}
+
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset) {
+    syscall_count++;
+    return __real_pread(fd, buf, count, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    syscall_count++;
+    return __real_pwrite(fd, buf, count, offset);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+struct bench_result {
+    uint64_t total_ns;
+    unsigned long syscalls;
+    unsigned long iters;
+};
+
+static void report_header(void) {
+    printf("%-20s %10s %8s %14s %12s\n",
+            "operation", "size", "iters", "ns/op", "syscalls/op");
+    printf("%-20s %10s %8s %14s %12s\n",
+            "--------------------", "----------", "--------",
+            "--------------", "------------");
+}
+
+static void report_row(const char *op, size_t size, const struct bench_result *r) {
+    char size_str[24];
+    if (size == 0) {
+        snprintf(size_str, sizeof(size_str), "-");
+    } else {
+        snprintf(size_str, sizeof(size_str), "%zu", size);
+    }
+
+    double ns_per_op = r->iters ? (double)r->total_ns / r->iters : 0.0;
+    double sc_per_op = r->iters ? (double)r->syscalls / r->iters : 0.0;
+    printf("%-20s %10s %8lu %14.1f %12.2f\n",
+            op, size_str, r->iters, ns_per_op, sc_per_op);
+    fflush(stdout);
+}
+
+static unsigned long iters_for_size(size_t size) {
+    unsigned long iters = BENCH_BYTES_PER_SIZE / size;
+    if (iters > BENCH_MAX_ITERS) iters = BENCH_MAX_ITERS;
+    if (iters < BENCH_MIN_ITERS) iters = BENCH_MIN_ITERS;
+    return iters;
+}
+
+static void bench_metadata(void) {
+    struct metadata_block copy;
+    struct bench_result r = {0, 0, BENCH_MAX_ITERS};
+
+    unsigned long sc0 = syscall_count;
+    uint64_t t0 = now_ns();
+    for (unsigned long i = 0; i < r.iters; i++) {
+        read_metadata(db, &copy);
+    }
+    r.total_ns = now_ns() - t0;
+    r.syscalls = syscall_count - sc0;
+    report_row("read_metadata", sizeof(copy), &r);
+
+    sc0 = syscall_count;
+    t0 = now_ns();
+    for (unsigned long i = 0; i < r.iters; i++) {
+        write_metadata(db, &copy);
+    }
+    r.total_ns = now_ns() - t0;
+    r.syscalls = syscall_count - sc0;
+    report_row("write_metadata", sizeof(copy), &r);
+}
+
+// Time allocating and freeing a `want`-block run in a segment whose first
+// `percent`% is fragmented: seven blocks used, one free, repeating. Single
+// blocks best-fit into the holes; larger runs come from the free tail.
+static void bench_alloc_run(const char *label, uint32_t want, uint32_t percent) {
+    struct segment *seg = &db->segments[0];
+    uint32_t used = (uint32_t)((uint64_t)seg->nblocks * percent / 100);
+    uint32_t first = reserved_blocks(db);
+
+    for (uint32_t i = first; i < used; i++) {
+        if (i % 8 != 7) {
+            mark_block_used(db, BLOCK_ADDR(0, i));
+        }
+    }
+    segment_index_bitmap(seg);
+
+    struct bench_result r = {0, 0, BENCH_MAX_ITERS};
+    unsigned long sc0 = syscall_count;
+    uint64_t t0 = now_ns();
+    for (unsigned long i = 0; i < r.iters; i++) {
+        uint32_t addr;
+        uint32_t got = alloc_run(db, want, &addr);
+        for (uint32_t k = 0; k < got; k++) {
+            mark_block_free(db, addr + k);
+        }
+    }
+    r.total_ns = now_ns() - t0;
+    r.syscalls = syscall_count - sc0;
+    report_row(label, 0, &r);
+
+    for (uint32_t i = first; i < used; i++) {
+        if (i % 8 != 7) {
+            mark_block_free(db, BLOCK_ADDR(0, i));
+        }
+    }
+    flush_bitmaps(db);
+}
+
+// Text-like values compress; random ones exercise the store-raw fallback
+static void fill_value(char *value, size_t size, int compressible) {
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < size; i++) {
+        if (compressible) {
+            value[i] = (char)('a' + (i % 26));
+        } else {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            value[i] = (char)x;
+        }
+    }
+}
+
+static void bench_value_size(size_t size, int compressible) {
+    char *value = malloc(size);
+    char *out = malloc(size);
+    if (!value || !out) {
+        fprintf(stderr, "storage_bench: out of memory for %zu byte value\n", size);
+        exit(1);
+    }
+    fill_value(value, size, compressible);
+
+    unsigned long iters = iters_for_size(size);
+    struct bench_result put_r = {0, 0, iters};
+    struct bench_result del_r = {0, 0, iters};
+    struct bench_result get_r = {0, 0, iters};
+
+    // PUT then DELETE so each PUT writes a fresh chain into a clean file
+    for (unsigned long i = 0; i < iters; i++) {
+        unsigned long sc0 = syscall_count;
+        uint64_t t0 = now_ns();
+        if (storage_put(db, "bench_key", value, size) != 0) {
+            fprintf(stderr, "storage_bench: PUT of %zu bytes failed\n", size);
+            exit(1);
+        }
+        put_r.total_ns += now_ns() - t0;
+        put_r.syscalls += syscall_count - sc0;
+
+        sc0 = syscall_count;
+        t0 = now_ns();
+        if (storage_delete(db, "bench_key") != 0) {
+            fprintf(stderr, "storage_bench: DELETE of %zu bytes failed\n", size);
+            exit(1);
+        }
+        del_r.total_ns += now_ns() - t0;
+        del_r.syscalls += syscall_count - sc0;
+    }
+
+    // GET walks the same chain repeatedly
+    if (storage_put(db, "bench_key", value, size) != 0) {
+        fprintf(stderr, "storage_bench: PUT of %zu bytes failed\n", size);
+        exit(1);
+    }
+    for (unsigned long i = 0; i < iters; i++) {
+        size_t out_size = size;
+        unsigned long sc0 = syscall_count;
+        uint64_t t0 = now_ns();
+        if (storage_get(db, "bench_key", out, &out_size) != 0 || out_size != size) {
+            fprintf(stderr, "storage_bench: GET of %zu bytes failed\n", size);
+            exit(1);
+        }
+        get_r.total_ns += now_ns() - t0;
+        get_r.syscalls += syscall_count - sc0;
+    }
+    if (memcmp(value, out, size) != 0) {
+        fprintf(stderr, "storage_bench: GET returned corrupted data for %zu bytes\n", size);
+        exit(1);
+    }
+
+    // Same-size overwrite rewrites the existing chain in place
+    struct bench_result upd_r = {0, 0, iters};
+    for (unsigned long i = 0; i < iters; i++) {
+        unsigned long sc0 = syscall_count;
+        uint64_t t0 = now_ns();
+        if (storage_put(db, "bench_key", value, size) != 0) {
+            fprintf(stderr, "storage_bench: overwrite of %zu bytes failed\n", size);
+            exit(1);
+        }
+        upd_r.total_ns += now_ns() - t0;
+        upd_r.syscalls += syscall_count - sc0;
+    }
+    storage_delete(db, "bench_key");
+
+    report_row(compressible ? "storage_put/text" : "storage_put", size, &put_r);
+    report_row(compressible ? "storage_get/text" : "storage_get", size, &get_r);
+    report_row(compressible ? "storage_delete/text" : "storage_delete", size, &del_r);
+    report_row(compressible ? "storage_update/text" : "storage_update", size, &upd_r);
+
+    free(value);
+    free(out);
+}
+
+static int count_entry(const char *key, const char *value, size_t value_size, void *arg) {
+    (void)key;
+    (void)value;
+    (void)value_size;
+    (*(unsigned long *)arg)++;
+    return 0;
+}
+
+// Index lookups and a 100-key prefix scan over BENCH_INDEX_KEYS small keys
+#define BENCH_INDEX_KEYS 10000
+
+static void bench_index(void) {
+    char key[32];
+    for (int i = 0; i < BENCH_INDEX_KEYS; i++) {
+        snprintf(key, sizeof(key), "user:%03d:%02d", i / 100, i % 100);
+        if (storage_put(db, key, "v", 1) != 0) {
+            fprintf(stderr, "storage_bench: index PUT failed\n");
+            exit(1);
+        }
+    }
+
+    struct bench_result r = {0, 0, 20000};
+    for (unsigned long i = 0; i < r.iters; i++) {
+        size_t size;
+        snprintf(key, sizeof(key), "user:%03lu:%02lu", (i * 7919) % 100, i % 100);
+        unsigned long sc0 = syscall_count;
+        uint64_t t0 = now_ns();
+        if (storage_get(db, key, NULL, &size) != 0) {
+            fprintf(stderr, "storage_bench: index lookup of %s failed\n", key);
+            exit(1);
+        }
+        r.total_ns += now_ns() - t0;
+        r.syscalls += syscall_count - sc0;
+    }
+    report_row("index_lookup", 0, &r);
+
+    // Absent keys share the prefix, so only the key filter tells them apart
+    struct bench_result m = {0, 0, 20000};
+    for (unsigned long i = 0; i < m.iters; i++) {
+        size_t size;
+        snprintf(key, sizeof(key), "user:%03lu:%02lux", (i * 7919) % 100, i % 100);
+        unsigned long sc0 = syscall_count;
+        uint64_t t0 = now_ns();
+        if (storage_get(db, key, NULL, &size) == 0) {
+            fprintf(stderr, "storage_bench: found absent key %s\n", key);
+            exit(1);
+        }
+        m.total_ns += now_ns() - t0;
+        m.syscalls += syscall_count - sc0;
+    }
+    report_row("index_miss", 0, &m);
+
+    struct bench_result s = {0, 0, 1000};
+    for (unsigned long i = 0; i < s.iters; i++) {
+        unsigned long visited = 0;
+        snprintf(key, sizeof(key), "user:%03lu:", i % 100);
+        unsigned long sc0 = syscall_count;
+        uint64_t t0 = now_ns();
+        storage_scan(db, NULL, NULL, key, count_entry, &visited);
+        s.total_ns += now_ns() - t0;
+        s.syscalls += syscall_count - sc0;
+        if (visited != 100) {
+            fprintf(stderr, "storage_bench: prefix scan saw %lu keys\n", visited);
+            exit(1);
+        }
+    }
+    report_row("storage_scan/100", 0, &s);
+
+    for (int i = 0; i < BENCH_INDEX_KEYS; i++) {
+        snprintf(key, sizeof(key), "user:%03d:%02d", i / 100, i % 100);
+        storage_delete(db, key);
+    }
+}
+
+// Reopening the store with BENCH_INDEX_KEYS keys, from the checkpoint
+// written by close and with it removed (bitmap and index scan)
+#define BENCH_OPEN_ITERS 20
+
+static void bench_open(const char *path) {
+    char key[64];
+    char ckpt[4096];
+    snprintf(ckpt, sizeof(ckpt), "%s%s", path, CHECKPOINT_SUFFIX);
+    for (int i = 0; i < BENCH_INDEX_KEYS; i++) {
+        snprintf(key, sizeof(key), "open:%05d", i);
+        storage_put_ttl(db, key, key, strlen(key), i % 10 == 0 ? 3600 : 0);
+    }
+
+    for (int scan = 0; scan < 2; scan++) {
+        struct bench_result m = {0, 0, BENCH_OPEN_ITERS};
+        for (unsigned long i = 0; i < m.iters; i++) {
+            storage_close(db);
+            if (scan) {
+                unlink(ckpt);
+            }
+            unsigned long sc0 = syscall_count;
+            uint64_t t0 = now_ns();
+            db = storage_open(path, NULL);
+            m.total_ns += now_ns() - t0;
+            m.syscalls += syscall_count - sc0;
+            if (!db) {
+                fprintf(stderr, "storage_bench: failed to reopen %s\n", path);
+                exit(1);
+            }
+        }
+        report_row(scan ? "storage_open/scan" : "storage_open/ckpt", 0, &m);
+    }
+
+    for (int i = 0; i < BENCH_INDEX_KEYS; i++) {
+        snprintf(key, sizeof(key), "open:%05d", i);
+        storage_delete(db, key);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct storage_format format = {0, 0, 0, 0, 0};
+    if (argc > 1 && strcmp(argv[1], "--memory") == 0) {
+        format.in_memory = 1;
+        argv++;
+        argc--;
+    }
+    const char *path = (argc > 1) ? argv[1] : DEFAULT_BENCH_FILE;
+    if (argc > 2) {
+        format.block_size = (uint32_t)strtoul(argv[2], NULL, 10);
+    }
+
+    unlink(path);
+    db = storage_open(path, &format);
+    if (!db) {
+        fprintf(stderr, "storage_bench: failed to initialize %s\n", path);
+        return 1;
+    }
+
+    printf("storage_bench: %s (block size %u%s)\n\n", path, db->meta.block_size,
+           format.in_memory ? ", in memory" : "");
+    report_header();
+
+    bench_metadata();
+    bench_alloc_run("alloc_run/1/0%", 1, 0);
+    bench_alloc_run("alloc_run/1/50%", 1, 50);
+    bench_alloc_run("alloc_run/1/99%", 1, 99);
+    bench_alloc_run("alloc_run/32/50%", 32, 50);
+
+    static const size_t sizes[] = {
+        64, 256, 1024, 4096, 16384, 65536, 262144, 1048576
+    };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_value_size(sizes[i], 0);
+    }
+    bench_value_size(4096, 1);
+    bench_value_size(65536, 1);
+    bench_value_size(1048576, 1);
+    bench_index();
+    if (!format.in_memory) {
+        bench_open(path);  // Volatile storage can't be reopened
+    }
+
+    storage_close(db);
+    unlink(path);
+    return 0;
+}
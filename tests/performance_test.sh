@@ -24,7 +24,7 @@ VALUE_SIZES=(64 256 1024 4096 16384)
 # Clean up function
 cleanup() {
     pkill -f storage_daemon 2>/dev/null || true
-    rm -f $STORAGE_FILE $SOCKET_PATH
+    rm -f $STORAGE_FILE $STORAGE_FILE.* $SOCKET_PATH
     rm -f /tmp/perf_*.tmp
 }
 
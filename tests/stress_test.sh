@@ -24,7 +24,7 @@ VALUE_SIZE=1024
 cleanup() {
     echo "Cleaning up..."
     pkill -f storage_daemon 2>/dev/null || true
-    rm -f $STORAGE_FILE $SOCKET_PATH
+    rm -f $STORAGE_FILE $STORAGE_FILE.* $SOCKET_PATH
     rm -f /tmp/stress_test_*.tmp
 }
 
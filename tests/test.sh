@@ -11,14 +11,20 @@ NC='\033[0m'
 
 DAEMON_BIN="./build/storage_daemon"
 CLIENT_BIN="./build/storage_client"
+FSCK_BIN="./build/storage_fsck"
 STORAGE_FILE="/tmp/test_storage.db"
 SOCKET_PATH="/tmp/storage_daemon.sock"
+FOLLOWER_SOCKET="/tmp/storage_daemon_follower.sock"
+SHARDED_SOCKET="/tmp/storage_daemon_sharded.sock"
+MEMORY_SOCKET="/tmp/storage_daemon_memory.sock"
+LOG_SOCKET="/tmp/storage_daemon_log.sock"
+APPEND_SOCKET="/tmp/storage_daemon_append.sock"
 
 # Clean up function
 cleanup() {
     echo "Cleaning up..."
     pkill -f storage_daemon 2>/dev/null || true
-    rm -f $STORAGE_FILE $SOCKET_PATH
+    rm -f $STORAGE_FILE $STORAGE_FILE.* $SOCKET_PATH $FOLLOWER_SOCKET $SHARDED_SOCKET $MEMORY_SOCKET $LOG_SOCKET $APPEND_SOCKET
 }
 
 # Set up trap for cleanup
@@ -45,7 +51,8 @@ run_test() {
     
     echo -n "Testing $test_name... "
     
-    result=$($cmd 2>&1)
+    # eval, so quoted arguments (values with spaces) reach the command whole
+    result=$(eval "$cmd" 2>&1) || true
     if [[ "$result" == *"$expected"* ]]; then
         echo -e "${GREEN}PASSED${NC}"
         return 0
@@ -110,6 +117,166 @@ run_test "GET empty value" "$CLIENT_BIN get emptykey" "Value: "
 run_test "Overwrite existing key" "$CLIENT_BIN put key2 newvalue" "PUT successful"
 run_test "GET overwritten key" "$CLIENT_BIN get key2" "newvalue"
 
+# Test 11: Flight recorder dump
+run_test "DUMP flight recorder" "$CLIENT_BIN dump" "DUMP successful"
+# A symlink planted at the dump path is refused, not followed
+echo untouched > $STORAGE_FILE.victim
+rm -f /tmp/storage_daemon.flight
+ln -s $STORAGE_FILE.victim /tmp/storage_daemon.flight
+run_test "DUMP refuses a symlink" "$CLIENT_BIN dump" "DUMP failed"
+run_test "DUMP leaves symlink target" "cat $STORAGE_FILE.victim" "untouched"
+rm -f /tmp/storage_daemon.flight
+
+# Test 12: Compressible value
+json_value=$(printf '{"user":%d,"active":true},' {1..100})
+run_test "PUT compressible value" "$CLIENT_BIN put jsonkey '$json_value'" "PUT successful"
+run_test "GET compressible value" "$CLIENT_BIN get jsonkey" "$json_value"
+
+# Test 13: Ordered prefix and range scans
+$CLIENT_BIN put "session:7:a" "first" > /dev/null
+$CLIENT_BIN put "session:7:b" "second" > /dev/null
+$CLIENT_BIN put "session:8:a" "other" > /dev/null
+run_test "SCAN by prefix" "$CLIENT_BIN scan session:7:" "SCAN complete: 2 keys"
+run_test "SCAN range" "$CLIENT_BIN range session:7:b session:9" "SCAN complete: 2 keys"
+
+# Test 14: Keys with a TTL expire
+run_test "PUT with TTL" "$CLIENT_BIN put shortlived soon 1" "PUT successful"
+$CLIENT_BIN put refreshed early 1 > /dev/null
+$CLIENT_BIN put refreshed later 4 > /dev/null
+sleep 2
+run_test "GET expired key" "$CLIENT_BIN get shortlived" "Key not found"
+run_test "GET key with a refreshed TTL" "$CLIENT_BIN get refreshed" "Value: later"
+
+# Test 15: Cached values follow writes and deletes
+$CLIENT_BIN put hotkey first > /dev/null
+$CLIENT_BIN get hotkey > /dev/null
+$CLIENT_BIN get hotkey > /dev/null
+run_test "PUT over cached key" "$CLIENT_BIN put hotkey second" "PUT successful"
+run_test "GET cached key after PUT" "$CLIENT_BIN get hotkey" "Value: second"
+$CLIENT_BIN delete hotkey > /dev/null
+run_test "GET cached key after DELETE" "$CLIENT_BIN get hotkey" "Key not found"
+
+# Test 16: Daemon counters
+run_test "STATS counters" "$CLIENT_BIN stats" "Fragmentation:"
+
+# Test 17: Online backup and restore
+$CLIENT_BIN put backupkey saved > /dev/null
+run_test "BACKUP snapshot" "$CLIENT_BIN backup /tmp/storage_test.backup" "BACKUP complete"
+$CLIENT_BIN delete backupkey > /dev/null
+run_test "RESTORE backup" "$CLIENT_BIN restore /tmp/storage_test.backup" "RESTORE complete"
+run_test "GET restored key" "$CLIENT_BIN get backupkey" "Value: saved"
+rm -f /tmp/storage_test.backup
+
+# Test 18: A follower replays the primary, keeping its versions, and refuses writes
+$CLIENT_BIN put replkey draft > /dev/null
+$CLIENT_BIN put replkey copied > /dev/null
+$DAEMON_BIN -s $FOLLOWER_SOCKET -f $SOCKET_PATH $STORAGE_FILE.follower
+sleep 2
+$CLIENT_BIN put replkey updated > /dev/null
+REPL_VERSION=$($CLIENT_BIN get replkey | sed -n 's/^Version: //p')
+sleep 1
+export STORAGE_DAEMON_SOCKET=$FOLLOWER_SOCKET
+run_test "GET from follower" "$CLIENT_BIN get replkey" "Value: updated"
+run_test "Version on follower" "$CLIENT_BIN get replkey" "Version: $REPL_VERSION"
+run_test "PUT to follower" "$CLIENT_BIN put replkey local" "read-only follower"
+run_test "STATS on follower" "$CLIENT_BIN stats" "Replication: follower"
+unset STORAGE_DAEMON_SOCKET
+
+# Test 19: Keys split over shards still scan as one ordered set
+$DAEMON_BIN -s $SHARDED_SOCKET --shards 4 $STORAGE_FILE.sharded
+sleep 2
+export STORAGE_DAEMON_SOCKET=$SHARDED_SOCKET
+for i in 1 2 3 4 5 6 7 8; do
+    $CLIENT_BIN put shard:$i value$i > /dev/null
+done
+run_test "GET from a shard" "$CLIENT_BIN get shard:5" "Value: value5"
+run_test "SCAN across shards" "$CLIENT_BIN scan shard:" "SCAN complete: 8 keys"
+run_test "INCR on a shard" "$CLIENT_BIN incr shard:count 5" "Value: 5"
+run_test "CAS on a shard" "$CLIENT_BIN cas shard:lease 0 owner" "CAS successful"
+run_test "APPEND on a shard" "$CLIENT_BIN append shard:log entry" "Size: 5"
+unset STORAGE_DAEMON_SOCKET
+
+# Test 20: A cleanly stopped store checks clean
+pkill -f "$SHARDED_SOCKET" 2>/dev/null || true
+sleep 1
+run_test "FSCK stopped shard" "$FSCK_BIN -j 2 $STORAGE_FILE.sharded.shard0" "Clean"
+
+# Test 21: Volatile storage serves the same protocol and writes no files
+$DAEMON_BIN -s $MEMORY_SOCKET --memory --shards 2 $STORAGE_FILE.memory
+sleep 2
+export STORAGE_DAEMON_SOCKET=$MEMORY_SOCKET
+$CLIENT_BIN put memkey:1 cached > /dev/null
+$CLIENT_BIN put memkey:2 cached > /dev/null
+run_test "GET from memory" "$CLIENT_BIN get memkey:1" "Value: cached"
+run_test "BACKUP from memory" "$CLIENT_BIN backup /tmp/storage_test.backup" "BACKUP complete"
+run_test "No files in memory mode" "ls $STORAGE_FILE.memory*" "No such file"
+rm -f /tmp/storage_test.backup
+unset STORAGE_DAEMON_SOCKET
+
+# Test 22: The log engine serves the same protocol and replays its files
+$DAEMON_BIN -s $LOG_SOCKET --engine log $STORAGE_FILE.log
+sleep 2
+export STORAGE_DAEMON_SOCKET=$LOG_SOCKET
+$CLIENT_BIN put logkey:1 first > /dev/null
+$CLIENT_BIN put logkey:1 second > /dev/null
+$CLIENT_BIN put logkey:2 gone > /dev/null
+$CLIENT_BIN delete logkey:2 > /dev/null
+run_test "GET from log engine" "$CLIENT_BIN get logkey:1" "Value: second"
+run_test "STATS on log engine" "$CLIENT_BIN stats" "Storage: log, 1 keys"
+pkill -f "$LOG_SOCKET" 2>/dev/null || true
+sleep 1
+$DAEMON_BIN -s $LOG_SOCKET $STORAGE_FILE.log
+sleep 2
+run_test "GET after log replay" "$CLIENT_BIN get logkey:1" "Value: second"
+run_test "DELETE survives log replay" "$CLIENT_BIN get logkey:2" "Key not found"
+unset STORAGE_DAEMON_SOCKET
+
+# Test 23: Versioned writes and counters run inside the daemon
+run_test "INCR missing key" "$CLIENT_BIN incr counter:hits" "Value: 1"
+run_test "INCR by delta" "$CLIENT_BIN incr counter:hits 41" "Value: 42"
+$CLIENT_BIN put counter:text abc > /dev/null
+run_test "INCR non-integer" "$CLIENT_BIN incr counter:text" "not an integer"
+run_test "CAS create" "$CLIENT_BIN cas lease:1 0 owner-a" "CAS successful, version"
+LEASE_VERSION=$($CLIENT_BIN get lease:1 | sed -n 's/^Version: //p')
+run_test "CAS stale version" "$CLIENT_BIN cas lease:1 0 owner-b" "key is at version $LEASE_VERSION"
+run_test "CAS current version" "$CLIENT_BIN cas lease:1 $LEASE_VERSION owner-b" "CAS successful, version $((LEASE_VERSION + 1))"
+run_test "GET version" "$CLIENT_BIN get lease:1" "Version: $((LEASE_VERSION + 1))"
+# A key deleted and created again never repeats a version it had
+$CLIENT_BIN cas lease:2 0 owner-a > /dev/null
+LEASE_VERSION=$($CLIENT_BIN get lease:2 | sed -n 's/^Version: //p')
+$CLIENT_BIN delete lease:2 > /dev/null
+run_test "CAS create after DELETE" "$CLIENT_BIN cas lease:2 0 owner-b" "CAS successful"
+run_test "CAS from before DELETE" "$CLIENT_BIN cas lease:2 $LEASE_VERSION owner-a" "key is at version"
+
+# Test 24: Appends extend a value in place, up to what a PUT could carry
+run_test "APPEND missing key" "$CLIENT_BIN append journal:1 'first;'" "Size: 6"
+$CLIENT_BIN get journal:1 > /dev/null
+run_test "APPEND existing key" "$CLIENT_BIN append journal:1 'second;'" "Size: 13"
+run_test "GET appended value" "$CLIENT_BIN get journal:1" "Value: first;second;"
+APPEND_BIG=$(head -c 3000 /dev/zero | tr '\0' x)
+$CLIENT_BIN append journal:2 $APPEND_BIG > /dev/null
+run_test "APPEND past the limit" "$CLIENT_BIN append journal:2 $APPEND_BIG" "would exceed"
+
+# Test 25: Appends cross block boundaries, and a cached value takes them too
+$DAEMON_BIN -s $APPEND_SOCKET -b 512 $STORAGE_FILE.small
+sleep 2
+export STORAGE_DAEMON_SOCKET=$APPEND_SOCKET
+APPEND_A=$(head -c 400 /dev/zero | tr '\0' a)
+APPEND_B=$(head -c 400 /dev/zero | tr '\0' b)
+APPEND_C=$(head -c 400 /dev/zero | tr '\0' c)
+$CLIENT_BIN append journal:3 $APPEND_A > /dev/null
+$CLIENT_BIN get journal:3 > /dev/null
+run_test "APPEND into a new block" "$CLIENT_BIN append journal:3 $APPEND_B" "Size: 800"
+run_test "APPEND over two blocks" "$CLIENT_BIN append journal:3 $APPEND_C" "Size: 1200"
+run_test "GET value over blocks" "$CLIENT_BIN get journal:3" "Value: $APPEND_A$APPEND_B$APPEND_C"
+pkill -f "$APPEND_SOCKET" 2>/dev/null || true
+sleep 1
+run_test "FSCK after appends" "$FSCK_BIN $STORAGE_FILE.small" "Clean"
+$DAEMON_BIN -s $APPEND_SOCKET $STORAGE_FILE.small
+sleep 2
+run_test "GET appends after restart" "$CLIENT_BIN get journal:3" "Value: $APPEND_A$APPEND_B$APPEND_C"
+unset STORAGE_DAEMON_SOCKET
+
 echo ""
 echo "==============="
 echo -e "${GREEN}All tests completed!${NC}"
\ No newline at end of file